@@ -439,6 +439,31 @@
                                    (set-active-windings! current-ws)
                                    (continuation x)))))))))
          outer-env)
+      ;;The same for escape continuations...
+      (eval
+         `(define call-with-escape-continuation
+             ,(let ((old-c/ec call-with-escape-continuation))
+                 (lambda (func)
+                    (let ((current-ws *active-windings*))
+                       (old-c/ec
+                          (lambda (escape)
+                             (func
+                                (lambda (x)
+                                   (set-active-windings! current-ws)
+                                   (escape x)))))))))
+         outer-env)
+      ;;...and for handlers, which run once throw has left the thunk.
+      (eval
+         `(define call-with-handler
+             ,(let ((old-c/h call-with-handler))
+                 (lambda (handler thunk)
+                    (let ((current-ws *active-windings*))
+                       (old-c/h
+                          (lambda ()
+                             (set-active-windings! current-ws)
+                             (handler))
+                          thunk)))))
+         outer-env)
       ;;We can't just say "define (dynamic-wind before thunk after)"
       ;;because the lambda it's defined to lives in this environment,
       ;;not in the global environment.
@@ -455,6 +480,7 @@
          outer-env)))
 
 (define call/cc call-with-current-continuation)
+(define call/ec call-with-escape-continuation)
 
 
 ;;;;; atom? and equal? written by a.k
@@ -539,7 +565,7 @@
 ;;;; Used as: (define-with-return (foo x y) .... (return z) ...)
 (macro (define-with-return form)
      `(define ,(cadr form)
-          (call/cc (lambda (return) ,@(cddr form)))))
+          (call/ec (lambda (return) ,@(cddr form)))))
 
 ;;;; Simple exception handling
 ;
@@ -557,32 +583,13 @@
 ;         (throw "message")
 ;
 ;    If used outside a (catch ...), reverts to (error "message)
-
-(define *handlers* (list))
-
-(define (push-handler proc)
-     (set! *handlers* (cons proc *handlers*)))
-
-(define (pop-handler)
-     (let ((h (car *handlers*)))
-          (set! *handlers* (cdr *handlers*))
-          h))
-
-(define (more-handlers?)
-     (pair? *handlers*))
-
-(define (throw . x)
-     (if (more-handlers?)
-          (apply (pop-handler))
-          (apply error x)))
+;
+;    Throw and call-with-handler are built in: a throw while the thunk
+;    runs leaves it, and calls the handler in its place.
 
 (macro (catch form)
-     (let ((label (gensym)))
-          `(call/cc (lambda (exit)
-               (push-handler (lambda () (exit ,(cadr form))))
-               (let ((,label (begin ,@(cddr form))))
-                    (pop-handler)
-                    ,label)))))
+     `(call-with-handler (lambda () ,(cadr form))
+                         (lambda () ,@(cddr form))))
 
 (define *error-hook* throw)
 
@@ -594,6 +601,14 @@
                ,@(cdr form)
                (current-environment))))
 
+;;;;; The macros above expand the same for the same form, so compiled
+;;;;; code may expand each call of them just once.  Other macros, such
+;;;;; as cond-expand below, are expanded every time they are reached.
+
+(for-each memoize-macro!
+          (list unless when define-macro quasiquote do
+                define-with-return catch make-environment))
+
 (define-macro (eval-polymorphic x . envl)
   (display envl)
   (let* ((env (if (null? envl) (current-environment) (eval (car envl))))
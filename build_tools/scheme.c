@@ -27,8 +27,19 @@
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <stdint.h>
 #include <stdbool.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if USE_PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -57,15 +68,24 @@
 
 #define BACKQUOTE '`'
 #define DELIMITERS  "()\";\f\t\v\n\r "
+/* DELIMITERS as a bit set; all of them are below 64 */
+#define DELIM_BITS  (1ULL << '(' | 1ULL << ')' | 1ULL << '"' | 1ULL << ';' \
+    | 1ULL << '\f' | 1ULL << '\t' | 1ULL << '\v' | 1ULL << '\n' | 1ULL << '\r' \
+    | 1ULL << ' ')
 
 /*
  *  Basic memory allocation units
  */
 
-#define OBJ_LIST_SIZE 461
+#define OBJ_LIST_SIZE 1024      /* a power of two */
 
 #define VERSION "TinyScheme R7 (v21.03)"
 
+/* the build that wrote a heap image or a FASL cache */
+#if USE_IMAGE || USE_FASL
+static const char *build_stamp(void);
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 
@@ -133,24 +153,51 @@ enum scheme_types {
   T_MACRO = 12,
   T_PROMISE = 13,
   T_ENVIRONMENT = 14,
-  T_BYTEVECTOR = 15
+  T_BYTEVECTOR = 15,
+  T_BYTECODE = 16,
+  T_FRAME = 17
 };
 
-/* ADJ is enough slack to align cells in a TYPE_BITS-bit boundary */
-#define ADJ 32
-#define TYPE_BITS 5
 #define T_MASKTYPE      31      /* 0000000000011111 */
+#define T_MEMO         256      /* 0000000100000000 */    /* see is_memo */
+#define T_UTF8         512      /* 0000001000000000 */    /* not ASCII */
+#define T_SHORT       1024      /* 0000010000000000 */    /* chars in cell */
+#define T_LOCAL       2048      /* 0000100000000000 */
 #define T_SYNTAX      4096      /* 0001000000000000 */
 #define T_IMMUTABLE   8192      /* 0010000000000000 */
 #define T_ATOM       16384    /* 0100000000000000 */    /* only for gc */
 #define CLRATOM      49151    /* 1011111111111111 */    /* only for gc */
-#define MARK         32768      /* 1000000000000000 */
-#define UNMARK       32767      /* 0111111111111111 */
+#define T_STATIC     32768      /* 1000000000000000 */    /* not in the heap */
 
 // these may be overriden by env properties
 static int cell_segsize = CELL_SEGSIZE;
 static int cell_nsegment = CELL_NSEGMENT;
+#if USE_PARALLEL_MARK
+static int gc_threads = GC_THREADS;
+#endif
+
+/*
+ * Neither the type and flag bits of a cell nor its mark bit are kept
+ * in the cell, which leaves it the 16 bytes of its data on a 64-bit
+ * machine.  They are at the head of its segment: first an array of
+ * flags, a 16-bit word per cell-sized slot, then a bitmap, one bit per
+ * slot.  A segment fills a block of seg_mask + 1 bytes aligned to its
+ * size, so both are found by masking the address of the cell.  The
+ * cells outside the heap (NIL, #t, ...) have a block of the same
+ * layout to themselves; they carry T_STATIC and always count as
+ * marked.
+ */
+#define MARK_WORD_BITS   (8 * sizeof(unsigned long))
+static uintptr_t seg_mask;
+static size_t flag_bytes;       /* bytes taken by the flags */
+static size_t mark_bytes;       /* ... by the bitmap after them */
+static int seg_head;            /* cells taken by the two */
+
+#define seg_base(p)      ((uintptr_t) (p) & ~seg_mask)
+#define mark_index(p)    (((uintptr_t) (p) & seg_mask) / sizeof(struct cell))
+#define mark_words(p)    ((unsigned long *) (seg_base(p) + flag_bytes))
 static long evalcnt = 0;
+static long fast_checks = 0;    /* built-in calls checked by args_fit */
 #ifdef EVAL_LIMIT
 static long eval_limit;
 #endif
@@ -170,23 +217,70 @@ static int num_le(num a, num b);
 #if USE_MATH
 static double round_per_R5RS(double x);
 #endif
+/*
+ * Integers that fit in a word less one bit, and all characters, are
+ * not kept in cells at all: the value is encoded in the pointer itself,
+ * so arithmetic on them does not allocate.  Cells are word aligned,
+ * which leaves the two low bits of a pointer free for a tag: x1 marks
+ * a fixnum (value << 1), 10 a character (value << 2).
+ */
+#define IMM_FIXNUM_TAG   1
+#define IMM_CHAR_TAG     2
+#define IMM_FIXNUM_MIN   (LONG_MIN >> 1)
+#define IMM_FIXNUM_MAX   (LONG_MAX >> 1)
+#define is_immediate(p)  ((uintptr_t) (p) & 3)
+#define is_imm_fixnum(p) ((uintptr_t) (p) & IMM_FIXNUM_TAG)
+#define imm_value(p)     (is_imm_fixnum(p) ? (long) ((intptr_t) (p) >> 1) \
+                                           : (long) ((intptr_t) (p) >> 2))
+#define mk_imm_fixnum(n) ((pointer) (((uintptr_t) (n) << 1) | IMM_FIXNUM_TAG))
+#define mk_imm_char(c)   ((pointer) (((uintptr_t) (c) << 2) | IMM_CHAR_TAG))
+
 static INLINE int num_is_integer(pointer p) {
-  return ((p)->_object._number.is_fixnum);
+  return is_immediate(p) || (p)->_object._number.is_fixnum;
 }
 
 static num num_zero;
 static num num_one;
 
 /* macros for cell operations */
-#define typeflag(p)      ((p)->_flag)
-#define type(p)          (typeflag(p)&T_MASKTYPE)
+#define typeflag(p)      (((unsigned short *) seg_base(p))[mark_index(p)])
+
+/* the flags an immediate would carry if it were a cell, by tag */
+static const unsigned int imm_flag[4] = {
+  0, T_NUMBER | T_ATOM, T_CHARACTER | T_ATOM, T_NUMBER | T_ATOM
+};
+
+#define cellflag(p)      (is_immediate(p) ? imm_flag[(uintptr_t) (p) & 3] \
+                                          : typeflag(p))
+#define type(p)          (cellflag(p)&T_MASKTYPE)
 
 INTERFACE INLINE int is_string(pointer p) {
   return (type(p) == T_STRING);
 }
 
-#define strvalue(p)      ((p)->_object._string._svalue)
-#define strlength(p)        ((p)->_object._string._length)
+/* The buffer of a long string, and that of a bytevector, vector, frame
+   or bytecode, which are laid out the same. */
+#define bufvalue(p)      ((p)->_object._string._svalue)
+#define buflength(p)     ((p)->_object._string._length)
+
+/* A short string keeps its chars in the cell, in place of the buffer.
+   A string with non-ASCII chars keeps them in UTF-8, followed in its
+   buffer by an index of where every STR_INDEX_STEPth char starts.
+   strsize() counts the bytes of a string, strlength() its chars. */
+#define is_short(p)      (typeflag(p) & T_SHORT)
+#define is_utf8(p)       (typeflag(p) & T_UTF8)
+#define strvalue(p)      (is_short(p) ? (p)->_object._short._chars \
+                                      : bufvalue(p))
+#define strsize(p)       (is_short(p) ? (p)->_object._short._length \
+                                      : buflength(p))
+#define strlength(p)     (is_utf8(p) ? (p)->_object._string._u._chars \
+                                     : strsize(p))
+#define strhash(p)       ((p)->_object._string._u._hash)
+
+#define STR_INDEX_STEP   16
+/* the index starts at the first int past the closing NUL */
+#define index_offset(len) (((len) + sizeof(int)) & ~(sizeof(int) - 1))
+#define str_index(p)     ((int *) (bufvalue(p) + index_offset(buflength(p))))
 
 INTERFACE static int is_list(scheme * sc, pointer p);
 INTERFACE INLINE int is_vector(pointer p) {
@@ -213,7 +307,7 @@ INTERFACE INLINE int is_integer(pointer p) {
 }
 
 INTERFACE INLINE int is_real(pointer p) {
-  return is_number(p) && (!(p)->_object._number.is_fixnum);
+  return is_number(p) && !num_is_integer(p);
 }
 
 INTERFACE INLINE int is_character(pointer p) {
@@ -223,13 +317,23 @@ INTERFACE INLINE char *string_value(pointer p) {
   return strvalue(p);
 }
 INLINE num nvalue(pointer p) {
-  return ((p)->_object._number);
+  num n;
+
+  if (!is_immediate(p))
+    return ((p)->_object._number);
+  n.is_fixnum = 1;
+  n.value.ivalue = imm_value(p);
+  return n;
 }
 INTERFACE long ivalue(pointer p) {
+  if (is_immediate(p))
+    return imm_value(p);
   return (num_is_integer(p) ? (p)->_object._number.value.ivalue : (long) (p)->
       _object._number.value.rvalue);
 }
 INTERFACE double rvalue(pointer p) {
+  if (is_immediate(p))
+    return (double) imm_value(p);
   return (!num_is_integer(p) ? (p)->_object._number.
       value.rvalue : (double) (p)->_object._number.value.ivalue);
 }
@@ -239,7 +343,7 @@ INTERFACE double rvalue(pointer p) {
 #define set_num_integer(p)   (p)->_object._number.is_fixnum=1;
 #define set_num_real(p)      (p)->_object._number.is_fixnum=0;
 INTERFACE long charvalue(pointer p) {
-  return ivalue_unchecked(p);
+  return is_immediate(p) ? imm_value(p) : ivalue_unchecked(p);
 }
 
 INTERFACE INLINE int is_port(pointer p) {
@@ -258,6 +362,7 @@ INTERFACE INLINE int is_pair(pointer p) {
 
 #define car(p)           ((p)->_object._cons._car)
 #define cdr(p)           ((p)->_object._cons._cdr)
+static INLINE void gc_barrier(pointer p, pointer v);
 INTERFACE pointer pair_car(pointer p) {
   return car(p);
 }
@@ -265,9 +370,11 @@ INTERFACE pointer pair_cdr(pointer p) {
   return cdr(p);
 }
 INTERFACE pointer set_car(pointer p, pointer q) {
+  gc_barrier(p, q);
   return car(p) = q;
 }
 INTERFACE pointer set_cdr(pointer p, pointer q) {
+  gc_barrier(p, q);
   return cdr(p) = q;
 }
 
@@ -277,17 +384,23 @@ INTERFACE INLINE int is_symbol(pointer p) {
 INTERFACE INLINE char *symname(pointer p) {
   return strvalue(car(p));
 }
+#define symhash(p)       strhash(car(p))
+
+/* A symbol never bound outside the global frame can only name a global
+   variable, so the slot it resolves to may be cached. */
+#define is_local(p)      (typeflag(p) & T_LOCAL)
+#define setlocal(p)      typeflag(p) |= T_LOCAL
 
 #if USE_PLIST
 SCHEME_EXPORT INLINE int hasprop(pointer p) {
-  return (typeflag(p) & T_SYMBOL);
+  return (cellflag(p) & T_SYMBOL);
 }
 
 #define symprop(p)       cdr(p)
 #endif
 
 INTERFACE INLINE int is_syntax(pointer p) {
-  return (typeflag(p) & T_SYNTAX);
+  return (cellflag(p) & T_SYNTAX);
 }
 INTERFACE INLINE int is_proc(pointer p) {
   return (type(p) == T_PROC);
@@ -308,8 +421,17 @@ INTERFACE INLINE int is_closure(pointer p) {
 INTERFACE INLINE int is_macro(pointer p) {
   return (type(p) == T_MACRO);
 }
+/* A macro whose expansion depends on its form alone, which compiled
+   code may then expand once for each call site. */
+#define is_memo(p)       (typeflag(p) & T_MEMO)
+/* compiled closures hold a prototype vector instead of their source */
+#define is_compiled(p)   is_vector(car(p))
+#define proto_code(p)    ((int *) bufvalue(vector_elem((p), 0)))
+#define proto_source(p)  vector_elem((p), 1)
+#define proto_names(p)   vector_elem((p), 2)
+
 INTERFACE INLINE pointer closure_code(pointer p) {
-  return car(p);
+  return is_compiled(p) ? proto_source(car(p)) : car(p);
 }
 INTERFACE INLINE pointer closure_env(pointer p) {
   return cdr(p);
@@ -320,6 +442,7 @@ INTERFACE INLINE int is_continuation(pointer p) {
 }
 
 #define cont_dump(p)     cdr(p)
+#define cont_escape(p)   car(p)         /* #t for call/ec's */
 
 /* To do: promise should be forced ONCE only */
 INTERFACE INLINE int is_promise(pointer p) {
@@ -330,18 +453,49 @@ INTERFACE INLINE int is_environment(pointer p) {
   return (type(p) == T_ENVIRONMENT);
 }
 
+INTERFACE INLINE int is_bytecode(pointer p) {
+  return (type(p) == T_BYTECODE);
+}
+
+INTERFACE INLINE int is_frame(pointer p) {
+  return (type(p) == T_FRAME);
+}
+
+/*
+ * Frames made by compiled code are T_FRAME cells rather than alists:
+ * they hold an array with one (name . value) slot per variable, so
+ * compiled code reaches a variable by index without searching, while
+ * a slot is still a pair for the code that looks variables up by name.
+ * The array ends with an alist of variables defined later that have
+ * no slot of their own.  A slot holding UNBOUND is not bound yet: an
+ * internal define or letrec variable that has not been reached.
+ */
+#define frame_size(f)    buflength(f)
+#define frame_slot(f, i) (((pointer *) bufvalue(f))[i])
+#define frame_extra(f)   frame_slot((f), frame_size(f))
+
+/* A vector is a cell holding a malloc'd array of its elements, like a
+   frame, rather than a run of consecutive cells. */
+#define vector_length(v)  buflength(v)
+#define vector_slot(v, i) (((pointer *) bufvalue(v))[i])
+
 #define setenvironment(p)    typeflag(p) = T_ENVIRONMENT
 
-#define is_atom(p)       (typeflag(p)&T_ATOM)
+#define is_atom(p)       (cellflag(p)&T_ATOM)
 #define setatom(p)       typeflag(p) |= T_ATOM
 #define clratom(p)       typeflag(p) &= CLRATOM
 
-#define is_mark(p)       (typeflag(p)&MARK)
-#define setmark(p)       typeflag(p) |= MARK
-#define clrmark(p)       typeflag(p) &= UNMARK
+#define cell_marked(p)   ((mark_words(p)[mark_index(p) / MARK_WORD_BITS] \
+                           >> (mark_index(p) % MARK_WORD_BITS)) & 1)
+#define setmark(p)       (mark_words(p)[mark_index(p) / MARK_WORD_BITS] \
+                           |= 1UL << (mark_index(p) % MARK_WORD_BITS))
+
+static INLINE int is_mark(pointer p) {
+  return is_immediate(p) || (typeflag(p) & T_STATIC) || cell_marked(p);
+}
 
 INTERFACE INLINE int is_immutable(pointer p) {
-  return (typeflag(p) & T_IMMUTABLE);
+  return (cellflag(p) & T_IMMUTABLE);
 }
 
 /*#define setimmutable(p)  typeflag(p) |= T_IMMUTABLE*/
@@ -387,13 +541,12 @@ static INLINE int is_one_of(char *s, int c);
 static int alloc_cellseg(scheme * sc, int n);
 static INLINE pointer get_cell(scheme * sc, pointer a, pointer b);
 static pointer _get_cell(scheme * sc, pointer a, pointer b);
-static pointer get_consecutive_cells(scheme * sc, int n);
-static pointer find_consecutive_cells(scheme * sc, int n);
+static pointer *alloc_slots(scheme * sc, int n);
 static void finalize_cell(scheme * sc, pointer a);
-static int count_consecutive_cells(pointer x, int needed);
 static pointer find_slot_in_env(scheme * sc, pointer env, pointer sym,
     int all);
 static pointer mk_number(scheme * sc, num n);
+static pointer mk_long_string(scheme * sc, const char *str, int len);
 static pointer mk_vector(scheme * sc, int len);
 static pointer mk_atom(scheme * sc, char *q);
 static pointer mk_sharp_const(scheme * sc, char *name);
@@ -409,10 +562,13 @@ static port *port_rep_from_string(scheme * sc, char *start,
 static void port_close(scheme * sc, pointer p, int flag);
 static void mark(pointer a);
 static void gc(scheme * sc, pointer a, pointer b);
-static int basic_inchar(port * pt);
+static int sweep_next(scheme * sc);
+static void lazy_sweep(scheme * sc);
+static void collect(scheme * sc, pointer a, pointer b);
+static int basic_inchar(scheme * sc, port * pt);
 static int inchar(scheme * sc);
 static void backchar(scheme * sc, int c);
-static char *readstr_upto(scheme * sc, char *delim);
+static char *readstr_upto(scheme * sc);
 static pointer readstrexp(scheme * sc);
 static INLINE int skipspace(scheme * sc);
 static int token(scheme * sc);
@@ -425,6 +581,7 @@ static pointer reverse(scheme * sc, pointer a);
 static pointer reverse_in_place(scheme * sc, pointer term, pointer list);
 static pointer revappend(scheme * sc, pointer a, pointer b);
 static void dump_stack_mark(scheme *);
+static void dump_stack_slide(scheme *);
 static pointer opexe_0(scheme * sc, enum scheme_opcodes op);
 static pointer opexe_1(scheme * sc, enum scheme_opcodes op);
 static pointer opexe_2(scheme * sc, enum scheme_opcodes op);
@@ -432,11 +589,32 @@ static pointer opexe_3(scheme * sc, enum scheme_opcodes op);
 static pointer opexe_4(scheme * sc, enum scheme_opcodes op);
 static pointer opexe_5(scheme * sc, enum scheme_opcodes op);
 static pointer opexe_6(scheme * sc, enum scheme_opcodes op);
+static pointer opexe_7(scheme * sc, enum scheme_opcodes op);
+static pointer vm_compile_lambda(scheme * sc, pointer source,
+    pointer scope);
+static int vm_push_list(scheme * sc, pointer a);
+static int vm_enter_closure(scheme * sc, pointer f, int argc);
 static void Eval_Cycle(scheme * sc, enum scheme_opcodes op);
 static void assign_syntax(scheme * sc, char *name);
 static int syntaxnum(pointer p);
 static void assign_proc(scheme * sc, enum scheme_opcodes, char *name);
 
+/*
+ * Marks are sticky: a cell that survived a collection keeps its mark
+ * and is old from then on.  A minor collection traces only from the
+ * roots through unmarked (young) cells and sweeps only the cells
+ * allocated since the last collection, so an old cell must never be
+ * the only path to a young one.  Every store of a pointer into a cell
+ * that may be old goes through gc_barrier, which promotes the young
+ * object stored, and all young cells it reaches, on the spot.
+ */
+static INLINE void gc_barrier(pointer p, pointer v) {
+  /* only heap cells are ever stored into */
+  if (cell_marked(p) && !is_mark(v)) {
+    mark(v);
+  }
+}
+
 #define num_ivalue(n)       (n.is_fixnum?(n).value.ivalue:(long)(n).value.rvalue)
 #define num_rvalue(n)       (!n.is_fixnum?(n).value.rvalue:(double)(n).value.ivalue)
 
@@ -593,48 +771,177 @@ static double round_per_R5RS(double x) {
 }
 #endif
 
+#define heap_cells(sc)   ((long) ((sc)->last_cell_seg + 1) * cell_segsize)
+
+/* The log of young cells has room for every cell of the heap, since
+   no cell is handed out twice between two collections. */
+static int grow_young_log(scheme * sc, long size) {
+  pointer *v;
+
+  if (size <= sc->young_size) {
+    return 1;
+  }
+  v = sc->malloc(size * sizeof(pointer));
+  if (v == 0) {
+    return 0;
+  }
+  if (sc->young != 0) {
+    memcpy(v, sc->young, sc->young_top * sizeof(pointer));
+    sc->free(sc->young);
+  }
+  sc->young = v;
+  sc->young_size = size;
+  return 1;
+}
+
+/* Round the segment size up to a power of two that also holds its
+   flags and mark bitmap, and use all the cells that fit. */
+static void size_cell_segs(void) {
+  uintptr_t size = 4096;
+  long slots;
+
+  for (;;) {
+    slots = size / sizeof(struct cell);
+    flag_bytes = (slots * sizeof(unsigned short) + sizeof(unsigned long) - 1)
+        / sizeof(unsigned long) * sizeof(unsigned long);
+    mark_bytes = (slots + MARK_WORD_BITS - 1) / MARK_WORD_BITS
+        * sizeof(unsigned long);
+    seg_head = (flag_bytes + mark_bytes + sizeof(struct cell) - 1)
+        / sizeof(struct cell);
+    if (slots - seg_head >= cell_segsize) {
+      break;
+    }
+    size <<= 1;
+  }
+  seg_mask = size - 1;
+  cell_segsize = slots - seg_head;
+}
+
+/* Add a segment to the heap and return its first cell, or 0 if out
+   of memory.  Its cells are free but not on the free list: sweeping
+   the segment puts them there. */
+static pointer add_cellseg(scheme * sc) {
+  pointer newp;
+  pointer p;
+  char *cp;
+  int i;
+
+  if (sc->last_cell_seg + 1 == sc->seg_room) {
+    char **a = sc->malloc(2 * sc->seg_room * sizeof(char *));
+    pointer *c = sc->malloc(2 * sc->seg_room * sizeof(pointer));
+
+    if (a == 0 || c == 0) {
+      sc->free(a);
+      sc->free(c);
+      return 0;
+    }
+    memcpy(a, sc->alloc_seg, sc->seg_room * sizeof(char *));
+    memcpy(c, sc->cell_seg, sc->seg_room * sizeof(pointer));
+    sc->free(sc->alloc_seg);
+    sc->free(sc->cell_seg);
+    sc->alloc_seg = a;
+    sc->cell_seg = c;
+    sc->seg_room *= 2;
+  }
+  if (!grow_young_log(sc, heap_cells(sc) + cell_segsize)) {
+    return 0;
+  }
+  /* the slack before and after the aligned block is never touched */
+  cp = (char *) sc->malloc(2 * (seg_mask + 1));
+  if (cp == 0) {
+    return 0;
+  }
+  i = ++sc->last_cell_seg;
+  sc->alloc_seg[i] = cp;
+  cp = (char *) (((uintptr_t) cp + seg_mask) & ~seg_mask);
+  memset(cp, 0, seg_head * sizeof(struct cell));
+  newp = (pointer) cp + seg_head;
+  for (p = newp; p < newp + cell_segsize; p++) {
+    typeflag(p) = 0;
+    car(p) = sc->NIL;
+  }
+  /* insert new segment in address order */
+  sc->cell_seg[i] = newp;
+  while (i > 0 && sc->cell_seg[i - 1] > sc->cell_seg[i]) {
+    p = sc->cell_seg[i];
+    sc->cell_seg[i] = sc->cell_seg[i - 1];
+    sc->cell_seg[i - 1] = p;
+    cp = sc->alloc_seg[i];
+    sc->alloc_seg[i] = sc->alloc_seg[i - 1];
+    sc->alloc_seg[--i] = cp;
+  }
+  return newp;
+}
+
+/* Pairs outside the heap that hold the arguments of a built-in the VM
+   calls directly: see vm_arg_cells. */
+#define ARG_CELLS 4
+
+/* The special cells are not in the heap, but their flags are kept
+   like those of any cell: give them a block laid out like a segment,
+   of which only the head and the cells are allocated. */
+static int alloc_static_cells(scheme * sc) {
+  char *cp;
+  pointer p;
+
+  /* room to align, the head, the six cells and the arg cells */
+  cp = (char *) sc->malloc(seg_mask + 1
+      + (seg_head + 6 + ARG_CELLS) * sizeof(struct cell));
+  if (cp == 0) {
+    return 0;
+  }
+  sc->static_seg = cp;
+  cp = (char *) (((uintptr_t) cp + seg_mask) & ~seg_mask);
+  memset(cp, 0, seg_head * sizeof(struct cell));
+  p = (pointer) cp + seg_head;
+  sc->sink = p++;
+  sc->NIL = p++;
+  sc->T = p++;
+  sc->F = p++;
+  sc->EOF_OBJ = p++;
+  sc->UNBOUND = p++;
+  sc->arg_cells = p;
+  return 1;
+}
+
+/* Give segment i back to the system.  None of its cells is marked. */
+static void free_cellseg(scheme * sc, int i) {
+  pointer p;
+
+  for (p = sc->cell_seg[i]; p < sc->cell_seg[i] + cell_segsize; p++) {
+    if (typeflag(p) != 0) {
+      finalize_cell(sc, p);
+    }
+  }
+  sc->free(sc->alloc_seg[i]);
+  for (; i < sc->last_cell_seg; i++) {
+    sc->cell_seg[i] = sc->cell_seg[i + 1];
+    sc->alloc_seg[i] = sc->alloc_seg[i + 1];
+  }
+  sc->last_cell_seg--;
+}
+
 /* allocate new cell segment */
 static int alloc_cellseg(scheme * sc, int n) {
   pointer newp;
   pointer last;
   pointer p;
-  char *cp;
-  long i;
   int k;
-  int adj = ADJ;
 
-  if (adj < sizeof(struct cell)) {
-    adj = sizeof(struct cell);
+  /* a new segment would shift the ones not swept yet */
+  while (sweep_next(sc)) {
   }
   for (k = 0; k < n; k++) {
-    if (sc->last_cell_seg >= cell_nsegment - 1)
-      return k;
-    cp = (char *) sc->malloc(cell_segsize * sizeof(struct cell) + adj);
-    if (cp == 0)
+    newp = add_cellseg(sc);
+    if (newp == 0)
       return k;
-    i = ++sc->last_cell_seg;
-    sc->alloc_seg[i] = cp;
-    /* adjust in TYPE_BITS-bit boundary */
-    if (((unsigned long) cp) % adj != 0) {
-      cp = (char *) (adj * ((unsigned long) cp / adj + 1));
-    }
-    /* insert new segment in address order */
-    newp = (pointer) cp;
-    sc->cell_seg[i] = newp;
-    while (i > 0 && sc->cell_seg[i - 1] > sc->cell_seg[i]) {
-      p = sc->cell_seg[i];
-      sc->cell_seg[i] = sc->cell_seg[i - 1];
-      sc->cell_seg[--i] = p;
-    }
     sc->fcells += cell_segsize;
     last = newp + cell_segsize - 1;
-    for (p = newp; p <= last; p++) {
-      typeflag(p) = 0;
+    for (p = newp; p < last; p++) {
       cdr(p) = p + 1;
-      car(p) = sc->NIL;
     }
     /* insert new cells in address order on free list */
-    if (sc->free_cell == sc->NIL || p < sc->free_cell) {
+    if (sc->free_cell == sc->NIL || newp < sc->free_cell) {
       cdr(last) = sc->free_cell;
       sc->free_cell = newp;
     } else {
@@ -653,6 +960,7 @@ static INLINE pointer get_cell_x(scheme * sc, pointer a, pointer b) {
     pointer x = sc->free_cell;
     sc->free_cell = cdr(x);
     --sc->fcells;
+    sc->young[sc->young_top++] = x;
     return (x);
   }
   return _get_cell(sc, a, b);
@@ -667,12 +975,15 @@ static pointer _get_cell(scheme * sc, pointer a, pointer b) {
     return sc->sink;
   }
 
+  lazy_sweep(sc);
   if (sc->free_cell == sc->NIL) {
-    const int min_to_be_recovered = sc->last_cell_seg * 8;
-    gc(sc, a, b);
-    if (sc->fcells < min_to_be_recovered || sc->free_cell == sc->NIL) {
-      /* if only a few recovered, get more to avoid fruitless gc's */
-      if (!alloc_cellseg(sc, 1) && sc->free_cell == sc->NIL) {
+    collect(sc, a, b);
+    lazy_sweep(sc);
+    /* a full collection sizes the heap; this is for when even that
+       left nothing free */
+    if (sc->free_cell == sc->NIL) {
+      if (!alloc_cellseg(sc, sc->last_cell_seg / 2 + 1)
+          && sc->free_cell == sc->NIL) {
         sc->no_memory = 1;
         return sc->sink;
       }
@@ -681,6 +992,7 @@ static pointer _get_cell(scheme * sc, pointer a, pointer b) {
   x = sc->free_cell;
   sc->free_cell = cdr(x);
   --sc->fcells;
+  sc->young[sc->young_top++] = x;
   return (x);
 }
 
@@ -694,10 +1006,10 @@ static pointer reserve_cells(scheme * sc, int n) {
   /* Are there enough cells available? */
   if (sc->fcells < n) {
     /* If not, try gc'ing some */
-    gc(sc, sc->NIL, sc->NIL);
+    collect(sc, sc->NIL, sc->NIL);
     if (sc->fcells < n) {
       /* If there still aren't, try getting more heap */
-      if (!alloc_cellseg(sc, 1)) {
+      if (!alloc_cellseg(sc, (n - sc->fcells) / cell_segsize + 1)) {
         sc->no_memory = 1;
         return sc->NIL;
       }
@@ -712,80 +1024,51 @@ static pointer reserve_cells(scheme * sc, int n) {
 }
 #endif
 
-static pointer get_consecutive_cells(scheme * sc, int n) {
-  pointer x;
-
-  if (sc->no_memory) {
-    return sc->sink;
-  }
-
-  /* Are there any cells available? */
-  x = find_consecutive_cells(sc, n);
-  if (x != sc->NIL) {
-    return x;
-  }
-
-  /* If not, try gc'ing some */
-  gc(sc, sc->NIL, sc->NIL);
-  x = find_consecutive_cells(sc, n);
-  if (x != sc->NIL) {
-    return x;
-  }
-
-  /* If there still aren't, try getting more heap */
-  if (!alloc_cellseg(sc, 1)) {
-    sc->no_memory = 1;
-    return sc->sink;
-  }
-
-  x = find_consecutive_cells(sc, n);
-  if (x != sc->NIL) {
-    return x;
-  }
-
-  /* If all fail, report failure */
-  sc->no_memory = 1;
-  return sc->sink;
-}
+/*
+ * Element arrays of frames and vectors.  Freed arrays of fewer than
+ * SLOT_POOL_SIZE elements are kept on a free list per size, which
+ * makes the small ones, allocated with every call, cost next to
+ * nothing; the others go back to malloc.
+ */
+static pointer *alloc_slots(scheme * sc, int n) {
+  pointer *v;
 
-static int count_consecutive_cells(pointer x, int needed) {
-  int n = 1;
-  while (cdr(x) == x + 1) {
-    x = cdr(x);
-    n++;
-    if (n > needed)
-      return n;
+  if (n < SLOT_POOL_SIZE && sc->slot_pool[n] != 0) {
+    v = sc->slot_pool[n];
+    sc->slot_pool[n] = (pointer *) v[0];
+    return v;
   }
-  return n;
+  /* room for the free list link even if there are no elements */
+  return (pointer *) sc->malloc((n > 0 ? n : 1) * sizeof(pointer));
 }
 
-static pointer find_consecutive_cells(scheme * sc, int n) {
-  pointer *pp;
-  int cnt;
-
-  pp = &sc->free_cell;
-  while (*pp != sc->NIL) {
-    cnt = count_consecutive_cells(*pp, n);
-    if (cnt >= n) {
-      pointer x = *pp;
-      *pp = cdr(*pp + n - 1);
-      sc->fcells -= n;
-      return x;
-    }
-    pp = &cdr(*pp + cnt - 1);
+static void free_slots(scheme * sc, pointer * v, int n) {
+  if (n < SLOT_POOL_SIZE) {
+    v[0] = (pointer) sc->slot_pool[n];
+    sc->slot_pool[n] = v;
+  } else {
+    sc->free(v);
   }
-  return sc->NIL;
 }
 
 /* To retain recent allocs before interpreter knows about them -
    Tehom */
 
-static void push_recent_alloc(scheme * sc, pointer recent, pointer extra) {
-  pointer holder = get_cell_x(sc, recent, extra);
-  typeflag(holder) = T_PAIR | T_IMMUTABLE;
-  car(holder) = recent;
-  cdr(holder) = car(sc->sink);
-  car(sc->sink) = holder;
+/* They are kept on a root stack of plain pointers rather than in a
+   list, so that protecting a cell costs no second cell. */
+static void push_recent_alloc(scheme * sc, pointer recent) {
+  if (sc->recent_top == sc->recent_size) {
+    pointer *v = sc->malloc(2 * sc->recent_size * sizeof(pointer));
+    if (v == 0) {
+      sc->no_memory = 1;
+      return;
+    }
+    memcpy(v, sc->recent, sc->recent_top * sizeof(pointer));
+    sc->free(sc->recent);
+    sc->recent = v;
+    sc->recent_size *= 2;
+  }
+  sc->recent[sc->recent_top++] = recent;
 }
 
 
@@ -797,26 +1080,41 @@ static pointer get_cell(scheme * sc, pointer a, pointer b) {
   typeflag(cell) = T_PAIR;
   car(cell) = a;
   cdr(cell) = b;
-  push_recent_alloc(sc, cell, sc->NIL);
+  push_recent_alloc(sc, cell);
   return cell;
 }
 
 static pointer get_vector_object(scheme * sc, int len, pointer init) {
-  pointer cells = get_consecutive_cells(sc, len / 2 + len % 2 + 1);
+  pointer cells;
+  pointer *v;
+
+  /* The elements are not in the heap, so running out of cells does not
+     tell when dead vectors are worth reclaiming: collect once vectors
+     as big as the heap have been made since the last collection. */
+  sc->vec_words += len;
+  if (sc->vec_words > heap_cells(sc)) {
+    collect(sc, init, sc->NIL);
+  }
+  cells = get_cell(sc, init, sc->NIL);
   if (sc->no_memory) {
     return sc->sink;
   }
+  v = alloc_slots(sc, len);
+  if (v == 0) {
+    sc->no_memory = 1;
+    return sc->sink;
+  }
   /* Record it as a vector so that gc understands it. */
   typeflag(cells) = (T_VECTOR | T_ATOM);
-  ivalue_unchecked(cells) = len;
-  set_num_integer(cells);
+  bufvalue(cells) = (char *) v;
+  vector_length(cells) = len;
   fill_vector(cells, init);
-  push_recent_alloc(sc, cells, sc->NIL);
+  push_recent_alloc(sc, cells);
   return cells;
 }
 
 static INLINE void ok_to_freely_gc(scheme * sc) {
-  car(sc->sink) = sc->NIL;
+  sc->recent_top = sc->recent_base;
 }
 
 
@@ -858,37 +1156,69 @@ pointer _cons(scheme * sc, pointer a, pointer b, int immutable) {
 
 /* ========== oblist implementation  ========== */
 
-static int hash_fn(const char *key, int table_size);
+static unsigned int hash_str(const char *key);
 
+/* The oblist is a vector of symbols, open addressed: a symbol is in the
+   first free slot from its hash on, and NIL marks a free slot.  It is
+   kept at most two thirds full. */
 static pointer oblist_initial_value(scheme * sc) {
+  sc->oblist_used = 0;
   return mk_vector(sc, OBJ_LIST_SIZE);
 }
 
+/* puts symbol x in the first free slot of table from its hash on */
+static void oblist_insert(scheme * sc, pointer table, pointer x) {
+  int mask = vector_length(table) - 1;
+  int i;
+
+  for (i = symhash(x) & mask; vector_elem(table, i) != sc->NIL;
+      i = (i + 1) & mask) {
+  }
+  set_vector_elem(table, i, x);
+}
+
+static void oblist_grow(scheme * sc) {
+  pointer table = mk_vector(sc, 2 * vector_length(sc->oblist));
+  pointer x;
+  int i;
+
+  for (i = 0; i < vector_length(sc->oblist); i++) {
+    x = vector_elem(sc->oblist, i);
+    if (x != sc->NIL) {
+      oblist_insert(sc, table, x);
+    }
+  }
+  sc->oblist = table;
+}
+
 /* returns the new symbol */
 static pointer oblist_add_by_name(scheme * sc, const char *name) {
   pointer x;
-  int location;
 
-  x = immutable_cons(sc, mk_string(sc, name), sc->NIL);
+  /* not a short string: the hash is kept beside the buffer */
+  x = immutable_cons(sc, mk_long_string(sc, name, strlen(name)), sc->NIL);
   typeflag(x) = T_SYMBOL;
   setimmutable(car(x));
+  symhash(x) = hash_str(name);
 
-  location = hash_fn(name, ivalue_unchecked(sc->oblist));
-  set_vector_elem(sc->oblist, location,
-      immutable_cons(sc, x, vector_elem(sc->oblist, location)));
+  if (3 * (sc->oblist_used + 1) > 2 * vector_length(sc->oblist)) {
+    oblist_grow(sc);
+  }
+  oblist_insert(sc, sc->oblist, x);
+  sc->oblist_used++;
   return x;
 }
 
 static INLINE pointer oblist_find_by_name(scheme * sc, const char *name) {
-  int location;
+  unsigned int hash = hash_str(name);
+  int mask = vector_length(sc->oblist) - 1;
+  int i;
   pointer x;
-  char *s;
 
-  location = hash_fn(name, ivalue_unchecked(sc->oblist));
-  for (x = vector_elem(sc->oblist, location); x != sc->NIL; x = cdr(x)) {
-    s = symname(car(x));
-    if (str_eq_to_lower(name, s)) {
-      return car(x);
+  for (i = hash & mask; (x = vector_elem(sc->oblist, i)) != sc->NIL;
+      i = (i + 1) & mask) {
+    if (symhash(x) == hash && strcmp(symname(x), name) == 0) {
+      return x;
     }
   }
   return sc->NIL;
@@ -899,8 +1229,9 @@ static pointer oblist_all_symbols(scheme * sc) {
   pointer x;
   pointer ob_list = sc->NIL;
 
-  for (i = 0; i < ivalue_unchecked(sc->oblist); i++) {
-    for (x = vector_elem(sc->oblist, i); x != sc->NIL; x = cdr(x)) {
+  for (i = 0; i < vector_length(sc->oblist); i++) {
+    x = vector_elem(sc->oblist, i);
+    if (x != sc->NIL) {
       ob_list = cons(sc, x, ob_list);
     }
   }
@@ -924,18 +1255,17 @@ pointer mk_foreign_func(scheme * sc, foreign_func f) {
 }
 
 INTERFACE pointer mk_character(scheme * sc, int c) {
-  pointer x = get_cell(sc, sc->NIL, sc->NIL);
-
-  typeflag(x) = (T_CHARACTER | T_ATOM);
-  ivalue_unchecked(x) = c;
-  set_num_integer(x);
-  return (x);
+  (void) sc;                    /* immediate: no cell taken */
+  return mk_imm_char(c);
 }
 
 /* get number atom (integer) */
 INTERFACE pointer mk_integer(scheme * sc, long num) {
-  pointer x = get_cell(sc, sc->NIL, sc->NIL);
+  pointer x;
 
+  if (num >= IMM_FIXNUM_MIN && num <= IMM_FIXNUM_MAX)
+    return mk_imm_fixnum(num);
+  x = get_cell(sc, sc->NIL, sc->NIL);
   typeflag(x) = (T_NUMBER | T_ATOM);
   ivalue_unchecked(x) = num;
   set_num_integer(x);
@@ -974,73 +1304,136 @@ static int utf8_decode(const char *p) {
   return c;
 }
 
-#define UTFSTR_LEN_GET(S) ((*((int*)(S)) >> 8) & 0x7FFFFF)
-#define UTFSTR_LEN_SET(LEN) ((((LEN) & 0x7FFFFF) << 8) | 0x80000080)
+/* the char after the one that starts at s */
+static const char *utf8_next(const char *s) {
+  do {
+    s++;
+  } while ((*s & 0xC0) == 0x80);
+  return s;
+}
 
-/* allocate name to string area */
-static char *store_string(scheme * sc, int len, const char *str) {
-  char *q;
-  const char *end;
-  int char_size = 1;
-  int i;
+/* Counts the chars in the len bytes at s, noting in index, unless it is
+   null, where every STR_INDEX_STEPth one starts. */
+static int utf8_scan(const char *s, int len, int *index) {
+  const char *p = s;
+  int n;
 
-  for (i = 0; i < len; i++) {
-    if ((str[i] & 0x80) != 0) {
-      char_size = 4;
-      break;
+  for (n = 0; p < s + len; n++) {
+    if (index != 0 && n % STR_INDEX_STEP == 0) {
+      index[n / STR_INDEX_STEP] = p - s;
     }
+    p = utf8_next(p);
   }
+  return n;
+}
+
+/* allocate name to string area, with room for the index of its chars
+   unless they are all ASCII.  A null str leaves room for len bytes,
+   zeroed, to be filled in. */
+static char *store_string(scheme * sc, int len, const char *str,
+    int chars) {
+  size_t size = len + 1;
+  char *q;
 
-  q = (char *) sc->malloc((len + 1) * char_size);
+  if (chars != len) {
+    size = index_offset(len)
+        + (chars + STR_INDEX_STEP - 1) / STR_INDEX_STEP * sizeof(int);
+  }
+  q = (char *) sc->malloc(size);
   if (q == 0) {
     sc->no_memory = 1;
-    return sc->strbuff;
+    return 0;
   }
   if (str != 0) {
-    if (char_size == 1) {
-      memcpy(q, str, len);
-      q[len] = 0;
-    } else {
-      i = 1;
-      end = str + len;
-      while (str < end) {
-        if (IS_ASCII(*str) || (*str & 0xE0) == 0xC0) {
-          ((int*) q)[i++] = utf8_decode(str);
-        }
-        str++;
-      }
-      ((int*) q)[0] = UTFSTR_LEN_SET(i - 1);
-    }
+    memcpy(q, str, len);
+  } else {
+    memset(q, 0, len);
   }
+  q[len] = 0;
   return (q);
 }
 
+/* Makes the buffer q, of len bytes and chars chars, that of the string
+   x, indexing its chars if they are not all ASCII. */
+static void set_string_buffer(pointer x, char *q, int len, int chars) {
+  typeflag(x) &= ~(T_SHORT | T_UTF8);
+  if (q == 0) {
+    /* out of memory: leave it empty */
+    typeflag(x) |= T_SHORT;
+    x->_object._short._chars[0] = 0;
+    x->_object._short._length = 0;
+    return;
+  }
+  bufvalue(x) = q;
+  buflength(x) = len;
+  if (chars != len) {
+    typeflag(x) |= T_UTF8;
+    x->_object._string._u._chars = chars;
+    utf8_scan(q, len, str_index(x));
+  }
+}
+
 /* get new string */
 INTERFACE pointer mk_string(scheme * sc, const char *str) {
   return mk_counted_string(sc, str, strlen(str));
 }
 
+/* A string of the len bytes of str, or of len zeroes if str is null,
+   kept in the cell if it is short and plain ASCII. */
 INTERFACE pointer mk_counted_string(scheme * sc, const char *str, int len) {
-  char *s;
+  pointer x;
+  int chars;
+  int i;
+
+  for (i = 0; str != 0 && i < len && IS_ASCII(str[i]); i++) {
+  }
+  if (str != 0 && i < len) {
+    chars = utf8_scan(str, len, 0);
+    x = get_cell(sc, sc->NIL, sc->NIL);
+    typeflag(x) = (T_STRING | T_ATOM);
+    set_string_buffer(x, store_string(sc, len, str, chars), len, chars);
+    return x;
+  }
+  if (len <= (int) SHORT_STR_MAX) {
+    x = get_cell(sc, sc->NIL, sc->NIL);
+    typeflag(x) = (T_STRING | T_ATOM | T_SHORT);
+    if (str != 0) {
+      memcpy(x->_object._short._chars, str, len);
+    } else {
+      memset(x->_object._short._chars, 0, len);
+    }
+    x->_object._short._chars[len] = 0;
+    x->_object._short._length = len;
+    return x;
+  }
+  return mk_long_string(sc, str, len);
+}
+
+/* The same with the bytes always in a buffer of their own, unindexed:
+   for symbol names too, whose hash is kept in place of the count. */
+static pointer mk_long_string(scheme * sc, const char *str, int len) {
   pointer x = get_cell(sc, sc->NIL, sc->NIL);
   typeflag(x) = (T_STRING | T_ATOM);
-  s = store_string(sc, len, str);
-  strvalue(x) = s;
-  strlength(x) = IS_ASCII(*s) ? len : UTFSTR_LEN_GET(s);
+  set_string_buffer(x, store_string(sc, len, str, len), len, len);
   return x;
 }
 
-static void upgrade_string(scheme *sc, pointer p) {
-  int len = strlength(p);
-  char *s = strvalue(p);
-  int *sbig = (int*) sc->malloc((len + 1) * sizeof(int));
-  int i;
-  sbig[0] = UTFSTR_LEN_SET(len);
-  for (i = 0; i < len; i++) {
-    sbig[i + 1] = s[i];
+/* where char i of the string p starts; i may be its length */
+static char *string_at(pointer p, int i) {
+  const char *s;
+  int n;
+
+  if (!is_utf8(p)) {
+    return strvalue(p) + i;
+  }
+  if (i == strlength(p)) {
+    return bufvalue(p) + buflength(p);
   }
-  sc->free(s);
-  strvalue(p) = (char*) sbig;
+  s = bufvalue(p) + str_index(p)[i / STR_INDEX_STEP];
+  for (n = i % STR_INDEX_STEP; n > 0; n--) {
+    s = utf8_next(s);
+  }
+  return (char *) s;
 }
 
 INTERFACE static pointer mk_vector(scheme * sc, int len) {
@@ -1049,31 +1442,20 @@ INTERFACE static pointer mk_vector(scheme * sc, int len) {
 
 INTERFACE static void fill_vector(pointer vec, pointer obj) {
   int i;
-  int num = ivalue(vec) / 2 + ivalue(vec) % 2;
+  int num = vector_length(vec);
   for (i = 0; i < num; i++) {
-    typeflag(vec + 1 + i) = T_PAIR;
-    setimmutable(vec + 1 + i);
-    car(vec + 1 + i) = obj;
-    cdr(vec + 1 + i) = obj;
+    vector_slot(vec, i) = obj;
   }
+  gc_barrier(vec, obj);
 }
 
 INTERFACE static pointer vector_elem(pointer vec, int ielem) {
-  int n = ielem / 2;
-  if (ielem % 2 == 0) {
-    return car(vec + 1 + n);
-  } else {
-    return cdr(vec + 1 + n);
-  }
+  return vector_slot(vec, ielem);
 }
 
 INTERFACE static pointer set_vector_elem(pointer vec, int ielem, pointer a) {
-  int n = ielem / 2;
-  if (ielem % 2 == 0) {
-    return car(vec + 1 + n) = a;
-  } else {
-    return cdr(vec + 1 + n) = a;
-  }
+  gc_barrier(vec, a);
+  return vector_slot(vec, ielem) = a;
 }
 
 INTERFACE static pointer mk_bvector(scheme * sc, int len, int val) {
@@ -1084,8 +1466,8 @@ INTERFACE static pointer mk_bvector(scheme * sc, int len, int val) {
   if (val >= 0) {
     memset(s, val, len);
   }
-  strvalue(x) = s;
-  strlength(x) = len;
+  bufvalue(x) = s;
+  buflength(x) = len;
   return x;
 }
 
@@ -1245,16 +1627,25 @@ static pointer mk_sharp_const(scheme * sc, char *name) {
 static void mark(pointer a) {
   pointer t, q, p;
 
+  if (is_immediate(a) || (typeflag(a) & T_STATIC))
+    return;
   t = (pointer) 0;
   p = a;
 E2:setmark(p);
   if (is_vector(p)) {
     int i;
-    int num = ivalue_unchecked(p) / 2 + ivalue_unchecked(p) % 2;
-    for (i = 0; i < num; i++) {
-      /* Vector cells will be treated like ordinary cells */
-      mark(p + 1 + i);
+    for (i = 0; i < vector_length(p); i++) {
+      mark(vector_slot(p, i));
+    }
+  } else if (is_frame(p)) {
+    int i;
+    for (i = 0; i <= frame_size(p); i++) {
+      mark(frame_slot(p, i));
     }
+  } else if (is_port(p) && (p->_object._port->kind & port_string)
+      && p->_object._port->rep.string.owner != 0) {
+    /* a string port reads the buffer of its string in place */
+    mark(p->_object._port->rep.string.owner);
   }
   if (is_atom(p))
     goto E6;
@@ -1292,1798 +1683,4556 @@ E6:                            /* up.  Undo the link switching from steps E4 and
   }
 }
 
-/* garbage collection. parameter a, b is marked. */
-static void gc(scheme * sc, pointer a, pointer b) {
-  pointer p;
-  int i;
+#if USE_PARALLEL_MARK
+/*
+ * Parallel marking, for full collections of a big heap.  Link
+ * inversion cannot be shared between threads, so each marker keeps the
+ * cells it still has to trace on a deque of its own (Chase and Lev,
+ * "Dynamic Circular Work-Stealing Deque", 2005): the owner pushes and
+ * pops at the bottom, markers out of work steal from the top of
+ * another.  A cell is claimed by setting its mark bit atomically, so
+ * only one marker ever traces it.  The roots are all pushed on the
+ * deque of the first marker, and the others start by stealing.
+ */
 
-  if (sc->gc_verbose) {
-    putstr(sc, "gc...");
-  }
+/* Below this many cells in use, starting threads costs more than it
+   saves. */
+#define PAR_MARK_MIN     (1L << 17)
+#define MARK_RING_SIZE   1024
 
-  /* mark system globals */
-  mark(sc->oblist);
-  mark(sc->global_env);
+struct mark_ring {
+  long size;                    /* a power of two */
+  struct mark_ring *prev;       /* outgrown, freed once marking is over */
+  pointer slot[1];
+};
 
-  /* mark current registers */
-  mark(sc->args);
-  mark(sc->envir);
-  mark(sc->code);
-  dump_stack_mark(sc);
-  mark(sc->value);
-  mark(sc->inport);
-  mark(sc->save_inport);
-  mark(sc->outport);
-  mark(sc->loadport);
+struct mark_team;
 
-  /* Mark recent objects the interpreter doesn't know about yet. */
-  mark(car(sc->sink));
-  /* Mark any older stuff above nested C calls */
-  mark(sc->c_nest);
+struct mark_deque {
+  long top;
+  long bottom;
+  struct mark_ring *ring;
+  struct mark_team *team;
+  unsigned long seed;           /* to pick a victim */
+  char pad[64];                 /* keep deques off each other's lines */
+};
 
-  /* mark variables a, b */
-  mark(a);
-  mark(b);
+struct mark_team {
+  struct mark_deque *deque;
+  int n;
+  int idle;                     /* markers that found no work */
+  int overflow;                 /* a claimed cell could not be queued */
+};
 
-  /* garbage collect */
-  clrmark(sc->NIL);
-  sc->fcells = 0;
-  sc->free_cell = sc->NIL;
-  /* free-list is kept sorted by address so as to maintain consecutive
-     ranges, if possible, for use with vectors. Here we scan the cells
-     (which are also kept sorted by address) downwards to build the
-     free-list in sorted order.
-   */
-  for (i = sc->last_cell_seg; i >= 0; i--) {
-    p = sc->cell_seg[i] + cell_segsize;
-    while (--p >= sc->cell_seg[i]) {
-      if (is_mark(p)) {
-        clrmark(p);
-      } else {
-        /* reclaim cell */
-        if (typeflag(p) != 0) {
-          finalize_cell(sc, p);
-          typeflag(p) = 0;
-          car(p) = sc->NIL;
-        }
-        ++sc->fcells;
-        cdr(p) = sc->free_cell;
-        sc->free_cell = p;
-      }
-    }
+/* The rings are only allocated while several threads run: they come
+   from malloc, which is thread safe, and not from sc->malloc. */
+static struct mark_ring *mark_ring_new(long size) {
+  struct mark_ring *r;
+
+  r = malloc(sizeof(struct mark_ring) + (size - 1) * sizeof(pointer));
+  if (r != 0) {
+    r->size = size;
+    r->prev = 0;
   }
+  return r;
+}
 
-  if (sc->gc_verbose) {
-    char msg[80];
-    sprintf(msg, "done: %ld cells were recovered.\n", sc->fcells);
-    putstr(sc, msg);
+/* Owner only.  The old ring stays readable for thieves still on it. */
+static struct mark_ring *mark_ring_grow(struct mark_deque *d,
+    struct mark_ring *r, long t, long b) {
+  struct mark_ring *n = mark_ring_new(2 * r->size);
+  long i;
+
+  if (n == 0) {
+    return 0;
+  }
+  for (i = t; i < b; i++) {
+    n->slot[i & (n->size - 1)] = r->slot[i & (r->size - 1)];
   }
+  n->prev = r;
+  __atomic_store_n(&d->ring, n, __ATOMIC_RELEASE);
+  return n;
 }
 
-static void finalize_cell(scheme * sc, pointer a) {
-  if (is_string(a)) {
-    sc->free(strvalue(a));
-  } else if (is_port(a)) {
-    if (a->_object._port->kind & port_file
-        && a->_object._port->rep.stdio.closeit) {
-      port_close(sc, a, port_input | port_output);
+static void deque_push(struct mark_deque *d, pointer p) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  struct mark_ring *r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+
+  if (b - t >= r->size) {
+    r = mark_ring_grow(d, r, t, b);
+    if (r == 0) {
+      __atomic_store_n(&d->team->overflow, 1, __ATOMIC_RELAXED);
+      return;
     }
-    sc->free(a->_object._port);
   }
+  __atomic_store_n(&r->slot[b & (r->size - 1)], p, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
 }
 
-/* ========== Routines for Reading ========== */
+static pointer deque_pop(struct mark_deque *d) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  struct mark_ring *r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+  pointer p;
+  long t;
 
-static int file_push(scheme * sc, const char *fname) {
-  FILE *fin = NULL;
-
-  if (sc->file_i == MAXFIL - 1)
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  if (t > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
     return 0;
-  fin = fopen(fname, "r");
-  if (fin != 0) {
-    sc->file_i++;
-    sc->load_stack[sc->file_i].kind = port_file | port_input;
-    sc->load_stack[sc->file_i].rep.stdio.file = fin;
-    sc->load_stack[sc->file_i].rep.stdio.closeit = 1;
-    sc->nesting_stack[sc->file_i] = 0;
-    sc->loadport->_object._port = sc->load_stack + sc->file_i;
-
-#if SHOW_ERROR_LINE
-    sc->load_stack[sc->file_i].rep.stdio.curr_line = 0;
-    if (fname)
-      sc->load_stack[sc->file_i].rep.stdio.filename =
-          store_string(sc, strlen(fname), fname);
-#endif
   }
-  return fin != 0;
-}
-
-static void file_pop(scheme * sc) {
-  if (sc->file_i != 0) {
-    sc->nesting = sc->nesting_stack[sc->file_i];
-    port_close(sc, sc->loadport, port_input);
-    sc->file_i--;
-    sc->loadport->_object._port = sc->load_stack + sc->file_i;
+  p = __atomic_load_n(&r->slot[b & (r->size - 1)], __ATOMIC_RELAXED);
+  if (t == b) {
+    /* the last one: race the thieves for it */
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      p = 0;
+    }
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
   }
+  return p;
 }
 
-static int file_interactive(scheme * sc) {
-  return sc->interactive_repl
-      && sc->file_i == 0 && sc->load_stack[0].rep.stdio.file == stdin
-      && sc->inport->_object._port->kind & port_file;
-}
+static pointer deque_steal(struct mark_deque *d) {
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  struct mark_ring *r;
+  pointer p;
+  long b;
 
-static port *port_rep_from_filename(scheme * sc, const char *fn, int prop) {
-  FILE *f;
-  char *rw;
-  port *pt;
-  if (prop == (port_input | port_output)) {
-    rw = "a+";
-  } else if (prop == port_output) {
-    rw = "w";
-  } else {
-    rw = "r";
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b) {
+    return 0;
   }
-  f = fopen(fn, rw);
-  if (f == 0) {
+  r = __atomic_load_n(&d->ring, __ATOMIC_ACQUIRE);
+  p = __atomic_load_n(&r->slot[t & (r->size - 1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
     return 0;
   }
-  pt = port_rep_from_file(sc, f, prop);
-  pt->rep.stdio.closeit = 1;
+  return p;
+}
 
-#if SHOW_ERROR_LINE
-  if (fn)
-    pt->rep.stdio.filename = store_string(sc, strlen(fn), fn);
+static INLINE long deque_size(struct mark_deque *d) {
+  return __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE)
+      - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+}
 
-  pt->rep.stdio.curr_line = 0;
-#endif
-  return pt;
+/* Set the mark bit of p, if it is a heap cell; true if this call set
+   it, i.e. p is ours to trace. */
+static INLINE int mark_claim(pointer p) {
+  unsigned long *w;
+  unsigned long bit;
+
+  if (p == 0 || is_immediate(p) || (typeflag(p) & T_STATIC)) {
+    return 0;
+  }
+  w = &mark_words(p)[mark_index(p) / MARK_WORD_BITS];
+  bit = 1UL << (mark_index(p) % MARK_WORD_BITS);
+  return (__atomic_load_n(w, __ATOMIC_RELAXED) & bit) == 0
+      && (__atomic_fetch_or(w, bit, __ATOMIC_RELAXED) & bit) == 0;
 }
 
-static pointer port_from_filename(scheme * sc, const char *fn, int prop) {
-  port *pt;
-  pt = port_rep_from_filename(sc, fn, prop);
-  if (pt == 0) {
-    return sc->NIL;
+static INLINE void mark_push(struct mark_deque *d, pointer p) {
+  if (mark_claim(p)) {
+    deque_push(d, p);
   }
-  return mk_port(sc, pt);
 }
 
-static port *port_rep_from_file(scheme * sc, FILE * f, int prop) {
-  port *pt;
+/* Queue what p points to.  The cdr is followed at once rather than
+   queued, so a list is walked without going through the deque. */
+static void mark_trace(struct mark_deque *d, pointer p) {
+  long i;
 
-  pt = (port *) sc->malloc(sizeof *pt);
-  if (pt == NULL) {
-    return NULL;
+  for (;;) {
+    if (is_vector(p)) {
+      for (i = 0; i < vector_length(p); i++) {
+        mark_push(d, vector_slot(p, i));
+      }
+    } else if (is_frame(p)) {
+      for (i = 0; i <= frame_size(p); i++) {
+        mark_push(d, frame_slot(p, i));
+      }
+    } else if (is_port(p) && (p->_object._port->kind & port_string)
+        && p->_object._port->rep.string.owner != 0) {
+      mark_push(d, p->_object._port->rep.string.owner);
+    }
+    if (is_atom(p)) {
+      return;
+    }
+    mark_push(d, car(p));
+    p = cdr(p);
+    if (!mark_claim(p)) {
+      return;
+    }
   }
-  pt->kind = port_file | prop;
-  pt->rep.stdio.file = f;
-  pt->rep.stdio.closeit = 0;
-  return pt;
 }
 
-static pointer port_from_file(scheme * sc, FILE * f, int prop) {
-  port *pt;
-  pt = port_rep_from_file(sc, f, prop);
-  if (pt == 0) {
-    return sc->NIL;
+static pointer mark_steal(struct mark_deque *d) {
+  struct mark_team *team = d->team;
+  pointer p;
+  int i;
+  int k;
+
+  d->seed = d->seed * 6364136223846793005UL + 1442695040888963407UL;
+  k = (int) ((d->seed >> 33) % team->n);
+  for (i = 0; i < team->n; i++, k = (k + 1) % team->n) {
+    if (team->deque + k != d && (p = deque_steal(team->deque + k)) != 0) {
+      return p;
+    }
   }
-  return mk_port(sc, pt);
+  return 0;
 }
 
-static port *port_rep_from_string(scheme * sc, char *start,
-    char *past_the_end, int prop) {
-  port *pt;
-  pt = (port *) sc->malloc(sizeof(port));
-  if (pt == 0) {
-    return 0;
+/*
+ * Called by a marker out of work.  A marker goes idle with an empty
+ * deque and pushes nothing while idle, so once all of them are idle
+ * there is no work left anywhere.  Until then, go back to work as soon
+ * as any deque has something to steal.
+ */
+static int mark_done(struct mark_deque *d) {
+  struct mark_team *team = d->team;
+  int i;
+
+  __atomic_add_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    if (__atomic_load_n(&team->idle, __ATOMIC_SEQ_CST) == team->n) {
+      return 1;
+    }
+    for (i = 0; i < team->n; i++) {
+      if (deque_size(team->deque + i) > 0) {
+        __atomic_sub_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+        return 0;
+      }
+    }
+    sched_yield();
   }
-  pt->kind = port_string | prop;
-  pt->rep.string.start = start;
-  pt->rep.string.curr = start;
-  pt->rep.string.past_the_end = past_the_end;
-  return pt;
 }
 
-static pointer port_from_string(scheme * sc, char *start, char *past_the_end,
-    int prop) {
-  port *pt;
-  pt = port_rep_from_string(sc, start, past_the_end, prop);
-  if (pt == 0) {
-    return sc->NIL;
+static void *mark_worker(void *arg) {
+  struct mark_deque *d = arg;
+  pointer p;
+
+  do {
+    while ((p = deque_pop(d)) != 0 || (p = mark_steal(d)) != 0) {
+      mark_trace(d, p);
+    }
+  } while (!mark_done(d));
+  return 0;
+}
+#endif /* USE_PARALLEL_MARK */
+
+/* Mark a root, or have the parallel markers do it. */
+static INLINE void mark_root(scheme * sc, pointer p) {
+#if USE_PARALLEL_MARK
+  if (sc->root_deque != 0) {
+    mark_push(sc->root_deque, p);
+    return;
   }
-  return mk_port(sc, pt);
+#else
+  (void) sc;
+#endif
+  mark(p);
 }
 
-#define BLOCK_SIZE 256
+/* garbage collection. parameter a, b is marked. */
+static void mark_roots(scheme * sc, pointer a, pointer b) {
+  int i;
 
-static port *port_rep_from_scratch(scheme * sc) {
-  port *pt;
-  char *start;
-  pt = (port *) sc->malloc(sizeof(port));
-  if (pt == 0) {
-    return 0;
+  /* mark system globals */
+  mark_root(sc, sc->oblist);
+  mark_root(sc, sc->global_env);
+
+  /* mark current registers */
+  mark_root(sc, sc->args);
+  mark_root(sc, sc->envir);
+  mark_root(sc, sc->code);
+  dump_stack_mark(sc);
+  mark_root(sc, sc->value);
+  for (i = 0; i < sc->vm_sp; i++) {
+    mark_root(sc, sc->vm_stack[i]);
   }
-  start = sc->malloc(BLOCK_SIZE);
-  if (start == 0) {
-    return 0;
+  for (i = 0; i < ARG_CELLS; i++) {
+    mark_root(sc, car(sc->arg_cells + i));
   }
-  memset(start, ' ', BLOCK_SIZE - 1);
-  start[BLOCK_SIZE - 1] = '\0';
-  pt->kind = port_string | port_output | port_srfi6;
-  pt->rep.string.start = start;
-  pt->rep.string.curr = start;
-  pt->rep.string.past_the_end = start + BLOCK_SIZE - 1;
-  return pt;
-}
+  mark_root(sc, sc->inport);
+  mark_root(sc, sc->save_inport);
+  mark_root(sc, sc->outport);
+  mark_root(sc, sc->loadport);
 
-static pointer port_from_scratch(scheme * sc) {
-  port *pt;
-  pt = port_rep_from_scratch(sc);
-  if (pt == 0) {
-    return sc->NIL;
+  /* Mark recent objects the interpreter doesn't know about yet. */
+  for (i = 0; i < sc->recent_top; i++) {
+    mark_root(sc, sc->recent[i]);
   }
-  return mk_port(sc, pt);
-}
-
-static void port_close(scheme * sc, pointer p, int flag) {
-  port *pt = p->_object._port;
-  pt->kind &= ~flag;
-  if ((pt->kind & (port_input | port_output)) == 0) {
-    if (pt->kind & port_file) {
+  /* Mark any older stuff above nested C calls */
+  mark_root(sc, sc->c_nest);
 
-#if SHOW_ERROR_LINE
-      /* Cleanup is here so (close-*-port) functions could work too */
-      pt->rep.stdio.curr_line = 0;
+  /* mark variables a, b */
+  mark_root(sc, a);
+  mark_root(sc, b);
+}
 
-      if (pt->rep.stdio.filename)
-        sc->free(pt->rep.stdio.filename);
-#endif
+#if USE_PARALLEL_MARK
+/* Trace again, on this thread alone, from every cell marked: a cell
+   claimed while its marker was out of memory was never traced. */
+static void mark_rescan(scheme * sc) {
+  pointer p;
+  long j;
+  long k;
+  int i;
 
-      fclose(pt->rep.stdio.file);
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    for (j = 0; j < cell_segsize; j++) {
+      p = sc->cell_seg[i] + j;
+      if (!cell_marked(p)) {
+        continue;
+      }
+      if (is_vector(p)) {
+        for (k = 0; k < vector_length(p); k++) {
+          mark(vector_slot(p, k));
+        }
+      } else if (is_frame(p)) {
+        for (k = 0; k <= frame_size(p); k++) {
+          mark(frame_slot(p, k));
+        }
+      } else if (is_port(p) && (p->_object._port->kind & port_string)
+          && p->_object._port->rep.string.owner != 0) {
+        mark(p->_object._port->rep.string.owner);
+      }
+      if (!is_atom(p)) {
+        mark(car(p));
+        mark(cdr(p));
+      }
     }
-    pt->kind = port_free;
   }
 }
 
-static int utf8_inchar(port *pt) {
-  int c = basic_inchar(pt);
-  int bytes, i;
-  char buf[4];
-  if (c == EOF || c < 0x80) {
-    return c;
+/* Mark from the roots with gc_threads markers, this thread being the
+   first.  A small heap is marked the usual way. */
+static void par_mark_roots(scheme * sc, pointer a, pointer b) {
+  struct mark_team team;
+  struct mark_ring *r;
+  pthread_t *tid;
+  int n = gc_threads;
+  int m;
+  int i;
+
+  if (n <= 1 || heap_cells(sc) - sc->fcells < PAR_MARK_MIN) {
+    mark_roots(sc, a, b);
+    return;
   }
-  buf[0] = (char) c;
-  bytes = (c < 0xE0) ? 2 : ((c < 0xF0) ? 3 : 4);
-  for (i = 1; i < bytes; i++) {
-    c = basic_inchar(pt);
-    if (c == EOF) {
-      return EOF;
+  team.deque = malloc(n * sizeof(struct mark_deque));
+  tid = malloc(n * sizeof(pthread_t));
+  for (m = 0; team.deque != 0 && m < n; m++) {
+    team.deque[m].ring = mark_ring_new(MARK_RING_SIZE);
+    if (team.deque[m].ring == 0) {
+      break;
     }
-    buf[i] = (char) c;
   }
-  return utf8_decode(buf);
-}
+  if (tid == 0 || m < n) {
+    while (--m >= 0) {
+      free(team.deque[m].ring);
+    }
+    free(team.deque);
+    free(tid);
+    mark_roots(sc, a, b);
+    return;
+  }
+  team.n = n;
+  team.idle = 0;
+  team.overflow = 0;
+  for (i = 0; i < n; i++) {
+    team.deque[i].top = 0;
+    team.deque[i].bottom = 0;
+    team.deque[i].team = &team;
+    team.deque[i].seed = i + 1;
+  }
+
+  sc->root_deque = team.deque;
+  mark_roots(sc, a, b);
+  sc->root_deque = 0;
+  for (m = 1; m < n; m++) {
+    if (pthread_create(tid + m, 0, mark_worker, team.deque + m) != 0) {
+      /* make do with fewer: the others count as idle from the start */
+      __atomic_add_fetch(&team.idle, n - m, __ATOMIC_SEQ_CST);
+      break;
+    }
+  }
+  mark_worker(team.deque);
+  for (i = 1; i < m; i++) {
+    pthread_join(tid[i], 0);
+  }
 
-/* get new character from input file */
-static int inchar(scheme * sc) {
-  int c;
-  port *pt;
-  if (sc->backchar >= 0) {
-    c = sc->backchar;
-    sc->backchar = -1;
-    return c;
+  for (i = 0; i < n; i++) {
+    while ((r = team.deque[i].ring) != 0) {
+      team.deque[i].ring = r->prev;
+      free(r);
+    }
   }
-  pt = sc->inport->_object._port;
-  if (pt->kind & port_saw_EOF) {
-    return EOF;
+  free(team.deque);
+  free(tid);
+  if (team.overflow) {
+    mark_rescan(sc);
   }
-  c = utf8_inchar(pt);
-  if (c == EOF && sc->inport == sc->loadport) {
-    /* Instead, set port_saw_EOF */
-    pt->kind |= port_saw_EOF;
-    return EOF;
+}
+#endif
+
+#if defined(__GNUC__)
+#define count_bits(w)    __builtin_popcountl(w)
+#else
+static int count_bits(unsigned long w) {
+  int n = 0;
+
+  for (; w != 0; w &= w - 1) {
+    n++;
   }
-  return c;
+  return n;
 }
+#endif
 
-static int inchar8(scheme * sc) {
-  int c;
-  port *pt;
-  if (sc->backchar >= 0) {
-    c = sc->backchar;
-    sc->backchar = -1;
-    return c;
+/* Number of cells of segment i marked, counted from the bitmap alone. */
+static long count_marked(scheme * sc, int i) {
+  unsigned long *bits = mark_words(sc->cell_seg[i]);
+  long n = 0;
+  long w;
+
+  for (w = seg_head / MARK_WORD_BITS;
+       w <= (long) ((seg_head + cell_segsize - 1) / MARK_WORD_BITS); w++) {
+    n += count_bits(bits[w]);
   }
-  pt = sc->inport->_object._port;
-  if (pt->kind & port_saw_EOF) {
-    return EOF;
+  return n;
+}
+
+/* The size of heap wanted for this many live cells: they should fill
+   at most half of it, or three quarters once it is past the soft limit
+   of cell_nsegment segments. */
+static long heap_target(long live) {
+  long soft = (long) cell_nsegment * cell_segsize;
+  long want = 2 * live;
+
+  if (want > soft) {
+    want = live + live / 3 > soft ? live + live / 3 : soft;
   }
-  c = basic_inchar(pt);
-  if (c == EOF && sc->inport == sc->loadport) {
-    /* Instead, set port_saw_EOF */
-    pt->kind |= port_saw_EOF;
-    return EOF;
+  if (want < (long) FIRST_CELLSEGS * cell_segsize) {
+    want = (long) FIRST_CELLSEGS * cell_segsize;
   }
-  return c;
+  return want;
 }
 
-static int basic_inchar(port * pt) {
-  if (pt->kind & port_file) {
-    return fgetc(pt->rep.stdio.file);
-  } else {
-    if (*pt->rep.string.curr == 0 ||
-        pt->rep.string.curr == pt->rep.string.past_the_end) {
-      return EOF;
-    } else {
-      return *pt->rep.string.curr++;
+/* Give segments with no cell marked back to the system, last first,
+   until the heap is down to want cells. */
+static void release_segs(scheme * sc, long want) {
+  int i;
+
+  for (i = sc->last_cell_seg; i >= 0 && heap_cells(sc) > want; i--) {
+    if (count_marked(sc, i) == 0) {
+      free_cellseg(sc, i);
     }
   }
+#ifdef __GLIBC__
+  /* glibc only unmaps blocks above a threshold that grows as big
+     ones are freed: have it return the free pages below that too */
+  if (sc->free == free) {
+    malloc_trim(0);
+  }
+#endif
 }
 
-/* back character to input buffer */
-static void backchar(scheme * sc, int c) {
-  if (c == EOF)
-    return;
-  sc->backchar = c;
+/*
+ * After marking, size the heap for the live cells.  It grows by as
+ * many segments as that takes at once.  When the live cells fill less
+ * than a quarter of it, empty segments are given back.
+ */
+static void resize_heap(scheme * sc, long live) {
+  long want = heap_target(live);
+
+  while (heap_cells(sc) < want && add_cellseg(sc) != 0) {
+  }
+  if (heap_cells(sc) > 2 * want) {
+    release_segs(sc, want);
+  }
 }
 
-static int realloc_port_string(scheme * sc, port * p) {
-  char *start = p->rep.string.start;
-  size_t new_size = p->rep.string.past_the_end - start + 1 + BLOCK_SIZE;
-  char *str = sc->malloc(new_size);
-  if (str) {
-    memset(str, ' ', new_size - 1);
-    str[new_size - 1] = '\0';
-    strcpy(str, start);
-    p->rep.string.start = str;
-    p->rep.string.past_the_end = str + new_size - 1;
-    p->rep.string.curr -= start - str;
-    sc->free(start);
-    return 1;
-  } else {
+/* Put the unmarked cells of segment i on the free list, in address
+   order, and return how many there were.  The bitmap is read a word at
+   a time: the cells of a word that is all ones are live and are not
+   even looked at. */
+static long sweep_seg(scheme * sc, int i) {
+  pointer first = sc->cell_seg[i];
+  unsigned long *bits = mark_words(first);
+  unsigned long live;
+  pointer p;
+  long n = 0;
+  long w;
+  long j;
+  int k;
+
+  /* w is signed: the first word of the bitmap may be word 0 */
+  for (w = (seg_head + cell_segsize - 1) / MARK_WORD_BITS;
+       w >= (long) (seg_head / MARK_WORD_BITS); w--) {
+    live = bits[w];
+    if (live == ~0UL) {
+      continue;
+    }
+    for (k = MARK_WORD_BITS - 1; k >= 0; k--) {
+      j = w * MARK_WORD_BITS + k - seg_head;
+      if ((live >> k) & 1 || j < 0 || j >= cell_segsize) {
+        continue;
+      }
+      p = first + j;
+      /* reclaim cell */
+      if (typeflag(p) != 0) {
+        finalize_cell(sc, p);
+        typeflag(p) = 0;
+        car(p) = sc->NIL;
+      }
+      ++n;
+      cdr(p) = sc->free_cell;
+      sc->free_cell = p;
+    }
+  }
+  return n;
+}
+
+/* Sweep the next segment left unswept by a lazy collection.  Its free
+   cells were counted in fcells already.  Returns 0 if there is none. */
+static int sweep_next(scheme * sc) {
+  if (sc->sweep_seg == 0) {
     return 0;
   }
+  sweep_seg(sc, --sc->sweep_seg);
+  return 1;
 }
 
-static void char_to_utf8(int c, char *p, int *plen) {
-  unsigned char *s = (unsigned char *) p;
-  int bytes;
-  if (c < 0 || c > 0x10FFFF) {
-    c = '?';
+/* Sweep segments until there is a free cell or nothing left to sweep. */
+static void lazy_sweep(scheme * sc) {
+  while (sc->free_cell == sc->NIL && sweep_next(sc)) {
   }
-  if (c < 0x80) {
-    *s++ = (unsigned char) c;
-    *s = 0;
-  } else {
-    bytes = (c < 0x800) ? 2 : ((c < 0x10000) ? 3 : 4);
-    s[bytes] = 0;
-    s[0] = 0x80;
-    while (--bytes) {
-      s[0] |= (0x80 >> bytes);
-      s[bytes] = (unsigned char) (0x80 | (c & 0x3F));
-      c >>= 6;
-    }
-    s[0] |= (unsigned char) c;
+}
+
+/* Mark all live cells afresh and return how many there are. */
+static long mark_heap(scheme * sc, pointer a, pointer b) {
+  long live = 0;
+  int i;
+
+  /* start over: old cells have to prove themselves live again */
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    memset(mark_words(sc->cell_seg[i]), 0, mark_bytes);
   }
-  *plen = strlen(p);
+#if USE_PARALLEL_MARK
+  par_mark_roots(sc, a, b);
+#else
+  mark_roots(sc, a, b);
+#endif
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    live += count_marked(sc, i);
+  }
+  return live;
 }
 
-INTERFACE void putstr(scheme * sc, const char *s) {
-  port *pt = sc->outport->_object._port;
-  if (pt->kind & port_file) {
-    fputs(s, pt->rep.stdio.file);
+/* Free the cells left unmarked by a full mark, or leave them to
+   lazy_sweep, and start over counting for the next collection. */
+static void sweep_heap(scheme * sc, long live) {
+  int i;
+
+  sc->free_cell = sc->NIL;
+  if (sc->gc_lazy) {
+    sc->sweep_seg = sc->last_cell_seg + 1;
+    sc->fcells = heap_cells(sc) - live;
   } else {
-    for (; *s; s++) {
-      if (pt->rep.string.curr != pt->rep.string.past_the_end) {
-        *pt->rep.string.curr++ = *s;
-      } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
-        *pt->rep.string.curr++ = *s;
-      }
+    /* free-list is kept sorted by address so that cells allocated
+       together lie close together. Here we scan the
+       segments (which are also kept sorted by address) downwards to
+       build the free-list in sorted order.
+     */
+    sc->sweep_seg = 0;
+    sc->fcells = 0;
+    for (i = sc->last_cell_seg; i >= 0; i--) {
+      sc->fcells += sweep_seg(sc, i);
     }
   }
+  sc->young_top = 0;
+  sc->old_live = live;
+  sc->vec_words = 0;
+  sc->old_vec_words = 0;
 }
 
-static void putchars(scheme * sc, const char *s, int len) {
-  port *pt = sc->outport->_object._port;
-  if (pt->kind & port_file) {
-    fwrite(s, 1, len, pt->rep.stdio.file);
-  } else {
-    for (; len; len--) {
-      if (pt->rep.string.curr != pt->rep.string.past_the_end) {
-        *pt->rep.string.curr++ = *s++;
-      } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
-        *pt->rep.string.curr++ = *s++;
+/*
+ * Collect the whole heap.  In lazy mode only the marking is done here:
+ * the segments are swept one at a time as the free list runs out, so
+ * a pause is the mark plus at most one segment.  Cells allocated in the
+ * meantime all come from segments already swept, so a minor collection
+ * may run before the sweep is over.
+ */
+static void gc(scheme * sc, pointer a, pointer b) {
+  long live;
+
+  if (sc->gc_verbose) {
+    putstr(sc, "gc...");
+  }
+
+  live = mark_heap(sc, a, b);
+  resize_heap(sc, live);
+  /* the survivors are spread over more segments than the heap should
+     have: slide them together at the next chance */
+  if (sc->gc_compact && heap_cells(sc) > 2 * heap_target(live)) {
+    sc->compact_due = 1;
+  }
+  sweep_heap(sc, live);
+
+  if (sc->gc_verbose) {
+    char msg[80];
+    sprintf(msg, "done: %ld cells were recovered.\n", sc->fcells);
+    putstr(sc, msg);
+  }
+}
+
+/* Collect only the cells allocated since the last collection. */
+static void gc_minor(scheme * sc, pointer a, pointer b) {
+  pointer p;
+  long i;
+
+  if (sc->gc_verbose) {
+    putstr(sc, "minor gc...");
+  }
+
+  mark_roots(sc, a, b);
+
+  /* cells were mostly handed out in address order: free them in
+     reverse so that the free list stays in address order too */
+  for (i = sc->young_top - 1; i >= 0; i--) {
+    p = sc->young[i];
+    if (cell_marked(p)) {
+      if (is_vector(p)) {
+        sc->old_vec_words += vector_length(p);
       }
+      continue;
+    }
+    if (typeflag(p) != 0) {
+      finalize_cell(sc, p);
     }
+    typeflag(p) = 0;
+    car(p) = sc->NIL;
+    ++sc->fcells;
+    cdr(p) = sc->free_cell;
+    sc->free_cell = p;
+  }
+  sc->young_top = 0;
+  sc->vec_words = 0;
+
+  if (sc->gc_verbose) {
+    char msg[80];
+    sprintf(msg, "done: %ld cells are free.\n", sc->fcells);
+    putstr(sc, msg);
   }
 }
 
-INTERFACE void putcharacter(scheme * sc, int c) {
-  port *pt = sc->outport->_object._port;
-  if (pt->kind & port_file) {
-    fputc(c, pt->rep.stdio.file);
-  } else {
-    if (pt->rep.string.curr != pt->rep.string.past_the_end) {
-      *pt->rep.string.curr++ = c;
-    } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
-      *pt->rep.string.curr++ = c;
+/* Old cells that died are only reclaimed by a full collection: have
+   one once more cells were promoted since the last one than a minor
+   collection leaves free, or vectors as big as the heap. */
+static void collect(scheme * sc, pointer a, pointer b) {
+  gc_minor(sc, a, b);
+  if (heap_cells(sc) - sc->fcells - sc->old_live > sc->fcells
+      || sc->old_vec_words > heap_cells(sc)) {
+    gc(sc, a, b);
+  }
+}
+
+/*
+ * Sliding compaction.  After a full mark the live cells slide down, in
+ * address order, to the start of the heap taken as one run of
+ * segments, so that the free cells are all together at its end and
+ * whole segments there can be given back.  The place a cell goes to is
+ * the number of live cells below it, which is worked out from the mark
+ * bitmaps: slide_base holds that count for the start of every bitmap
+ * word, which leaves a popcount to do for each pointer.  All pointers
+ * are set to their new value before any cell moves.
+ *
+ * Cells move, so no C code may hold a pointer to one that the
+ * collector does not know about.  This only holds between two
+ * operations of Eval_Cycle, and only when it was not called from a
+ * foreign function: see compact_due.
+ */
+static long *slide_base;
+static long slide_words;        /* bitmap words per segment */
+
+/* Set slide_base up for the heap as it is.  0 if out of memory. */
+static int alloc_ranks(scheme * sc) {
+  slide_words = (seg_head + cell_segsize + MARK_WORD_BITS - 1)
+      / MARK_WORD_BITS;
+  slide_base = sc->malloc((sc->last_cell_seg + 1) * slide_words
+      * sizeof(long));
+  return slide_base != 0;
+}
+
+/* Fill slide_base in from the marks, and return the cells marked. */
+static long count_ranks(scheme * sc) {
+  unsigned long *bits;
+  long n = 0;
+  long w;
+  int i;
+
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    bits = mark_words(sc->cell_seg[i]);
+    for (w = 0; w < slide_words; w++) {
+      slide_base[i * slide_words + w] = n;
+      n += count_bits(bits[w]);
     }
   }
+  return n;
 }
 
-static int check_strbuff_size(scheme * sc, char **p) {
-  char *t;
-  int len = *p - sc->strbuff;
-  if (len + 4 < sc->strbuff_size) {
-    return 1;
+/* The number of marked cells below heap cell p. */
+static long cell_rank(scheme * sc, pointer p) {
+  unsigned long *bits;
+  long k;
+  int lo = 0;
+  int hi = sc->last_cell_seg;
+  int mid;
+
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (sc->cell_seg[mid] <= p) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
   }
-  sc->strbuff_size *= 2;
-  if (sc->strbuff_size >= STRBUFF_MAX_SIZE) {
-    sc->strbuff_size /= 2;
-    return 0;
+  bits = mark_words(p);
+  k = mark_index(p);
+  return slide_base[lo * slide_words + k / MARK_WORD_BITS]
+      + count_bits(bits[k / MARK_WORD_BITS]
+      & ((1UL << (k % MARK_WORD_BITS)) - 1));
+}
+
+static pointer slide_to(scheme * sc, pointer p) {
+  long n;
+
+  if (p == 0 || is_immediate(p) || (typeflag(p) & T_STATIC)) {
+    return p;
   }
-  t = sc->malloc(sc->strbuff_size);
-  memcpy(t, sc->strbuff, len);
-  *p = t + len;
-  sc->free(sc->strbuff);
-  sc->strbuff = t;
-  return 1;
+  n = cell_rank(sc, p);
+  return sc->cell_seg[n / cell_segsize] + n % cell_segsize;
 }
 
-/* read characters up to delimiter, but cater to character constants */
-static char *readstr_upto(scheme * sc, char *delim) {
-  char *p = sc->strbuff;
-  int c, len;
+#define slide(sc, x)     ((x) = slide_to(sc, x))
 
-  while (1) {
-    c = inchar(sc);
-    if (check_strbuff_size(sc, &p)) {
-      char_to_utf8(c, p, &len);
-      p += len;
+/* Point the fields of live cell p to where their cells will be. */
+static void slide_cell(scheme * sc, pointer p) {
+  long i;
+
+  if (is_vector(p)) {
+    for (i = 0; i < vector_length(p); i++) {
+      slide(sc, vector_slot(p, i));
     }
-    if(is_one_of(delim, c)) {
-      break;
+  } else if (is_frame(p)) {
+    for (i = 0; i <= frame_size(p); i++) {
+      slide(sc, frame_slot(p, i));
     }
-  }
+  } else if (is_port(p) && (p->_object._port->kind & port_string)
+      && p->_object._port->rep.string.owner != 0) {
+    port *pt = p->_object._port;
+    pointer o = pt->rep.string.owner;
 
-  if (p == sc->strbuff + 2 && p[-2] == '\\') {
-    *p = 0;
-  } else {
-    backchar(sc, p[-1]);
-    *--p = '\0';
+    slide(sc, pt->rep.string.owner);
+    /* the chars of a short string move with it */
+    if (is_short(o)) {
+      ptrdiff_t d = (char *) pt->rep.string.owner - (char *) o;
+
+      pt->rep.string.start += d;
+      pt->rep.string.curr += d;
+      pt->rep.string.past_the_end += d;
+    }
+  }
+  if (!is_atom(p)) {
+    slide(sc, car(p));
+    slide(sc, cdr(p));
   }
-  return sc->strbuff;
 }
 
-/* read string expression "xxx...xxx" */
-static pointer readstrexp(scheme * sc) {
-  char *p = sc->strbuff;
-  int c, len;
-  int c1 = 0;
-  enum { st_ok, st_bsl, st_x1, st_x2, st_oct1, st_oct2 } state = st_ok;
+/* The same for everything mark_roots starts from, and the pointers to
+   symbols kept in sc. */
+static void slide_roots(scheme * sc) {
+  int i;
 
-  for (;;) {
-    c = inchar(sc);
-    if (c == EOF || !check_strbuff_size(sc, &p)) {
-      return sc->F;
+  slide(sc, sc->oblist);
+  slide(sc, sc->global_env);
+  slide(sc, sc->args);
+  slide(sc, sc->envir);
+  slide(sc, sc->code);
+  dump_stack_slide(sc);
+  slide(sc, sc->value);
+  for (i = 0; i < sc->vm_sp; i++) {
+    slide(sc, sc->vm_stack[i]);
+  }
+  for (i = 0; i < ARG_CELLS; i++) {
+    slide(sc, car(sc->arg_cells + i));
+  }
+  slide(sc, sc->inport);
+  slide(sc, sc->save_inport);
+  slide(sc, sc->outport);
+  slide(sc, sc->loadport);
+  for (i = 0; i < sc->recent_top; i++) {
+    slide(sc, sc->recent[i]);
+  }
+  slide(sc, sc->c_nest);
+
+  slide(sc, sc->LAMBDA);
+  slide(sc, sc->QUOTE);
+  slide(sc, sc->QQUOTE);
+  slide(sc, sc->UNQUOTE);
+  slide(sc, sc->UNQUOTESP);
+  slide(sc, sc->FEED_TO);
+  slide(sc, sc->COLON_HOOK);
+  slide(sc, sc->ERROR_HOOK);
+  slide(sc, sc->SHARP_HOOK);
+  slide(sc, sc->COMPILE_HOOK);
+}
+
+/* A full collection that also compacts the heap. */
+static void compact(scheme * sc) {
+  pointer first;
+  pointer p;
+  pointer to;
+  long live;
+  long n;
+  long j;
+  int segs;
+  int i;
+
+  sc->compact_due = 0;
+  if (!alloc_ranks(sc)) {
+    gc(sc, sc->NIL, sc->NIL);
+    return;
+  }
+  if (sc->gc_verbose) {
+    putstr(sc, "gc compact...");
+  }
+
+  live = mark_heap(sc, sc->NIL, sc->NIL);
+  count_ranks(sc);
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    first = sc->cell_seg[i];
+    /* the dead are overwritten below: finalize them now */
+    for (p = first; p < first + cell_segsize; p++) {
+      if (typeflag(p) != 0 && !cell_marked(p)) {
+        finalize_cell(sc, p);
+        typeflag(p) = 0;
+      }
     }
-    switch (state) {
-    case st_ok:
-      switch (c) {
-      case '\\':
-        state = st_bsl;
-        break;
-      case '"':
-        *p = 0;
-        return mk_counted_string(sc, sc->strbuff, p - sc->strbuff);
-      default:
-        char_to_utf8(c, p, &len);
-        p += len;
-        break;
+  }
+
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    first = sc->cell_seg[i];
+    for (p = first; p < first + cell_segsize; p++) {
+      if (cell_marked(p)) {
+        slide_cell(sc, p);
       }
-      break;
-    case st_bsl:
-      switch (c) {
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-        state = st_oct1;
-        c1 = c - '0';
-        break;
-      case 'x':
-      case 'X':
-        state = st_x1;
-        c1 = 0;
-        break;
-      case 'n':
-        *p++ = '\n';
-        state = st_ok;
-        break;
-      case 't':
-        *p++ = '\t';
-        state = st_ok;
-        break;
-      case 'r':
-        *p++ = '\r';
-        state = st_ok;
-        break;
-      case '"':
-        *p++ = '"';
-        state = st_ok;
-        break;
-      default:
-        *p++ = c;
-        state = st_ok;
-        break;
+    }
+  }
+  slide_roots(sc);
+
+  /* n counts the cells moved so far; none moves up, so none lands on
+     a live cell that has not moved yet */
+  n = 0;
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    first = sc->cell_seg[i];
+    for (p = first; p < first + cell_segsize; p++) {
+      if (cell_marked(p)) {
+        to = sc->cell_seg[n / cell_segsize] + n % cell_segsize;
+        *to = *p;
+        typeflag(to) = typeflag(p);
+        n++;
       }
-      break;
-    case st_x1:
-    case st_x2:
-      c = toupper(c);
-      if (c >= '0' && c <= 'F') {
-        if (c <= '9') {
-          c1 = (c1 << 4) + c - '0';
-        } else {
-          c1 = (c1 << 4) + c - 'A' + 10;
-        }
-        if (state == st_x1) {
-          state = st_x2;
-        } else {
-          *p++ = c1;
-          state = st_ok;
-        }
+    }
+  }
+  sc->free(slide_base);
+  slide_base = 0;
+
+  /* mark the cells where they are now; the rest is free */
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    first = sc->cell_seg[i];
+    memset(mark_words(first), 0, mark_bytes);
+    for (j = 0; j < cell_segsize; j++, n--) {
+      if (n > 0) {
+        setmark(first + j);
       } else {
-        return sc->F;
+        typeflag(first + j) = 0;
+        car(first + j) = sc->NIL;
       }
-      break;
-    case st_oct1:
-    case st_oct2:
-      if (c < '0' || c > '7') {
-        *p++ = c1;
-        backchar(sc, c);
-        state = st_ok;
-      } else {
-        if (state == st_oct2 && c1 >= 32)
-          return sc->F;
+    }
+  }
 
-        c1 = (c1 << 3) + (c - '0');
+  segs = sc->last_cell_seg;
+  release_segs(sc, heap_target(live));
+  segs -= sc->last_cell_seg;
+  sweep_heap(sc, live);
 
-        if (state == st_oct1)
-          state = st_oct2;
-        else {
-          *p++ = c1;
-          state = st_ok;
-        }
-      }
-      break;
+  if (sc->gc_verbose) {
+    char msg[80];
+    sprintf(msg, "done: %ld cells live, %d segments freed.\n", live, segs);
+    putstr(sc, msg);
+  }
+}
 
+static void finalize_cell(scheme * sc, pointer a) {
+  if (is_frame(a)) {
+    free_slots(sc, (pointer *) bufvalue(a), frame_size(a) + 1);
+  } else if (is_vector(a)) {
+    free_slots(sc, (pointer *) bufvalue(a), vector_length(a));
+  } else if ((is_string(a) && !is_short(a)) || is_bytecode(a)) {
+    sc->free(bufvalue(a));
+  } else if (is_port(a)) {
+    if (a->_object._port->kind & port_file
+        && a->_object._port->rep.stdio.closeit) {
+      port_close(sc, a, port_input | port_output);
     }
+    sc->free(a->_object._port);
   }
 }
 
-/* check c is in chars */
-static INLINE int is_one_of(char *s, int c) {
-  if (c == EOF)
-    return 1;
-  while (*s)
-    if (*s++ == c)
-      return (1);
-  return (0);
+#if USE_FASL
+/* ========== FASL caches ========== */
+
+/*
+ * The forms read from a loaded file are kept in a FASL cache beside
+ * it, init.fasl for init.scm, and read back from there the next time
+ * the file is loaded, as long as the size, time and contents of the
+ * file are those the cache was made from.  The forms are kept as read:
+ * macros are expanded as they are evaluated, since a file may define
+ * the macros it uses.
+ *
+ * A form goes in as the line the reader got to, then the form itself,
+ * cell by cell: symbols by name, so that they are interned again, and
+ * immediates as they are.  A file read with the help of *sharp-hook*,
+ * or with an error along the way, gets no cache.  The cache is written
+ * once the file is read to its end; on quit, the rest of the files
+ * being loaded is read for it, and no more of them evaluated.
+ */
+#define FASL_IMMEDIATE 0
+#define FASL_STATIC    1
+#define FASL_PAIR      2
+#define FASL_SYMBOL    3
+#define FASL_STRING    4
+#define FASL_VECTOR    5
+#define FASL_CELL      6
+
+struct fasl_head {
+  char stamp[48];
+  long size;                    /* of the source */
+  long mtime;
+  unsigned int hash;
+  unsigned int check;           /* hash of the forms */
+};
+
+static unsigned int fasl_hash(const char *p, size_t n) {
+  unsigned int hashed = 2166136261u;
+
+  while (n-- > 0) {
+    hashed ^= (unsigned char) *p++;
+    hashed *= 16777619u;
+  }
+  return hashed;
 }
 
-/* skip white characters */
-static INLINE int skipspace(scheme * sc) {
-  int c = 0, curr_line = 0;
+static void fasl_drop(scheme * sc, fasl * f) {
+  sc->free(f->name);
+  sc->free(f->buf);
+  memset(f, 0, sizeof(*f));
+}
 
-  do {
-    c = inchar(sc);
-#if SHOW_ERROR_LINE
-    if (c == '\n')
-      curr_line++;
-#endif
-  } while (isspace(c));
+/* Give up on the cache of f: something in it cannot be kept. */
+static void fasl_spoil(scheme * sc, fasl * f) {
+  if (f->name != 0) {
+    fasl_drop(sc, f);
+  }
+}
 
-/* record it */
-#if SHOW_ERROR_LINE
-  if (sc->load_stack[sc->file_i].kind & port_file)
-    sc->load_stack[sc->file_i].rep.stdio.curr_line += curr_line;
-#endif
+/* An error: what was read may fall short of the files being loaded. */
+static void fasl_spoil_all(scheme * sc) {
+  int i;
 
-  if (c != EOF) {
-    backchar(sc, c);
-    return 1;
-  } else {
-    return EOF;
+  for (i = 0; i <= sc->file_i; i++) {
+    fasl_spoil(sc, sc->fasl_stack + i);
   }
 }
 
-/* get token */
-static int token(scheme * sc) {
-  int c;
-  c = skipspace(sc);
-  if (c == EOF) {
-    return (TOK_EOF);
+static void fasl_put(scheme * sc, fasl * f, const void *p, size_t n) {
+  size_t room;
+  char *b;
+
+  if (f->name == 0) {
+    return;
   }
-  switch (c = inchar(sc)) {
-  case EOF:
-    return (TOK_EOF);
-  case '(':
-    return (TOK_LPAREN);
-  case ')':
-    return (TOK_RPAREN);
-  case '.':
-    c = inchar(sc);
-    if (is_one_of(" \n\t", c)) {
-      return (TOK_DOT);
-    } else {
-      backchar(sc, c);
-      backchar(sc, '.');
-      return TOK_ATOM;
+  if (f->len + n > f->room) {
+    for (room = f->room ? 2 * f->room : 4096; room < f->len + n; room *= 2) {
     }
-  case '\'':
-    return (TOK_QUOTE);
-  case ';':
-    while ((c = inchar(sc)) != '\n' && c != EOF) {
+    b = sc->malloc(room);
+    if (b == 0) {
+      fasl_spoil(sc, f);
+      return;
     }
+    if (f->len != 0) {
+      memcpy(b, f->buf, f->len);
+    }
+    sc->free(f->buf);
+    f->buf = b;
+    f->room = room;
+  }
+  memcpy(f->buf + f->len, p, n);
+  f->len += n;
+}
 
-#if SHOW_ERROR_LINE
-    if (c == '\n' && sc->load_stack[sc->file_i].kind & port_file)
-      sc->load_stack[sc->file_i].rep.stdio.curr_line++;
-#endif
+static void fasl_put_kind(scheme * sc, fasl * f, char kind, pointer p) {
+  unsigned short flag = typeflag(p);
 
-    if (c == EOF) {
-      return (TOK_EOF);
-    } else {
-      return (token(sc));
-    }
-  case '"':
-    return (TOK_DQUOTE);
-  case BACKQUOTE:
-    return (TOK_BQUOTE);
-  case ',':
-    if ((c = inchar(sc)) == '@') {
-      return (TOK_ATMARK);
+  fasl_put(sc, f, &kind, 1);
+  fasl_put(sc, f, &flag, sizeof(flag));
+}
+
+static void fasl_put_form(scheme * sc, fasl * f, pointer p) {
+  uintptr_t u;
+  char c;
+  int len;
+  int i;
+
+  /* down the cdrs in a loop, so that long lists take no stack */
+  for (; f->name != 0; p = cdr(p)) {
+    if (p == 0 || is_immediate(p)) {
+      c = FASL_IMMEDIATE;
+      u = (uintptr_t) p;
+      fasl_put(sc, f, &c, 1);
+      fasl_put(sc, f, &u, sizeof(u));
+    } else if (typeflag(p) & T_STATIC) {
+      c = FASL_STATIC;
+      fasl_put(sc, f, &c, 1);
+      c = (char) (p - sc->sink);
+      fasl_put(sc, f, &c, 1);
+    } else if (is_symbol(p)) {
+      c = FASL_SYMBOL;
+      len = strsize(car(p));
+      fasl_put(sc, f, &c, 1);
+      fasl_put(sc, f, &len, sizeof(len));
+      fasl_put(sc, f, symname(p), len + 1);
+    } else if (is_string(p)) {
+      fasl_put_kind(sc, f, FASL_STRING, p);
+      len = strsize(p);
+      fasl_put(sc, f, &len, sizeof(len));
+      fasl_put(sc, f, strvalue(p), len);
+    } else if (is_vector(p)) {
+      fasl_put_kind(sc, f, FASL_VECTOR, p);
+      len = vector_length(p);
+      fasl_put(sc, f, &len, sizeof(len));
+      for (i = 0; i < len; i++) {
+        fasl_put_form(sc, f, vector_elem(p, i));
+      }
+    } else if (is_number(p) || is_character(p)) {
+      fasl_put_kind(sc, f, FASL_CELL, p);
+      fasl_put(sc, f, p, sizeof(struct cell));
+    } else if (is_pair(p)) {
+      fasl_put_kind(sc, f, FASL_PAIR, p);
+      fasl_put_form(sc, f, car(p));
+      continue;
     } else {
-      backchar(sc, c);
-      return (TOK_COMMA);
+      fasl_spoil(sc, f);
     }
-  case '#':
-    c = inchar(sc);
-    if (c == '(') {
-      return (TOK_VEC);
-    } else if (c == '!') {
-      while ((c = inchar(sc)) != '\n' && c != EOF) {
-      }
+    return;
+  }
+}
 
-#if SHOW_ERROR_LINE
-      if (c == '\n' && sc->load_stack[sc->file_i].kind & port_file)
-        sc->load_stack[sc->file_i].rep.stdio.curr_line++;
-#endif
+/* The cells made here are all on the recent stack until the next op,
+   so nothing is lost to a collection along the way. */
+static pointer fasl_get_form(scheme * sc, fasl * f) {
+  pointer list = sc->NIL;
+  pointer x;
+  unsigned short flag = 0;
+  uintptr_t u;
+  char kind;
+  int len;
+  int i;
 
-      if (c == EOF) {
-        return (TOK_EOF);
-      } else {
-        return (token(sc));
+  for (;;) {
+    kind = f->buf[f->at++];
+    if (kind != FASL_IMMEDIATE && kind != FASL_STATIC
+        && kind != FASL_SYMBOL) {
+      memcpy(&flag, f->buf + f->at, sizeof(flag));
+      f->at += sizeof(flag);
+    }
+    switch (kind) {
+    case FASL_PAIR:
+      x = fasl_get_form(sc, f);
+      list = cons(sc, x, list);
+      if (flag & T_IMMUTABLE) {
+        setimmutable(list);
       }
-    } else {
-      backchar(sc, c);
-      if (is_one_of(" tfodxb\\", c)) {
-        return TOK_SHARP_CONST;
-      } else {
-        return (TOK_SHARP);
+      continue;
+    case FASL_IMMEDIATE:
+      memcpy(&u, f->buf + f->at, sizeof(u));
+      f->at += sizeof(u);
+      x = (pointer) u;
+      break;
+    case FASL_STATIC:
+      x = sc->sink + f->buf[f->at++];
+      break;
+    case FASL_SYMBOL:
+      memcpy(&len, f->buf + f->at, sizeof(len));
+      x = mk_symbol(sc, f->buf + f->at + sizeof(len));
+      f->at += sizeof(len) + len + 1;
+      break;
+    case FASL_STRING:
+      memcpy(&len, f->buf + f->at, sizeof(len));
+      x = mk_counted_string(sc, f->buf + f->at + sizeof(len), len);
+      f->at += sizeof(len) + len;
+      break;
+    case FASL_VECTOR:
+      memcpy(&len, f->buf + f->at, sizeof(len));
+      f->at += sizeof(len);
+      x = mk_vector(sc, len);
+      for (i = 0; i < len; i++) {
+        set_vector_elem(x, i, fasl_get_form(sc, f));
       }
+      break;
+    default:                   /* FASL_CELL */
+      x = get_cell(sc, sc->NIL, sc->NIL);
+      memcpy(x, f->buf + f->at, sizeof(struct cell));
+      f->at += sizeof(struct cell);
+      typeflag(x) = flag;
+      break;
     }
-  default:
-    backchar(sc, c);
-    return (TOK_ATOM);
+    if (kind != FASL_IMMEDIATE && kind != FASL_STATIC
+        && kind != FASL_SYMBOL && (flag & T_IMMUTABLE)) {
+      setimmutable(x);
+    }
+    return reverse_in_place(sc, x, list);
   }
 }
 
-/* ========== Routines for Printing ========== */
-#define   ok_abbrev(x)   (is_pair(x) && cdr(x) == sc->NIL)
+/* The cache of fname: init.fasl for init.scm. */
+static char *fasl_name(scheme * sc, const char *fname) {
+  size_t n = strlen(fname);
+  char *name;
 
-void long_to_str(long v, char *s, int base) {
-  char *p;
-  char c;
-  if (v < 0) {
-    *s++ = '-';
-    v = -v;
+  if (n > 4 && str_eq(fname + n - 4, ".scm")) {
+    n -= 4;
   }
-  p = s;
-  if (v == 0) {
-    *s++ = '0';
+  name = sc->malloc(n + 6);
+  if (name != 0) {
+    memcpy(name, fname, n);
+    strcpy(name + n, ".fasl");
   }
-  while (v > 0) {
-    c = (char) (v % base);
-    v /= base;
-    if (c < 10) {
-      c += '0';
-    } else {
-      c += 'A' - 10;
-    }
-    *s++ = c;
+  return name;
+}
+
+/* Read the cache of f into its buffer if it is good for the source. */
+static int fasl_read(scheme * sc, fasl * f) {
+  struct fasl_head head;
+  FILE *c;
+  long size = 0;
+  int ok = 0;
+
+  c = fopen(f->name, "rb");
+  if (c == 0) {
+    return 0;
   }
-  *s-- = '\0';
-  while (s > p) {
-    c = *p;
-    *p++ = *s;
-    *s-- = c;
+  if (fseek(c, 0, SEEK_END) == 0 && (size = ftell(c)) >= (long) sizeof(head)
+      && fseek(c, 0, SEEK_SET) == 0 && (f->buf = sc->malloc(size)) != 0) {
+    ok = fread(f->buf, 1, size, c) == (size_t) size;
+  }
+  fclose(c);
+  if (ok) {
+    memcpy(&head, f->buf, sizeof(head));
+    ok = strncmp(head.stamp, build_stamp(), sizeof(head.stamp)) == 0
+        && head.size == f->size && head.mtime == f->mtime
+        && head.hash == f->hash
+        && head.check == fasl_hash(f->buf + sizeof(head),
+        size - sizeof(head));
+  }
+  if (!ok) {
+    sc->free(f->buf);
+    f->buf = 0;
+    return 0;
   }
+  f->len = f->room = size;
+  f->at = sizeof(head);
+  return 1;
 }
 
+static void fasl_write(scheme * sc, fasl * f) {
+  struct fasl_head head;
+  char *tmp;
+  FILE *c;
+  int ok;
 
-static void string_to_utf8(scheme * sc, char *s, int len) {
-  int i, c, d, charsize;
-  char *q = sc->strbuff;
-  if (IS_ASCII(*s)) {
-    charsize = 1;
-  } else {
-    charsize = 4;
-    s += 4;
+  tmp = sc->malloc(strlen(f->name) + 5);
+  if (tmp == 0) {
+    return;
   }
-  for (i = 0; i < len; i++) {
-    if (charsize == 1) {
-      c = *s++;
-    } else {
-      c = *((int*) s);
-      s += 4;
-    }
-    if (check_strbuff_size(sc, &q)) {
-      if (c != 0) {
-        char_to_utf8(c, q, &d);
-        q += d;
-      } else {
-        *q++ = (char) 0xC0;
-        *q++ = (char) 0x80;
-      }
-    }
+  memset(&head, 0, sizeof(head));
+  strcpy(head.stamp, build_stamp());
+  head.size = f->size;
+  head.mtime = f->mtime;
+  head.hash = f->hash;
+  head.check = fasl_hash(f->buf, f->len);
+  /* write it aside, so that no one reads half a cache */
+  sprintf(tmp, "%s.tmp", f->name);
+  c = fopen(tmp, "wb");
+  ok = c != 0 && fwrite(&head, sizeof(head), 1, c) == 1
+      && fwrite(f->buf, 1, f->len, c) == f->len;
+  if (c != 0) {
+    ok = fclose(c) == 0 && ok;
+  }
+#ifdef _WIN32
+  if (ok) {
+    remove(f->name);
+  }
+#endif
+  if (!ok || rename(tmp, f->name) != 0) {
+    remove(tmp);
   }
-  *q = 0;
+  sc->free(tmp);
 }
 
-static void printslashstring(scheme * sc, char *p, int len) {
-  int i, c, d, charsize;
-  char buf[5];
-  unsigned char *s = (unsigned char *) p;
-  putcharacter(sc, '"');
-  if (IS_ASCII(*p)) {
-    charsize = 1;
-  } else {
-    charsize = 4;
-    s += 4;
+/* Start loading fname, just opened as fin, at the current level: from
+   its cache if that is good, else from the file, keeping the forms. */
+static void fasl_start(scheme * sc, const char *fname, FILE * fin) {
+  fasl *f = sc->fasl_stack + sc->file_i;
+  struct stat st;
+  char *src;
+  int ok;
+
+  fasl_drop(sc, f);
+  if (fname == 0 || fin == stdin || fstat(fileno(fin), &st) != 0
+      || !S_ISREG(st.st_mode)) {
+    return;
   }
-  for (i = 0; i < len; i++) {
-    if (charsize == 1) {
-      c = *s++;
-    } else {
-      c = *((int*) s);
-      s += 4;
-    }
-    if (c == '"' || c < ' ' || c == '\\') {
-      putcharacter(sc, '\\');
-      switch (c) {
-      case '"':
-        putcharacter(sc, '"');
-        break;
-      case '\n':
-        putcharacter(sc, 'n');
-        break;
-      case '\t':
-        putcharacter(sc, 't');
-        break;
-      case '\r':
-        putcharacter(sc, 'r');
-        break;
-      case '\\':
-        putcharacter(sc, '\\');
-        break;
-      default:{
-          d = c / 16;
-          putcharacter(sc, 'x');
-          if (d < 10) {
-            putcharacter(sc, d + '0');
-          } else {
-            putcharacter(sc, d - 10 + 'A');
-          }
-          d = c % 16;
-          if (d < 10) {
-            putcharacter(sc, d + '0');
-          } else {
-            putcharacter(sc, d - 10 + 'A');
-          }
-        }
-      }
-    } else {
-      char_to_utf8(c, buf, &d);
-      for (c = 0; c < d; c++) {
-        putcharacter(sc, buf[c]);
-      }
-    }
+  src = sc->malloc(st.st_size + 1);
+  if (src == 0) {
+    return;
+  }
+  ok = fread(src, 1, st.st_size, fin) == (size_t) st.st_size;
+  f->hash = fasl_hash(src, st.st_size);
+  sc->free(src);
+  if (fseek(fin, 0, SEEK_SET) != 0 || !ok) {
+    return;
+  }
+  f->size = st.st_size;
+  f->mtime = st.st_mtime;
+  f->name = fasl_name(sc, fname);
+  if (f->name != 0 && fasl_read(sc, f)) {
+    sc->free(f->name);
+    f->name = 0;
+    f->replay = 1;
   }
-  putcharacter(sc, '"');
 }
 
+/* Keep a form just read at the top level. */
+static void fasl_record(scheme * sc, pointer form) {
+  fasl *f = sc->fasl_stack + sc->file_i;
+  int line = 0;
 
-/* print atoms */
-static void printatom(scheme * sc, pointer l, int f) {
-  char *p;
-  int len;
-  atom2str(sc, l, f, &p, &len);
-  putchars(sc, p, len);
+  if (f->name == 0 || form == sc->EOF_OBJ) {
+    return;
+  }
+#if SHOW_ERROR_LINE
+  line = sc->load_stack[sc->file_i].rep.stdio.curr_line;
+#endif
+  fasl_put(sc, f, &line, sizeof(line));
+  fasl_put_form(sc, f, form);
 }
 
+/* The next form from the cache, or EOF_OBJ at its end. */
+static pointer fasl_next(scheme * sc) {
+  fasl *f = sc->fasl_stack + sc->file_i;
+  int line;
 
-/* Uses internal buffer unless string pointer is already available */
-static void atom2str(scheme * sc, pointer l, int f, char **pp, int *plen) {
-  char *p;
-
-  *plen = -1;
-  if (l == sc->NIL) {
-    p = "()";
-  } else if (l == sc->T) {
-    p = "#t";
-  } else if (l == sc->F) {
-    p = "#f";
-  } else if (l == sc->EOF_OBJ) {
-    p = "#<EOF>";
-  } else if (is_port(l)) {
-    p = "#<PORT>";
-  } else if (is_number(l)) {
-    p = sc->strbuff;
-    if (f <= 1 || f == 10) {    /* f is the base for numbers if > 1 */
-      if (num_is_integer(l)) {
-        sprintf(p, "%ld", ivalue_unchecked(l));
-      } else {
-        if (rvalue_unchecked(l) * 0.0 != 0.0) { // is +/-inf or nan
-          if (rvalue_unchecked(l) > 0) {
-            strcpy(p, "+inf");
-          } else if (rvalue_unchecked(l) < 0) {
-            strcpy(p, "-inf");
-          } else {
-            strcpy(p, "+nan");
-          }
-        } else {
-          sprintf(p, "%.10g", rvalue_unchecked(l));
-        }
-        /* r5rs says there must be a '.' (unless 'e'?) */
-        f = strcspn(p, ".e");
-        if (p[f] == 0) {
-          p[f] = '.';           /* not found, so add '.0' at the end */
-          p[f + 1] = '0';
-          p[f + 2] = 0;
-        }
-      }
-    } else {
-      long v = ivalue(l);
-      if (f >= 2 && f <= 36) {
-        long_to_str(v, p, f);
-      } else {
-        *p = '\0';
-      }
-    }
-  } else if (is_string(l)) {
-    if (!f) {
-      p = strvalue(l);
-      if (IS_ASCII(*p)) {
-        *plen = strlength(l);
-      } else {
-        string_to_utf8(sc, strvalue(l), strlength(l));
-        p = sc->strbuff;
-      }
-    } else {                    /* Hack, uses the fact that printing is needed */
-      *pp = sc->strbuff;
-      *plen = 0;
-      printslashstring(sc, strvalue(l), strlength(l));
-      return;
-    }
-  } else if (is_character(l)) {
-    int c = charvalue(l);
-    p = sc->strbuff;
-    if (!f) {
-      char_to_utf8(c, p, plen);
-    } else {
-      switch (c) {
-      case ' ':
-        p = "#\\space";
-        break;
-      case '\n':
-        p = "#\\newline";
-        break;
-      case '\r':
-        p = "#\\return";
-        break;
-      case '\t':
-        p = "#\\tab";
-        break;
-      default:
-        if (c < 32 || c >= 0x80) {
-          sprintf(p, "#\\x%x", c);
-          break;
-        }
-        sprintf(p, "#\\%c", c);
-        break;
-      }
-    }
-  } else if (is_symbol(l)) {
-    p = symname(l);
-  } else if (is_proc(l)) {
-    p = sc->strbuff;
-    snprintf(p, sc->strbuff_size, "#<%s PROCEDURE %ld>", procname(l), procnum(l));
-  } else if (is_macro(l)) {
-    p = "#<MACRO>";
-  } else if (is_closure(l)) {
-    p = "#<CLOSURE>";
-  } else if (is_promise(l)) {
-    p = "#<PROMISE>";
-  } else if (is_foreign(l)) {
-    p = sc->strbuff;
-    snprintf(p, sc->strbuff_size, "#<FOREIGN PROCEDURE %ld>", procnum(l));
-  } else if (is_continuation(l)) {
-    p = "#<CONTINUATION>";
-  } else if (is_bvector(l)) {
-    p = sc->strbuff;
-    sprintf(p, "#u8(len=%d)", strlength(l));
-  } else {
-    p = "#<ERROR>";
-  }
-  *pp = p;
-  if (*plen < 0) {
-    *plen = strlen(p);
+  if (f->at == f->len) {
+    sc->load_stack[sc->file_i].kind |= port_saw_EOF;
+    return sc->EOF_OBJ;
   }
+  memcpy(&line, f->buf + f->at, sizeof(line));
+  f->at += sizeof(line);
+#if SHOW_ERROR_LINE
+  sc->load_stack[sc->file_i].rep.stdio.curr_line = line;
+#endif
+  return fasl_get_form(sc, f);
 }
 
-/* ========== Routines for Evaluation Cycle ========== */
-
-/* make closure. c is code. e is environment */
-static pointer mk_closure(scheme * sc, pointer c, pointer e) {
-  pointer x = get_cell(sc, c, e);
+/* The file at the current level is read: write its cache if need be. */
+static void fasl_finish(scheme * sc) {
+  fasl *f = sc->fasl_stack + sc->file_i;
 
-  typeflag(x) = T_CLOSURE;
-  car(x) = c;
-  cdr(x) = e;
-  return (x);
+  /* not if it ends in the middle of a form */
+  if (f->name != 0 && sc->nesting == 0) {
+    fasl_write(sc, f);
+  }
+  fasl_drop(sc, f);
 }
+#endif /* USE_FASL */
 
-/* make continuation. */
-static pointer mk_continuation(scheme * sc, pointer d) {
-  pointer x = get_cell(sc, sc->NIL, d);
+/* ========== Routines for Reading ========== */
 
-  typeflag(x) = T_CONTINUATION;
-  cont_dump(x) = d;
-  return (x);
+/* A file port reads ahead into a buffer of its own, made on first use. */
+static void port_set_file(port * pt, FILE * f, int kind) {
+  pt->kind = kind;
+  pt->nback = 0;
+  pt->rep.stdio.file = f;
+  pt->rep.stdio.closeit = 0;
+  pt->rep.stdio.buf = pt->rep.stdio.curr = pt->rep.stdio.end = 0;
 }
 
-static pointer list_star(scheme * sc, pointer d) {
-  pointer p, q;
-  if (cdr(d) == sc->NIL) {
-    return car(d);
-  }
-  p = cons(sc, car(d), cdr(d));
-  q = p;
-  while (cdr(cdr(p)) != sc->NIL) {
-    d = cons(sc, car(p), cdr(p));
-    if (cdr(cdr(p)) != sc->NIL) {
-      p = cdr(d);
-    }
-  }
-  cdr(p) = car(cdr(p));
-  return q;
+static void port_set_string(port * pt, char *start, char *past_the_end,
+    int kind) {
+  pt->kind = kind;
+  pt->nback = 0;
+  pt->rep.string.start = start;
+  pt->rep.string.curr = start;
+  pt->rep.string.past_the_end = past_the_end;
+  pt->rep.string.owner = 0;
 }
 
-/* reverse list -- produce new list */
-static pointer reverse(scheme * sc, pointer a) {
-/* a must be checked by gc */
-  pointer p = sc->NIL;
-
-  for (; is_pair(a); a = cdr(a)) {
-    p = cons(sc, car(a), p);
-  }
-  return (p);
-}
+static int file_push(scheme * sc, const char *fname) {
+  FILE *fin = NULL;
 
-/* reverse list --- in-place */
-static pointer reverse_in_place(scheme * sc, pointer term, pointer list) {
-  pointer p = list, result = term, q;
+  if (sc->file_i == MAXFIL - 1)
+    return 0;
+  fin = fopen(fname, "r");
+  if (fin != 0) {
+    sc->file_i++;
+    port_set_file(sc->load_stack + sc->file_i, fin, port_file | port_input);
+    sc->load_stack[sc->file_i].rep.stdio.closeit = 1;
+    sc->nesting_stack[sc->file_i] = 0;
+    sc->loadport->_object._port = sc->load_stack + sc->file_i;
+#if USE_FASL
+    fasl_start(sc, fname, fin);
+#endif
 
-  while (p != sc->NIL) {
-    q = cdr(p);
-    cdr(p) = result;
-    result = p;
-    p = q;
+#if SHOW_ERROR_LINE
+    sc->load_stack[sc->file_i].rep.stdio.curr_line = 0;
+    if (fname)
+      sc->load_stack[sc->file_i].rep.stdio.filename =
+          store_string(sc, strlen(fname), fname, strlen(fname));
+#endif
   }
-  return (result);
+  return fin != 0;
 }
 
-/* append list -- produce new list (in reverse order) */
-static pointer revappend(scheme * sc, pointer a, pointer b) {
-  pointer result = a;
-  pointer p = b;
-
-  while (is_pair(p)) {
-    result = cons(sc, car(p), result);
-    p = cdr(p);
-  }
-
-  if (p == sc->NIL) {
-    return result;
+static void file_pop(scheme * sc) {
+  if (sc->file_i != 0) {
+    sc->nesting = sc->nesting_stack[sc->file_i];
+    port_close(sc, sc->loadport, port_input);
+    sc->file_i--;
+    sc->loadport->_object._port = sc->load_stack + sc->file_i;
   }
+}
 
-  return sc->F;                 /* signal an error */
+static int file_interactive(scheme * sc) {
+  return sc->interactive_repl
+      && sc->file_i == 0 && sc->load_stack[0].rep.stdio.file == stdin
+      && sc->inport->_object._port->kind & port_file;
 }
 
-/* equivalence of atoms */
-int eqv(pointer a, pointer b) {
-  if (is_string(a)) {
-    if (is_string(b))
-      return (strvalue(a) == strvalue(b));
-    else
-      return (0);
-  } else if (is_number(a)) {
-    if (is_number(b)) {
-      if (num_is_integer(a) == num_is_integer(b))
-        return num_eq(nvalue(a), nvalue(b));
-    }
-    return (0);
-  } else if (is_character(a)) {
-    if (is_character(b))
-      return charvalue(a) == charvalue(b);
-    else
-      return (0);
-  } else if (is_port(a)) {
-    if (is_port(b))
-      return a == b;
-    else
-      return (0);
-  } else if (is_proc(a)) {
-    if (is_proc(b))
-      return procnum(a) == procnum(b);
-    else
-      return (0);
+static port *port_rep_from_filename(scheme * sc, const char *fn, int prop) {
+  FILE *f;
+  char *rw;
+  port *pt;
+  if (prop == (port_input | port_output)) {
+    rw = "a+";
+  } else if (prop == port_output) {
+    rw = "w";
   } else {
-    return (a == b);
+    rw = "r";
   }
-}
-
-/* true or false value macro */
-/* () is #t in R5RS */
-#define is_true(p)       ((p) != sc->F)
-#define is_false(p)      ((p) == sc->F)
-
-/* ========== Environment implementation  ========== */
+  f = fopen(fn, rw);
+  if (f == 0) {
+    return 0;
+  }
+  pt = port_rep_from_file(sc, f, prop);
+  pt->rep.stdio.closeit = 1;
 
-#if !defined(USE_ALIST_ENV) || !defined(USE_OBJECT_LIST)
+#if SHOW_ERROR_LINE
+  if (fn)
+    pt->rep.stdio.filename = store_string(sc, strlen(fn), fn, strlen(fn));
 
-static int hash_fn(const char *key, int table_size) {
-  unsigned int hashed = 0;
-  const char *c;
-  int bits_per_int = sizeof(unsigned int) * 8;
+  pt->rep.stdio.curr_line = 0;
+#endif
+  return pt;
+}
 
-  for (c = key; *c; c++) {
-    /* letters have about 5 bits in them */
-    hashed = (hashed << 5) | (hashed >> (bits_per_int - 5));
-    hashed ^= *c;
+static pointer port_from_filename(scheme * sc, const char *fn, int prop) {
+  port *pt;
+  pt = port_rep_from_filename(sc, fn, prop);
+  if (pt == 0) {
+    return sc->NIL;
   }
-  return hashed % table_size;
+  return mk_port(sc, pt);
 }
-#endif
 
-#ifndef USE_ALIST_ENV
+static port *port_rep_from_file(scheme * sc, FILE * f, int prop) {
+  port *pt;
 
-/*
- * In this implementation, each frame of the environment may be
- * a hash table: a vector of alists hashed by variable name.
- * In practice, we use a vector only for the initial frame;
- * subsequent frames are too small and transient for the lookup
- * speed to out-weigh the cost of making a new vector.
- */
+  pt = (port *) sc->malloc(sizeof *pt);
+  if (pt == NULL) {
+    return NULL;
+  }
+  port_set_file(pt, f, port_file | prop);
+  return pt;
+}
 
-static void new_frame_in_env(scheme * sc, pointer old_env) {
-  pointer new_frame;
+static pointer port_from_file(scheme * sc, FILE * f, int prop) {
+  port *pt;
+  pt = port_rep_from_file(sc, f, prop);
+  if (pt == 0) {
+    return sc->NIL;
+  }
+  return mk_port(sc, pt);
+}
 
-  /* The interaction-environment has about 300 variables in it. */
-  if (old_env == sc->NIL) {
-    new_frame = mk_vector(sc, 461);
-  } else {
-    new_frame = sc->NIL;
+static port *port_rep_from_string(scheme * sc, char *start,
+    char *past_the_end, int prop) {
+  port *pt;
+  pt = (port *) sc->malloc(sizeof(port));
+  if (pt == 0) {
+    return 0;
   }
+  port_set_string(pt, start, past_the_end, port_string | prop);
+  return pt;
+}
 
-  sc->envir = immutable_cons(sc, new_frame, old_env);
-  setenvironment(sc->envir);
+static pointer port_from_string(scheme * sc, char *start, char *past_the_end,
+    int prop) {
+  port *pt;
+  pt = port_rep_from_string(sc, start, past_the_end, prop);
+  if (pt == 0) {
+    return sc->NIL;
+  }
+  return mk_port(sc, pt);
 }
 
-static INLINE void new_slot_spec_in_env(scheme * sc, pointer env,
-    pointer variable, pointer value) {
-  pointer slot = immutable_cons(sc, variable, value);
+#define BLOCK_SIZE 256
 
-  if (is_vector(car(env))) {
-    int location = hash_fn(symname(variable), ivalue_unchecked(car(env)));
+static port *port_rep_from_scratch(scheme * sc) {
+  port *pt;
+  char *start;
+  pt = (port *) sc->malloc(sizeof(port));
+  if (pt == 0) {
+    return 0;
+  }
+  start = sc->malloc(BLOCK_SIZE);
+  if (start == 0) {
+    return 0;
+  }
+  memset(start, ' ', BLOCK_SIZE - 1);
+  start[BLOCK_SIZE - 1] = '\0';
+  port_set_string(pt, start, start + BLOCK_SIZE - 1,
+      port_string | port_output | port_srfi6);
+  return pt;
+}
 
-    set_vector_elem(car(env), location,
-        immutable_cons(sc, slot, vector_elem(car(env), location)));
-  } else {
-    car(env) = immutable_cons(sc, slot, car(env));
+static pointer port_from_scratch(scheme * sc) {
+  port *pt;
+  pt = port_rep_from_scratch(sc);
+  if (pt == 0) {
+    return sc->NIL;
   }
+  return mk_port(sc, pt);
 }
 
-static pointer find_slot_in_env(scheme * sc, pointer env, pointer hdl,
-    int all) {
-  pointer x, y;
-  int location;
+static void port_close(scheme * sc, pointer p, int flag) {
+  port *pt = p->_object._port;
+  pt->kind &= ~flag;
+  if ((pt->kind & (port_input | port_output)) == 0) {
+    if (pt->kind & port_file) {
 
-  for (x = env; x != sc->NIL; x = cdr(x)) {
-    if (is_vector(car(x))) {
-      location = hash_fn(symname(hdl), ivalue_unchecked(car(x)));
-      y = vector_elem(car(x), location);
-    } else {
-      y = car(x);
-    }
-    for (; y != sc->NIL; y = cdr(y)) {
-      if (caar(y) == hdl) {
-        break;
-      }
-    }
-    if (y != sc->NIL) {
-      break;
+#if SHOW_ERROR_LINE
+      /* Cleanup is here so (close-*-port) functions could work too */
+      pt->rep.stdio.curr_line = 0;
+
+      if (pt->rep.stdio.filename)
+        sc->free(pt->rep.stdio.filename);
+#endif
+
+      fclose(pt->rep.stdio.file);
+      sc->free(pt->rep.stdio.buf);
+      pt->rep.stdio.buf = 0;
     }
-    if (!all) {
-      return sc->NIL;
+    pt->kind = port_free;
+  }
+}
+
+static int utf8_inchar(scheme * sc, port * pt) {
+  int c = basic_inchar(sc, pt);
+  int bytes, i;
+  char buf[4];
+  if (c == EOF || c < 0x80) {
+    return c;
+  }
+  buf[0] = (char) c;
+  bytes = (c < 0xE0) ? 2 : ((c < 0xF0) ? 3 : 4);
+  for (i = 1; i < bytes; i++) {
+    c = basic_inchar(sc, pt);
+    if (c == EOF) {
+      return EOF;
     }
+    buf[i] = (char) c;
   }
-  if (x != sc->NIL) {
-    return car(y);
+  return utf8_decode(buf);
+}
+
+/* get new character from input file */
+static int inchar(scheme * sc) {
+  int c;
+  port *pt = sc->inport->_object._port;
+
+  if (pt->nback != 0) {
+    return pt->back[--pt->nback];
   }
-  return sc->NIL;
+  if (pt->kind & port_saw_EOF) {
+    return EOF;
+  }
+  c = utf8_inchar(sc, pt);
+  if (c == EOF && sc->inport == sc->loadport) {
+    /* Instead, set port_saw_EOF */
+    pt->kind |= port_saw_EOF;
+    return EOF;
+  }
+  return c;
 }
 
-#else /* USE_ALIST_ENV */
+static int inchar8(scheme * sc) {
+  int c;
+  port *pt = sc->inport->_object._port;
 
-static INLINE void new_frame_in_env(scheme * sc, pointer old_env) {
-  sc->envir = immutable_cons(sc, sc->NIL, old_env);
-  setenvironment(sc->envir);
+  if (pt->nback != 0) {
+    return pt->back[--pt->nback];
+  }
+  if (pt->kind & port_saw_EOF) {
+    return EOF;
+  }
+  c = basic_inchar(sc, pt);
+  if (c == EOF && sc->inport == sc->loadport) {
+    /* Instead, set port_saw_EOF */
+    pt->kind |= port_saw_EOF;
+    return EOF;
+  }
+  return c;
 }
 
-static INLINE void new_slot_spec_in_env(scheme * sc, pointer env,
-    pointer variable, pointer value) {
-  car(env) =
-      immutable_cons(sc, immutable_cons(sc, variable, value), car(env));
+/* Read ahead into the buffer of file port pt, making it on first use.
+   Returns the bytes read, or -1 if pt is on anything but a plain file
+   open only for input: it is then read a char at a time, so that a
+   terminal or a pipe gives what it has as soon as it has it.  Nor is
+   stdin read ahead, even from a file: the port loading from it and
+   the current input port share it, and each must leave the other its
+   chars. */
+static long port_fill(scheme * sc, port * pt) {
+  struct stat st;
+  size_t n;
+
+  if (pt->rep.stdio.buf == 0) {
+    if (pt->kind & port_output || pt->rep.stdio.file == stdin
+        || fstat(fileno(pt->rep.stdio.file), &st) != 0
+        || !S_ISREG(st.st_mode)
+        || (pt->rep.stdio.buf = sc->malloc(PORT_BUFSIZE)) == 0) {
+      pt->kind |= port_unbuffered;
+      return -1;
+    }
+  }
+  n = fread(pt->rep.stdio.buf, 1, PORT_BUFSIZE, pt->rep.stdio.file);
+  pt->rep.stdio.curr = pt->rep.stdio.buf;
+  pt->rep.stdio.end = pt->rep.stdio.buf + n;
+  return n;
 }
 
-static pointer find_slot_in_env(scheme * sc, pointer env, pointer hdl,
-    int all) {
-  pointer x, y;
-  for (x = env; x != sc->NIL; x = cdr(x)) {
-    for (y = car(x); y != sc->NIL; y = cdr(y)) {
-      if (caar(y) == hdl) {
+static int basic_inchar(scheme * sc, port * pt) {
+  if (pt->kind & port_file) {
+    if (pt->rep.stdio.curr != pt->rep.stdio.end) {
+      return (unsigned char) *pt->rep.stdio.curr++;
+    }
+    if (!(pt->kind & port_unbuffered)) {
+      switch (port_fill(sc, pt)) {
+      case -1:
         break;
+      case 0:
+        return EOF;
+      default:
+        return (unsigned char) *pt->rep.stdio.curr++;
       }
     }
-    if (y != sc->NIL) {
-      break;
-    }
-    if (!all) {
-      return sc->NIL;
+    return fgetc(pt->rep.stdio.file);
+  } else {
+    if (*pt->rep.string.curr == 0 ||
+        pt->rep.string.curr == pt->rep.string.past_the_end) {
+      return EOF;
+    } else {
+      return (unsigned char) *pt->rep.string.curr++;
     }
   }
-  if (x != sc->NIL) {
-    return car(y);
-  }
-  return sc->NIL;
 }
 
-#endif /* USE_ALIST_ENV else */
+/* back character to input buffer */
+static void backchar(scheme * sc, int c) {
+  port *pt = sc->inport->_object._port;
 
-static INLINE void new_slot_in_env(scheme * sc, pointer variable,
-    pointer value) {
-  new_slot_spec_in_env(sc, sc->envir, variable, value);
+  if (c == EOF || pt->nback == PORT_BACK)
+    return;
+  pt->back[pt->nback++] = c;
 }
 
-static INLINE void set_slot_in_env(pointer slot, pointer value) {
-  cdr(slot) = value;
-}
+/* The unread input that is in memory, from the result up to *end, so
+   that the reader can scan it in place; 0 if chars were taken back. */
+static char *inbuf(scheme * sc, char **end) {
+  port *pt = sc->inport->_object._port;
 
-static INLINE pointer slot_value_in_env(pointer slot) {
-  return cdr(slot);
+  if (pt->nback != 0) {
+    return 0;
+  }
+  if (pt->kind & port_file) {
+    *end = pt->rep.stdio.end;
+    return pt->rep.stdio.curr;
+  }
+  *end = pt->rep.string.past_the_end;
+  return pt->rep.string.curr;
 }
 
-/* ========== Evaluation Cycle ========== */
-
-
-static pointer _Error_1(scheme * sc, const char *s, pointer a) {
-  const char *str = s;
-#if USE_ERROR_HOOK
-  pointer x;
-  pointer hdl = sc->ERROR_HOOK;
-#endif
-
-#if SHOW_ERROR_LINE
-  char sbuf[AUXBUFF_SIZE];
+/* The input scanned in place was read up to p. */
+static void inbuf_skip(scheme * sc, char *p) {
+  port *pt = sc->inport->_object._port;
 
-  /* make sure error is not in REPL */
-  if (sc->load_stack[sc->file_i].kind & port_file &&
-      sc->load_stack[sc->file_i].rep.stdio.file != stdin) {
-    int ln = sc->load_stack[sc->file_i].rep.stdio.curr_line;
-    const char *fname = sc->load_stack[sc->file_i].rep.stdio.filename;
+  if (pt->kind & port_file) {
+    pt->rep.stdio.curr = p;
+  } else {
+    pt->rep.string.curr = p;
+  }
+}
 
-    /* should never happen */
-    if (!fname)
-      fname = "<unknown>";
+/* Skip the rest of a line comment, and return the char ending it. */
+static int skip_line(scheme * sc) {
+  char *p, *end;
+  int c;
 
-    /* we started from 0 */
-    ln++;
-    snprintf(sbuf, AUXBUFF_SIZE, "(%s : %i) %s", fname, ln, s);
+  do {
+    if ((p = inbuf(sc, &end)) != 0) {
+      while (p != end && *p != '\n' && *p != 0) {
+        p++;
+      }
+      inbuf_skip(sc, p);
+    }
+  } while ((c = inchar(sc)) != '\n' && c != EOF);
+  return c;
+}
 
-    str = (const char *) sbuf;
+static int realloc_port_string(scheme * sc, port * p) {
+  char *start = p->rep.string.start;
+  size_t new_size = p->rep.string.past_the_end - start + 1 + BLOCK_SIZE;
+  char *str = sc->malloc(new_size);
+  if (str) {
+    memset(str, ' ', new_size - 1);
+    str[new_size - 1] = '\0';
+    strcpy(str, start);
+    p->rep.string.start = str;
+    p->rep.string.past_the_end = str + new_size - 1;
+    p->rep.string.curr -= start - str;
+    sc->free(start);
+    return 1;
+  } else {
+    return 0;
   }
-#endif
+}
 
-#if USE_ERROR_HOOK
-  x = find_slot_in_env(sc, sc->envir, hdl, 1);
-  if (x != sc->NIL) {
-    if (a != 0) {
-      sc->code =
-          cons(sc, cons(sc, sc->QUOTE, cons(sc, (a), sc->NIL)), sc->NIL);
-    } else {
-      sc->code = sc->NIL;
+static void char_to_utf8(int c, char *p, int *plen) {
+  unsigned char *s = (unsigned char *) p;
+  int bytes;
+  if (c < 0 || c > 0x10FFFF) {
+    c = '?';
+  }
+  if (c < 0x80) {
+    *s++ = (unsigned char) c;
+    *s = 0;
+  } else {
+    bytes = (c < 0x800) ? 2 : ((c < 0x10000) ? 3 : 4);
+    s[bytes] = 0;
+    s[0] = 0x80;
+    while (--bytes) {
+      s[0] |= (0x80 >> bytes);
+      s[bytes] = (unsigned char) (0x80 | (c & 0x3F));
+      c >>= 6;
     }
-    sc->code = cons(sc, mk_string(sc, str), sc->code);
-    setimmutable(car(sc->code));
-    sc->code = cons(sc, slot_value_in_env(x), sc->code);
-    sc->op = (int) OP_EVAL;
-    return sc->T;
+    s[0] |= (unsigned char) c;
   }
-#endif
+  *plen = strlen(p);
+}
 
-  if (a != 0) {
-    sc->args = cons(sc, (a), sc->NIL);
+INTERFACE void putstr(scheme * sc, const char *s) {
+  port *pt = sc->outport->_object._port;
+  if (pt->kind & port_file) {
+    fputs(s, pt->rep.stdio.file);
   } else {
-    sc->args = sc->NIL;
+    for (; *s; s++) {
+      if (pt->rep.string.curr != pt->rep.string.past_the_end) {
+        *pt->rep.string.curr++ = *s;
+      } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
+        *pt->rep.string.curr++ = *s;
+      }
+    }
   }
-  sc->args = cons(sc, mk_string(sc, str), sc->args);
-  setimmutable(car(sc->args));
-  sc->op = (int) OP_ERR0;
-  return sc->T;
 }
 
-#define Error_1(sc,s, a) return _Error_1(sc,s,a)
-#define Error_0(sc,s)    return _Error_1(sc,s,0)
-
-/* Too small to turn into function */
-#define  BEGIN     do {
-#define  END  } while (0)
-#define s_goto(sc,a) BEGIN                                  \
-    sc->op = (int)(a);                                      \
-    return sc->T; END
-
-#define s_return(sc,a) return _s_return(sc,a)
-
-#ifndef USE_SCHEME_STACK
-
-/* this structure holds all the interpreter's registers */
-struct dump_stack_frame {
-  enum scheme_opcodes op;
-  pointer args;
-  pointer envir;
-  pointer code;
-};
-
-#define STACK_GROWTH 3
-
-static void s_save(scheme * sc, enum scheme_opcodes op, pointer args,
-    pointer code) {
-  int nframes = (int) sc->dump;
-  struct dump_stack_frame *next_frame;
-
-  /* enough room for the next frame? */
-  if (nframes >= sc->dump_size) {
-    sc->dump_size += STACK_GROWTH;
-    /* alas there is no sc->realloc */
-    sc->dump_base = realloc(sc->dump_base,
-        sizeof(struct dump_stack_frame) * sc->dump_size);
+static void putchars(scheme * sc, const char *s, int len) {
+  port *pt = sc->outport->_object._port;
+  if (pt->kind & port_file) {
+    fwrite(s, 1, len, pt->rep.stdio.file);
+  } else {
+    for (; len; len--) {
+      if (pt->rep.string.curr != pt->rep.string.past_the_end) {
+        *pt->rep.string.curr++ = *s++;
+      } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
+        *pt->rep.string.curr++ = *s++;
+      }
+    }
   }
-  next_frame = (struct dump_stack_frame *) sc->dump_base + nframes;
-  next_frame->op = op;
-  next_frame->args = args;
-  next_frame->envir = sc->envir;
-  next_frame->code = code;
-  sc->dump = (pointer) (nframes + 1);
 }
 
-static pointer _s_return(scheme * sc, pointer a) {
-  int nframes = (int) sc->dump;
-  struct dump_stack_frame *frame;
-
-  sc->value = (a);
-  if (nframes <= 0) {
-    return sc->NIL;
+INTERFACE void putcharacter(scheme * sc, int c) {
+  port *pt = sc->outport->_object._port;
+  if (pt->kind & port_file) {
+    fputc(c, pt->rep.stdio.file);
+  } else {
+    if (pt->rep.string.curr != pt->rep.string.past_the_end) {
+      *pt->rep.string.curr++ = c;
+    } else if (pt->kind & port_srfi6 && realloc_port_string(sc, pt)) {
+      *pt->rep.string.curr++ = c;
+    }
   }
-  nframes--;
-  frame = (struct dump_stack_frame *) sc->dump_base + nframes;
-  sc->op = frame->op;
-  sc->args = frame->args;
-  sc->envir = frame->envir;
-  sc->code = frame->code;
-  sc->dump = (pointer) nframes;
-  return sc->T;
 }
 
-static INLINE void dump_stack_reset(scheme * sc) {
-  /* in this implementation, sc->dump is the number of frames on the stack */
-  sc->dump = (pointer) 0;
+static int check_strbuff_size(scheme * sc, char **p) {
+  char *t;
+  int len = *p - sc->strbuff;
+  if (len + 4 < sc->strbuff_size) {
+    return 1;
+  }
+  sc->strbuff_size *= 2;
+  if (sc->strbuff_size >= STRBUFF_MAX_SIZE) {
+    sc->strbuff_size /= 2;
+    return 0;
+  }
+  t = sc->malloc(sc->strbuff_size);
+  memcpy(t, sc->strbuff, len);
+  *p = t + len;
+  sc->free(sc->strbuff);
+  sc->strbuff = t;
+  return 1;
 }
 
-static INLINE void dump_stack_initialize(scheme * sc) {
-  sc->dump_size = 0;
-  sc->dump_base = NULL;
-  dump_stack_reset(sc);
-}
+/* The length of the run of plain ASCII at p, up to n bytes, that holds
+   no DELIMITERS (atom) or no '"' and '\\' (string). NUL and UTF-8 end
+   a run too; they are left to inchar. SSE2 looks at 16 bytes a step. */
+static size_t ascii_run(const char *p, size_t n, int string) {
+  size_t i = 0;
+  unsigned char c;
 
-static void dump_stack_free(scheme * sc) {
-  free(sc->dump_base);
-  sc->dump_base = NULL;
-  sc->dump = (pointer) 0;
-  sc->dump_size = 0;
-}
+#if defined(__SSE2__) && defined(__GNUC__)
+  const __m128i zero = _mm_setzero_si128();
 
-static INLINE void dump_stack_mark(scheme * sc) {
-  int nframes = (int) sc->dump;
-  int i;
-  for (i = 0; i < nframes; i++) {
-    struct dump_stack_frame *frame;
-    frame = (struct dump_stack_frame *) sc->dump_base + i;
-    mark(frame->args);
-    mark(frame->envir);
-    mark(frame->code);
-  }
-}
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+    __m128i stop = _mm_cmpeq_epi8(x, zero);
+    int m;
 
-#else
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+    if (string) {
+      stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+    } else {
+      /* \t \n \v \f \r are 9..13: x - 9 below 5, as a signed compare */
+      __m128i ws = _mm_sub_epi8(x, _mm_set1_epi8(9 - 128));
 
-static INLINE void dump_stack_reset(scheme * sc) {
-  sc->dump = sc->NIL;
+      stop = _mm_or_si128(stop, _mm_cmplt_epi8(ws, _mm_set1_epi8(5 - 128)));
+      stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+      stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8('(')));
+      stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8(')')));
+      stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, _mm_set1_epi8(';')));
+    }
+    /* the sign bit picks out the bytes of UTF-8 */
+    m = _mm_movemask_epi8(_mm_or_si128(stop, x));
+    if (m != 0) {
+      return i + __builtin_ctz(m);
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    c = p[i];
+    if (c == 0 || c >= 0x80 || c == '"') {
+      break;
+    }
+    if (string ? c == '\\' : c < 64 && (DELIM_BITS >> c & 1)) {
+      break;
+    }
+  }
+  return i;
 }
 
-static INLINE void dump_stack_initialize(scheme * sc) {
-  dump_stack_reset(sc);
-}
+/* Copy the run of plain ASCII that starts the input into strbuff at *p,
+   as far as it fits. */
+static void copy_run(scheme * sc, char **p, int string) {
+  char *q, *end;
+  ptrdiff_t room = sc->strbuff + sc->strbuff_size - 5 - *p;
+  size_t n;
 
-static void dump_stack_free(scheme * sc) {
-  sc->dump = sc->NIL;
+  if (room > 0 && (q = inbuf(sc, &end)) != 0) {
+    n = ascii_run(q, end - q < room ? end - q : room, string);
+    memcpy(*p, q, n);
+    *p += n;
+    inbuf_skip(sc, q + n);
+  }
 }
 
-static pointer _s_return(scheme * sc, pointer a) {
-  sc->value = (a);
-  if (sc->dump == sc->NIL)
-    return sc->NIL;
-  sc->op = ivalue(car(sc->dump));
-  sc->args = cadr(sc->dump);
-  sc->envir = caddr(sc->dump);
-  sc->code = cadddr(sc->dump);
-  sc->dump = cddddr(sc->dump);
-  return sc->T;
-}
+/* read characters up to delimiter, but cater to character constants */
+static char *readstr_upto(scheme * sc) {
+  char *p = sc->strbuff;
+  int c, len;
 
-static void s_save(scheme * sc, enum scheme_opcodes op, pointer args,
-    pointer code) {
-  sc->dump = cons(sc, sc->envir, cons(sc, (code), sc->dump));
-  sc->dump = cons(sc, (args), sc->dump);
-  sc->dump = cons(sc, mk_integer(sc, (long) (op)), sc->dump);
-}
+  while (1) {
+    copy_run(sc, &p, 0);
+    c = inchar(sc);
+    if (check_strbuff_size(sc, &p)) {
+      char_to_utf8(c, p, &len);
+      p += len;
+    }
+    if(is_one_of(DELIMITERS, c)) {
+      break;
+    }
+  }
 
-static INLINE void dump_stack_mark(scheme * sc) {
-  mark(sc->dump);
+  if (p == sc->strbuff + 2 && p[-2] == '\\') {
+    *p = 0;
+  } else {
+    backchar(sc, p[-1]);
+    *--p = '\0';
+  }
+  return sc->strbuff;
 }
-#endif
-
-#define s_retbool(tf)    s_return(sc,(tf) ? sc->T : sc->F)
 
-static pointer opexe_0(scheme * sc, enum scheme_opcodes op) {
+/* read string expression "xxx...xxx" */
+static pointer readstrexp(scheme * sc) {
+  char *p = sc->strbuff;
+  int c, len;
+  int c1 = 0;
+  enum { st_ok, st_bsl, st_x1, st_x2, st_oct1, st_oct2 } state = st_ok;
+
+  for (;;) {
+    if (state == st_ok) {
+      copy_run(sc, &p, 1);
+    }
+    c = inchar(sc);
+    if (c == EOF || !check_strbuff_size(sc, &p)) {
+      return sc->F;
+    }
+    switch (state) {
+    case st_ok:
+      switch (c) {
+      case '\\':
+        state = st_bsl;
+        break;
+      case '"':
+        *p = 0;
+        return mk_counted_string(sc, sc->strbuff, p - sc->strbuff);
+      default:
+        char_to_utf8(c, p, &len);
+        p += len;
+        break;
+      }
+      break;
+    case st_bsl:
+      switch (c) {
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+        state = st_oct1;
+        c1 = c - '0';
+        break;
+      case 'x':
+      case 'X':
+        state = st_x1;
+        c1 = 0;
+        break;
+      case 'n':
+        *p++ = '\n';
+        state = st_ok;
+        break;
+      case 't':
+        *p++ = '\t';
+        state = st_ok;
+        break;
+      case 'r':
+        *p++ = '\r';
+        state = st_ok;
+        break;
+      case '"':
+        *p++ = '"';
+        state = st_ok;
+        break;
+      default:
+        *p++ = c;
+        state = st_ok;
+        break;
+      }
+      break;
+    case st_x1:
+    case st_x2:
+      c = toupper(c);
+      if (c >= '0' && c <= 'F') {
+        if (c <= '9') {
+          c1 = (c1 << 4) + c - '0';
+        } else {
+          c1 = (c1 << 4) + c - 'A' + 10;
+        }
+        if (state == st_x1) {
+          state = st_x2;
+        } else {
+          *p++ = c1;
+          state = st_ok;
+        }
+      } else {
+        return sc->F;
+      }
+      break;
+    case st_oct1:
+    case st_oct2:
+      if (c < '0' || c > '7') {
+        *p++ = c1;
+        backchar(sc, c);
+        state = st_ok;
+      } else {
+        if (state == st_oct2 && c1 >= 32)
+          return sc->F;
+
+        c1 = (c1 << 3) + (c - '0');
+
+        if (state == st_oct1)
+          state = st_oct2;
+        else {
+          *p++ = c1;
+          state = st_ok;
+        }
+      }
+      break;
+
+    }
+  }
+}
+
+/* check c is in chars */
+static INLINE int is_one_of(char *s, int c) {
+  if (c == EOF)
+    return 1;
+  while (*s)
+    if (*s++ == c)
+      return (1);
+  return (0);
+}
+
+/* skip white characters */
+static INLINE int skipspace(scheme * sc) {
+  int c = 0, curr_line = 0;
+  char *p, *end;
+
+  do {
+    if ((p = inbuf(sc, &end)) != 0) {
+      for (; p != end && isspace((unsigned char) *p); p++) {
+#if SHOW_ERROR_LINE
+        curr_line += *p == '\n';
+#endif
+      }
+      inbuf_skip(sc, p);
+    }
+    c = inchar(sc);
+#if SHOW_ERROR_LINE
+    if (c == '\n')
+      curr_line++;
+#endif
+  } while (isspace(c));
+
+/* record it */
+#if SHOW_ERROR_LINE
+  if (sc->load_stack[sc->file_i].kind & port_file)
+    sc->load_stack[sc->file_i].rep.stdio.curr_line += curr_line;
+#endif
+
+  if (c != EOF) {
+    backchar(sc, c);
+    return 1;
+  } else {
+    return EOF;
+  }
+}
+
+/* get token */
+static int token(scheme * sc) {
+  int c;
+  c = skipspace(sc);
+  if (c == EOF) {
+    return (TOK_EOF);
+  }
+  switch (c = inchar(sc)) {
+  case EOF:
+    return (TOK_EOF);
+  case '(':
+    return (TOK_LPAREN);
+  case ')':
+    return (TOK_RPAREN);
+  case '.':
+    c = inchar(sc);
+    if (is_one_of(" \n\t", c)) {
+      return (TOK_DOT);
+    } else {
+      backchar(sc, c);
+      backchar(sc, '.');
+      return TOK_ATOM;
+    }
+  case '\'':
+    return (TOK_QUOTE);
+  case ';':
+    c = skip_line(sc);
+
+#if SHOW_ERROR_LINE
+    if (c == '\n' && sc->load_stack[sc->file_i].kind & port_file)
+      sc->load_stack[sc->file_i].rep.stdio.curr_line++;
+#endif
+
+    if (c == EOF) {
+      return (TOK_EOF);
+    } else {
+      return (token(sc));
+    }
+  case '"':
+    return (TOK_DQUOTE);
+  case BACKQUOTE:
+    return (TOK_BQUOTE);
+  case ',':
+    if ((c = inchar(sc)) == '@') {
+      return (TOK_ATMARK);
+    } else {
+      backchar(sc, c);
+      return (TOK_COMMA);
+    }
+  case '#':
+    c = inchar(sc);
+    if (c == '(') {
+      return (TOK_VEC);
+    } else if (c == '!') {
+      c = skip_line(sc);
+
+#if SHOW_ERROR_LINE
+      if (c == '\n' && sc->load_stack[sc->file_i].kind & port_file)
+        sc->load_stack[sc->file_i].rep.stdio.curr_line++;
+#endif
+
+      if (c == EOF) {
+        return (TOK_EOF);
+      } else {
+        return (token(sc));
+      }
+    } else {
+      backchar(sc, c);
+      if (is_one_of(" tfodxb\\", c)) {
+        return TOK_SHARP_CONST;
+      } else {
+        return (TOK_SHARP);
+      }
+    }
+  default:
+    backchar(sc, c);
+    return (TOK_ATOM);
+  }
+}
+
+/* ========== Routines for Printing ========== */
+#define   ok_abbrev(x)   (is_pair(x) && cdr(x) == sc->NIL)
+
+void long_to_str(long v, char *s, int base) {
+  char *p;
+  char c;
+  if (v < 0) {
+    *s++ = '-';
+    v = -v;
+  }
+  p = s;
+  if (v == 0) {
+    *s++ = '0';
+  }
+  while (v > 0) {
+    c = (char) (v % base);
+    v /= base;
+    if (c < 10) {
+      c += '0';
+    } else {
+      c += 'A' - 10;
+    }
+    *s++ = c;
+  }
+  *s-- = '\0';
+  while (s > p) {
+    c = *p;
+    *p++ = *s;
+    *s-- = c;
+  }
+}
+
+
+static void printslashstring(scheme * sc, char *p, int len) {
+  int c, d;
+  char buf[5];
+  const char *s;
+  putcharacter(sc, '"');
+  for (s = p; s < p + len; s = utf8_next(s)) {
+    c = utf8_decode(s);
+    if (c == '"' || c < ' ' || c == '\\') {
+      putcharacter(sc, '\\');
+      switch (c) {
+      case '"':
+        putcharacter(sc, '"');
+        break;
+      case '\n':
+        putcharacter(sc, 'n');
+        break;
+      case '\t':
+        putcharacter(sc, 't');
+        break;
+      case '\r':
+        putcharacter(sc, 'r');
+        break;
+      case '\\':
+        putcharacter(sc, '\\');
+        break;
+      default:{
+          d = c / 16;
+          putcharacter(sc, 'x');
+          if (d < 10) {
+            putcharacter(sc, d + '0');
+          } else {
+            putcharacter(sc, d - 10 + 'A');
+          }
+          d = c % 16;
+          if (d < 10) {
+            putcharacter(sc, d + '0');
+          } else {
+            putcharacter(sc, d - 10 + 'A');
+          }
+        }
+      }
+    } else {
+      char_to_utf8(c, buf, &d);
+      for (c = 0; c < d; c++) {
+        putcharacter(sc, buf[c]);
+      }
+    }
+  }
+  putcharacter(sc, '"');
+}
+
+
+/* print atoms */
+static void printatom(scheme * sc, pointer l, int f) {
+  char *p;
+  int len;
+  atom2str(sc, l, f, &p, &len);
+  putchars(sc, p, len);
+}
+
+
+/* Uses internal buffer unless string pointer is already available */
+static void atom2str(scheme * sc, pointer l, int f, char **pp, int *plen) {
+  char *p;
+
+  *plen = -1;
+  if (l == sc->NIL) {
+    p = "()";
+  } else if (l == sc->T) {
+    p = "#t";
+  } else if (l == sc->F) {
+    p = "#f";
+  } else if (l == sc->EOF_OBJ) {
+    p = "#<EOF>";
+  } else if (is_port(l)) {
+    p = "#<PORT>";
+  } else if (is_number(l)) {
+    p = sc->strbuff;
+    if (f <= 1 || f == 10) {    /* f is the base for numbers if > 1 */
+      if (num_is_integer(l)) {
+        sprintf(p, "%ld", ivalue(l));
+      } else {
+        if (rvalue_unchecked(l) * 0.0 != 0.0) { // is +/-inf or nan
+          if (rvalue_unchecked(l) > 0) {
+            strcpy(p, "+inf");
+          } else if (rvalue_unchecked(l) < 0) {
+            strcpy(p, "-inf");
+          } else {
+            strcpy(p, "+nan");
+          }
+        } else {
+          sprintf(p, "%.10g", rvalue_unchecked(l));
+        }
+        /* r5rs says there must be a '.' (unless 'e'?) */
+        f = strcspn(p, ".e");
+        if (p[f] == 0) {
+          p[f] = '.';           /* not found, so add '.0' at the end */
+          p[f + 1] = '0';
+          p[f + 2] = 0;
+        }
+      }
+    } else {
+      long v = ivalue(l);
+      if (f >= 2 && f <= 36) {
+        long_to_str(v, p, f);
+      } else {
+        *p = '\0';
+      }
+    }
+  } else if (is_string(l)) {
+    if (!f) {
+      p = strvalue(l);
+      *plen = strsize(l);
+    } else {                    /* Hack, uses the fact that printing is needed */
+      *pp = sc->strbuff;
+      *plen = 0;
+      printslashstring(sc, strvalue(l), strsize(l));
+      return;
+    }
+  } else if (is_character(l)) {
+    int c = charvalue(l);
+    p = sc->strbuff;
+    if (!f) {
+      char_to_utf8(c, p, plen);
+    } else {
+      switch (c) {
+      case ' ':
+        p = "#\\space";
+        break;
+      case '\n':
+        p = "#\\newline";
+        break;
+      case '\r':
+        p = "#\\return";
+        break;
+      case '\t':
+        p = "#\\tab";
+        break;
+      default:
+        if (c < 32 || c >= 0x80) {
+          sprintf(p, "#\\x%x", c);
+          break;
+        }
+        sprintf(p, "#\\%c", c);
+        break;
+      }
+    }
+  } else if (is_symbol(l)) {
+    p = symname(l);
+  } else if (is_proc(l)) {
+    p = sc->strbuff;
+    snprintf(p, sc->strbuff_size, "#<%s PROCEDURE %ld>", procname(l), procnum(l));
+  } else if (is_macro(l)) {
+    p = "#<MACRO>";
+  } else if (is_closure(l)) {
+    p = "#<CLOSURE>";
+  } else if (is_promise(l)) {
+    p = "#<PROMISE>";
+  } else if (is_foreign(l)) {
+    p = sc->strbuff;
+    snprintf(p, sc->strbuff_size, "#<FOREIGN PROCEDURE %ld>", procnum(l));
+  } else if (is_continuation(l)) {
+    p = "#<CONTINUATION>";
+  } else if (is_bvector(l)) {
+    p = sc->strbuff;
+    sprintf(p, "#u8(len=%d)", buflength(l));
+  } else {
+    p = "#<ERROR>";
+  }
+  *pp = p;
+  if (*plen < 0) {
+    *plen = strlen(p);
+  }
+}
+
+/* ========== Routines for Evaluation Cycle ========== */
+
+/* make closure. c is code. e is environment */
+static pointer mk_closure(scheme * sc, pointer c, pointer e) {
+  pointer x = get_cell(sc, c, e);
+
+  typeflag(x) = T_CLOSURE;
+  car(x) = c;
+  cdr(x) = e;
+  return (x);
+}
+
+/* make continuation. */
+static pointer mk_continuation(scheme * sc, pointer d) {
+  pointer x = get_cell(sc, sc->NIL, d);
+
+  typeflag(x) = T_CONTINUATION;
+  cont_dump(x) = d;
+  return (x);
+}
+
+static pointer list_star(scheme * sc, pointer d) {
+  pointer p, q;
+  if (cdr(d) == sc->NIL) {
+    return car(d);
+  }
+  p = cons(sc, car(d), cdr(d));
+  q = p;
+  while (cdr(cdr(p)) != sc->NIL) {
+    d = cons(sc, car(p), cdr(p));
+    if (cdr(cdr(p)) != sc->NIL) {
+      p = cdr(d);
+    }
+  }
+  gc_barrier(p, car(cdr(p)));
+  cdr(p) = car(cdr(p));
+  return q;
+}
+
+/* reverse list -- produce new list */
+static pointer reverse(scheme * sc, pointer a) {
+/* a must be checked by gc */
+  pointer p = sc->NIL;
+
+  for (; is_pair(a); a = cdr(a)) {
+    p = cons(sc, car(a), p);
+  }
+  return (p);
+}
+
+/* reverse list --- in-place */
+static pointer reverse_in_place(scheme * sc, pointer term, pointer list) {
+  pointer p = list, result = term, q;
+
+  while (p != sc->NIL) {
+    q = cdr(p);
+    gc_barrier(p, result);
+    cdr(p) = result;
+    result = p;
+    p = q;
+  }
+  return (result);
+}
+
+/* append list -- produce new list (in reverse order) */
+static pointer revappend(scheme * sc, pointer a, pointer b) {
+  pointer result = a;
+  pointer p = b;
+
+  while (is_pair(p)) {
+    result = cons(sc, car(p), result);
+    p = cdr(p);
+  }
+
+  if (p == sc->NIL) {
+    return result;
+  }
+
+  return sc->F;                 /* signal an error */
+}
+
+/* equivalence of atoms */
+int eqv(pointer a, pointer b) {
+  if (is_string(a)) {
+    if (is_string(b))
+      return (a == b);
+    else
+      return (0);
+  } else if (is_number(a)) {
+    if (is_number(b)) {
+      if (num_is_integer(a) == num_is_integer(b))
+        return num_eq(nvalue(a), nvalue(b));
+    }
+    return (0);
+  } else if (is_character(a)) {
+    if (is_character(b))
+      return charvalue(a) == charvalue(b);
+    else
+      return (0);
+  } else if (is_port(a)) {
+    if (is_port(b))
+      return a == b;
+    else
+      return (0);
+  } else if (is_proc(a)) {
+    if (is_proc(b))
+      return procnum(a) == procnum(b);
+    else
+      return (0);
+  } else {
+    return (a == b);
+  }
+}
+
+/* true or false value macro */
+/* () is #t in R5RS */
+#define is_true(p)       ((p) != sc->F)
+#define is_false(p)      ((p) == sc->F)
+
+/* ========== Environment implementation  ========== */
+
+static pointer mk_frame(scheme * sc, pointer names) {
+  int n = list_length(sc, names);
+  pointer f = get_cell(sc, sc->NIL, sc->NIL);
+  pointer x;
+  int i;
+
+  if (sc->no_memory) {
+    return sc->sink;
+  }
+  typeflag(f) = (T_FRAME | T_ATOM);
+  bufvalue(f) = (char *) alloc_slots(sc, n + 1);
+  if (bufvalue(f) == 0) {
+    typeflag(f) = 0;
+    sc->no_memory = 1;
+    return sc->sink;
+  }
+  buflength(f) = n;
+  for (i = 0; i <= n; i++) {
+    frame_slot(f, i) = sc->NIL;
+  }
+  push_recent_alloc(sc, f);
+  for (i = 0; i < n; i++, names = cdr(names)) {
+    setlocal(car(names));
+    x = immutable_cons(sc, car(names), sc->UNBOUND);
+    gc_barrier(f, x);
+    frame_slot(f, i) = x;
+  }
+  return f;
+}
+
+static pointer find_slot_in_frame(scheme * sc, pointer f, pointer hdl) {
+  pointer x;
+  int i;
+
+  /* the last of several slots with the same name wins, as with alists */
+  for (i = frame_size(f) - 1; i >= 0; i--) {
+    x = frame_slot(f, i);
+    if (car(x) == hdl && cdr(x) != sc->UNBOUND) {
+      return x;
+    }
+  }
+  for (x = frame_extra(f); x != sc->NIL; x = cdr(x)) {
+    if (caar(x) == hdl) {
+      return car(x);
+    }
+  }
+  return sc->NIL;
+}
+
+static void new_slot_in_frame(scheme * sc, pointer f, pointer variable,
+    pointer value) {
+  pointer x;
+  int i;
+
+  for (i = frame_size(f) - 1; i >= 0; i--) {
+    x = frame_slot(f, i);
+    if (car(x) == variable && cdr(x) == sc->UNBOUND) {
+      gc_barrier(x, value);
+      cdr(x) = value;
+      return;
+    }
+  }
+  x = immutable_cons(sc, immutable_cons(sc, variable, value),
+      frame_extra(f));
+  gc_barrier(f, x);
+  frame_extra(f) = x;
+}
+
+/* FNV-1a, with the high bits mixed down into the low ones that index
+   the oblist */
+static unsigned int hash_str(const char *key) {
+  unsigned int hashed = 2166136261u;
+  const char *c;
+
+  for (c = key; *c; c++) {
+    hashed ^= (unsigned char) *c;
+    hashed *= 16777619u;
+  }
+  hashed ^= hashed >> 16;
+  hashed *= 0x85EBCA6Bu;
+  hashed ^= hashed >> 13;
+  return hashed;
+}
+
+#ifndef USE_ALIST_ENV
+
+/*
+ * In this implementation, each frame of the environment may be
+ * a hash table: a vector of alists hashed by variable name.
+ * In practice, we use a vector only for the initial frame;
+ * subsequent frames are too small and transient for the lookup
+ * speed to out-weigh the cost of making a new vector.
+ */
+
+static void new_frame_in_env(scheme * sc, pointer old_env) {
+  pointer new_frame;
+
+  /* The interaction-environment has about 300 variables in it. */
+  if (old_env == sc->NIL) {
+    new_frame = mk_vector(sc, 461);
+  } else {
+    new_frame = sc->NIL;
+  }
+
+  sc->envir = immutable_cons(sc, new_frame, old_env);
+  setenvironment(sc->envir);
+}
+
+static INLINE void new_slot_spec_in_env(scheme * sc, pointer env,
+    pointer variable, pointer value) {
+  pointer slot;
+
+  if (env != sc->global_env) {
+    setlocal(variable);
+  }
+  if (is_frame(car(env))) {
+    new_slot_in_frame(sc, car(env), variable, value);
+    return;
+  }
+  slot = immutable_cons(sc, variable, value);
+  if (is_vector(car(env))) {
+    int location = symhash(variable) % vector_length(car(env));
+
+    set_vector_elem(car(env), location,
+        immutable_cons(sc, slot, vector_elem(car(env), location)));
+  } else {
+    slot = immutable_cons(sc, slot, car(env));
+    gc_barrier(env, slot);
+    car(env) = slot;
+  }
+}
+
+static pointer find_slot_in_env(scheme * sc, pointer env, pointer hdl,
+    int all) {
+  pointer x, y;
+  int location;
+
+  for (x = env; x != sc->NIL; x = cdr(x)) {
+    if (is_frame(car(x))) {
+      y = find_slot_in_frame(sc, car(x), hdl);
+      if (y != sc->NIL || !all) {
+        return y;
+      }
+      continue;
+    }
+    if (is_vector(car(x))) {
+      location = symhash(hdl) % vector_length(car(x));
+      y = vector_elem(car(x), location);
+    } else {
+      y = car(x);
+    }
+    for (; y != sc->NIL; y = cdr(y)) {
+      if (caar(y) == hdl) {
+        break;
+      }
+    }
+    if (y != sc->NIL) {
+      break;
+    }
+    if (!all) {
+      return sc->NIL;
+    }
+  }
+  if (x != sc->NIL) {
+    return car(y);
+  }
+  return sc->NIL;
+}
+
+#else /* USE_ALIST_ENV */
+
+static INLINE void new_frame_in_env(scheme * sc, pointer old_env) {
+  sc->envir = immutable_cons(sc, sc->NIL, old_env);
+  setenvironment(sc->envir);
+}
+
+static INLINE void new_slot_spec_in_env(scheme * sc, pointer env,
+    pointer variable, pointer value) {
+  pointer x;
+
+  if (env != sc->global_env) {
+    setlocal(variable);
+  }
+  if (is_frame(car(env))) {
+    new_slot_in_frame(sc, car(env), variable, value);
+    return;
+  }
+  x = immutable_cons(sc, immutable_cons(sc, variable, value), car(env));
+  gc_barrier(env, x);
+  car(env) = x;
+}
+
+static pointer find_slot_in_env(scheme * sc, pointer env, pointer hdl,
+    int all) {
+  pointer x, y;
+  for (x = env; x != sc->NIL; x = cdr(x)) {
+    if (is_frame(car(x))) {
+      y = find_slot_in_frame(sc, car(x), hdl);
+      if (y != sc->NIL || !all) {
+        return y;
+      }
+      continue;
+    }
+    for (y = car(x); y != sc->NIL; y = cdr(y)) {
+      if (caar(y) == hdl) {
+        break;
+      }
+    }
+    if (y != sc->NIL) {
+      break;
+    }
+    if (!all) {
+      return sc->NIL;
+    }
+  }
+  if (x != sc->NIL) {
+    return car(y);
+  }
+  return sc->NIL;
+}
+
+#endif /* USE_ALIST_ENV else */
+
+static INLINE void new_slot_in_env(scheme * sc, pointer variable,
+    pointer value) {
+  new_slot_spec_in_env(sc, sc->envir, variable, value);
+}
+
+static INLINE void set_slot_in_env(pointer slot, pointer value) {
+  gc_barrier(slot, value);
+  cdr(slot) = value;
+}
+
+static INLINE pointer slot_value_in_env(pointer slot) {
+  return cdr(slot);
+}
+
+/* ========== Evaluation Cycle ========== */
+
+
+static pointer _Error_1(scheme * sc, const char *s, pointer a) {
+  const char *str = s;
+  enum scheme_opcodes op = OP_ERR0;
+#if USE_ERROR_HOOK
+  pointer x;
+  pointer hdl = sc->ERROR_HOOK;
+#endif
+
+#if SHOW_ERROR_LINE
+  char sbuf[AUXBUFF_SIZE];
+
+  /* make sure error is not in REPL */
+  if (sc->load_stack[sc->file_i].kind & port_file &&
+      sc->load_stack[sc->file_i].rep.stdio.file != stdin) {
+    int ln = sc->load_stack[sc->file_i].rep.stdio.curr_line;
+    const char *fname = sc->load_stack[sc->file_i].rep.stdio.filename;
+
+    /* should never happen */
+    if (!fname)
+      fname = "<unknown>";
+
+    /* we started from 0 */
+    ln++;
+    snprintf(sbuf, AUXBUFF_SIZE, "(%s : %i) %s", fname, ln, s);
+
+    str = (const char *) sbuf;
+  }
+#endif
+
+#if USE_ERROR_HOOK
+  x = find_slot_in_env(sc, sc->envir, hdl, 1);
+  if (x != sc->NIL && is_proc(slot_value_in_env(x))
+      && procnum(slot_value_in_env(x)) == OP_THROW) {
+    /* the usual hook: no need to evaluate a call to it */
+    op = OP_THROW;
+  } else if (x != sc->NIL) {
+    pointer code;
+
+    /* sc->code is only replaced at the end, the VM may still need it */
+    if (a != 0) {
+      code = cons(sc, cons(sc, sc->QUOTE, cons(sc, (a), sc->NIL)), sc->NIL);
+    } else {
+      code = sc->NIL;
+    }
+    code = cons(sc, mk_string(sc, str), code);
+    setimmutable(car(code));
+    sc->code = cons(sc, slot_value_in_env(x), code);
+    sc->op = (int) OP_EVAL;
+    return sc->T;
+  }
+#endif
+
+  if (a != 0) {
+    sc->args = cons(sc, (a), sc->NIL);
+  } else {
+    sc->args = sc->NIL;
+  }
+  sc->args = cons(sc, mk_string(sc, str), sc->args);
+  setimmutable(car(sc->args));
+  sc->op = (int) op;
+  return sc->T;
+}
+
+#define Error_1(sc,s, a) return _Error_1(sc,s,a)
+#define Error_0(sc,s)    return _Error_1(sc,s,0)
+
+/* Too small to turn into function */
+#define  BEGIN     do {
+#define  END  } while (0)
+#define s_goto(sc,a) BEGIN                                  \
+    sc->op = (int)(a);                                      \
+    s_next(sc); END
+
+#define s_return(sc,a) BEGIN                                \
+    if (_s_return(sc,a) == sc->NIL) {                       \
+      return sc->NIL;                                       \
+    }                                                       \
+    s_next(sc); END
+
+#if USE_THREADING
+/* Go on to sc->op: straight to its label if it is an op of this
+   opexe_N and Eval_Cycle has nothing to do before it, else back
+   through Eval_Cycle. */
+#define s_next(sc) BEGIN                                    \
+    op = (enum scheme_opcodes) sc->op;                      \
+    if (op_labels[op] != 0 && dispatch_table[op].name == 0  \
+        && !sc->compact_due && !sc->no_memory) {            \
+      ok_to_freely_gc(sc);                                  \
+      goto *op_labels[op];                                  \
+    }                                                       \
+    return sc->T; END
+#define OP_CASE(op) case op: L_##op
+#else
+#define s_next(sc) return sc->T
+#define OP_CASE(op) case op
+#endif
+
+/* A fall through comment is not seen in front of OP_CASE. */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define FALL_THROUGH __attribute__ ((fallthrough))
+#else
+#define FALL_THROUGH
+#endif
+
+/*
+ * The dump is a stack of frames in one array, doubled when it fills.
+ * call/cc freezes the frames into vectors of at most DUMP_SEGMENT
+ * frames, each linked to the one below through its first slot, and
+ * sc->dump points to the topmost; a continuation is just that pointer.
+ * A frozen segment is never written again: returning into one copies
+ * it back onto the stack first, so continuations can share segments
+ * and be re-entered any number of times.
+ */
+
+/* this structure holds all the interpreter's registers */
+struct dump_stack_frame {
+  enum scheme_opcodes op;
+  pointer args;
+  pointer envir;
+  pointer code;
+};
+
+#define DUMP_SEGMENT 64         /* most frames frozen in one vector */
+#define FRAME_SLOTS 4           /* vector slots of a frozen frame */
+
+/* Room for n more frames. */
+static int dump_stack_reserve(scheme * sc, int n) {
+  struct dump_stack_frame *p;
+  int size = sc->dump_size == 0 ? 64 : sc->dump_size;
+
+  if (sc->dump_top + n <= sc->dump_size) {
+    return 1;
+  }
+  while (size < sc->dump_top + n) {
+    size *= 2;
+  }
+  p = realloc(sc->dump_base, size * sizeof(struct dump_stack_frame));
+  if (p == 0) {
+    sc->no_memory = 1;
+    return 0;
+  }
+  sc->dump_base = p;
+  sc->dump_size = size;
+  return 1;
+}
+
+static void s_save(scheme * sc, enum scheme_opcodes op, pointer args,
+    pointer code) {
+  struct dump_stack_frame *next_frame;
+
+  if (sc->dump_top == sc->dump_size && !dump_stack_reserve(sc, 1)) {
+    return;
+  }
+  next_frame = (struct dump_stack_frame *) sc->dump_base + sc->dump_top++;
+  next_frame->op = op;
+  next_frame->args = args;
+  next_frame->envir = sc->envir;
+  next_frame->code = code;
+}
+
+#define seg_frames(seg) ((vector_length(seg) - 1) / FRAME_SLOTS)
+
+/* Copy the n lowest frames of a frozen segment onto the stack, which
+   goes on below with the segment's link. */
+static int dump_stack_thaw(scheme * sc, pointer seg, int n) {
+  pointer *v = &vector_slot(seg, 1);
+  struct dump_stack_frame *frame;
+  int i;
+
+  if (!dump_stack_reserve(sc, n)) {
+    return 0;
+  }
+  frame = (struct dump_stack_frame *) sc->dump_base + sc->dump_top;
+  for (i = 0; i < n; i++, v += FRAME_SLOTS) {
+    frame[i].op = (enum scheme_opcodes) imm_value(v[0]);
+    frame[i].args = v[1];
+    frame[i].envir = v[2];
+    frame[i].code = v[3];
+  }
+  sc->dump_top += n;
+  /* these reverse the values gathered so far in place once done:
+     leave the segment's own list alone for the next return here */
+  for (i = 0; i < n; i++) {
+    if (frame[i].op == OP_E1ARGS || frame[i].op == OP_LET1
+        || frame[i].op == OP_LET1REC) {
+      pointer x = reverse(sc, frame[i].args);
+
+      frame[i].args = reverse_in_place(sc, sc->NIL, x);
+    }
+  }
+  sc->dump = vector_slot(seg, 0);
+  return 1;
+}
+
+static pointer _s_return(scheme * sc, pointer a) {
+  struct dump_stack_frame *frame;
+
+  sc->value = (a);
+  if (sc->dump_top == sc->dump_floor && (sc->dump == sc->NIL
+          || !dump_stack_thaw(sc, sc->dump, seg_frames(sc->dump)))) {
+    return sc->NIL;
+  }
+  frame = (struct dump_stack_frame *) sc->dump_base + --sc->dump_top;
+  sc->op = frame->op;
+  sc->args = frame->args;
+  sc->envir = frame->envir;
+  sc->code = frame->code;
+  return sc->T;
+}
+
+/* Freeze the frames on the stack; what is returned stands for the
+   whole dump from then on. */
+static pointer dump_stack_capture(scheme * sc) {
+  struct dump_stack_frame *base = sc->dump_base;
+  int i = sc->dump_floor;
+
+  while (i < sc->dump_top) {
+    int n = sc->dump_top - i;
+    pointer seg;
+    pointer *v;
+
+    if (n > DUMP_SEGMENT) {
+      n = DUMP_SEGMENT;
+    }
+    seg = mk_vector(sc, 1 + n * FRAME_SLOTS);
+    if (sc->no_memory) {
+      break;
+    }
+    v = &vector_slot(seg, 0);
+    *v++ = sc->dump;
+    for (; n > 0; n--, i++) {
+      *v++ = mk_imm_fixnum(base[i].op);
+      *v++ = base[i].args;
+      *v++ = base[i].envir;
+      *v++ = base[i].code;
+    }
+    sc->dump = seg;
+  }
+  /* whatever could not be frozen stays on the stack */
+  memmove(base + sc->dump_floor, base + i,
+      (sc->dump_top - i) * sizeof(struct dump_stack_frame));
+  sc->dump_top = sc->dump_floor + sc->dump_top - i;
+  return sc->dump;
+}
+
+/* Drop the frames down to the topmost one for op, with args too unless
+   that is 0, and that one as well; *found gets its args.  0 if there
+   is none. */
+static int dump_stack_unwind(scheme * sc, enum scheme_opcodes op,
+    pointer args, pointer * found) {
+  struct dump_stack_frame *base = sc->dump_base;
+  pointer seg;
+  int i;
+
+  for (i = sc->dump_top - 1; i >= sc->dump_floor; i--) {
+    if (base[i].op == op && (args == 0 || base[i].args == args)) {
+      *found = base[i].args;
+      sc->dump_top = i;
+      return 1;
+    }
+  }
+  for (seg = sc->dump; seg != sc->NIL; seg = vector_slot(seg, 0)) {
+    pointer *v = &vector_slot(seg, 1);
+
+    for (i = seg_frames(seg) - 1; i >= 0; i--) {
+      pointer *f = v + i * FRAME_SLOTS;
+
+      if (imm_value(f[0]) == op && (args == 0 || f[1] == args)) {
+        *found = f[1];
+        sc->dump_top = sc->dump_floor;
+        return dump_stack_thaw(sc, seg, i);
+      }
+    }
+  }
+  return 0;
+}
+
+/* Make a captured dump the current one. */
+static INLINE void dump_stack_restore(scheme * sc, pointer d) {
+  sc->dump_top = sc->dump_floor;
+  sc->dump = d;
+}
+
+static INLINE void dump_stack_reset(scheme * sc) {
+  dump_stack_restore(sc, sc->NIL);
+}
+
+/* Have the dump look empty, leaving the frames where they are, until
+   dump_stack_unhide; the caller keeps d reachable meanwhile. */
+static INLINE int dump_stack_hide(scheme * sc) {
+  int held = sc->dump_floor;
+
+  sc->dump_floor = sc->dump_top;
+  sc->dump = sc->NIL;
+  return held;
+}
+
+static INLINE void dump_stack_unhide(scheme * sc, int held, pointer d) {
+  sc->dump_top = sc->dump_floor;
+  sc->dump_floor = held;
+  sc->dump = d;
+}
+
+static INLINE void dump_stack_initialize(scheme * sc) {
+  sc->dump_size = 0;
+  sc->dump_base = NULL;
+  sc->dump_floor = 0;
+  dump_stack_reset(sc);
+}
+
+static void dump_stack_free(scheme * sc) {
+  free(sc->dump_base);
+  sc->dump_base = NULL;
+  sc->dump_size = 0;
+  sc->dump_floor = 0;
+  dump_stack_reset(sc);
+}
+
+static INLINE void dump_stack_mark(scheme * sc) {
+  struct dump_stack_frame *frame = sc->dump_base;
+  int i;
+
+  mark_root(sc, sc->dump);
+  for (i = 0; i < sc->dump_top; i++, frame++) {
+    mark_root(sc, frame->args);
+    mark_root(sc, frame->envir);
+    mark_root(sc, frame->code);
+  }
+}
+
+static void dump_stack_slide(scheme * sc) {
+  struct dump_stack_frame *frame = sc->dump_base;
+  int i;
+
+  slide(sc, sc->dump);
+  for (i = 0; i < sc->dump_top; i++, frame++) {
+    slide(sc, frame->args);
+    slide(sc, frame->envir);
+    slide(sc, frame->code);
+  }
+}
+
+#define s_retbool(tf)    s_return(sc,(tf) ? sc->T : sc->F)
+
+typedef pointer(*dispatch_func) (scheme *, enum scheme_opcodes);
+
+typedef int (*test_predicate) (pointer);
+static int is_any(pointer p) {
+  (void) p;
+  return 1;
+}
+
+static int is_nonneg(pointer p) {
+  return ivalue(p) >= 0 && is_integer(p);
+}
+
+/* Correspond carefully with following defines! */
+static struct {
+  test_predicate fct;
+  const char *kind;
+} tests[] = {
+  {0, 0},                        /* unused */
+  {is_any, 0},
+  {is_string, "string"},
+  {is_symbol, "symbol"},
+  {is_port, "port"},
+  {is_inport, "input port"},
+  {is_outport, "output port"},
+  {is_environment, "environment"},
+  {is_pair, "pair"},
+  {0, "pair or '()"},
+  {is_character, "character"},
+  {is_vector, "vector"},
+  {is_number, "number"},
+  {is_integer, "integer"},
+  {is_nonneg, "non-negative integer"},
+  {is_bvector, "bytevector"},
+};
+
+/* correspond with preceding struct "tests" */
+#define TST_NONE 0
+#define TST_ANY "\001"
+#define TST_STRING "\002"
+#define TST_SYMBOL "\003"
+#define TST_PORT "\004"
+#define TST_INPORT "\005"
+#define TST_OUTPORT "\006"
+#define TST_ENVIRONMENT "\007"
+#define TST_PAIR "\010"
+#define TST_LIST "\011"
+#define TST_CHAR "\012"
+#define TST_VECTOR "\013"
+#define TST_NUMBER "\014"
+#define TST_INTEGER "\015"
+#define TST_NATURAL "\016"
+#define TST_BVECTOR "\017"
+
+#define FIXED_ARGS 3
+
+typedef struct {
+  dispatch_func func;
+  char *name;
+  int min_arity;
+  int max_arity;
+  char *arg_tests_encoding;
+  /* set up by decode_arg_tests: built-ins of fixed arity up to
+     FIXED_ARGS have fixed set and the test of each argument, 0 for
+     any */
+  int fixed;
+  test_predicate fixed_tests[FIXED_ARGS];
+} op_code_info;
+
+#define INF_ARG 0xffff
+
+static op_code_info dispatch_table[] = {
+#define _OP_DEF(A,B,C,D,E,OP) {A,B,C,D,E,0,{0}},
+#include "scm_opdf.h"
+  {0}
+};
+
+#if USE_IMAGE || USE_FASL
+/* what a heap image or a FASL cache takes from the build: the layout
+   of a cell, the options, the opcodes and where the code went.  The
+   date alone is the same for builds with other flags. */
+static const long build_config[] = {
+  sizeof(struct cell), sizeof(pointer), OP_MAXDEFINED, FIXED_ARGS,
+  USE_MATH, USE_CHAR_CLASSIFIERS, USE_STRING_PORTS, USE_ERROR_HOOK,
+  USE_TRACING, USE_COLON_HOOK, USE_PLIST, USE_INTERFACE,
+  USE_PARALLEL_MARK, USE_IMAGE, USE_FASL, USE_THREADING,
+  SHOW_ERROR_LINE, STANDALONE, CASE_SENSITIVE,
+#if USE_DL
+  1,
+#else
+  0,
+#endif
+#ifdef USE_ALIST_ENV
+  1,
+#else
+  0,
+#endif
+};
+
+static unsigned int build_hash(unsigned int h, const void *p, size_t n) {
+  const unsigned char *c = p;
+
+  while (n-- > 0) {
+    h ^= *c++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static const char *build_stamp(void) {
+  static char stamp[48];
+  unsigned int h = 2166136261u;
+  uintptr_t off;
+  int i;
+
+  if (stamp[0] != 0) {
+    return stamp;
+  }
+  h = build_hash(h, __DATE__ " " __TIME__, sizeof(__DATE__ " " __TIME__));
+  h = build_hash(h, build_config, sizeof(build_config));
+  for (i = 0; i < OP_MAXDEFINED; i++) {
+    op_code_info *pcd = dispatch_table + i;
+
+    if (pcd->name != 0) {
+      h = build_hash(h, pcd->name, strlen(pcd->name) + 1);
+    }
+    if (pcd->arg_tests_encoding != 0) {
+      h = build_hash(h, pcd->arg_tests_encoding,
+          strlen(pcd->arg_tests_encoding) + 1);
+    }
+    h = build_hash(h, &pcd->min_arity, sizeof(pcd->min_arity));
+    h = build_hash(h, &pcd->max_arity, sizeof(pcd->max_arity));
+    /* foreign functions are kept as offsets from scheme_init */
+    off = (uintptr_t) pcd->func - (uintptr_t) scheme_init;
+    h = build_hash(h, &off, sizeof(off));
+  }
+  off = (uintptr_t) mk_foreign_func - (uintptr_t) scheme_init;
+  h = build_hash(h, &off, sizeof(off));
+  snprintf(stamp, sizeof(stamp), "%s %08x", VERSION, h);
+  return stamp;
+}
+#endif
+
+static pointer opexe_0(scheme * sc, enum scheme_opcodes op) {
+  pointer x, y;
+#if USE_THREADING
+#define OPEXE_N 0
+#include "scm_optab.h"
+#endif
+
+  switch (op) {
+  OP_CASE(OP_LOAD):                /* load */
+    if (file_interactive(sc)) {
+      fprintf(sc->outport->_object._port->rep.stdio.file,
+          "Loading %s\n", strvalue(car(sc->args)));
+    }
+    if (!file_push(sc, strvalue(car(sc->args)))) {
+      Error_1(sc, "unable to open", car(sc->args));
+    } else {
+      sc->args = mk_integer(sc, sc->file_i);
+      s_goto(sc, OP_T0LVL);
+    }
+
+  OP_CASE(OP_T0LVL):               /* top level */
+    /* If we reached the end of file, this loop is done. */
+    if (sc->loadport->_object._port->kind & port_saw_EOF) {
+#if USE_FASL
+      fasl_finish(sc);
+#endif
+      if (sc->file_i == 0) {
+        sc->args = sc->NIL;
+        s_goto(sc, OP_QUIT);
+      } else {
+        file_pop(sc);
+        s_return(sc, sc->value);
+      }
+      /* NOTREACHED */
+    }
+
+    /* If interactive, be nice to user. */
+    if (file_interactive(sc)) {
+      sc->envir = sc->global_env;
+      dump_stack_reset(sc);
+      putstr(sc, "\n");
+      putstr(sc, prompt);
+    }
+
+    /* Set up another iteration of REPL */
+    sc->nesting = 0;
+    sc->save_inport = sc->inport;
+    sc->inport = sc->loadport;
+    s_save(sc, OP_T0LVL, sc->NIL, sc->NIL);
+    s_save(sc, OP_VALUEPRINT, sc->NIL, sc->NIL);
+    s_save(sc, OP_T1LVL, sc->NIL, sc->NIL);
+#if USE_FASL
+    if (sc->fasl_stack[sc->file_i].replay) {
+      s_return(sc, fasl_next(sc));
+    }
+#endif
+    s_goto(sc, OP_READ_INTERNAL);
+
+  OP_CASE(OP_T1LVL):               /* top level */
+#if USE_FASL
+    fasl_record(sc, sc->value);
+#endif
+    sc->code = sc->value;
+    sc->inport = sc->save_inport;
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_READ_INTERNAL):       /* internal read */
+    sc->tok = token(sc);
+    if (sc->tok == TOK_EOF) {
+      s_return(sc, sc->EOF_OBJ);
+    }
+    s_goto(sc, OP_RDSEXPR);
+
+  OP_CASE(OP_GENSYM):
+    s_return(sc, gensym(sc));
+
+  OP_CASE(OP_VALUEPRINT):          /* print evaluation result */
+    /* OP_VALUEPRINT is always pushed, because when changing from
+       non-interactive to interactive mode, it needs to be
+       already on the stack */
+    if (sc->tracing) {
+      putstr(sc, "\nGives: ");
+    }
+    if (file_interactive(sc)) {
+      sc->print_flag = 1;
+      sc->args = sc->value;
+      s_goto(sc, OP_P0LIST);
+    } else {
+      s_return(sc, sc->value);
+    }
+
+  OP_CASE(OP_EVAL):                /* main part of evaluation */
+    evalcnt += 1;
+#ifdef EVAL_LIMIT
+    if (evalcnt >= eval_limit) {
+        fprintf(stderr, "Eval steps limit reached: %ld\n", evalcnt);
+        exit(7);
+    }
+#endif
+#if USE_TRACING
+    if (sc->tracing) {
+      /*s_save(sc,OP_VALUEPRINT,sc->NIL,sc->NIL); */
+      s_save(sc, OP_REAL_EVAL, sc->args, sc->code);
+      sc->args = sc->code;
+      putstr(sc, "\nEval: ");
+      s_goto(sc, OP_P0LIST);
+    }
+    FALL_THROUGH;
+  OP_CASE(OP_REAL_EVAL):
+#endif
+    if (is_symbol(sc->code)) {  /* symbol */
+      x = find_slot_in_env(sc, sc->envir, sc->code, 1);
+      if (x != sc->NIL) {
+        s_return(sc, slot_value_in_env(x));
+      } else {
+        Error_1(sc, "eval: unbound variable:", sc->code);
+      }
+    } else if (is_pair(sc->code)) {
+      if (is_syntax(x = car(sc->code))) {       /* SYNTAX */
+        sc->code = cdr(sc->code);
+        s_goto(sc, syntaxnum(x));
+      } else {                  /* first, eval top element and eval arguments */
+        s_save(sc, OP_E0ARGS, sc->NIL, sc->code);
+        /* If no macros => s_save(sc,OP_E1ARGS, sc->NIL, cdr(sc->code)); */
+        sc->code = car(sc->code);
+        s_goto(sc, OP_EVAL);
+      }
+    } else {
+      s_return(sc, sc->code);
+    }
+
+  OP_CASE(OP_E0ARGS):              /* eval arguments */
+    if (is_macro(sc->value)) {  /* macro expansion */
+      s_save(sc, OP_DOMACRO, sc->NIL, sc->NIL);
+      sc->args = cons(sc, sc->code, sc->NIL);
+      sc->code = sc->value;
+      s_goto(sc, OP_APPLY);
+    } else {
+      sc->code = cdr(sc->code);
+      s_goto(sc, OP_E1ARGS);
+    }
+
+  OP_CASE(OP_E1ARGS):              /* eval arguments */
+    sc->args = cons(sc, sc->value, sc->args);
+    if (is_pair(sc->code)) {    /* continue */
+      s_save(sc, OP_E1ARGS, sc->args, cdr(sc->code));
+      sc->code = car(sc->code);
+      sc->args = sc->NIL;
+      s_goto(sc, OP_EVAL);
+    } else {                    /* end */
+      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
+      sc->code = car(sc->args);
+      sc->args = cdr(sc->args);
+      s_goto(sc, OP_APPLY);
+    }
+
+#if USE_TRACING
+  OP_CASE(OP_TRACING):{
+      int tr = sc->tracing;
+      sc->tracing = ivalue(car(sc->args));
+      s_return(sc, mk_integer(sc, tr));
+    }
+#endif
+
+  OP_CASE(OP_APPLY):               /* apply 'code' to 'args' */
+#if USE_TRACING
+    if (sc->tracing) {
+      s_save(sc, OP_REAL_APPLY, sc->args, sc->code);
+      sc->print_flag = 1;
+      /*  sc->args=cons(sc,sc->code,sc->args); */
+      putstr(sc, "\nApply to: ");
+      s_goto(sc, OP_P0LIST);
+    }
+    FALL_THROUGH;
+  OP_CASE(OP_REAL_APPLY):
+#endif
+    if (is_proc(sc->code)) {
+      s_goto(sc, procnum(sc->code));    /* PROCEDURE */
+    } else if (is_foreign(sc->code)) {
+      /* Keep nested calls from GC'ing the arglist */
+      push_recent_alloc(sc, sc->args);
+      x = sc->code->_object._ff(sc, sc->args);
+      s_return(sc, x);
+    } else if (is_closure(sc->code) || is_macro(sc->code)
+        || is_promise(sc->code)) {      /* CLOSURE */
+      /* Should not accept promise */
+      if (is_compiled(sc->code)) {
+        int n = vm_push_list(sc, sc->args);
+
+        if (vm_enter_closure(sc, sc->code, n)) {
+          sc->args = sc->NIL;
+          s_goto(sc, OP_VM_RUN);
+        }
+        sc->vm_sp -= n;
+      }
+      /* make environment */
+      new_frame_in_env(sc, closure_env(sc->code));
+      for (x = car(closure_code(sc->code)), y = sc->args;
+          is_pair(x); x = cdr(x), y = cdr(y)) {
+        if (y == sc->NIL) {
+          Error_0(sc, "not enough arguments");
+        } else {
+          new_slot_in_env(sc, car(x), car(y));
+        }
+      }
+      if (x == sc->NIL) {
+                    /*--
+                     * if (y != sc->NIL) {
+                     *   Error_0(sc,"too many arguments");
+                     * }
+                     */
+      } else if (is_symbol(x))
+        new_slot_in_env(sc, x, y);
+      else {
+        Error_1(sc, "syntax error in closure: not a symbol:", x);
+      }
+      sc->args = sc->NIL;
+      sc->code = cdr(closure_code(sc->code));
+      s_goto(sc, OP_BEGIN);
+    } else if (is_continuation(sc->code)) {     /* CONTINUATION */
+      if (cont_escape(sc->code) == sc->NIL) {
+        dump_stack_restore(sc, cont_dump(sc->code));
+      } else if (!dump_stack_unwind(sc, OP_ESCAPE1, sc->code, &x)) {
+        Error_0(sc, "escape continuation is no longer active");
+      }
+      s_return(sc, sc->args != sc->NIL ? car(sc->args) : sc->NIL);
+    } else {
+      Error_0(sc, "illegal function");
+    }
+
+  OP_CASE(OP_DOMACRO):             /* do macro */
+    sc->code = sc->value;
+    s_goto(sc, OP_EVAL);
+
+#if 1
+  OP_CASE(OP_LAMBDA):              /* lambda */
+    /* If the hook is defined, apply it to sc->code, otherwise
+       set sc->value fall thru */
+    {
+      pointer f = find_slot_in_env(sc, sc->envir, sc->COMPILE_HOOK, 1);
+      if (f == sc->NIL) {
+        sc->value = sc->code;
+        /* Fallthru */
+      } else {
+        s_save(sc, OP_LAMBDA1, sc->args, sc->code);
+        sc->args = cons(sc, sc->code, sc->NIL);
+        sc->code = slot_value_in_env(f);
+        s_goto(sc, OP_APPLY);
+      }
+    }
+    FALL_THROUGH;
+
+  OP_CASE(OP_LAMBDA1):
+    s_return(sc, mk_closure(sc, vm_compile_lambda(sc, sc->value, sc->NIL),
+            sc->envir));
+
+#else
+  OP_CASE(OP_LAMBDA):              /* lambda */
+    s_return(sc, mk_closure(sc, sc->code, sc->envir));
+
+#endif
+
+  OP_CASE(OP_MKCLOSURE):           /* make-closure */
+    x = car(sc->args);
+    if (car(x) == sc->LAMBDA) {
+      x = cdr(x);
+    }
+    if (cdr(sc->args) == sc->NIL) {
+      y = sc->envir;
+    } else {
+      y = cadr(sc->args);
+    }
+    s_return(sc, mk_closure(sc, x, y));
+
+  OP_CASE(OP_QUOTE):               /* quote */
+    s_return(sc, car(sc->code));
+
+  OP_CASE(OP_DEF0):                /* define */
+    if (is_immutable(car(sc->code)))
+      Error_1(sc, "define: unable to alter immutable", car(sc->code));
+
+    if (is_pair(car(sc->code))) {
+      x = caar(sc->code);
+      sc->code =
+          cons(sc, sc->LAMBDA, cons(sc, cdar(sc->code), cdr(sc->code)));
+    } else {
+      x = car(sc->code);
+      sc->code = cadr(sc->code);
+    }
+    if (!is_symbol(x)) {
+      Error_0(sc, "variable is not a symbol");
+    }
+    s_save(sc, OP_DEF1, sc->NIL, x);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_DEF1):                /* define */
+    x = find_slot_in_env(sc, sc->envir, sc->code, 0);
+    if (x != sc->NIL) {
+      set_slot_in_env(x, sc->value);
+    } else {
+      new_slot_in_env(sc, sc->code, sc->value);
+    }
+    s_return(sc, sc->code);
+
+
+  OP_CASE(OP_DEFP):                /* defined? */
+    x = sc->envir;
+    if (cdr(sc->args) != sc->NIL) {
+      x = cadr(sc->args);
+    }
+    s_retbool(find_slot_in_env(sc, x, car(sc->args), 1) != sc->NIL);
+
+  OP_CASE(OP_SET0):                /* set! */
+    if (is_immutable(car(sc->code)))
+      Error_1(sc, "set!: unable to alter immutable variable", car(sc->code));
+    s_save(sc, OP_SET1, sc->NIL, car(sc->code));
+    sc->code = cadr(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_SET1):                /* set! */
+    y = find_slot_in_env(sc, sc->envir, sc->code, 1);
+    if (y != sc->NIL) {
+      set_slot_in_env(y, sc->value);
+      s_return(sc, sc->value);
+    } else {
+      Error_1(sc, "set!: unbound variable:", sc->code);
+    }
+
+
+  OP_CASE(OP_BEGIN):               /* begin */
+    if (!is_pair(sc->code)) {
+      s_return(sc, sc->code);
+    }
+    if (cdr(sc->code) != sc->NIL) {
+      s_save(sc, OP_BEGIN, sc->NIL, cdr(sc->code));
+    }
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_IF0):                 /* if */
+    s_save(sc, OP_IF1, sc->NIL, cdr(sc->code));
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_IF1):                 /* if */
+    if (is_true(sc->value))
+      sc->code = car(sc->code);
+    else
+      sc->code = cadr(sc->code);        /* (if #f 1) ==> () because
+                                         * car(sc->NIL) = sc->NIL */
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_LET0):                /* let */
+    sc->args = sc->NIL;
+    sc->value = sc->code;
+    sc->code = is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code);
+    s_goto(sc, OP_LET1);
+
+  OP_CASE(OP_LET1):                /* let (calculate parameters) */
+    sc->args = cons(sc, sc->value, sc->args);
+    if (is_pair(sc->code)) {    /* continue */
+      if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
+        Error_1(sc, "Bad syntax of binding spec in let :", car(sc->code));
+      }
+      s_save(sc, OP_LET1, sc->args, cdr(sc->code));
+      sc->code = cadar(sc->code);
+      sc->args = sc->NIL;
+      s_goto(sc, OP_EVAL);
+    } else {                    /* end */
+      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
+      sc->code = car(sc->args);
+      sc->args = cdr(sc->args);
+      s_goto(sc, OP_LET2);
+    }
+
+  OP_CASE(OP_LET2):                /* let */
+    new_frame_in_env(sc, sc->envir);
+    for (x =
+        is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code), y =
+        sc->args; y != sc->NIL; x = cdr(x), y = cdr(y)) {
+      new_slot_in_env(sc, caar(x), car(y));
+    }
+    if (is_symbol(car(sc->code))) {     /* named let */
+      for (x = cadr(sc->code), sc->args = sc->NIL; x != sc->NIL; x = cdr(x)) {
+        if (!is_pair(x))
+          Error_1(sc, "Bad syntax of binding in let :", x);
+        if (!is_list(sc, car(x)))
+          Error_1(sc, "Bad syntax of binding in let :", car(x));
+        sc->args = cons(sc, caar(x), sc->args);
+      }
+      x = vm_compile_lambda(sc, cons(sc, reverse_in_place(sc, sc->NIL,
+                  sc->args), cddr(sc->code)), sc->NIL);
+      x = mk_closure(sc, x, sc->envir);
+      new_slot_in_env(sc, car(sc->code), x);
+      sc->code = cddr(sc->code);
+      sc->args = sc->NIL;
+    } else {
+      sc->code = cdr(sc->code);
+      sc->args = sc->NIL;
+    }
+    s_goto(sc, OP_BEGIN);
+
+  OP_CASE(OP_LET0AST):             /* let* */
+    if (car(sc->code) == sc->NIL) {
+      new_frame_in_env(sc, sc->envir);
+      sc->code = cdr(sc->code);
+      s_goto(sc, OP_BEGIN);
+    }
+    if (!is_pair(car(sc->code)) || !is_pair(caar(sc->code))
+        || !is_pair(cdaar(sc->code))) {
+      Error_1(sc, "Bad syntax of binding spec in let* :", car(sc->code));
+    }
+    s_save(sc, OP_LET1AST, cdr(sc->code), car(sc->code));
+    sc->code = cadaar(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_LET1AST):             /* let* (make new frame) */
+    new_frame_in_env(sc, sc->envir);
+    s_goto(sc, OP_LET2AST);
+
+  OP_CASE(OP_LET2AST):             /* let* (calculate parameters) */
+    new_slot_in_env(sc, caar(sc->code), sc->value);
+    sc->code = cdr(sc->code);
+    if (is_pair(sc->code)) {    /* continue */
+      s_save(sc, OP_LET2AST, sc->args, sc->code);
+      sc->code = cadar(sc->code);
+      sc->args = sc->NIL;
+      s_goto(sc, OP_EVAL);
+    } else {                    /* end */
+      sc->code = sc->args;
+      sc->args = sc->NIL;
+      s_goto(sc, OP_BEGIN);
+    }
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
+  }
+  return sc->T;
+}
+
+static pointer opexe_1(scheme * sc, enum scheme_opcodes op) {
+  pointer x, y;
+#if USE_THREADING
+#define OPEXE_N 1
+#include "scm_optab.h"
+#endif
+
+  switch (op) {
+  OP_CASE(OP_LET0REC):             /* letrec */
+    new_frame_in_env(sc, sc->envir);
+    sc->args = sc->NIL;
+    sc->value = sc->code;
+    sc->code = car(sc->code);
+    s_goto(sc, OP_LET1REC);
+
+  OP_CASE(OP_LET1REC):             /* letrec (calculate parameters) */
+    sc->args = cons(sc, sc->value, sc->args);
+    if (is_pair(sc->code)) {    /* continue */
+      if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
+        Error_1(sc, "Bad syntax of binding spec in letrec :", car(sc->code));
+      }
+      s_save(sc, OP_LET1REC, sc->args, cdr(sc->code));
+      sc->code = cadar(sc->code);
+      sc->args = sc->NIL;
+      s_goto(sc, OP_EVAL);
+    } else {                    /* end */
+      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
+      sc->code = car(sc->args);
+      sc->args = cdr(sc->args);
+      s_goto(sc, OP_LET2REC);
+    }
+
+  OP_CASE(OP_LET2REC):             /* letrec */
+    for (x = car(sc->code), y = sc->args; y != sc->NIL;
+        x = cdr(x), y = cdr(y)) {
+      new_slot_in_env(sc, caar(x), car(y));
+    }
+    sc->code = cdr(sc->code);
+    sc->args = sc->NIL;
+    s_goto(sc, OP_BEGIN);
+
+  OP_CASE(OP_COND0):               /* cond */
+    if (!is_pair(sc->code)) {
+      Error_0(sc, "syntax error in cond");
+    }
+    s_save(sc, OP_COND1, sc->NIL, sc->code);
+    sc->code = caar(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_COND1):               /* cond */
+    if (is_true(sc->value)) {
+      if ((sc->code = cdar(sc->code)) == sc->NIL) {
+        s_return(sc, sc->value);
+      }
+      if (!sc->code || car(sc->code) == sc->FEED_TO) {
+        if (!is_pair(cdr(sc->code))) {
+          Error_0(sc, "syntax error in cond");
+        }
+        x = cons(sc, sc->QUOTE, cons(sc, sc->value, sc->NIL));
+        sc->code = cons(sc, cadr(sc->code), cons(sc, x, sc->NIL));
+        s_goto(sc, OP_EVAL);
+      }
+      s_goto(sc, OP_BEGIN);
+    } else {
+      if ((sc->code = cdr(sc->code)) == sc->NIL) {
+        s_return(sc, sc->NIL);
+      } else {
+        s_save(sc, OP_COND1, sc->NIL, sc->code);
+        sc->code = caar(sc->code);
+        s_goto(sc, OP_EVAL);
+      }
+    }
+
+  OP_CASE(OP_DELAY):               /* delay */
+    x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
+    typeflag(x) = T_PROMISE;
+    s_return(sc, x);
+
+  OP_CASE(OP_AND0):                /* and */
+    if (sc->code == sc->NIL) {
+      s_return(sc, sc->T);
+    }
+    s_save(sc, OP_AND1, sc->NIL, cdr(sc->code));
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_AND1):                /* and */
+    if (is_false(sc->value)) {
+      s_return(sc, sc->value);
+    } else if (sc->code == sc->NIL) {
+      s_return(sc, sc->value);
+    } else {
+      s_save(sc, OP_AND1, sc->NIL, cdr(sc->code));
+      sc->code = car(sc->code);
+      s_goto(sc, OP_EVAL);
+    }
+
+  OP_CASE(OP_OR0):                 /* or */
+    if (sc->code == sc->NIL) {
+      s_return(sc, sc->F);
+    }
+    s_save(sc, OP_OR1, sc->NIL, cdr(sc->code));
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_OR1):                 /* or */
+    if (is_true(sc->value)) {
+      s_return(sc, sc->value);
+    } else if (sc->code == sc->NIL) {
+      s_return(sc, sc->value);
+    } else {
+      s_save(sc, OP_OR1, sc->NIL, cdr(sc->code));
+      sc->code = car(sc->code);
+      s_goto(sc, OP_EVAL);
+    }
+
+  OP_CASE(OP_C0STREAM):            /* cons-stream */
+    s_save(sc, OP_C1STREAM, sc->NIL, cdr(sc->code));
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_C1STREAM):            /* cons-stream */
+    sc->args = sc->value;       /* save sc->value to register sc->args for gc */
+    x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
+    typeflag(x) = T_PROMISE;
+    s_return(sc, cons(sc, sc->args, x));
+
+  OP_CASE(OP_MACRO0):              /* macro */
+    if (is_pair(car(sc->code))) {
+      x = caar(sc->code);
+      sc->code =
+          cons(sc, sc->LAMBDA, cons(sc, cdar(sc->code), cdr(sc->code)));
+    } else {
+      x = car(sc->code);
+      sc->code = cadr(sc->code);
+    }
+    if (!is_symbol(x)) {
+      Error_0(sc, "variable is not a symbol");
+    }
+    s_save(sc, OP_MACRO1, sc->NIL, x);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_MACRO1):              /* macro */
+    typeflag(sc->value) = T_MACRO;
+    x = find_slot_in_env(sc, sc->envir, sc->code, 0);
+    if (x != sc->NIL) {
+      set_slot_in_env(x, sc->value);
+    } else {
+      new_slot_in_env(sc, sc->code, sc->value);
+    }
+    s_return(sc, sc->code);
+
+  OP_CASE(OP_CASE0):               /* case */
+    s_save(sc, OP_CASE1, sc->NIL, cdr(sc->code));
+    sc->code = car(sc->code);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_CASE1):               /* case */
+    for (x = sc->code; x != sc->NIL; x = cdr(x)) {
+      if (!is_pair(y = caar(x))) {
+        break;
+      }
+      for (; y != sc->NIL; y = cdr(y)) {
+        if (eqv(car(y), sc->value)) {
+          break;
+        }
+      }
+      if (y != sc->NIL) {
+        break;
+      }
+    }
+    if (x != sc->NIL) {
+      if (is_pair(caar(x))) {
+        sc->code = cdar(x);
+        s_goto(sc, OP_BEGIN);
+      } else {                  /* else */
+        s_save(sc, OP_CASE2, sc->NIL, cdar(x));
+        sc->code = caar(x);
+        s_goto(sc, OP_EVAL);
+      }
+    } else {
+      s_return(sc, sc->NIL);
+    }
+
+  OP_CASE(OP_CASE2):               /* case */
+    if (is_true(sc->value)) {
+      s_goto(sc, OP_BEGIN);
+    } else {
+      s_return(sc, sc->NIL);
+    }
+
+  OP_CASE(OP_PAPPLY):              /* apply */
+    sc->code = car(sc->args);
+    sc->args = list_star(sc, cdr(sc->args));
+    /*sc->args = cadr(sc->args); */
+    s_goto(sc, OP_APPLY);
+
+  OP_CASE(OP_PEVAL):               /* eval */
+    if (cdr(sc->args) != sc->NIL) {
+      sc->envir = cadr(sc->args);
+    }
+    sc->code = car(sc->args);
+    s_goto(sc, OP_EVAL);
+
+  OP_CASE(OP_CONTINUATION):        /* call-with-current-continuation */
+    sc->code = car(sc->args);
+    sc->args = cons(sc, mk_continuation(sc, dump_stack_capture(sc)), sc->NIL);
+    s_goto(sc, OP_APPLY);
+
+  OP_CASE(OP_ESCAPE):              /* call-with-escape-continuation */
+    x = mk_continuation(sc, sc->NIL);
+    cont_escape(x) = sc->T;
+    /* good for as long as this frame is on the dump */
+    s_save(sc, OP_ESCAPE1, x, sc->NIL);
+    sc->code = car(sc->args);
+    sc->args = cons(sc, x, sc->NIL);
+    s_goto(sc, OP_APPLY);
+
+  OP_CASE(OP_ESCAPE1):
+  OP_CASE(OP_CATCH1):
+    s_return(sc, sc->value);
+
+  OP_CASE(OP_CATCH):               /* call-with-handler */
+    s_save(sc, OP_CATCH1, car(sc->args), sc->NIL);
+    sc->code = cadr(sc->args);
+    sc->args = sc->NIL;
+    s_goto(sc, OP_APPLY);
+
+  OP_CASE(OP_THROW):               /* throw */
+    if (!dump_stack_unwind(sc, OP_CATCH1, 0, &x)) {
+      /* not caught: the arguments are an error's */
+      s_goto(sc, OP_ERR0);
+    }
+    sc->code = x;
+    sc->args = sc->NIL;
+    s_goto(sc, OP_APPLY);
+
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
+  }
+  return sc->T;
+}
+
+static pointer opexe_2(scheme * sc, enum scheme_opcodes op) {
   pointer x, y;
+  num v;
+#if USE_MATH
+  double dd;
+#endif
+#if USE_THREADING
+#define OPEXE_N 2
+#include "scm_optab.h"
+#endif
 
   switch (op) {
-  case OP_LOAD:                /* load */
-    if (file_interactive(sc)) {
-      fprintf(sc->outport->_object._port->rep.stdio.file,
-          "Loading %s\n", strvalue(car(sc->args)));
+#if USE_MATH
+  OP_CASE(OP_INEX2EX):             /* exact */
+    x = car(sc->args);
+    if (num_is_integer(x)) {
+      s_return(sc, x);
+    } else if (modf(rvalue_unchecked(x), &dd) == 0.0) {
+      s_return(sc, mk_integer(sc, ivalue(x)));
+    } else {
+      Error_1(sc, "argument not integral:", x);
     }
-    if (!file_push(sc, strvalue(car(sc->args)))) {
-      Error_1(sc, "unable to open", car(sc->args));
+
+  OP_CASE(OP_EXP):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, exp(rvalue(x))));
+
+  OP_CASE(OP_LOG):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, log(rvalue(x))));
+
+  OP_CASE(OP_SIN):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, sin(rvalue(x))));
+
+  OP_CASE(OP_COS):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, cos(rvalue(x))));
+
+  OP_CASE(OP_TAN):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, tan(rvalue(x))));
+
+  OP_CASE(OP_ASIN):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, asin(rvalue(x))));
+
+  OP_CASE(OP_ACOS):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, acos(rvalue(x))));
+
+  OP_CASE(OP_ATAN):
+    x = car(sc->args);
+    if (cdr(sc->args) == sc->NIL) {
+      s_return(sc, mk_real(sc, atan(rvalue(x))));
     } else {
-      sc->args = mk_integer(sc, sc->file_i);
-      s_goto(sc, OP_T0LVL);
+      y = cadr(sc->args);
+      s_return(sc, mk_real(sc, atan2(rvalue(x), rvalue(y))));
+    }
+
+  OP_CASE(OP_SQRT):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, sqrt(rvalue(x))));
+
+  OP_CASE(OP_EXPT):{
+      double result;
+      int real_result = 1;
+      x = car(sc->args);
+      y = cadr(sc->args);
+      if (num_is_integer(x) && num_is_integer(y))
+        real_result = 0;
+      result = pow(rvalue(x), rvalue(y));
+      /* Before returning integer result make sure we can. */
+      /* If the test fails, result is too big for integer. */
+      if (!real_result) {
+        long result_as_long = (long) result;
+        if (result != (double) result_as_long)
+          real_result = 1;
+      }
+      if (real_result) {
+        s_return(sc, mk_real(sc, result));
+      } else {
+        s_return(sc, mk_integer(sc, result));
+      }
+    }
+
+  OP_CASE(OP_FLOOR):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, floor(rvalue(x))));
+
+  OP_CASE(OP_CEILING):
+    x = car(sc->args);
+    s_return(sc, mk_real(sc, ceil(rvalue(x))));
+
+  OP_CASE(OP_ROUND):
+    x = car(sc->args);
+    if (num_is_integer(x))
+      s_return(sc, x);
+    s_return(sc, mk_real(sc, round_per_R5RS(rvalue(x))));
+#endif
+
+  OP_CASE(OP_ADD):                 /* + */
+    v = num_zero;
+    for (x = sc->args; x != sc->NIL; x = cdr(x)) {
+      v = num_add(v, nvalue(car(x)));
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_MUL):                 /* * */
+    v = num_one;
+    for (x = sc->args; x != sc->NIL; x = cdr(x)) {
+      v = num_mul(v, nvalue(car(x)));
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_SUB):                 /* - */
+    if (cdr(sc->args) == sc->NIL) {
+      x = sc->args;
+      v = num_zero;
+    } else {
+      x = cdr(sc->args);
+      v = nvalue(car(sc->args));
+    }
+    for (; x != sc->NIL; x = cdr(x)) {
+      v = num_sub(v, nvalue(car(x)));
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_DIV):                 /* / */
+    if (cdr(sc->args) == sc->NIL) {
+      x = sc->args;
+      v = num_one;
+    } else {
+      x = cdr(sc->args);
+      v = nvalue(car(sc->args));
+    }
+    for (; x != sc->NIL; x = cdr(x)) {
+      v = num_div(v, nvalue(car(x)));
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_REM):                 /* remainder */
+    v = nvalue(car(sc->args));
+    x = cadr(sc->args);
+    if (ivalue(x) != 0)
+      v = num_rem(v, nvalue(x));
+    else {
+      Error_0(sc, "remainder: division by zero");
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_MOD):                 /* modulo */
+    v = nvalue(car(sc->args));
+    x = cadr(sc->args);
+    if (ivalue(x) != 0)
+      v = num_mod(v, nvalue(x));
+    else {
+      Error_0(sc, "modulo: division by zero");
+    }
+    s_return(sc, mk_number(sc, v));
+
+  OP_CASE(OP_CAR):                 /* car */
+    s_return(sc, caar(sc->args));
+
+  OP_CASE(OP_CDR):                 /* cdr */
+    s_return(sc, cdar(sc->args));
+
+  OP_CASE(OP_CONS):                /* cons */
+    s_return(sc, cons(sc, car(sc->args), cadr(sc->args)));
+
+  OP_CASE(OP_SETCAR):              /* set-car! */
+    if (!is_immutable(car(sc->args))) {
+      gc_barrier(car(sc->args), cadr(sc->args));
+      caar(sc->args) = cadr(sc->args);
+      s_return(sc, car(sc->args));
+    } else {
+      Error_0(sc, "set-car!: unable to alter immutable pair");
+    }
+
+  OP_CASE(OP_SETCDR):              /* set-cdr! */
+    if (!is_immutable(car(sc->args))) {
+      gc_barrier(car(sc->args), cadr(sc->args));
+      cdar(sc->args) = cadr(sc->args);
+      s_return(sc, car(sc->args));
+    } else {
+      Error_0(sc, "set-cdr!: unable to alter immutable pair");
+    }
+
+  OP_CASE(OP_CHAR2INT):            /* char->integer */
+    s_return(sc, mk_integer(sc, charvalue(car(sc->args))));
+
+  OP_CASE(OP_INT2CHAR):            /* integer->char */
+    s_return(sc, mk_character(sc, (int) ivalue(car(sc->args))));
+
+  OP_CASE(OP_CHARUPCASE):{
+      unsigned char c;
+      c = (unsigned char) ivalue(car(sc->args));
+      c = toupper(c);
+      s_return(sc, mk_character(sc, (char) c));
+    }
+
+  OP_CASE(OP_CHARDNCASE):{
+      unsigned char c;
+      c = (unsigned char) ivalue(car(sc->args));
+      c = tolower(c);
+      s_return(sc, mk_character(sc, (char) c));
+    }
+
+  OP_CASE(OP_STR2SYM):             /* string->symbol */
+    s_return(sc, mk_symbol(sc, strvalue(car(sc->args))));
+
+  OP_CASE(OP_STR2ATOM):            /* string->atom */  {
+      char *s = strvalue(car(sc->args));
+      long pf = 0;
+      if (cdr(sc->args) != sc->NIL) {
+        /* we know cadr(sc->args) is a natural number */
+        /* see if it is 2, 8, 10, or 16, or error */
+        pf = ivalue(cadr(sc->args));
+        if (pf < 2 || pf > 36) {
+          pf = -1;
+        }
+      }
+      if (pf < 0) {
+        Error_1(sc, "string->atom: bad base:", cadr(sc->args));
+      } else if (*s == '#') {   /* no use of base! */
+        s_return(sc, mk_sharp_const(sc, s + 1));
+      } else {
+        if (pf == 0 || pf == 10) {
+          s_return(sc, mk_atom(sc, s));
+        } else {
+          char *ep;
+          long iv = strtol(s, &ep, (int) pf);
+          if (*ep == 0) {
+            s_return(sc, mk_integer(sc, iv));
+          } else {
+            s_return(sc, sc->F);
+          }
+        }
+      }
     }
 
-  case OP_T0LVL:               /* top level */
-    /* If we reached the end of file, this loop is done. */
-    if (sc->loadport->_object._port->kind & port_saw_EOF) {
-      if (sc->file_i == 0) {
-        sc->args = sc->NIL;
-        s_goto(sc, OP_QUIT);
+  OP_CASE(OP_SYM2STR):             /* symbol->string */
+    x = mk_string(sc, symname(car(sc->args)));
+    setimmutable(x);
+    s_return(sc, x);
+
+  OP_CASE(OP_ATOM2STR):            /* atom->string */  {
+      long pf = 0;
+      x = car(sc->args);
+      y = cdr(sc->args);
+      if (y != sc->NIL) {
+        /* we know cadr(sc->args) is a natural number */
+        /* see if it is 2, 8, 10, or 16, or error */
+        y = car(y);
+        pf = ivalue(y);
+        if (!is_number(x) || pf < 2 || pf > 36) {
+          pf = -1;
+        }
+      }
+      if (pf < 0) {
+        Error_1(sc, "atom->string: bad base:", y);
+      } else if (is_number(x) || is_character(x) || is_string(x)
+          || is_symbol(x)) {
+        char *p;
+        int len;
+        atom2str(sc, x, (int) pf, &p, &len);
+        s_return(sc, mk_counted_string(sc, p, len));
+      } else {
+        Error_1(sc, "atom->string: not an atom:", x);
+      }
+    }
+
+  OP_CASE(OP_MKSTRING):{           /* make-string */
+      int fill = ' ';
+      int len, i, w;
+      char buf[5];
+      char* s;
+      pointer p;
+
+      len = ivalue(car(sc->args));
+
+      if (cdr(sc->args) != sc->NIL) {
+        fill = charvalue(cadr(sc->args));
+      }
+      if (IS_ASCII(fill)) {
+        p = mk_counted_string(sc, 0, len);
+        s = strvalue(p);
+        memset(s, (char) fill, len);
+        s[len] = 0;
       } else {
-        file_pop(sc);
-        s_return(sc, sc->value);
+        char_to_utf8(fill, buf, &w);
+        s = store_string(sc, len * w, 0, len);
+        for (i = 0; s != 0 && i < len; i++) {
+          memcpy(s + i * w, buf, w);
+        }
+        p = get_cell(sc, sc->NIL, sc->NIL);
+        typeflag(p) = (T_STRING | T_ATOM);
+        set_string_buffer(p, s, len * w, len);
       }
-      /* NOTREACHED */
+      s_return(sc, p);
     }
 
-    /* If interactive, be nice to user. */
-    if (file_interactive(sc)) {
-      sc->envir = sc->global_env;
-      dump_stack_reset(sc);
-      putstr(sc, "\n");
-      putstr(sc, prompt);
-    }
+  OP_CASE(OP_STRLEN):              /* string-length */
+    s_return(sc, mk_integer(sc, strlength(car(sc->args))));
 
-    /* Set up another iteration of REPL */
-    sc->nesting = 0;
-    sc->save_inport = sc->inport;
-    sc->inport = sc->loadport;
-    s_save(sc, OP_T0LVL, sc->NIL, sc->NIL);
-    s_save(sc, OP_VALUEPRINT, sc->NIL, sc->NIL);
-    s_save(sc, OP_T1LVL, sc->NIL, sc->NIL);
-    s_goto(sc, OP_READ_INTERNAL);
+  OP_CASE(OP_STRREF):{             /* string-ref */
+      int index;
 
-  case OP_T1LVL:               /* top level */
-    sc->code = sc->value;
-    sc->inport = sc->save_inport;
-    s_goto(sc, OP_EVAL);
+      x = cadr(sc->args);
+      if (!is_integer(x)) {
+        Error_1(sc, "string-ref: index must be exact:", x);
+      }
 
-  case OP_READ_INTERNAL:       /* internal read */
-    sc->tok = token(sc);
-    if (sc->tok == TOK_EOF) {
-      s_return(sc, sc->EOF_OBJ);
+      index = ivalue(x);
+      if (index >= strlength(car(sc->args))) {
+        Error_1(sc, "string-ref: out of bounds:", x);
+      }
+
+      s_return(sc, mk_character(sc,
+        is_utf8(car(sc->args))
+          ? utf8_decode(string_at(car(sc->args), index))
+          : ((unsigned char *) strvalue(car(sc->args)))[index]));
     }
-    s_goto(sc, OP_RDSEXPR);
 
-  case OP_GENSYM:
-    s_return(sc, gensym(sc));
+  OP_CASE(OP_STRSET):{             /* string-set! */
+      char *str;
+      char *q;
+      char buf[5];
+      int index;
+      int c;
+      int w;
+      int old;
+      int size;
 
-  case OP_VALUEPRINT:          /* print evaluation result */
-    /* OP_VALUEPRINT is always pushed, because when changing from
-       non-interactive to interactive mode, it needs to be
-       already on the stack */
-    if (sc->tracing) {
-      putstr(sc, "\nGives: ");
-    }
-    if (file_interactive(sc)) {
-      sc->print_flag = 1;
-      sc->args = sc->value;
-      s_goto(sc, OP_P0LIST);
-    } else {
-      s_return(sc, sc->value);
-    }
+      x = car(sc->args);
+      if (is_immutable(x)) {
+        Error_1(sc, "string-set!: unable to alter immutable string:", x);
+      }
+      str = strvalue(x);
 
-  case OP_EVAL:                /* main part of evaluation */
-    evalcnt += 1;
-#ifdef EVAL_LIMIT
-    if (evalcnt >= eval_limit) {
-        fprintf(stderr, "Eval steps limit reached: %ld\n", evalcnt);
-        exit(7);
-    }
-#endif
-#if USE_TRACING
-    if (sc->tracing) {
-      /*s_save(sc,OP_VALUEPRINT,sc->NIL,sc->NIL); */
-      s_save(sc, OP_REAL_EVAL, sc->args, sc->code);
-      sc->args = sc->code;
-      putstr(sc, "\nEval: ");
-      s_goto(sc, OP_P0LIST);
+      y = cadr(sc->args);
+      if (!is_integer(y)) {
+        Error_1(sc, "string-set!: index must be exact:", y);
+      }
+
+      index = ivalue(y);
+      if (index >= strlength(x)) {
+        Error_1(sc, "string-set!: out of bounds:", y);
+      }
+
+      c = charvalue(caddr(sc->args));
+
+      if (!is_utf8(x) && IS_ASCII(c)) {
+        str[index] = (char) c;
+        s_return(sc, x);
+      }
+      str = string_at(x, index);
+      old = is_utf8(x) ? utf8_next(str) - str : 1;
+      char_to_utf8(c, buf, &w);
+      if (w == 0) {
+        w = 1;                  /* the NUL char */
+      }
+      if (w == old) {
+        memcpy(str, buf, w);
+        s_return(sc, x);
+      }
+      /* the bytes of the char change in number: make a new buffer */
+      size = strsize(x) + w - old;
+      q = store_string(sc, size, 0, strlength(x));
+      if (q == 0) {
+        s_return(sc, x);
+      }
+      memcpy(q, strvalue(x), str - strvalue(x));
+      memcpy(q + (str - strvalue(x)), buf, w);
+      memcpy(q + (str - strvalue(x)) + w, str + old,
+          strsize(x) - (str - strvalue(x)) - old);
+      c = strlength(x);
+      if (!is_short(x)) {
+        sc->free(bufvalue(x));
+      }
+      set_string_buffer(x, q, size, c);
+      s_return(sc, x);
     }
-    /* fall through */
-  case OP_REAL_EVAL:
-#endif
-    if (is_symbol(sc->code)) {  /* symbol */
-      x = find_slot_in_env(sc, sc->envir, sc->code, 1);
-      if (x != sc->NIL) {
-        s_return(sc, slot_value_in_env(x));
+
+  OP_CASE(OP_STRAPPEND):{ /* string-append in core for speed*/
+      int len = 0, chars = 0;
+      pointer newstr = sc->NIL;
+      char *pos, *s;
+
+      /* compute needed length for new string */
+      for (x = sc->args; x != sc->NIL; x = cdr(x)) {
+        len += strsize(car(x));
+        chars += strlength(car(x));
+      }
+      if (chars == len) {
+        newstr = mk_counted_string(sc, 0, len);
+        s = strvalue(newstr);
       } else {
-        Error_1(sc, "eval: unbound variable:", sc->code);
+        s = store_string(sc, len, 0, chars);
       }
-    } else if (is_pair(sc->code)) {
-      if (is_syntax(x = car(sc->code))) {       /* SYNTAX */
-        sc->code = cdr(sc->code);
-        s_goto(sc, syntaxnum(x));
-      } else {                  /* first, eval top element and eval arguments */
-        s_save(sc, OP_E0ARGS, sc->NIL, sc->code);
-        /* If no macros => s_save(sc,OP_E1ARGS, sc->NIL, cdr(sc->code)); */
-        sc->code = car(sc->code);
-        s_goto(sc, OP_EVAL);
+      /* store the contents of the argument strings into the new string */
+      for (pos = s, x = sc->args; s != 0 && x != sc->NIL;
+          pos += strsize(car(x)), x = cdr(x)) {
+        memcpy(pos, strvalue(car(x)), strsize(car(x)));
       }
-    } else {
-      s_return(sc, sc->code);
+      if (chars != len) {
+        newstr = get_cell(sc, sc->NIL, sc->NIL);
+        typeflag(newstr) = (T_STRING | T_ATOM);
+        set_string_buffer(newstr, s, len, chars);
+      }
+      s_return(sc, newstr);
     }
 
-  case OP_E0ARGS:              /* eval arguments */
-    if (is_macro(sc->value)) {  /* macro expansion */
-      s_save(sc, OP_DOMACRO, sc->NIL, sc->NIL);
-      sc->args = cons(sc, sc->code, sc->NIL);
-      sc->code = sc->value;
-      s_goto(sc, OP_APPLY);
-    } else {
-      sc->code = cdr(sc->code);
-      s_goto(sc, OP_E1ARGS);
-    }
+  OP_CASE(OP_SUBSTR):{             /* substring */
+      char *str;
+      int index0;
+      int index1;
+      int len;
 
-  case OP_E1ARGS:              /* eval arguments */
-    sc->args = cons(sc, sc->value, sc->args);
-    if (is_pair(sc->code)) {    /* continue */
-      s_save(sc, OP_E1ARGS, sc->args, cdr(sc->code));
-      sc->code = car(sc->code);
-      sc->args = sc->NIL;
-      s_goto(sc, OP_EVAL);
-    } else {                    /* end */
-      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
-      sc->code = car(sc->args);
-      sc->args = cdr(sc->args);
-      s_goto(sc, OP_APPLY);
-    }
+      index0 = ivalue(cadr(sc->args));
 
-#if USE_TRACING
-  case OP_TRACING:{
-      int tr = sc->tracing;
-      sc->tracing = ivalue(car(sc->args));
-      s_return(sc, mk_integer(sc, tr));
-    }
-#endif
+      if (index0 > strlength(car(sc->args))) {
+        Error_1(sc, "substring: start out of bounds:", cadr(sc->args));
+      }
 
-  case OP_APPLY:               /* apply 'code' to 'args' */
-#if USE_TRACING
-    if (sc->tracing) {
-      s_save(sc, OP_REAL_APPLY, sc->args, sc->code);
-      sc->print_flag = 1;
-      /*  sc->args=cons(sc,sc->code,sc->args); */
-      putstr(sc, "\nApply to: ");
-      s_goto(sc, OP_P0LIST);
-    }
-    /* fall through */
-  case OP_REAL_APPLY:
-#endif
-    if (is_proc(sc->code)) {
-      s_goto(sc, procnum(sc->code));    /* PROCEDURE */
-    } else if (is_foreign(sc->code)) {
-      /* Keep nested calls from GC'ing the arglist */
-      push_recent_alloc(sc, sc->args, sc->NIL);
-      x = sc->code->_object._ff(sc, sc->args);
-      s_return(sc, x);
-    } else if (is_closure(sc->code) || is_macro(sc->code)
-        || is_promise(sc->code)) {      /* CLOSURE */
-      /* Should not accept promise */
-      /* make environment */
-      new_frame_in_env(sc, closure_env(sc->code));
-      for (x = car(closure_code(sc->code)), y = sc->args;
-          is_pair(x); x = cdr(x), y = cdr(y)) {
-        if (y == sc->NIL) {
-          Error_0(sc, "not enough arguments");
-        } else {
-          new_slot_in_env(sc, car(x), car(y));
+      if (cddr(sc->args) != sc->NIL) {
+        index1 = ivalue(caddr(sc->args));
+        if (index1 > strlength(car(sc->args)) || index1 < index0) {
+          Error_1(sc, "substring: end out of bounds:", caddr(sc->args));
         }
+      } else {
+        index1 = strlength(car(sc->args));
       }
-      if (x == sc->NIL) {
-                    /*--
-                     * if (y != sc->NIL) {
-                     *   Error_0(sc,"too many arguments");
-                     * }
-                     */
-      } else if (is_symbol(x))
-        new_slot_in_env(sc, x, y);
-      else {
-        Error_1(sc, "syntax error in closure: not a symbol:", x);
+
+      str = string_at(car(sc->args), index0);
+      len = string_at(car(sc->args), index1) - str;
+      s_return(sc, mk_counted_string(sc, str, len));
+    }
+
+  OP_CASE(OP_VECTOR):{             /* vector */
+      int i;
+      pointer vec;
+      int len = list_length(sc, sc->args);
+      if (len < 0) {
+        Error_1(sc, "vector: not a proper list:", sc->args);
       }
-      sc->code = cdr(closure_code(sc->code));
-      sc->args = sc->NIL;
-      s_goto(sc, OP_BEGIN);
-    } else if (is_continuation(sc->code)) {     /* CONTINUATION */
-      sc->dump = cont_dump(sc->code);
-      s_return(sc, sc->args != sc->NIL ? car(sc->args) : sc->NIL);
-    } else {
-      Error_0(sc, "illegal function");
+      vec = mk_vector(sc, len);
+      if (sc->no_memory) {
+        s_return(sc, sc->sink);
+      }
+      for (x = sc->args, i = 0; is_pair(x); x = cdr(x), i++) {
+        set_vector_elem(vec, i, car(x));
+      }
+      s_return(sc, vec);
     }
 
-  case OP_DOMACRO:             /* do macro */
-    sc->code = sc->value;
-    s_goto(sc, OP_EVAL);
+  OP_CASE(OP_MKVECTOR):{           /* make-vector */
+      pointer fill = sc->NIL;
+      int len;
+      pointer vec;
 
-#if 1
-  case OP_LAMBDA:              /* lambda */
-    /* If the hook is defined, apply it to sc->code, otherwise
-       set sc->value fall thru */
-    {
-      pointer f = find_slot_in_env(sc, sc->envir, sc->COMPILE_HOOK, 1);
-      if (f == sc->NIL) {
-        sc->value = sc->code;
-        /* Fallthru */
-      } else {
-        s_save(sc, OP_LAMBDA1, sc->args, sc->code);
-        sc->args = cons(sc, sc->code, sc->NIL);
-        sc->code = slot_value_in_env(f);
-        s_goto(sc, OP_APPLY);
+      len = ivalue(car(sc->args));
+
+      if (cdr(sc->args) != sc->NIL) {
+        fill = cadr(sc->args);
+      }
+      vec = mk_vector(sc, len);
+      if (sc->no_memory) {
+        s_return(sc, sc->sink);
+      }
+      if (fill != sc->NIL) {
+        fill_vector(vec, fill);
       }
+      s_return(sc, vec);
     }
 
-  case OP_LAMBDA1:
-    s_return(sc, mk_closure(sc, sc->value, sc->envir));
+  OP_CASE(OP_VECLEN):              /* vector-length */
+    s_return(sc, mk_integer(sc, vector_length(car(sc->args))));
 
-#else
-  case OP_LAMBDA:              /* lambda */
-    s_return(sc, mk_closure(sc, sc->code, sc->envir));
+  OP_CASE(OP_VECREF):{             /* vector-ref */
+      int index;
 
-#endif
+      x = cadr(sc->args);
+      if (!is_integer(x)) {
+        Error_1(sc, "vector-ref: index must be exact:", x);
+      }
+      index = ivalue(x);
 
-  case OP_MKCLOSURE:           /* make-closure */
-    x = car(sc->args);
-    if (car(x) == sc->LAMBDA) {
-      x = cdr(x);
-    }
-    if (cdr(sc->args) == sc->NIL) {
-      y = sc->envir;
-    } else {
-      y = cadr(sc->args);
+      if (index >= vector_length(car(sc->args))) {
+        Error_1(sc, "vector-ref: out of bounds:", x);
+      }
+
+      s_return(sc, vector_elem(car(sc->args), index));
     }
-    s_return(sc, mk_closure(sc, x, y));
 
-  case OP_QUOTE:               /* quote */
-    s_return(sc, car(sc->code));
+  OP_CASE(OP_VECSET):{             /* vector-set! */
+      int index;
 
-  case OP_DEF0:                /* define */
-    if (is_immutable(car(sc->code)))
-      Error_1(sc, "define: unable to alter immutable", car(sc->code));
+      if (is_immutable(car(sc->args))) {
+        Error_1(sc, "vector-set!: unable to alter immutable vector:",
+            car(sc->args));
+      }
 
-    if (is_pair(car(sc->code))) {
-      x = caar(sc->code);
-      sc->code =
-          cons(sc, sc->LAMBDA, cons(sc, cdar(sc->code), cdr(sc->code)));
-    } else {
-      x = car(sc->code);
-      sc->code = cadr(sc->code);
-    }
-    if (!is_symbol(x)) {
-      Error_0(sc, "variable is not a symbol");
-    }
-    s_save(sc, OP_DEF1, sc->NIL, x);
-    s_goto(sc, OP_EVAL);
+      x = cadr(sc->args);
+      if (!is_integer(x)) {
+        Error_1(sc, "vector-set!: index must be exact:", x);
+      }
 
-  case OP_DEF1:                /* define */
-    x = find_slot_in_env(sc, sc->envir, sc->code, 0);
-    if (x != sc->NIL) {
-      set_slot_in_env(x, sc->value);
-    } else {
-      new_slot_in_env(sc, sc->code, sc->value);
+      index = ivalue(x);
+      if (index >= vector_length(car(sc->args))) {
+        Error_1(sc, "vector-set!: out of bounds:", x);
+      }
+
+      set_vector_elem(car(sc->args), index, caddr(sc->args));
+      s_return(sc, car(sc->args));
     }
-    s_return(sc, sc->code);
 
+  OP_CASE(OP_MKBVECTOR):{           /* make-bytevector */
+      int fill = 0;
+      int len;
+      pointer vec;
+
+      len = ivalue(car(sc->args));
 
-  case OP_DEFP:                /* defined? */
-    x = sc->envir;
-    if (cdr(sc->args) != sc->NIL) {
-      x = cadr(sc->args);
+      if (cdr(sc->args) != sc->NIL) {
+        fill = ivalue(cadr(sc->args));
+      }
+      vec = mk_bvector(sc, len, fill);
+      if (sc->no_memory) {
+        s_return(sc, sc->sink);
+      }
+      s_return(sc, vec);
     }
-    s_retbool(find_slot_in_env(sc, x, car(sc->args), 1) != sc->NIL);
 
-  case OP_SET0:                /* set! */
-    if (is_immutable(car(sc->code)))
-      Error_1(sc, "set!: unable to alter immutable variable", car(sc->code));
-    s_save(sc, OP_SET1, sc->NIL, car(sc->code));
-    sc->code = cadr(sc->code);
-    s_goto(sc, OP_EVAL);
+  OP_CASE(OP_BVECREF):{             /* bytevector-u8-ref */
+      int index;
 
-  case OP_SET1:                /* set! */
-    y = find_slot_in_env(sc, sc->envir, sc->code, 1);
-    if (y != sc->NIL) {
-      set_slot_in_env(y, sc->value);
-      s_return(sc, sc->value);
-    } else {
-      Error_1(sc, "set!: unbound variable:", sc->code);
-    }
+      x = cadr(sc->args);
+      if (!is_integer(x)) {
+        Error_1(sc, "bytevector-u8-ref: index must be exact:", x);
+      }
+      index = ivalue(x);
 
+      if (index >= ivalue(car(sc->args))) {
+        Error_1(sc, "bytevector-u8-ref: out of bounds:", x);
+      }
 
-  case OP_BEGIN:               /* begin */
-    if (!is_pair(sc->code)) {
-      s_return(sc, sc->code);
-    }
-    if (cdr(sc->code) != sc->NIL) {
-      s_save(sc, OP_BEGIN, sc->NIL, cdr(sc->code));
+      s_return(sc, mk_integer(sc, ((unsigned char *) bufvalue(car(sc->args)))[index]));
     }
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
-
-  case OP_IF0:                 /* if */
-    s_save(sc, OP_IF1, sc->NIL, cdr(sc->code));
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
 
-  case OP_IF1:                 /* if */
-    if (is_true(sc->value))
-      sc->code = car(sc->code);
-    else
-      sc->code = cadr(sc->code);        /* (if #f 1) ==> () because
-                                         * car(sc->NIL) = sc->NIL */
-    s_goto(sc, OP_EVAL);
+  OP_CASE(OP_BVECSET):{             /* bytevector-u8-set! */
+      int index;
 
-  case OP_LET0:                /* let */
-    sc->args = sc->NIL;
-    sc->value = sc->code;
-    sc->code = is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code);
-    s_goto(sc, OP_LET1);
+      x = car(sc->args);
+      if (is_immutable(x)) {
+        Error_1(sc, "bytevector-u8-set!: unable to alter immutable data:", x);
+      }
 
-  case OP_LET1:                /* let (calculate parameters) */
-    sc->args = cons(sc, sc->value, sc->args);
-    if (is_pair(sc->code)) {    /* continue */
-      if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
-        Error_1(sc, "Bad syntax of binding spec in let :", car(sc->code));
+      y = cadr(sc->args);
+      if (!is_integer(y)) {
+        Error_1(sc, "bytevector-u8-set!: index must be exact:", y);
       }
-      s_save(sc, OP_LET1, sc->args, cdr(sc->code));
-      sc->code = cadar(sc->code);
-      sc->args = sc->NIL;
-      s_goto(sc, OP_EVAL);
-    } else {                    /* end */
-      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
-      sc->code = car(sc->args);
-      sc->args = cdr(sc->args);
-      s_goto(sc, OP_LET2);
-    }
 
-  case OP_LET2:                /* let */
-    new_frame_in_env(sc, sc->envir);
-    for (x =
-        is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code), y =
-        sc->args; y != sc->NIL; x = cdr(x), y = cdr(y)) {
-      new_slot_in_env(sc, caar(x), car(y));
-    }
-    if (is_symbol(car(sc->code))) {     /* named let */
-      for (x = cadr(sc->code), sc->args = sc->NIL; x != sc->NIL; x = cdr(x)) {
-        if (!is_pair(x))
-          Error_1(sc, "Bad syntax of binding in let :", x);
-        if (!is_list(sc, car(x)))
-          Error_1(sc, "Bad syntax of binding in let :", car(x));
-        sc->args = cons(sc, caar(x), sc->args);
+      index = ivalue(y);
+      if (index >= buflength(x)) {
+        Error_1(sc, "bytevector-u8-set!: out of bounds:", y);
       }
-      x = mk_closure(sc, cons(sc, reverse_in_place(sc, sc->NIL, sc->args),
-              cddr(sc->code)), sc->envir);
-      new_slot_in_env(sc, car(sc->code), x);
-      sc->code = cddr(sc->code);
-      sc->args = sc->NIL;
-    } else {
-      sc->code = cdr(sc->code);
-      sc->args = sc->NIL;
+
+      bufvalue(x)[index] = (unsigned char) (ivalue(caddr(sc->args)));
+      s_return(sc, x);
     }
-    s_goto(sc, OP_BEGIN);
 
-  case OP_LET0AST:             /* let* */
-    if (car(sc->code) == sc->NIL) {
-      new_frame_in_env(sc, sc->envir);
-      sc->code = cdr(sc->code);
-      s_goto(sc, OP_BEGIN);
+  OP_CASE(OP_BVECLEN):              /* bytevector-length */
+    s_return(sc, mk_integer(sc, buflength(car(sc->args))));
+
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
+  }
+  return sc->T;
+}
+
+static int is_list(scheme * sc, pointer a) {
+  return list_length(sc, a) >= 0;
+}
+
+/* Result is:
+   proper list: length
+   circular list: -1
+   not even a pair: -2
+   dotted list: -2 minus length before dot
+*/
+int list_length(scheme * sc, pointer a) {
+  int i = 0;
+  pointer slow, fast;
+
+  slow = fast = a;
+  while (1) {
+    if (fast == sc->NIL)
+      return i;
+    if (!is_pair(fast))
+      return -2 - i;
+    fast = cdr(fast);
+    ++i;
+    if (fast == sc->NIL)
+      return i;
+    if (!is_pair(fast))
+      return -2 - i;
+    ++i;
+    fast = cdr(fast);
+
+    /* Safe because we would have already returned if `fast'
+       encountered a non-pair. */
+    slow = cdr(slow);
+    if (fast == slow) {
+      /* the fast pointer has looped back around and caught up
+         with the slow pointer, hence the structure is circular,
+         not of finite length, and therefore not a list */
+      return -1;
     }
-    if (!is_pair(car(sc->code)) || !is_pair(caar(sc->code))
-        || !is_pair(cdaar(sc->code))) {
-      Error_1(sc, "Bad syntax of binding spec in let* :", car(sc->code));
+  }
+}
+
+static pointer opexe_3(scheme * sc, enum scheme_opcodes op) {
+  pointer x;
+  num v;
+  int (*comp_func) (num, num) = 0;
+#if USE_THREADING
+#define OPEXE_N 3
+#include "scm_optab.h"
+#endif
+
+  switch (op) {
+  OP_CASE(OP_NOT):                 /* not */
+    s_retbool(is_false(car(sc->args)));
+  OP_CASE(OP_BOOLP):               /* boolean? */
+    s_retbool(car(sc->args) == sc->F || car(sc->args) == sc->T);
+  OP_CASE(OP_EOFOBJP):             /* boolean? */
+    s_retbool(car(sc->args) == sc->EOF_OBJ);
+  OP_CASE(OP_NULLP):               /* null? */
+    s_retbool(car(sc->args) == sc->NIL);
+  OP_CASE(OP_NUMEQ):               /* = */
+  OP_CASE(OP_LESS):                /* < */
+  OP_CASE(OP_GRE):                 /* > */
+  OP_CASE(OP_LEQ):                 /* <= */
+  OP_CASE(OP_GEQ):                 /* >= */
+    switch (op) {
+    case OP_NUMEQ:
+      comp_func = num_eq;
+      break;
+    case OP_LESS:
+      comp_func = num_lt;
+      break;
+    case OP_GRE:
+      comp_func = num_gt;
+      break;
+    case OP_LEQ:
+      comp_func = num_le;
+      break;
+    case OP_GEQ:
+      comp_func = num_ge;
+      break;
+    default:
+      break;                    /* Quiet the compiler */
     }
-    s_save(sc, OP_LET1AST, cdr(sc->code), car(sc->code));
-    sc->code = cadaar(sc->code);
-    s_goto(sc, OP_EVAL);
-
-  case OP_LET1AST:             /* let* (make new frame) */
-    new_frame_in_env(sc, sc->envir);
-    s_goto(sc, OP_LET2AST);
+    x = sc->args;
+    v = nvalue(car(x));
+    x = cdr(x);
 
-  case OP_LET2AST:             /* let* (calculate parameters) */
-    new_slot_in_env(sc, caar(sc->code), sc->value);
-    sc->code = cdr(sc->code);
-    if (is_pair(sc->code)) {    /* continue */
-      s_save(sc, OP_LET2AST, sc->args, sc->code);
-      sc->code = cadar(sc->code);
-      sc->args = sc->NIL;
-      s_goto(sc, OP_EVAL);
-    } else {                    /* end */
-      sc->code = sc->args;
-      sc->args = sc->NIL;
-      s_goto(sc, OP_BEGIN);
+    for (; x != sc->NIL; x = cdr(x)) {
+      if (!comp_func(v, nvalue(car(x)))) {
+        s_retbool(0);
+      }
+      v = nvalue(car(x));
     }
+    s_retbool(1);
+  OP_CASE(OP_SYMBOLP):             /* symbol? */
+    s_retbool(is_symbol(car(sc->args)));
+  OP_CASE(OP_NUMBERP):             /* number? */
+    s_retbool(is_number(car(sc->args)));
+  OP_CASE(OP_STRINGP):             /* string? */
+    s_retbool(is_string(car(sc->args)));
+  OP_CASE(OP_INTEGERP):            /* integer? */
+    s_retbool(is_integer(car(sc->args)));
+  OP_CASE(OP_REALP):               /* real? */
+    s_retbool(is_number(car(sc->args)));        /* All numbers are real */
+  OP_CASE(OP_CHARP):               /* char? */
+    s_retbool(is_character(car(sc->args)));
+#if USE_CHAR_CLASSIFIERS
+  OP_CASE(OP_CHARAP):              /* char-alphabetic? */
+    s_retbool(Cisalpha(ivalue(car(sc->args))));
+  OP_CASE(OP_CHARNP):              /* char-numeric? */
+    s_retbool(Cisdigit(ivalue(car(sc->args))));
+  OP_CASE(OP_CHARWP):              /* char-whitespace? */
+    s_retbool(Cisspace(ivalue(car(sc->args))));
+  OP_CASE(OP_CHARUP):              /* char-upper-case? */
+    s_retbool(Cisupper(ivalue(car(sc->args))));
+  OP_CASE(OP_CHARLP):              /* char-lower-case? */
+    s_retbool(Cislower(ivalue(car(sc->args))));
+#endif
+  OP_CASE(OP_PORTP):               /* port? */
+    s_retbool(is_port(car(sc->args)));
+  OP_CASE(OP_INPORTP):             /* input-port? */
+    s_retbool(is_inport(car(sc->args)));
+  OP_CASE(OP_OUTPORTP):            /* output-port? */
+    s_retbool(is_outport(car(sc->args)));
+  OP_CASE(OP_PROCP):               /* procedure? */
+          /*--
+              * continuation should be procedure by the example
+              * (call-with-current-continuation procedure?) ==> #t
+                 * in R^3 report sec. 6.9
+              */
+    s_retbool(is_proc(car(sc->args)) || is_closure(car(sc->args))
+        || is_continuation(car(sc->args)) || is_foreign(car(sc->args)));
+  OP_CASE(OP_PAIRP):               /* pair? */
+    s_retbool(is_pair(car(sc->args)));
+  OP_CASE(OP_LISTP):               /* list? */
+    s_retbool(list_length(sc, car(sc->args)) >= 0);
+
+  OP_CASE(OP_ENVP):                /* environment? */
+    s_retbool(is_environment(car(sc->args)));
+  OP_CASE(OP_VECTORP):             /* vector? */
+    s_retbool(is_vector(car(sc->args)));
+  OP_CASE(OP_BVECTORP):             /* bytevector? */
+    s_retbool(is_bvector(car(sc->args)));
+  OP_CASE(OP_EQ):                  /* eq? */
+    s_retbool(car(sc->args) == cadr(sc->args));
+  OP_CASE(OP_EQV):                 /* eqv? */
+    s_retbool(eqv(car(sc->args), cadr(sc->args)));
+  OP_CASE(OP_CURR_SEC):            /* current-second */
+    v.is_fixnum = 0;
+    v.value.rvalue = time(0);
+    s_return(sc, mk_number(sc, v));
+  OP_CASE(OP_EVAL_CNT):            /* eval-count */
+    v.is_fixnum = 1;
+    v.value.ivalue = evalcnt;
+    s_return(sc, mk_number(sc, v));
+  OP_CASE(OP_FAST_CHECKS):         /* fast-check-count */
+    v.is_fixnum = 1;
+    v.value.ivalue = fast_checks;
+    s_return(sc, mk_number(sc, v));
   default:
     sprintf(sc->strbuff, "%d: illegal operator", sc->op);
     Error_0(sc, sc->strbuff);
@@ -3091,1742 +6240,2145 @@ static pointer opexe_0(scheme * sc, enum scheme_opcodes op) {
   return sc->T;
 }
 
-static pointer opexe_1(scheme * sc, enum scheme_opcodes op) {
+static pointer opexe_4(scheme * sc, enum scheme_opcodes op) {
   pointer x, y;
+#if USE_THREADING
+#define OPEXE_N 4
+#include "scm_optab.h"
+#endif
 
   switch (op) {
-  case OP_LET0REC:             /* letrec */
-    new_frame_in_env(sc, sc->envir);
-    sc->args = sc->NIL;
-    sc->value = sc->code;
-    sc->code = car(sc->code);
-    s_goto(sc, OP_LET1REC);
-
-  case OP_LET1REC:             /* letrec (calculate parameters) */
-    sc->args = cons(sc, sc->value, sc->args);
-    if (is_pair(sc->code)) {    /* continue */
-      if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
-        Error_1(sc, "Bad syntax of binding spec in letrec :", car(sc->code));
-      }
-      s_save(sc, OP_LET1REC, sc->args, cdr(sc->code));
-      sc->code = cadar(sc->code);
+  OP_CASE(OP_FORCE):               /* force */
+    sc->code = car(sc->args);
+    if (is_promise(sc->code)) {
+      /* Should change type to closure here */
+      s_save(sc, OP_SAVE_FORCED, sc->NIL, sc->code);
       sc->args = sc->NIL;
-      s_goto(sc, OP_EVAL);
-    } else {                    /* end */
-      sc->args = reverse_in_place(sc, sc->NIL, sc->args);
-      sc->code = car(sc->args);
-      sc->args = cdr(sc->args);
-      s_goto(sc, OP_LET2REC);
-    }
-
-  case OP_LET2REC:             /* letrec */
-    for (x = car(sc->code), y = sc->args; y != sc->NIL;
-        x = cdr(x), y = cdr(y)) {
-      new_slot_in_env(sc, caar(x), car(y));
+      s_goto(sc, OP_APPLY);
+    } else {
+      s_return(sc, sc->code);
     }
-    sc->code = cdr(sc->code);
-    sc->args = sc->NIL;
-    s_goto(sc, OP_BEGIN);
 
-  case OP_COND0:               /* cond */
-    if (!is_pair(sc->code)) {
-      Error_0(sc, "syntax error in cond");
+  OP_CASE(OP_SAVE_FORCED):         /* Save forced value replacing promise */
+    if (is_immediate(sc->value)) {
+      /* the promise cell becomes a boxed copy of the immediate */
+      typeflag(sc->code) = type(sc->value) | T_ATOM;
+      ivalue_unchecked(sc->code) = imm_value(sc->value);
+      set_num_integer(sc->code);
+    } else if (is_mark(sc->code)) {
+      /* an old promise: what the value points to is promoted with it */
+      memcpy(sc->code, sc->value, sizeof(struct cell));
+      typeflag(sc->code) = typeflag(sc->value);
+      mark(sc->code);
+    } else {
+      /* the flags are not in the cell; T_SHORT must come along too */
+      memcpy(sc->code, sc->value, sizeof(struct cell));
+      typeflag(sc->code) = typeflag(sc->value);
     }
-    s_save(sc, OP_COND1, sc->NIL, sc->code);
-    sc->code = caar(sc->code);
-    s_goto(sc, OP_EVAL);
+    s_return(sc, sc->value);
 
-  case OP_COND1:               /* cond */
-    if (is_true(sc->value)) {
-      if ((sc->code = cdar(sc->code)) == sc->NIL) {
-        s_return(sc, sc->value);
-      }
-      if (!sc->code || car(sc->code) == sc->FEED_TO) {
-        if (!is_pair(cdr(sc->code))) {
-          Error_0(sc, "syntax error in cond");
-        }
-        x = cons(sc, sc->QUOTE, cons(sc, sc->value, sc->NIL));
-        sc->code = cons(sc, cadr(sc->code), cons(sc, x, sc->NIL));
-        s_goto(sc, OP_EVAL);
+  OP_CASE(OP_WRITE):               /* write */
+  OP_CASE(OP_DISPLAY):             /* display */
+  OP_CASE(OP_WRITE_CHAR):          /* write-char */
+    if (is_pair(cdr(sc->args))) {
+      if (cadr(sc->args) != sc->outport) {
+        x = cons(sc, sc->outport, sc->NIL);
+        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
+        sc->outport = cadr(sc->args);
       }
-      s_goto(sc, OP_BEGIN);
+    }
+    sc->args = car(sc->args);
+    if (op == OP_WRITE) {
+      sc->print_flag = 1;
     } else {
-      if ((sc->code = cdr(sc->code)) == sc->NIL) {
-        s_return(sc, sc->NIL);
-      } else {
-        s_save(sc, OP_COND1, sc->NIL, sc->code);
-        sc->code = caar(sc->code);
-        s_goto(sc, OP_EVAL);
-      }
+      sc->print_flag = 0;
     }
+    s_goto(sc, OP_P0LIST);
 
-  case OP_DELAY:               /* delay */
-    x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
-    typeflag(x) = T_PROMISE;
-    s_return(sc, x);
-
-  case OP_AND0:                /* and */
-    if (sc->code == sc->NIL) {
-      s_return(sc, sc->T);
+  OP_CASE(OP_WRITE_U8):            /* write-u8 */
+    if (is_pair(cdr(sc->args))) {
+      if (cadr(sc->args) != sc->outport) {
+        x = cons(sc, sc->outport, sc->NIL);
+        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
+        sc->outport = cadr(sc->args);
+      }
     }
-    s_save(sc, OP_AND1, sc->NIL, cdr(sc->code));
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
+    putcharacter(sc, ivalue(car(sc->args)));
+    s_return(sc, sc->T);
 
-  case OP_AND1:                /* and */
-    if (is_false(sc->value)) {
-      s_return(sc, sc->value);
-    } else if (sc->code == sc->NIL) {
-      s_return(sc, sc->value);
-    } else {
-      s_save(sc, OP_AND1, sc->NIL, cdr(sc->code));
-      sc->code = car(sc->code);
-      s_goto(sc, OP_EVAL);
+  OP_CASE(OP_NEWLINE):             /* newline */
+    if (is_pair(sc->args)) {
+      if (car(sc->args) != sc->outport) {
+        x = cons(sc, sc->outport, sc->NIL);
+        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
+        sc->outport = car(sc->args);
+      }
     }
+    putstr(sc, "\n");
+    s_return(sc, sc->T);
 
-  case OP_OR0:                 /* or */
-    if (sc->code == sc->NIL) {
-      s_return(sc, sc->F);
+  OP_CASE(OP_ERR0):                /* error */
+    sc->retcode = -1;
+#if USE_FASL
+    fasl_spoil_all(sc);
+#endif
+    if (!is_string(car(sc->args))) {
+      sc->args = cons(sc, mk_string(sc, " -- "), sc->args);
+      setimmutable(car(sc->args));
     }
-    s_save(sc, OP_OR1, sc->NIL, cdr(sc->code));
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
+    putstr(sc, "Error: ");
+    putstr(sc, strvalue(car(sc->args)));
+    sc->args = cdr(sc->args);
+    s_goto(sc, OP_ERR1);
 
-  case OP_OR1:                 /* or */
-    if (is_true(sc->value)) {
-      s_return(sc, sc->value);
-    } else if (sc->code == sc->NIL) {
-      s_return(sc, sc->value);
+  OP_CASE(OP_ERR1):                /* error */
+    putstr(sc, " ");
+    if (sc->args != sc->NIL) {
+      s_save(sc, OP_ERR1, cdr(sc->args), sc->NIL);
+      sc->args = car(sc->args);
+      sc->print_flag = 1;
+      s_goto(sc, OP_P0LIST);
     } else {
-      s_save(sc, OP_OR1, sc->NIL, cdr(sc->code));
-      sc->code = car(sc->code);
-      s_goto(sc, OP_EVAL);
+      putstr(sc, "\n");
+      if (sc->interactive_repl) {
+        s_goto(sc, OP_T0LVL);
+      } else {
+        return sc->NIL;
+      }
     }
 
-  case OP_C0STREAM:            /* cons-stream */
-    s_save(sc, OP_C1STREAM, sc->NIL, cdr(sc->code));
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
-
-  case OP_C1STREAM:            /* cons-stream */
-    sc->args = sc->value;       /* save sc->value to register sc->args for gc */
-    x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
-    typeflag(x) = T_PROMISE;
-    s_return(sc, cons(sc, sc->args, x));
+  OP_CASE(OP_REVERSE):             /* reverse */
+    s_return(sc, reverse(sc, car(sc->args)));
 
-  case OP_MACRO0:              /* macro */
-    if (is_pair(car(sc->code))) {
-      x = caar(sc->code);
-      sc->code =
-          cons(sc, sc->LAMBDA, cons(sc, cdar(sc->code), cdr(sc->code)));
-    } else {
-      x = car(sc->code);
-      sc->code = cadr(sc->code);
-    }
-    if (!is_symbol(x)) {
-      Error_0(sc, "variable is not a symbol");
-    }
-    s_save(sc, OP_MACRO1, sc->NIL, x);
-    s_goto(sc, OP_EVAL);
+  OP_CASE(OP_LIST_STAR):           /* list* */
+    s_return(sc, list_star(sc, sc->args));
 
-  case OP_MACRO1:              /* macro */
-    typeflag(sc->value) = T_MACRO;
-    x = find_slot_in_env(sc, sc->envir, sc->code, 0);
-    if (x != sc->NIL) {
-      set_slot_in_env(x, sc->value);
-    } else {
-      new_slot_in_env(sc, sc->code, sc->value);
+  OP_CASE(OP_APPEND):              /* append */
+    x = sc->NIL;
+    y = sc->args;
+    if (y == x) {
+      s_return(sc, x);
     }
-    s_return(sc, sc->code);
-
-  case OP_CASE0:               /* case */
-    s_save(sc, OP_CASE1, sc->NIL, cdr(sc->code));
-    sc->code = car(sc->code);
-    s_goto(sc, OP_EVAL);
 
-  case OP_CASE1:               /* case */
-    for (x = sc->code; x != sc->NIL; x = cdr(x)) {
-      if (!is_pair(y = caar(x))) {
-        break;
-      }
-      for (; y != sc->NIL; y = cdr(y)) {
-        if (eqv(car(y), sc->value)) {
-          break;
-        }
+    /* cdr() in the while condition is not a typo. If car() */
+    /* is used (append '() 'a) will return the wrong result. */
+    while (cdr(y) != sc->NIL) {
+      x = revappend(sc, x, car(y));
+      y = cdr(y);
+      if (x == sc->F) {
+        Error_0(sc, "non-list argument to append");
       }
-      if (y != sc->NIL) {
+    }
+
+    s_return(sc, reverse_in_place(sc, car(y), x));
+
+#if USE_PLIST
+  OP_CASE(OP_PUT):                 /* put */
+    if (!hasprop(car(sc->args)) || !hasprop(cadr(sc->args))) {
+      Error_0(sc, "illegal use of put");
+    }
+    for (x = symprop(car(sc->args)), y = cadr(sc->args); x != sc->NIL;
+        x = cdr(x)) {
+      if (caar(x) == y) {
         break;
       }
     }
     if (x != sc->NIL) {
-      if (is_pair(caar(x))) {
-        sc->code = cdar(x);
-        s_goto(sc, OP_BEGIN);
-      } else {                  /* else */
-        s_save(sc, OP_CASE2, sc->NIL, cdar(x));
-        sc->code = caar(x);
-        s_goto(sc, OP_EVAL);
-      }
+      gc_barrier(car(x), caddr(sc->args));
+      cdar(x) = caddr(sc->args);
     } else {
-      s_return(sc, sc->NIL);
+      x = cons(sc, cons(sc, y, caddr(sc->args)), symprop(car(sc->args)));
+      gc_barrier(car(sc->args), x);
+      symprop(car(sc->args)) = x;
     }
+    s_return(sc, sc->T);
 
-  case OP_CASE2:               /* case */
-    if (is_true(sc->value)) {
-      s_goto(sc, OP_BEGIN);
+  OP_CASE(OP_GET):                 /* get */
+    if (!hasprop(car(sc->args)) || !hasprop(cadr(sc->args))) {
+      Error_0(sc, "illegal use of get");
+    }
+    for (x = symprop(car(sc->args)), y = cadr(sc->args); x != sc->NIL;
+        x = cdr(x)) {
+      if (caar(x) == y) {
+        break;
+      }
+    }
+    if (x != sc->NIL) {
+      s_return(sc, cdar(x));
     } else {
       s_return(sc, sc->NIL);
     }
-
-  case OP_PAPPLY:              /* apply */
-    sc->code = car(sc->args);
-    sc->args = list_star(sc, cdr(sc->args));
-    /*sc->args = cadr(sc->args); */
-    s_goto(sc, OP_APPLY);
-
-  case OP_PEVAL:               /* eval */
-    if (cdr(sc->args) != sc->NIL) {
-      sc->envir = cadr(sc->args);
+#endif /* USE_PLIST */
+  OP_CASE(OP_QUIT):                /* quit */
+    if (is_pair(sc->args)) {
+      sc->retcode = ivalue(car(sc->args));
     }
-    sc->code = car(sc->args);
-    s_goto(sc, OP_EVAL);
-
-  case OP_CONTINUATION:        /* call-with-current-continuation */
-    sc->code = car(sc->args);
-    sc->args = cons(sc, mk_continuation(sc, sc->dump), sc->NIL);
-    s_goto(sc, OP_APPLY);
-
-  default:
-    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
-    Error_0(sc, sc->strbuff);
-  }
-  return sc->T;
-}
-
-static pointer opexe_2(scheme * sc, enum scheme_opcodes op) {
-  pointer x, y;
-  num v;
-#if USE_MATH
-  double dd;
+#if USE_FASL
+    /* the files being loaded are not read to the end */
+    fasl_spoil_all(sc);
 #endif
+    return (sc->NIL);
 
-  switch (op) {
-#if USE_MATH
-  case OP_INEX2EX:             /* exact */
-    x = car(sc->args);
-    if (num_is_integer(x)) {
-      s_return(sc, x);
-    } else if (modf(rvalue_unchecked(x), &dd) == 0.0) {
-      s_return(sc, mk_integer(sc, ivalue(x)));
+  OP_CASE(OP_GC):                  /* gc */
+    /* called from Eval_Cycle: cells may move unless C called us */
+    if (sc->gc_compact && sc->c_nest == sc->NIL) {
+      compact(sc);
     } else {
-      Error_1(sc, "argument not integral:", x);
+      gc(sc, sc->NIL, sc->NIL);
     }
+    s_return(sc, sc->T);
 
-  case OP_EXP:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, exp(rvalue(x))));
-
-  case OP_LOG:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, log(rvalue(x))));
-
-  case OP_SIN:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, sin(rvalue(x))));
-
-  case OP_COS:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, cos(rvalue(x))));
-
-  case OP_TAN:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, tan(rvalue(x))));
-
-  case OP_ASIN:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, asin(rvalue(x))));
+  OP_CASE(OP_GCVERB):              /* gc-verbose */
+    {
+      int was = sc->gc_verbose;
 
-  case OP_ACOS:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, acos(rvalue(x))));
+      sc->gc_verbose = (car(sc->args) != sc->F);
+      s_retbool(was);
+    }
 
-  case OP_ATAN:
-    x = car(sc->args);
-    if (cdr(sc->args) == sc->NIL) {
-      s_return(sc, mk_real(sc, atan(rvalue(x))));
-    } else {
-      y = cadr(sc->args);
-      s_return(sc, mk_real(sc, atan2(rvalue(x), rvalue(y))));
+  OP_CASE(OP_GCMODE):              /* gc-mode */
+    x = mk_symbol(sc, sc->gc_lazy ? "lazy" : "eager");
+    if (sc->args != sc->NIL) {
+      if (car(sc->args) == mk_symbol(sc, "lazy")) {
+        sc->gc_lazy = 1;
+      } else if (car(sc->args) == mk_symbol(sc, "eager")) {
+        sc->gc_lazy = 0;
+      } else {
+        Error_1(sc, "gc-mode: mode must be lazy or eager:", car(sc->args));
+      }
     }
+    s_return(sc, x);
 
-  case OP_SQRT:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, sqrt(rvalue(x))));
+  OP_CASE(OP_GCCOMPACT):           /* gc-compact */
+    {
+      int was = sc->gc_compact;
 
-  case OP_EXPT:{
-      double result;
-      int real_result = 1;
-      x = car(sc->args);
-      y = cadr(sc->args);
-      if (num_is_integer(x) && num_is_integer(y))
-        real_result = 0;
-      result = pow(rvalue(x), rvalue(y));
-      /* Before returning integer result make sure we can. */
-      /* If the test fails, result is too big for integer. */
-      if (!real_result) {
-        long result_as_long = (long) result;
-        if (result != (double) result_as_long)
-          real_result = 1;
-      }
-      if (real_result) {
-        s_return(sc, mk_real(sc, result));
-      } else {
-        s_return(sc, mk_integer(sc, result));
+      if (sc->args != sc->NIL) {
+        sc->gc_compact = (car(sc->args) != sc->F);
       }
+      s_retbool(was);
     }
 
-  case OP_FLOOR:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, floor(rvalue(x))));
+  OP_CASE(OP_NEWSEGMENT):          /* new-segment */
+    if (!is_pair(sc->args) || !is_number(car(sc->args))) {
+      Error_0(sc, "new-segment: argument must be a number");
+    }
+    alloc_cellseg(sc, (int) ivalue(car(sc->args)));
+    s_return(sc, sc->T);
 
-  case OP_CEILING:
-    x = car(sc->args);
-    s_return(sc, mk_real(sc, ceil(rvalue(x))));
+  OP_CASE(OP_OBLIST):              /* oblist */
+    s_return(sc, oblist_all_symbols(sc));
 
-  case OP_ROUND:
-    x = car(sc->args);
-    if (num_is_integer(x))
-      s_return(sc, x);
-    s_return(sc, mk_real(sc, round_per_R5RS(rvalue(x))));
-#endif
+  OP_CASE(OP_CURR_INPORT):         /* current-input-port */
+    s_return(sc, sc->inport);
 
-  case OP_ADD:                 /* + */
-    v = num_zero;
-    for (x = sc->args; x != sc->NIL; x = cdr(x)) {
-      v = num_add(v, nvalue(car(x)));
-    }
-    s_return(sc, mk_number(sc, v));
+  OP_CASE(OP_CURR_OUTPORT):        /* current-output-port */
+    s_return(sc, sc->outport);
 
-  case OP_MUL:                 /* * */
-    v = num_one;
-    for (x = sc->args; x != sc->NIL; x = cdr(x)) {
-      v = num_mul(v, nvalue(car(x)));
+  OP_CASE(OP_OPEN_INFILE):         /* open-input-file */
+  OP_CASE(OP_OPEN_OUTFILE):        /* open-output-file */
+  OP_CASE(OP_OPEN_INOUTFILE):      /* open-input-output-file */  {
+      int prop = 0;
+      pointer p;
+      switch (op) {
+      case OP_OPEN_INFILE:
+        prop = port_input;
+        break;
+      case OP_OPEN_OUTFILE:
+        prop = port_output;
+        break;
+      case OP_OPEN_INOUTFILE:
+        prop = port_input | port_output;
+        break;
+      default:
+        break;                  /* Quiet the compiler */
+      }
+      p = port_from_filename(sc, strvalue(car(sc->args)), prop);
+      if (p == sc->NIL) {
+        s_return(sc, sc->F);
+      }
+      s_return(sc, p);
     }
-    s_return(sc, mk_number(sc, v));
 
-  case OP_SUB:                 /* - */
-    if (cdr(sc->args) == sc->NIL) {
-      x = sc->args;
-      v = num_zero;
-    } else {
-      x = cdr(sc->args);
-      v = nvalue(car(sc->args));
+#if USE_STRING_PORTS
+  OP_CASE(OP_OPEN_INSTRING):       /* open-input-string */
+  OP_CASE(OP_OPEN_INOUTSTRING):    /* open-input-output-string */  {
+      int prop = 0;
+      pointer p;
+      switch (op) {
+      case OP_OPEN_INSTRING:
+        prop = port_input;
+        break;
+      case OP_OPEN_INOUTSTRING:
+        prop = port_input | port_output;
+        break;
+      default:
+        break;                  /* Quiet the compiler */
+      }
+      p = port_from_string(sc, strvalue(car(sc->args)),
+          strvalue(car(sc->args)) + strsize(car(sc->args)), prop);
+      if (p == sc->NIL) {
+        s_return(sc, sc->F);
+      }
+      p->_object._port->rep.string.owner = car(sc->args);
+      s_return(sc, p);
     }
-    for (; x != sc->NIL; x = cdr(x)) {
-      v = num_sub(v, nvalue(car(x)));
+  OP_CASE(OP_OPEN_OUTSTRING):      /* open-output-string */  {
+      pointer p;
+      if (car(sc->args) == sc->NIL) {
+        p = port_from_scratch(sc);
+        if (p == sc->NIL) {
+          s_return(sc, sc->F);
+        }
+      } else {
+        p = port_from_string(sc, strvalue(car(sc->args)),
+            strvalue(car(sc->args)) + strsize(car(sc->args)), port_output);
+        if (p == sc->NIL) {
+          s_return(sc, sc->F);
+        }
+        p->_object._port->rep.string.owner = car(sc->args);
+      }
+      s_return(sc, p);
     }
-    s_return(sc, mk_number(sc, v));
+  OP_CASE(OP_GET_OUTSTRING):       /* get-output-string */  {
+      port *p;
 
-  case OP_DIV:                 /* / */
-    if (cdr(sc->args) == sc->NIL) {
-      x = sc->args;
-      v = num_one;
-    } else {
-      x = cdr(sc->args);
-      v = nvalue(car(sc->args));
-    }
-    for (; x != sc->NIL; x = cdr(x)) {
-      v = num_div(v, nvalue(car(x)));
-    }
-    s_return(sc, mk_number(sc, v));
+      if ((p = car(sc->args)->_object._port)->kind & port_string) {
+        int size;
+        char *str;
 
-  case OP_REM:                 /* remainder */
-    v = nvalue(car(sc->args));
-    x = cadr(sc->args);
-    if (ivalue(x) != 0)
-      v = num_rem(v, nvalue(x));
-    else {
-      Error_0(sc, "remainder: division by zero");
+        size = p->rep.string.curr - p->rep.string.start + 1;
+        str = sc->malloc(size);
+        if (str != NULL) {
+          pointer s;
+
+          memcpy(str, p->rep.string.start, size - 1);
+          str[size - 1] = '\0';
+          s = mk_counted_string(sc, str, size - 1);
+          sc->free(str);
+          s_return(sc, s);
+        }
+      }
+      s_return(sc, sc->F);
     }
-    s_return(sc, mk_number(sc, v));
+#endif
 
-  case OP_MOD:                 /* modulo */
-    v = nvalue(car(sc->args));
-    x = cadr(sc->args);
-    if (ivalue(x) != 0)
-      v = num_mod(v, nvalue(x));
-    else {
-      Error_0(sc, "modulo: division by zero");
-    }
-    s_return(sc, mk_number(sc, v));
+  OP_CASE(OP_CLOSE_INPORT):        /* close-input-port */
+    port_close(sc, car(sc->args), port_input);
+    s_return(sc, sc->T);
 
-  case OP_CAR:                 /* car */
-    s_return(sc, caar(sc->args));
+  OP_CASE(OP_CLOSE_OUTPORT):       /* close-output-port */
+    port_close(sc, car(sc->args), port_output);
+    s_return(sc, sc->T);
 
-  case OP_CDR:                 /* cdr */
-    s_return(sc, cdar(sc->args));
+  OP_CASE(OP_INT_ENV):             /* interaction-environment */
+    s_return(sc, sc->global_env);
 
-  case OP_CONS:                /* cons */
-    cdr(sc->args) = cadr(sc->args);
-    s_return(sc, sc->args);
+  OP_CASE(OP_CURR_ENV):            /* current-environment */
+    s_return(sc, sc->envir);
 
-  case OP_SETCAR:              /* set-car! */
-    if (!is_immutable(car(sc->args))) {
-      caar(sc->args) = cadr(sc->args);
-      s_return(sc, car(sc->args));
-    } else {
-      Error_0(sc, "set-car!: unable to alter immutable pair");
-    }
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
+  }
+  return sc->T;
+}
 
-  case OP_SETCDR:              /* set-cdr! */
-    if (!is_immutable(car(sc->args))) {
-      cdar(sc->args) = cadr(sc->args);
-      s_return(sc, car(sc->args));
-    } else {
-      Error_0(sc, "set-cdr!: unable to alter immutable pair");
-    }
+static pointer opexe_5(scheme * sc, enum scheme_opcodes op) {
+  pointer x;
+#if USE_THREADING
+#define OPEXE_N 5
+#include "scm_optab.h"
+#endif
 
-  case OP_CHAR2INT:{           /* char->integer */
-      char c;
-      c = (char) ivalue(car(sc->args));
-      s_return(sc, mk_integer(sc, (unsigned char) c));
-    }
+  if (sc->nesting != 0) {
+    int n = sc->nesting;
+    sc->nesting = 0;
+    sc->retcode = -1;
+    Error_1(sc, "unmatched parentheses:", mk_integer(sc, n));
+  }
 
-  case OP_INT2CHAR:{           /* integer->char */
-      unsigned char c;
-      c = (unsigned char) ivalue(car(sc->args));
-      s_return(sc, mk_character(sc, (char) c));
+  switch (op) {
+    /* ========== reading part ========== */
+  OP_CASE(OP_READ):
+    if (!is_pair(sc->args)) {
+      s_goto(sc, OP_READ_INTERNAL);
     }
-
-  case OP_CHARUPCASE:{
-      unsigned char c;
-      c = (unsigned char) ivalue(car(sc->args));
-      c = toupper(c);
-      s_return(sc, mk_character(sc, (char) c));
+    if (!is_inport(car(sc->args))) {
+      Error_1(sc, "read: not an input port:", car(sc->args));
     }
-
-  case OP_CHARDNCASE:{
-      unsigned char c;
-      c = (unsigned char) ivalue(car(sc->args));
-      c = tolower(c);
-      s_return(sc, mk_character(sc, (char) c));
+    if (car(sc->args) == sc->inport) {
+      s_goto(sc, OP_READ_INTERNAL);
     }
+    x = sc->inport;
+    sc->inport = car(sc->args);
+    x = cons(sc, x, sc->NIL);
+    s_save(sc, OP_SET_INPORT, x, sc->NIL);
+    s_goto(sc, OP_READ_INTERNAL);
 
-  case OP_STR2SYM:             /* string->symbol */
-    s_return(sc, mk_symbol(sc, strvalue(car(sc->args))));
-
-  case OP_STR2ATOM:            /* string->atom */  {
-      char *s = strvalue(car(sc->args));
-      long pf = 0;
-      if (cdr(sc->args) != sc->NIL) {
-        /* we know cadr(sc->args) is a natural number */
-        /* see if it is 2, 8, 10, or 16, or error */
-        pf = ivalue_unchecked(cadr(sc->args));
-        if (pf < 2 || pf > 36) {
-          pf = -1;
+  OP_CASE(OP_READ_CHAR):           /* read-char */
+  OP_CASE(OP_PEEK_CHAR):           /* peek-char */  {
+      int c;
+      if (is_pair(sc->args)) {
+        if (car(sc->args) != sc->inport) {
+          x = sc->inport;
+          x = cons(sc, x, sc->NIL);
+          s_save(sc, OP_SET_INPORT, x, sc->NIL);
+          sc->inport = car(sc->args);
         }
       }
-      if (pf < 0) {
-        Error_1(sc, "string->atom: bad base:", cadr(sc->args));
-      } else if (*s == '#') {   /* no use of base! */
-        s_return(sc, mk_sharp_const(sc, s + 1));
-      } else {
-        if (pf == 0 || pf == 10) {
-          s_return(sc, mk_atom(sc, s));
-        } else {
-          char *ep;
-          long iv = strtol(s, &ep, (int) pf);
-          if (*ep == 0) {
-            s_return(sc, mk_integer(sc, iv));
-          } else {
-            s_return(sc, sc->F);
-          }
-        }
+      c = inchar(sc);
+      if (c == EOF) {
+        s_return(sc, sc->EOF_OBJ);
+      }
+      if (sc->op == OP_PEEK_CHAR) {
+        backchar(sc, c);
       }
+      s_return(sc, mk_character(sc, c));
     }
 
-  case OP_SYM2STR:             /* symbol->string */
-    x = mk_string(sc, symname(car(sc->args)));
-    setimmutable(x);
-    s_return(sc, x);
-
-  case OP_ATOM2STR:            /* atom->string */  {
-      long pf = 0;
-      x = car(sc->args);
-      y = cdr(sc->args);
-      if (y != sc->NIL) {
-        /* we know cadr(sc->args) is a natural number */
-        /* see if it is 2, 8, 10, or 16, or error */
-        y = car(y);
-        pf = ivalue_unchecked(y);
-        if (!is_number(x) || pf < 2 || pf > 36) {
-          pf = -1;
+  OP_CASE(OP_READ_U8):           /* read-u8 */
+  OP_CASE(OP_PEEK_U8):           /* peek-u8 */  {
+      int c;
+      if (is_pair(sc->args)) {
+        if (car(sc->args) != sc->inport) {
+          x = sc->inport;
+          x = cons(sc, x, sc->NIL);
+          s_save(sc, OP_SET_INPORT, x, sc->NIL);
+          sc->inport = car(sc->args);
         }
       }
-      if (pf < 0) {
-        Error_1(sc, "atom->string: bad base:", y);
-      } else if (is_number(x) || is_character(x) || is_string(x)
-          || is_symbol(x)) {
-        char *p;
-        int len;
-        atom2str(sc, x, (int) pf, &p, &len);
-        s_return(sc, mk_counted_string(sc, p, len));
-      } else {
-        Error_1(sc, "atom->string: not an atom:", x);
+      c = inchar8(sc);
+      if (c == EOF) {
+        s_return(sc, sc->EOF_OBJ);
       }
+      if (sc->op == OP_PEEK_U8) {
+        backchar(sc, c);
+      }
+      s_return(sc, mk_integer(sc, c));
     }
 
-  case OP_MKSTRING:{           /* make-string */
-      int fill = ' ';
-      int len, i;
-      char* s;
-      pointer p;
+  OP_CASE(OP_CHAR_READY):          /* char-ready? */  {
+      pointer p = sc->inport;
+      int res;
+      if (is_pair(sc->args)) {
+        p = car(sc->args);
+      }
+      res = p->_object._port->kind & port_string;
+      s_retbool(res);
+    }
 
-      len = ivalue(car(sc->args));
+  OP_CASE(OP_SET_INPORT):          /* set-input-port */
+    sc->inport = car(sc->args);
+    s_return(sc, sc->value);
 
-      if (cdr(sc->args) != sc->NIL) {
-        fill = charvalue(cadr(sc->args));
+  OP_CASE(OP_SET_OUTPORT):         /* set-output-port */
+    sc->outport = car(sc->args);
+    s_return(sc, sc->value);
+
+  OP_CASE(OP_RDSEXPR):
+    switch (sc->tok) {
+    case TOK_EOF:
+      s_return(sc, sc->EOF_OBJ);
+    case TOK_VEC:
+      s_save(sc, OP_RDVEC, sc->NIL, sc->NIL);
+      /* fall through */
+    case TOK_LPAREN:
+      sc->tok = token(sc);
+      if (sc->tok == TOK_RPAREN) {
+        s_return(sc, sc->NIL);
+      } else if (sc->tok == TOK_DOT) {
+        Error_0(sc, "syntax error: illegal dot expression");
+      } else {
+        sc->nesting_stack[sc->file_i]++;
+        s_save(sc, OP_RDLIST, sc->NIL, sc->NIL);
+        s_goto(sc, OP_RDSEXPR);
       }
-      p = mk_counted_string(sc, "", len);
-      s = strvalue(p);
-      if (IS_ASCII(fill)) {
-        memset(s, (char) fill, len);
-        s[len] = 0;
+    case TOK_QUOTE:
+      s_save(sc, OP_RDQUOTE, sc->NIL, sc->NIL);
+      sc->tok = token(sc);
+      s_goto(sc, OP_RDSEXPR);
+    case TOK_BQUOTE:
+      sc->tok = token(sc);
+      if (sc->tok == TOK_VEC) {
+        s_save(sc, OP_RDQQUOTEVEC, sc->NIL, sc->NIL);
+        sc->tok = TOK_LPAREN;
+        s_goto(sc, OP_RDSEXPR);
       } else {
-        upgrade_string(sc, p);
-        s = strvalue(p);
-        ((int*) s)[0] = UTFSTR_LEN_SET(len);
-        for (i = 1; i <= len; i++) {
-          ((int*) s)[i] = fill;
+        s_save(sc, OP_RDQQUOTE, sc->NIL, sc->NIL);
+      }
+      s_goto(sc, OP_RDSEXPR);
+    case TOK_COMMA:
+      s_save(sc, OP_RDUNQUOTE, sc->NIL, sc->NIL);
+      sc->tok = token(sc);
+      s_goto(sc, OP_RDSEXPR);
+    case TOK_ATMARK:
+      s_save(sc, OP_RDUQTSP, sc->NIL, sc->NIL);
+      sc->tok = token(sc);
+      s_goto(sc, OP_RDSEXPR);
+    case TOK_ATOM:
+      s_return(sc, mk_atom(sc, readstr_upto(sc)));
+    case TOK_DQUOTE:
+      x = readstrexp(sc);
+      if (x == sc->F) {
+        Error_0(sc, "Error reading string");
+      }
+      setimmutable(x);
+      s_return(sc, x);
+    case TOK_SHARP:{
+        pointer f = find_slot_in_env(sc, sc->envir, sc->SHARP_HOOK, 1);
+#if USE_FASL
+        fasl_spoil(sc, sc->fasl_stack + sc->file_i);
+#endif
+        if (f == sc->NIL) {
+          Error_0(sc, "undefined sharp expression");
+        } else {
+          sc->code = cons(sc, slot_value_in_env(f), sc->NIL);
+          s_goto(sc, OP_EVAL);
         }
       }
-      s_return(sc, p);
+    case TOK_SHARP_CONST:
+      if ((x = mk_sharp_const(sc, readstr_upto(sc))) == sc->NIL) {
+        Error_0(sc, "undefined sharp expression");
+      } else {
+        s_return(sc, x);
+      }
+    default:
+      Error_0(sc, "syntax error: illegal token");
+    }
+    break;
+
+  OP_CASE(OP_RDLIST):{
+      sc->args = cons(sc, sc->value, sc->args);
+      sc->tok = token(sc);
+      if (sc->tok == TOK_EOF) {
+        s_return(sc, sc->EOF_OBJ);
+      } else if (sc->tok == TOK_RPAREN) {
+        int c = inchar(sc);
+        if (c != '\n')
+          backchar(sc, c);
+#if SHOW_ERROR_LINE
+        else if (sc->load_stack[sc->file_i].kind & port_file)
+          sc->load_stack[sc->file_i].rep.stdio.curr_line++;
+#endif
+        sc->nesting_stack[sc->file_i]--;
+        s_return(sc, reverse_in_place(sc, sc->NIL, sc->args));
+      } else if (sc->tok == TOK_DOT) {
+        s_save(sc, OP_RDDOT, sc->args, sc->NIL);
+        sc->tok = token(sc);
+        s_goto(sc, OP_RDSEXPR);
+      } else {
+        s_save(sc, OP_RDLIST, sc->args, sc->NIL);;
+        s_goto(sc, OP_RDSEXPR);
+      }
     }
 
-  case OP_STRLEN:              /* string-length */
-    s_return(sc, mk_integer(sc, strlength(car(sc->args))));
-
-  case OP_STRREF:{             /* string-ref */
-      char *str;
-      int index;
-
-      str = strvalue(car(sc->args));
-
-      x = cadr(sc->args);
-      if (!is_integer(x)) {
-        Error_1(sc, "string-ref: index must be exact:", x);
-      }
-
-      index = ivalue(x);
-      if (index >= strlength(car(sc->args))) {
-        Error_1(sc, "string-ref: out of bounds:", x);
-      }
-
-      s_return(sc, mk_character(sc,
-        IS_ASCII(*str)
-          ? ((unsigned char *) str)[index]
-          : ((int*) str)[index + 1]));
+  OP_CASE(OP_RDDOT):
+    if (token(sc) != TOK_RPAREN) {
+      Error_0(sc, "syntax error: illegal dot expression");
+    } else {
+      sc->nesting_stack[sc->file_i]--;
+      s_return(sc, reverse_in_place(sc, sc->value, sc->args));
     }
 
-  case OP_STRSET:{             /* string-set! */
-      char *str;
-      int index;
-      int c;
-
-      x = car(sc->args);
-      if (is_immutable(x)) {
-        Error_1(sc, "string-set!: unable to alter immutable string:", x);
-      }
-      str = strvalue(x);
+  OP_CASE(OP_RDQUOTE):
+    s_return(sc, cons(sc, sc->QUOTE, cons(sc, sc->value, sc->NIL)));
 
-      y = cadr(sc->args);
-      if (!is_integer(y)) {
-        Error_1(sc, "string-set!: index must be exact:", y);
-      }
+  OP_CASE(OP_RDQQUOTE):
+    s_return(sc, cons(sc, sc->QQUOTE, cons(sc, sc->value, sc->NIL)));
 
-      index = ivalue(y);
-      if (index >= strlength(x)) {
-        Error_1(sc, "string-set!: out of bounds:", y);
-      }
+  OP_CASE(OP_RDQQUOTEVEC):
+    s_return(sc, cons(sc, mk_symbol(sc, "apply"),
+            cons(sc, mk_symbol(sc, "vector"),
+                cons(sc, cons(sc, sc->QQUOTE,
+                        cons(sc, sc->value, sc->NIL)), sc->NIL))));
 
-      c = charvalue(caddr(sc->args));
+  OP_CASE(OP_RDUNQUOTE):
+    s_return(sc, cons(sc, sc->UNQUOTE, cons(sc, sc->value, sc->NIL)));
 
-      if (IS_ASCII(*str)) {
-        if (IS_ASCII(c)) {
-          str[index] = (char) c;
-          s_return(sc, x);
-        }
-        upgrade_string(sc, x);
-        str = strvalue(x);
-      }
-      ((int*) str)[index + 1] = c;
-      s_return(sc, x);
-    }
+  OP_CASE(OP_RDUQTSP):
+    s_return(sc, cons(sc, sc->UNQUOTESP, cons(sc, sc->value, sc->NIL)));
 
-  case OP_STRAPPEND:{ /* string-append in core for speed*/
-      int len = 0, isbig = 0    , i;
-      pointer newstr;
-      char *pos, *s;
+  OP_CASE(OP_RDVEC):
+    /*sc->code=cons(sc,mk_proc(sc,OP_VECTOR),sc->value);
+       s_goto(sc,OP_EVAL); Cannot be quoted */
+    /*x=cons(sc,mk_proc(sc,OP_VECTOR),sc->value);
+       s_return(sc,x); Cannot be part of pairs */
+    /*sc->code=mk_proc(sc,OP_VECTOR);
+       sc->args=sc->value;
+       s_goto(sc,OP_APPLY); */
+    sc->args = sc->value;
+    s_goto(sc, OP_VECTOR);
 
-      /* compute needed length for new string */
-      for (x = sc->args; x != sc->NIL; x = cdr(x)) {
-        len += strlength(car(x));
-        if (!IS_ASCII(*strvalue(car(x)))) {
-            isbig = 1;
-        }
-      }
-      newstr = mk_counted_string(sc, "", len);
-      if (isbig) {
-        upgrade_string(sc, newstr);
-      }
-      /* store the contents of the argument strings into the new string */
-      for (pos = strvalue(newstr) + (isbig ? 4 : 0), x = sc->args; x != sc->NIL;
-          pos += strlength(car(x)) * (isbig ? 4 : 1), x = cdr(x)) {
-        len = strlength(car(x));
-        s = strvalue(car(x));
-        if (isbig) {
-          if (IS_ASCII(*s)) {
-            for (i = 0; i < len; i++) {
-              ((int*) pos)[i] = s[i];
-            }
-          } else {
-            memcpy(pos, s + 4, len * 4);
-          }
-        } else {
-          memcpy(pos, s, len);
-          pos[len] = 0;
-        }
-      }
-      s_return(sc, newstr);
+    /* ========== printing part ========== */
+  OP_CASE(OP_P0LIST):
+    if (is_vector(sc->args)) {
+      putstr(sc, "#(");
+      sc->args = cons(sc, sc->args, mk_integer(sc, 0));
+      s_goto(sc, OP_PVECFROM);
+    } else if (is_environment(sc->args)) {
+      putstr(sc, "#<ENVIRONMENT>");
+      s_return(sc, sc->T);
+    } else if (!is_pair(sc->args)) {
+      printatom(sc, sc->args, sc->print_flag);
+      s_return(sc, sc->T);
+    } else if (car(sc->args) == sc->QUOTE && ok_abbrev(cdr(sc->args))) {
+      putstr(sc, "'");
+      sc->args = cadr(sc->args);
+      s_goto(sc, OP_P0LIST);
+    } else if (car(sc->args) == sc->QQUOTE && ok_abbrev(cdr(sc->args))) {
+      putstr(sc, "`");
+      sc->args = cadr(sc->args);
+      s_goto(sc, OP_P0LIST);
+    } else if (car(sc->args) == sc->UNQUOTE && ok_abbrev(cdr(sc->args))) {
+      putstr(sc, ",");
+      sc->args = cadr(sc->args);
+      s_goto(sc, OP_P0LIST);
+    } else if (car(sc->args) == sc->UNQUOTESP && ok_abbrev(cdr(sc->args))) {
+      putstr(sc, ",@");
+      sc->args = cadr(sc->args);
+      s_goto(sc, OP_P0LIST);
+    } else {
+      putstr(sc, "(");
+      s_save(sc, OP_P1LIST, cdr(sc->args), sc->NIL);
+      sc->args = car(sc->args);
+      s_goto(sc, OP_P0LIST);
     }
 
-  case OP_SUBSTR:{             /* substring */
-      char *str;
-      int index0;
-      int index1;
-      int len;
-
-      str = strvalue(car(sc->args));
-
-      index0 = ivalue(cadr(sc->args));
-
-      if (index0 > strlength(car(sc->args))) {
-        Error_1(sc, "substring: start out of bounds:", cadr(sc->args));
+  OP_CASE(OP_P1LIST):
+    if (is_pair(sc->args)) {
+      s_save(sc, OP_P1LIST, cdr(sc->args), sc->NIL);
+      putstr(sc, " ");
+      sc->args = car(sc->args);
+      s_goto(sc, OP_P0LIST);
+    } else if (is_vector(sc->args)) {
+      s_save(sc, OP_P1LIST, sc->NIL, sc->NIL);
+      putstr(sc, " . ");
+      s_goto(sc, OP_P0LIST);
+    } else {
+      if (sc->args != sc->NIL) {
+        putstr(sc, " . ");
+        printatom(sc, sc->args, sc->print_flag);
       }
-
-      if (cddr(sc->args) != sc->NIL) {
-        index1 = ivalue(caddr(sc->args));
-        if (index1 > strlength(car(sc->args)) || index1 < index0) {
-          Error_1(sc, "substring: end out of bounds:", caddr(sc->args));
-        }
+      putstr(sc, ")");
+      s_return(sc, sc->T);
+    }
+  OP_CASE(OP_PVECFROM):{
+      int i = ivalue(cdr(sc->args));
+      pointer vec = car(sc->args);
+      int len = vector_length(vec);
+      if (i == len) {
+        putstr(sc, ")");
+        s_return(sc, sc->T);
       } else {
-        index1 = strlength(car(sc->args));
+        pointer elem = vector_elem(vec, i);
+        cdr(sc->args) = mk_integer(sc, i + 1);
+        s_save(sc, OP_PVECFROM, sc->args, sc->NIL);
+        sc->args = elem;
+        if (i > 0)
+          putstr(sc, " ");
+        s_goto(sc, OP_P0LIST);
       }
+    }
 
-      len = index1 - index0;
-      x = mk_counted_string(sc, "", len);
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
 
-      if (IS_ASCII(*str)) {
-        memcpy(strvalue(x), str + index0, len);
-      } else { //todo - perhaps downgrade if al ascii in substr
-        upgrade_string(sc, x);
-        memcpy(strvalue(x) + 4, str + (index0 + 1) * 4, len * 4);
-      }
-      strvalue(x)[len] = 0;
+  }
+  return sc->T;
+}
 
-      s_return(sc, x);
+static pointer opexe_6(scheme * sc, enum scheme_opcodes op) {
+  pointer x, y;
+  long v;
+#if USE_THREADING
+#define OPEXE_N 6
+#include "scm_optab.h"
+#endif
+
+  switch (op) {
+  OP_CASE(OP_LIST_LENGTH):         /* length *//* a.k */
+    v = list_length(sc, car(sc->args));
+    if (v < 0) {
+      Error_1(sc, "length: not a list:", car(sc->args));
     }
+    s_return(sc, mk_integer(sc, v));
 
-  case OP_VECTOR:{             /* vector */
-      int i;
-      pointer vec;
-      int len = list_length(sc, sc->args);
-      if (len < 0) {
-        Error_1(sc, "vector: not a proper list:", sc->args);
-      }
-      vec = mk_vector(sc, len);
-      if (sc->no_memory) {
-        s_return(sc, sc->sink);
-      }
-      for (x = sc->args, i = 0; is_pair(x); x = cdr(x), i++) {
-        set_vector_elem(vec, i, car(x));
+  OP_CASE(OP_ASSQ):                /* assq *//* a.k */
+    x = car(sc->args);
+    for (y = cadr(sc->args); is_pair(y); y = cdr(y)) {
+      if (!is_pair(car(y))) {
+        Error_0(sc, "unable to handle non pair element");
       }
-      s_return(sc, vec);
+      if (x == caar(y))
+        break;
+    }
+    if (is_pair(y)) {
+      s_return(sc, car(y));
+    } else {
+      s_return(sc, sc->F);
     }
 
-  case OP_MKVECTOR:{           /* make-vector */
-      pointer fill = sc->NIL;
-      int len;
-      pointer vec;
-
-      len = ivalue(car(sc->args));
 
-      if (cdr(sc->args) != sc->NIL) {
-        fill = cadr(sc->args);
-      }
-      vec = mk_vector(sc, len);
-      if (sc->no_memory) {
-        s_return(sc, sc->sink);
-      }
-      if (fill != sc->NIL) {
-        fill_vector(vec, fill);
-      }
-      s_return(sc, vec);
+  OP_CASE(OP_GET_CLOSURE):         /* get-closure-code *//* a.k */
+    sc->args = car(sc->args);
+    if (sc->args == sc->NIL) {
+      s_return(sc, sc->F);
+    } else if (is_closure(sc->args)) {
+      s_return(sc, cons(sc, sc->LAMBDA, closure_code(sc->args)));
+    } else if (is_macro(sc->args)) {
+      s_return(sc, cons(sc, sc->LAMBDA, closure_code(sc->args)));
+    } else {
+      s_return(sc, sc->F);
+    }
+  OP_CASE(OP_CLOSUREP):            /* closure? */
+    /*
+     * Note, macro object is also a closure.
+     * Therefore, (closure? <#MACRO>) ==> #t
+     */
+    s_retbool(is_closure(car(sc->args)));
+  OP_CASE(OP_MACROP):              /* macro? */
+    s_retbool(is_macro(car(sc->args)));
+  OP_CASE(OP_MEMOMACRO):           /* memoize-macro! */
+    x = car(sc->args);
+    if (!is_macro(x)) {
+      Error_1(sc, "memoize-macro!: not a macro:", x);
     }
+    typeflag(x) |= T_MEMO;
+    s_return(sc, x);
+  default:
+    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
+    Error_0(sc, sc->strbuff);
+  }
+  return sc->T;                 /* NOTREACHED */
+}
 
-  case OP_VECLEN:              /* vector-length */
-    s_return(sc, mk_integer(sc, ivalue(car(sc->args))));
+static const char *procname(pointer x) {
+  int n = procnum(x);
+  const char *name = dispatch_table[n].name;
+  if (name == 0) {
+    name = "ILLEGAL!";
+  }
+  return name;
+}
 
-  case OP_VECREF:{             /* vector-ref */
-      int index;
+/* Decode the argument tests of a built-in of fixed arity, so that
+   args_fit can check a call without walking the encoding. */
+static void decode_arg_tests(op_code_info * pcd) {
+  const char *t = pcd->arg_tests_encoding;
+  int i;
 
-      x = cadr(sc->args);
-      if (!is_integer(x)) {
-        Error_1(sc, "vector-ref: index must be exact:", x);
-      }
-      index = ivalue(x);
+  if (pcd->name == 0 || pcd->min_arity != pcd->max_arity
+      || pcd->min_arity > FIXED_ARGS) {
+    return;
+  }
+  for (i = 0; i < pcd->min_arity && t != 0; i++) {
+    if (t[0] == TST_LIST[0]) {
+      return;
+    }
+    pcd->fixed_tests[i] = t[0] == TST_ANY[0] ? 0 : tests[(int) t[0]].fct;
+    if (t[1] != 0) {
+      t++;
+    }
+  }
+  pcd->fixed = 1;
+}
 
-      if (index >= ivalue(car(sc->args))) {
-        Error_1(sc, "vector-ref: out of bounds:", x);
-      }
+/* Whether sc->args is right for a built-in of fixed arity: a list of
+   just that many arguments, each passing its test. */
+static INLINE int args_fit(scheme * sc, op_code_info * pcd) {
+  pointer a = sc->args;
+  int i;
 
-      s_return(sc, vector_elem(car(sc->args), index));
+  for (i = 0; i < pcd->min_arity; i++) {
+    if (!is_pair(a)
+        || (pcd->fixed_tests[i] != 0 && !pcd->fixed_tests[i](car(a)))) {
+      return 0;
     }
+    a = cdr(a);
+  }
+  return a == sc->NIL;
+}
 
-  case OP_VECSET:{             /* vector-set! */
-      int index;
+/* Check sc->args against the arity and argument tests of a built-in.
+   On failure the reason is left in msg. */
+static int proc_args_ok(scheme * sc, op_code_info * pcd, char *msg) {
+  int n;
 
-      if (is_immutable(car(sc->args))) {
-        Error_1(sc, "vector-set!: unable to alter immutable vector:",
-            car(sc->args));
-      }
+  if (pcd->fixed && args_fit(sc, pcd)) {
+    fast_checks++;
+    return 1;
+  }
+  n = list_length(sc, sc->args);
 
-      x = cadr(sc->args);
-      if (!is_integer(x)) {
-        Error_1(sc, "vector-set!: index must be exact:", x);
+  /* Check number of arguments */
+  if (n < pcd->min_arity) {
+    snprintf(msg, AUXBUFF_SIZE, "%s: needs%s %d argument(s)",
+        pcd->name,
+        pcd->min_arity == pcd->max_arity ? "" : " at least",
+        pcd->min_arity);
+    return 0;
+  }
+  if (n > pcd->max_arity) {
+    snprintf(msg, AUXBUFF_SIZE, "%s: needs%s %d argument(s)",
+        pcd->name,
+        pcd->min_arity == pcd->max_arity ? "" : " at most",
+        pcd->max_arity);
+    return 0;
+  }
+  if (pcd->arg_tests_encoding != 0) {
+    int i = 0;
+    int j;
+    const char *t = pcd->arg_tests_encoding;
+    pointer arglist = sc->args;
+    do {
+      pointer arg = car(arglist);
+      j = (int) t[0];
+      if (j == TST_LIST[0]) {
+        if (arg != sc->NIL && !is_pair(arg))
+          break;
+      } else {
+        if (!tests[j].fct(arg))
+          break;
       }
 
-      index = ivalue(x);
-      if (index >= ivalue(car(sc->args))) {
-        Error_1(sc, "vector-set!: out of bounds:", x);
+      if (t[1] != 0) {          /* last test is replicated as necessary */
+        t++;
       }
-
-      set_vector_elem(car(sc->args), index, caddr(sc->args));
-      s_return(sc, car(sc->args));
+      arglist = cdr(arglist);
+      i++;
+    } while (i < n);
+    if (i < n) {
+      snprintf(msg, AUXBUFF_SIZE, "%s: argument %d must be: %s",
+          pcd->name, i + 1, tests[j].kind);
+      return 0;
     }
+  }
+  return 1;
+}
 
-  case OP_MKBVECTOR:{           /* make-bytevector */
-      int fill = 0;
-      int len;
-      pointer vec;
-
-      len = ivalue(car(sc->args));
-
-      if (cdr(sc->args) != sc->NIL) {
-        fill = ivalue(cadr(sc->args));
-      }
-      vec = mk_bvector(sc, len, fill);
-      if (sc->no_memory) {
-        s_return(sc, sc->sink);
+/* kernel of this interpreter */
+static void Eval_Cycle(scheme * sc, enum scheme_opcodes op) {
+  sc->op = op;
+  for (;;) {
+    op_code_info *pcd = dispatch_table + sc->op;
+    if (pcd->name != 0) {       /* if built-in function, check arguments */
+      char msg[AUXBUFF_SIZE];
+      if (!proc_args_ok(sc, pcd, msg)) {
+        if (_Error_1(sc, msg, 0) == sc->NIL) {
+          return;
+        }
+        pcd = dispatch_table + sc->op;
       }
-      s_return(sc, vec);
     }
+    ok_to_freely_gc(sc);
+    /* all cells in use are reachable from sc here, unless a foreign
+       function called us and has some */
+    if (sc->compact_due && sc->c_nest == sc->NIL) {
+      compact(sc);
+    }
+    if (pcd->func(sc, (enum scheme_opcodes) sc->op) == sc->NIL) {
+      return;
+    }
+    if (sc->no_memory) {
+      fprintf(stderr, "No memory!\n");
+      sc->retcode = 9;
+      return;
+    }
+  }
+}
 
-  case OP_BVECREF:{             /* bytevector-u8-ref */
-      int index;
+/* ========== Bytecode compiler and VM ========== */
 
-      x = cadr(sc->args);
-      if (!is_integer(x)) {
-        Error_1(sc, "bytevector-u8-ref: index must be exact:", x);
-      }
-      index = ivalue(x);
+/*
+ * Closure bodies are compiled once, when the closure is first made,
+ * into a flat array of ints that opexe_7 runs without going back to
+ * Eval_Cycle for every subexpression.  The registers keep their
+ * meaning: sc->value is the accumulator, sc->envir the environment and
+ * sc->code the running prototype.  Operands are pushed on sc->vm_stack
+ * rather than consed onto sc->args; only when the VM is left does what
+ * is on it go to sc->args, as a list with the top first, to be saved
+ * on the dump.  Built-ins called directly get their arguments in the
+ * arg cells, closures in their new frame.
+ *
+ * A prototype is a vector: slot 0 is the code (a T_BYTECODE cell),
+ * slot 1 the source, either (formals . body) or a plain expression,
+ * slot 2 the names of the frame a call makes, and the remaining slots
+ * hold constants.  A return point is a constant (prototype . pc); r
+ * operands name one, or are 0 in tail position.  Forms the compiler
+ * does not handle (macro, cons-stream, malformed syntax) are handed
+ * back to OP_EVAL.
+ *
+ * Variables bound by compiled code live in T_FRAME frames and are
+ * addressed as (depth, index) pairs worked out at compile time; the
+ * scope of a prototype lists the names of the frames around it,
+ * innermost first.  Variables outside that scope, globals included,
+ * are looked up by name; c operands cache the global slot found.
+ */
+enum vm_opcodes {
+  VM_CONST,                     /* k      value = k */
+  VM_REF,                       /* k c    value = variable k, c a cache */
+  VM_SET,                       /* k c    set! variable k to value */
+  VM_DEF,                       /* k      define variable k as value */
+  VM_LREF,                      /* d i k  value = slot i of frame d */
+  VM_LSET,                      /* d i k  set! slot i of frame d to value */
+  VM_LDEF,                      /* i k    bind slot i of this frame */
+  VM_PUSH,                      /*        push value */
+  VM_INSERT,                    /* n      push value below the top n */
+  VM_JMP,                       /* t      */
+  VM_JMPF,                      /* t      jump if value is #f */
+  VM_JMPT,                      /* t      jump unless value is #f */
+  VM_MEMV,                      /* k t    jump unless value is memv of k */
+  VM_FRAME,                     /* n k    new frame for names k, the first
+                                           n slots popped off the stack */
+  VM_BIND,                      /* n      pop n values into this frame */
+  VM_POPENV,                    /*        drop the innermost frame */
+  VM_CLOSURE,                   /* k      value = closure of prototype k */
+  VM_PROMISE,                   /* k      value = promise of prototype k */
+  VM_LAMBDA,                    /* k      compile (lambda . scope) k, through
+                                           *compile-hook* if there is one */
+  VM_MACCHK,                    /* k m r  expand (form . scope) k if value
+                                           is a macro, once into m if it
+                                           is memoized */
+  VM_TREE,                      /* k r    evaluate form k with OP_EVAL */
+  VM_CALL,                      /* n r    apply the top n+1 stack values */
+  VM_TCALL,                     /* n      same, in tail position */
+  VM_RET                        /*        return value */
+};
 
-      if (index >= ivalue(car(sc->args))) {
-        Error_1(sc, "bytevector-u8-ref: out of bounds:", x);
-      }
+struct vm_buf {
+  int *code;
+  int len, size;
+  pointer consts;               /* in reverse order */
+  int nconst;
+  pointer rets;                 /* return points waiting for the prototype */
+  pointer scope;                /* names of the enclosing frames */
+};
+
+static void vm_compile_expr(scheme * sc, struct vm_buf *b, pointer x,
+    int tail);
 
-      s_return(sc, mk_integer(sc, ((unsigned char *) strvalue(car(sc->args)))[index]));
+static void vm_emit(scheme * sc, struct vm_buf *b, int w) {
+  if (b->len == b->size) {
+    int size = b->size == 0 ? 32 : 2 * b->size;
+    int *code = (int *) sc->malloc(size * sizeof(int));
+
+    if (code == 0) {
+      sc->no_memory = 1;
+      return;
+    }
+    if (b->code != 0) {
+      memcpy(code, b->code, b->len * sizeof(int));
+      sc->free(b->code);
     }
+    b->code = code;
+    b->size = size;
+  }
+  b->code[b->len++] = w;
+}
 
-  case OP_BVECSET:{             /* bytevector-u8-set! */
-      int index;
+static INLINE void vm_emit2(scheme * sc, struct vm_buf *b, int op, int a) {
+  vm_emit(sc, b, op);
+  vm_emit(sc, b, a);
+}
 
-      x = car(sc->args);
-      if (is_immutable(x)) {
-        Error_1(sc, "bytevector-u8-set!: unable to alter immutable data:", x);
-      }
+/* Point the chain of jump operands starting at 'at' to 'target'. */
+static void vm_patch(scheme * sc, struct vm_buf *b, int at, int target) {
+  while (at >= 0 && !sc->no_memory) {
+    int next = b->code[at];
+    b->code[at] = target;
+    at = next;
+  }
+}
 
-      y = cadr(sc->args);
-      if (!is_integer(y)) {
-        Error_1(sc, "bytevector-u8-set!: index must be exact:", y);
-      }
+/* Emit a forward jump, chaining it to the earlier ones in *chain. */
+static void vm_jump(scheme * sc, struct vm_buf *b, int op, int *chain) {
+  vm_emit2(sc, b, op, *chain);
+  *chain = b->len - 1;
+}
 
-      index = ivalue(y);
-      if (index >= strlength(x)) {
-        Error_1(sc, "bytevector-u8-set!: out of bounds:", y);
+static int vm_const(scheme * sc, struct vm_buf *b, pointer x) {
+  if (is_symbol(x)) {
+    pointer y;
+    int i = b->nconst;
+    for (y = b->consts; y != sc->NIL; y = cdr(y)) {
+      i--;
+      if (car(y) == x) {
+        return i + 3;
       }
+    }
+  }
+  b->consts = cons(sc, x, b->consts);
+  return b->nconst++ + 3;
+}
 
-      strvalue(x)[index] = (unsigned char) (ivalue(caddr(sc->args)));
-      s_return(sc, x);
+/* Slot index of variable x in the scope, or -1; *depth counts frames. */
+static int vm_lookup(scheme * sc, struct vm_buf *b, pointer x, int *depth) {
+  pointer s, y;
+  int i, at;
+
+  for (s = b->scope, *depth = 0; s != sc->NIL; s = cdr(s), (*depth)++) {
+    for (y = car(s), i = 0, at = -1; y != sc->NIL; y = cdr(y), i++) {
+      if (car(y) == x) {
+        at = i;
+      }
     }
+    if (at >= 0) {
+      return at;
+    }
+  }
+  return -1;
+}
 
-  case OP_BVECLEN:              /* bytevector-length */
-    s_return(sc, mk_integer(sc, strlength(car(sc->args))));
+/* Reference or set! a variable, by address where the scope allows. */
+static void vm_compile_var(scheme * sc, struct vm_buf *b, int op,
+    pointer x) {
+  int d, i = vm_lookup(sc, b, x, &d);
 
-  default:
-    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
-    Error_0(sc, sc->strbuff);
+  if (i < 0) {
+    vm_emit2(sc, b, op, vm_const(sc, b, x));
+    vm_emit(sc, b, vm_const(sc, b, cons(sc, sc->NIL, sc->NIL)));
+    return;
   }
-  return sc->T;
+  vm_emit(sc, b, op == VM_REF ? VM_LREF : VM_LSET);
+  vm_emit2(sc, b, d, i);
+  vm_emit(sc, b, vm_const(sc, b, x));
 }
 
-static int is_list(scheme * sc, pointer a) {
-  return list_length(sc, a) >= 0;
+/* A return point whose pc is filled in once the site is emitted. */
+static int vm_retpoint(scheme * sc, struct vm_buf *b, pointer * rp) {
+  *rp = cons(sc, sc->NIL, sc->NIL);
+  b->rets = cons(sc, *rp, b->rets);
+  return vm_const(sc, b, *rp);
 }
 
-/* Result is:
-   proper list: length
-   circular list: -1
-   not even a pair: -2
-   dotted list: -2 minus length before dot
-*/
-int list_length(scheme * sc, pointer a) {
-  int i = 0;
-  pointer slow, fast;
+static INLINE void vm_leaf(scheme * sc, struct vm_buf *b, int tail) {
+  if (tail) {
+    vm_emit(sc, b, VM_RET);
+  }
+}
 
-  slow = fast = a;
-  while (1) {
-    if (fast == sc->NIL)
-      return i;
-    if (!is_pair(fast))
-      return -2 - i;
-    fast = cdr(fast);
-    ++i;
-    if (fast == sc->NIL)
-      return i;
-    if (!is_pair(fast))
-      return -2 - i;
-    ++i;
-    fast = cdr(fast);
+static pointer vm_finish(scheme * sc, struct vm_buf *b, pointer source,
+    pointer names) {
+  pointer p, x;
+  int i;
 
-    /* Safe because we would have already returned if `fast'
-       encountered a non-pair. */
-    slow = cdr(slow);
-    if (fast == slow) {
-      /* the fast pointer has looped back around and caught up
-         with the slow pointer, hence the structure is circular,
-         not of finite length, and therefore not a list */
-      return -1;
-    }
+  p = mk_vector(sc, b->nconst + 3);
+  x = get_cell(sc, sc->NIL, sc->NIL);
+  if (sc->no_memory) {
+    sc->free(b->code);
+    return sc->NIL;
+  }
+  typeflag(x) = (T_BYTECODE | T_ATOM);
+  bufvalue(x) = (char *) b->code;
+  buflength(x) = b->len;
+  set_vector_elem(p, 0, x);
+  set_vector_elem(p, 1, source);
+  set_vector_elem(p, 2, names);
+  for (i = b->nconst + 2, x = b->consts; x != sc->NIL; i--, x = cdr(x)) {
+    set_vector_elem(p, i, car(x));
+  }
+  for (x = b->rets; x != sc->NIL; x = cdr(x)) {
+    gc_barrier(car(x), p);
+    caar(x) = p;
   }
+  return p;
 }
 
-static pointer opexe_3(scheme * sc, enum scheme_opcodes op) {
-  pointer x;
-  num v;
-  int (*comp_func) (num, num) = 0;
+static void vm_init(scheme * sc, struct vm_buf *b, pointer scope) {
+  b->code = 0;
+  b->len = b->size = 0;
+  b->consts = b->rets = sc->NIL;
+  b->nconst = 0;
+  b->scope = scope;
+}
 
-  switch (op) {
-  case OP_NOT:                 /* not */
-    s_retbool(is_false(car(sc->args)));
-  case OP_BOOLP:               /* boolean? */
-    s_retbool(car(sc->args) == sc->F || car(sc->args) == sc->T);
-  case OP_EOFOBJP:             /* boolean? */
-    s_retbool(car(sc->args) == sc->EOF_OBJ);
-  case OP_NULLP:               /* null? */
-    s_retbool(car(sc->args) == sc->NIL);
-  case OP_NUMEQ:               /* = */
-  case OP_LESS:                /* < */
-  case OP_GRE:                 /* > */
-  case OP_LEQ:                 /* <= */
-  case OP_GEQ:                 /* >= */
-    switch (op) {
-    case OP_NUMEQ:
-      comp_func = num_eq;
-      break;
-    case OP_LESS:
-      comp_func = num_lt;
-      break;
-    case OP_GRE:
-      comp_func = num_gt;
-      break;
-    case OP_LEQ:
-      comp_func = num_le;
-      break;
-    case OP_GEQ:
-      comp_func = num_ge;
-      break;
-    default:
-      break;                    /* Quiet the compiler */
+/* Push the variables a body defines at its top level onto names. */
+static pointer vm_define_names(scheme * sc, pointer x, pointer names) {
+  pointer y, z;
+
+  for (; is_pair(x); x = cdr(x)) {
+    y = car(x);
+    if (!is_pair(y) || !is_syntax(car(y)) || !is_pair(cdr(y))) {
+      continue;
     }
-    x = sc->args;
-    v = nvalue(car(x));
-    x = cdr(x);
+    if (syntaxnum(car(y)) == OP_BEGIN) {
+      names = vm_define_names(sc, cdr(y), names);
+      continue;
+    }
+    if (syntaxnum(car(y)) != OP_DEF0) {
+      continue;
+    }
+    y = is_pair(cadr(y)) ? car(cadr(y)) : cadr(y);
+    if (!is_symbol(y) || is_immutable(y)) {
+      continue;
+    }
+    for (z = names; z != sc->NIL && car(z) != y; z = cdr(z)) {
+    }
+    if (z == sc->NIL) {
+      names = cons(sc, y, names);
+    }
+  }
+  return names;
+}
 
-    for (; x != sc->NIL; x = cdr(x)) {
-      if (!comp_func(v, nvalue(car(x)))) {
-        s_retbool(0);
-      }
-      v = nvalue(car(x));
+/* Names of the frame for a body binding vars, a list that may end in
+   a rest variable: vars first, then what the body defines.  #f if one
+   of vars is not a symbol. */
+static pointer vm_frame_names(scheme * sc, pointer vars, pointer body) {
+  pointer names = sc->NIL;
+
+  for (; is_pair(vars); vars = cdr(vars)) {
+    if (!is_symbol(car(vars))) {
+      return sc->F;
     }
-    s_retbool(1);
-  case OP_SYMBOLP:             /* symbol? */
-    s_retbool(is_symbol(car(sc->args)));
-  case OP_NUMBERP:             /* number? */
-    s_retbool(is_number(car(sc->args)));
-  case OP_STRINGP:             /* string? */
-    s_retbool(is_string(car(sc->args)));
-  case OP_INTEGERP:            /* integer? */
-    s_retbool(is_integer(car(sc->args)));
-  case OP_REALP:               /* real? */
-    s_retbool(is_number(car(sc->args)));        /* All numbers are real */
-  case OP_CHARP:               /* char? */
-    s_retbool(is_character(car(sc->args)));
-#if USE_CHAR_CLASSIFIERS
-  case OP_CHARAP:              /* char-alphabetic? */
-    s_retbool(Cisalpha(ivalue(car(sc->args))));
-  case OP_CHARNP:              /* char-numeric? */
-    s_retbool(Cisdigit(ivalue(car(sc->args))));
-  case OP_CHARWP:              /* char-whitespace? */
-    s_retbool(Cisspace(ivalue(car(sc->args))));
-  case OP_CHARUP:              /* char-upper-case? */
-    s_retbool(Cisupper(ivalue(car(sc->args))));
-  case OP_CHARLP:              /* char-lower-case? */
-    s_retbool(Cislower(ivalue(car(sc->args))));
-#endif
-  case OP_PORTP:               /* port? */
-    s_retbool(is_port(car(sc->args)));
-  case OP_INPORTP:             /* input-port? */
-    s_retbool(is_inport(car(sc->args)));
-  case OP_OUTPORTP:            /* output-port? */
-    s_retbool(is_outport(car(sc->args)));
-  case OP_PROCP:               /* procedure? */
-          /*--
-              * continuation should be procedure by the example
-              * (call-with-current-continuation procedure?) ==> #t
-                 * in R^3 report sec. 6.9
-              */
-    s_retbool(is_proc(car(sc->args)) || is_closure(car(sc->args))
-        || is_continuation(car(sc->args)) || is_foreign(car(sc->args)));
-  case OP_PAIRP:               /* pair? */
-    s_retbool(is_pair(car(sc->args)));
-  case OP_LISTP:               /* list? */
-    s_retbool(list_length(sc, car(sc->args)) >= 0);
+    names = cons(sc, car(vars), names);
+  }
+  if (vars != sc->NIL) {
+    if (!is_symbol(vars)) {
+      return sc->F;
+    }
+    names = cons(sc, vars, names);
+  }
+  return reverse_in_place(sc, sc->NIL, vm_define_names(sc, body, names));
+}
 
-  case OP_ENVP:                /* environment? */
-    s_retbool(is_environment(car(sc->args)));
-  case OP_VECTORP:             /* vector? */
-    s_retbool(is_vector(car(sc->args)));
-  case OP_BVECTORP:             /* bytevector? */
-    s_retbool(is_bvector(car(sc->args)));
-  case OP_EQ:                  /* eq? */
-    s_retbool(car(sc->args) == cadr(sc->args));
-  case OP_EQV:                 /* eqv? */
-    s_retbool(eqv(car(sc->args), cadr(sc->args)));
-  case OP_CURR_SEC:            /* current-second */
-    v.is_fixnum = 0;
-    v.value.rvalue = time(0);
-    s_return(sc, mk_number(sc, v));
-  case OP_EVAL_CNT:            /* eval-count */
-    v.is_fixnum = 1;
-    v.value.ivalue = evalcnt;
-    s_return(sc, mk_number(sc, v));
-  default:
-    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
-    Error_0(sc, sc->strbuff);
+/* Same semantics as OP_BEGIN: an improper tail is the value. */
+static void vm_compile_body(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  if (!is_pair(x)) {
+    vm_emit2(sc, b, VM_CONST, vm_const(sc, b, x));
+    vm_leaf(sc, b, tail);
+    return;
+  }
+  for (; is_pair(cdr(x)); x = cdr(x)) {
+    vm_compile_expr(sc, b, car(x), 0);
+  }
+  if (cdr(x) == sc->NIL) {
+    vm_compile_expr(sc, b, car(x), tail);
+  } else {
+    vm_compile_expr(sc, b, car(x), 0);
+    vm_emit2(sc, b, VM_CONST, vm_const(sc, b, cdr(x)));
+    vm_leaf(sc, b, tail);
   }
-  return sc->T;
 }
 
-static pointer opexe_4(scheme * sc, enum scheme_opcodes op) {
-  pointer x, y;
+/* Code that needs a prototype of its own: lambdas and named lets.
+   scope is that of the code making the closure. */
+static pointer vm_compile_lambda(scheme * sc, pointer source,
+    pointer scope) {
+  struct vm_buf b;
+  pointer names;
 
-  switch (op) {
-  case OP_FORCE:               /* force */
-    sc->code = car(sc->args);
-    if (is_promise(sc->code)) {
-      /* Should change type to closure here */
-      s_save(sc, OP_SAVE_FORCED, sc->NIL, sc->code);
-      sc->args = sc->NIL;
-      s_goto(sc, OP_APPLY);
-    } else {
-      s_return(sc, sc->code);
-    }
+  if (!is_pair(source)) {
+    return source;
+  }
+  names = vm_frame_names(sc, car(source), cdr(source));
+  if (names == sc->F) {
+    return source;              /* let OP_APPLY complain */
+  }
+  vm_init(sc, &b, cons(sc, names, scope));
+  vm_compile_body(sc, &b, cdr(source), 1);
+  return vm_finish(sc, &b, source, names);
+}
 
-  case OP_SAVE_FORCED:         /* Save forced value replacing promise */
-    memcpy(sc->code, sc->value, sizeof(struct cell));
-    s_return(sc, sc->value);
+/* Code run in the caller's frame: macro expansions. */
+static pointer vm_compile_block(scheme * sc, pointer x, pointer scope) {
+  struct vm_buf b;
 
-  case OP_WRITE:               /* write */
-  case OP_DISPLAY:             /* display */
-  case OP_WRITE_CHAR:          /* write-char */
-    if (is_pair(cdr(sc->args))) {
-      if (cadr(sc->args) != sc->outport) {
-        x = cons(sc, sc->outport, sc->NIL);
-        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
-        sc->outport = cadr(sc->args);
-      }
-    }
-    sc->args = car(sc->args);
-    if (op == OP_WRITE) {
-      sc->print_flag = 1;
-    } else {
-      sc->print_flag = 0;
-    }
-    s_goto(sc, OP_P0LIST);
+  vm_init(sc, &b, scope);
+  vm_compile_expr(sc, &b, x, 1);
+  return vm_finish(sc, &b, x, sc->NIL);
+}
 
-  case OP_WRITE_U8:            /* write-u8 */
-    if (is_pair(cdr(sc->args))) {
-      if (cadr(sc->args) != sc->outport) {
-        x = cons(sc, sc->outport, sc->NIL);
-        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
-        sc->outport = cadr(sc->args);
-      }
-    }
-    putcharacter(sc, ivalue(car(sc->args)));
-    s_return(sc, sc->T);
+static void vm_compile_tree(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer rp;
+  int k = vm_const(sc, b, x);
 
-  case OP_NEWLINE:             /* newline */
-    if (is_pair(sc->args)) {
-      if (car(sc->args) != sc->outport) {
-        x = cons(sc, sc->outport, sc->NIL);
-        s_save(sc, OP_SET_OUTPORT, x, sc->NIL);
-        sc->outport = car(sc->args);
-      }
-    }
-    putstr(sc, "\n");
-    s_return(sc, sc->T);
+  if (tail) {
+    vm_emit(sc, b, VM_TREE);
+    vm_emit2(sc, b, k, 0);
+  } else {
+    int r = vm_retpoint(sc, b, &rp);
+    vm_emit(sc, b, VM_TREE);
+    vm_emit2(sc, b, k, r);
+    cdr(rp) = mk_integer(sc, b->len);
+  }
+}
 
-  case OP_ERR0:                /* error */
-    sc->retcode = -1;
-    if (!is_string(car(sc->args))) {
-      sc->args = cons(sc, mk_string(sc, " -- "), sc->args);
-      setimmutable(car(sc->args));
+/* Bindings of let and friends: a proper list of (name init) lists. */
+static int vm_bindings_ok(scheme * sc, pointer x) {
+  for (; is_pair(x); x = cdr(x)) {
+    if (!is_pair(car(x)) || !is_symbol(caar(x)) || !is_pair(cdar(x))) {
+      return 0;
     }
-    putstr(sc, "Error: ");
-    putstr(sc, strvalue(car(sc->args)));
-    sc->args = cdr(sc->args);
-    s_goto(sc, OP_ERR1);
+  }
+  return x == sc->NIL;
+}
 
-  case OP_ERR1:                /* error */
-    putstr(sc, " ");
-    if (sc->args != sc->NIL) {
-      s_save(sc, OP_ERR1, cdr(sc->args), sc->NIL);
-      sc->args = car(sc->args);
-      sc->print_flag = 1;
-      s_goto(sc, OP_P0LIST);
+static pointer vm_binding_names(scheme * sc, pointer x) {
+  pointer y = sc->NIL;
+  for (; x != sc->NIL; x = cdr(x)) {
+    y = cons(sc, caar(x), y);
+  }
+  return reverse_in_place(sc, sc->NIL, y);
+}
+
+static void vm_compile_inits(scheme * sc, struct vm_buf *b, pointer x) {
+  for (; x != sc->NIL; x = cdr(x)) {
+    vm_compile_expr(sc, b, cadar(x), 0);
+    vm_emit(sc, b, VM_PUSH);
+  }
+}
+
+/* The body of a let that made a new frame for names. */
+static void vm_compile_scope(scheme * sc, struct vm_buf *b, pointer x,
+    pointer names, int tail) {
+  pointer scope = b->scope;
+
+  b->scope = cons(sc, names, scope);
+  vm_compile_body(sc, b, x, tail);
+  b->scope = scope;
+  if (!tail) {
+    vm_emit(sc, b, VM_POPENV);
+  }
+}
+
+static int vm_compile_let(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer names, rp;
+  int n;
+
+  if (is_symbol(car(x))) {      /* named let */
+    pointer loop, scope;
+
+    if (!is_pair(cdr(x)) || !vm_bindings_ok(sc, cadr(x))) {
+      return 0;
+    }
+    names = vm_binding_names(sc, cadr(x));
+    n = list_length(sc, names);
+    vm_compile_inits(sc, b, cadr(x));
+    /* the loop procedure gets a frame of its own around it */
+    loop = cons(sc, car(x), sc->NIL);
+    vm_emit(sc, b, VM_FRAME);
+    vm_emit2(sc, b, 0, vm_const(sc, b, loop));
+    scope = cons(sc, loop, b->scope);
+    vm_emit2(sc, b, VM_CLOSURE,
+        vm_const(sc, b, vm_compile_lambda(sc, cons(sc, names, cddr(x)),
+                scope)));
+    vm_emit(sc, b, VM_LDEF);
+    vm_emit2(sc, b, 0, vm_const(sc, b, car(x)));
+    vm_emit(sc, b, VM_LREF);
+    vm_emit2(sc, b, 0, 0);
+    vm_emit(sc, b, vm_const(sc, b, car(x)));
+    vm_emit2(sc, b, VM_INSERT, n);
+    if (tail) {
+      vm_emit2(sc, b, VM_TCALL, n);
     } else {
-      putstr(sc, "\n");
-      if (sc->interactive_repl) {
-        s_goto(sc, OP_T0LVL);
-      } else {
-        return sc->NIL;
-      }
+      int r = vm_retpoint(sc, b, &rp);
+      vm_emit2(sc, b, VM_CALL, n);
+      vm_emit(sc, b, r);
+      cdr(rp) = mk_integer(sc, b->len);
+      vm_emit(sc, b, VM_POPENV);
     }
+    return 1;
+  }
+  if (!vm_bindings_ok(sc, car(x))) {
+    return 0;
+  }
+  names = vm_binding_names(sc, car(x));
+  n = list_length(sc, names);
+  names = vm_frame_names(sc, names, cdr(x));
+  vm_compile_inits(sc, b, car(x));
+  vm_emit(sc, b, VM_FRAME);
+  vm_emit2(sc, b, n, vm_const(sc, b, names));
+  vm_compile_scope(sc, b, cdr(x), names, tail);
+  return 1;
+}
 
-  case OP_REVERSE:             /* reverse */
-    s_return(sc, reverse(sc, car(sc->args)));
+/* One frame for all the variables, filled in as the inits are done:
+   OP_LET2AST works the same way. */
+static int vm_compile_letstar(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer y, names, scope;
+  int i;
 
-  case OP_LIST_STAR:           /* list* */
-    s_return(sc, list_star(sc, sc->args));
+  if (!is_pair(x) || !vm_bindings_ok(sc, car(x))) {
+    return 0;
+  }
+  y = car(x);
+  names = vm_frame_names(sc, vm_binding_names(sc, y), cdr(x));
+  if (y == sc->NIL) {
+    vm_emit(sc, b, VM_FRAME);
+    vm_emit2(sc, b, 0, vm_const(sc, b, names));
+  } else {
+    /* the first init is done before the frame is made */
+    vm_compile_expr(sc, b, cadar(y), 0);
+    vm_emit(sc, b, VM_PUSH);
+    vm_emit(sc, b, VM_FRAME);
+    vm_emit2(sc, b, 1, vm_const(sc, b, names));
+    scope = b->scope;
+    b->scope = cons(sc, names, scope);
+    for (i = 1, y = cdr(y); y != sc->NIL; i++, y = cdr(y)) {
+      vm_compile_expr(sc, b, cadar(y), 0);
+      vm_emit(sc, b, VM_LDEF);
+      vm_emit2(sc, b, i, vm_const(sc, b, caar(y)));
+    }
+    b->scope = scope;
+  }
+  vm_compile_scope(sc, b, cdr(x), names, tail);
+  return 1;
+}
 
-  case OP_APPEND:              /* append */
-    x = sc->NIL;
-    y = sc->args;
-    if (y == x) {
-      s_return(sc, x);
-    }
+static int vm_compile_letrec(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer names, scope;
 
-    /* cdr() in the while condition is not a typo. If car() */
-    /* is used (append '() 'a) will return the wrong result. */
-    while (cdr(y) != sc->NIL) {
-      x = revappend(sc, x, car(y));
-      y = cdr(y);
-      if (x == sc->F) {
-        Error_0(sc, "non-list argument to append");
-      }
-    }
+  if (!is_pair(x) || !vm_bindings_ok(sc, car(x))) {
+    return 0;
+  }
+  names = vm_frame_names(sc, vm_binding_names(sc, car(x)), cdr(x));
+  vm_emit(sc, b, VM_FRAME);
+  vm_emit2(sc, b, 0, vm_const(sc, b, names));
+  scope = b->scope;
+  b->scope = cons(sc, names, scope);
+  vm_compile_inits(sc, b, car(x));
+  b->scope = scope;
+  vm_emit2(sc, b, VM_BIND, list_length(sc, car(x)));
+  vm_compile_scope(sc, b, cdr(x), names, tail);
+  return 1;
+}
 
-    s_return(sc, reverse_in_place(sc, car(y), x));
+static int vm_compile_cond(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer y, rp;
+  int end = -1;
 
-#if USE_PLIST
-  case OP_PUT:                 /* put */
-    if (!hasprop(car(sc->args)) || !hasprop(cadr(sc->args))) {
-      Error_0(sc, "illegal use of put");
+  if (!is_pair(x)) {
+    return 0;
+  }
+  for (y = x; is_pair(y); y = cdr(y)) {
+    if (!is_pair(car(y))) {
+      return 0;
     }
-    for (x = symprop(car(sc->args)), y = cadr(sc->args); x != sc->NIL;
-        x = cdr(x)) {
-      if (caar(x) == y) {
-        break;
-      }
+    if (is_pair(cdar(y)) && cadar(y) == sc->FEED_TO && !is_pair(cdr(cdar(y)))) {
+      return 0;
     }
-    if (x != sc->NIL)
-      cdar(x) = caddr(sc->args);
-    else
-      symprop(car(sc->args)) = cons(sc, cons(sc, y, caddr(sc->args)),
-          symprop(car(sc->args)));
-    s_return(sc, sc->T);
+  }
+  if (y != sc->NIL) {
+    return 0;
+  }
+  for (; x != sc->NIL; x = cdr(x)) {
+    int next = -1;
 
-  case OP_GET:                 /* get */
-    if (!hasprop(car(sc->args)) || !hasprop(cadr(sc->args))) {
-      Error_0(sc, "illegal use of get");
-    }
-    for (x = symprop(car(sc->args)), y = cadr(sc->args); x != sc->NIL;
-        x = cdr(x)) {
-      if (caar(x) == y) {
-        break;
+    y = car(x);
+    vm_compile_expr(sc, b, car(y), 0);
+    if (cdr(y) == sc->NIL) {    /* (test) */
+      if (tail) {
+        vm_jump(sc, b, VM_JMPF, &next);
+        vm_emit(sc, b, VM_RET);
+      } else {
+        vm_jump(sc, b, VM_JMPT, &end);
+      }
+    } else if (is_pair(cdr(y)) && cadr(y) == sc->FEED_TO) {
+      vm_jump(sc, b, VM_JMPF, &next);
+      vm_emit(sc, b, VM_PUSH);
+      vm_compile_expr(sc, b, caddr(y), 0);
+      vm_emit2(sc, b, VM_INSERT, 1);
+      if (tail) {
+        vm_emit2(sc, b, VM_TCALL, 1);
+      } else {
+        int r = vm_retpoint(sc, b, &rp);
+        vm_emit2(sc, b, VM_CALL, 1);
+        vm_emit(sc, b, r);
+        cdr(rp) = mk_integer(sc, b->len);
+        vm_jump(sc, b, VM_JMP, &end);
       }
-    }
-    if (x != sc->NIL) {
-      s_return(sc, cdar(x));
     } else {
-      s_return(sc, sc->NIL);
-    }
-#endif /* USE_PLIST */
-  case OP_QUIT:                /* quit */
-    if (is_pair(sc->args)) {
-      sc->retcode = ivalue(car(sc->args));
+      vm_jump(sc, b, VM_JMPF, &next);
+      vm_compile_body(sc, b, cdr(y), tail);
+      if (!tail) {
+        vm_jump(sc, b, VM_JMP, &end);
+      }
     }
-    return (sc->NIL);
-
-  case OP_GC:                  /* gc */
-    gc(sc, sc->NIL, sc->NIL);
-    s_return(sc, sc->T);
+    vm_patch(sc, b, next, b->len);
+  }
+  vm_emit2(sc, b, VM_CONST, vm_const(sc, b, sc->NIL));
+  vm_leaf(sc, b, tail);
+  vm_patch(sc, b, end, b->len);
+  return 1;
+}
 
-  case OP_GCVERB:              /* gc-verbose */
-    {
-      int was = sc->gc_verbose;
+static int vm_compile_case(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer y;
+  int end = -1;
 
-      sc->gc_verbose = (car(sc->args) != sc->F);
-      s_retbool(was);
+  if (!is_pair(x)) {
+    return 0;
+  }
+  for (y = cdr(x); is_pair(y); y = cdr(y)) {
+    if (!is_pair(car(y))) {
+      return 0;
     }
-
-  case OP_NEWSEGMENT:          /* new-segment */
-    if (!is_pair(sc->args) || !is_number(car(sc->args))) {
-      Error_0(sc, "new-segment: argument must be a number");
+    if (!is_pair(caar(y))) {
+      break;
     }
-    alloc_cellseg(sc, (int) ivalue(car(sc->args)));
-    s_return(sc, sc->T);
-
-  case OP_OBLIST:              /* oblist */
-    s_return(sc, oblist_all_symbols(sc));
+    if (!is_list(sc, caar(y))) {
+      return 0;
+    }
+  }
+  if (y != sc->NIL && !is_pair(y)) {
+    return 0;
+  }
+  vm_compile_expr(sc, b, car(x), 0);
+  for (x = cdr(x); x != sc->NIL; x = cdr(x)) {
+    int next = -1;
+
+    y = car(x);
+    if (!is_pair(car(y))) {     /* else */
+      vm_compile_expr(sc, b, car(y), 0);
+      vm_jump(sc, b, VM_JMPF, &next);
+      vm_compile_body(sc, b, cdr(y), tail);
+      if (!tail) {
+        vm_jump(sc, b, VM_JMP, &end);
+      }
+      vm_patch(sc, b, next, b->len);
+      break;
+    }
+    vm_emit2(sc, b, VM_MEMV, vm_const(sc, b, car(y)));
+    vm_emit(sc, b, next);
+    next = b->len - 1;
+    vm_compile_body(sc, b, cdr(y), tail);
+    if (!tail) {
+      vm_jump(sc, b, VM_JMP, &end);
+    }
+    vm_patch(sc, b, next, b->len);
+  }
+  vm_emit2(sc, b, VM_CONST, vm_const(sc, b, sc->NIL));
+  vm_leaf(sc, b, tail);
+  vm_patch(sc, b, end, b->len);
+  return 1;
+}
 
-  case OP_CURR_INPORT:         /* current-input-port */
-    s_return(sc, sc->inport);
+/* Special forms; returns 0 to leave the form to OP_EVAL. */
+static int vm_compile_syntax(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  int op = syntaxnum(car(x));
+  int next = -1, end = -1;
+  int d, i;
+  pointer y;
 
-  case OP_CURR_OUTPORT:        /* current-output-port */
-    s_return(sc, sc->outport);
+  x = cdr(x);
+  switch (op) {
+  case OP_QUOTE:
+    vm_emit2(sc, b, VM_CONST, vm_const(sc, b, car(x)));
+    vm_leaf(sc, b, tail);
+    return 1;
 
-  case OP_OPEN_INFILE:         /* open-input-file */
-  case OP_OPEN_OUTFILE:        /* open-output-file */
-  case OP_OPEN_INOUTFILE:      /* open-input-output-file */  {
-      int prop = 0;
-      pointer p;
-      switch (op) {
-      case OP_OPEN_INFILE:
-        prop = port_input;
-        break;
-      case OP_OPEN_OUTFILE:
-        prop = port_output;
-        break;
-      case OP_OPEN_INOUTFILE:
-        prop = port_input | port_output;
-        break;
-      default:
-        break;                  /* Quiet the compiler */
-      }
-      p = port_from_filename(sc, strvalue(car(sc->args)), prop);
-      if (p == sc->NIL) {
-        s_return(sc, sc->F);
-      }
-      s_return(sc, p);
+  case OP_IF0:
+    if (!is_pair(x) || !is_pair(cdr(x))) {
+      return 0;
     }
-
-#if USE_STRING_PORTS
-  case OP_OPEN_INSTRING:       /* open-input-string */
-  case OP_OPEN_INOUTSTRING:    /* open-input-output-string */  {
-      int prop = 0;
-      pointer p;
-      switch (op) {
-      case OP_OPEN_INSTRING:
-        prop = port_input;
-        break;
-      case OP_OPEN_INOUTSTRING:
-        prop = port_input | port_output;
-        break;
-      default:
-        break;                  /* Quiet the compiler */
-      }
-      p = port_from_string(sc, strvalue(car(sc->args)),
-          strvalue(car(sc->args)) + strlength(car(sc->args)), prop);
-      if (p == sc->NIL) {
-        s_return(sc, sc->F);
-      }
-      s_return(sc, p);
+    vm_compile_expr(sc, b, car(x), 0);
+    vm_jump(sc, b, VM_JMPF, &next);
+    vm_compile_expr(sc, b, cadr(x), tail);
+    if (!tail) {
+      vm_jump(sc, b, VM_JMP, &end);
     }
-  case OP_OPEN_OUTSTRING:      /* open-output-string */  {
-      pointer p;
-      if (car(sc->args) == sc->NIL) {
-        p = port_from_scratch(sc);
-        if (p == sc->NIL) {
-          s_return(sc, sc->F);
-        }
-      } else {
-        p = port_from_string(sc, strvalue(car(sc->args)),
-            strvalue(car(sc->args)) + strlength(car(sc->args)), port_output);
-        if (p == sc->NIL) {
-          s_return(sc, sc->F);
-        }
+    vm_patch(sc, b, next, b->len);
+    vm_compile_expr(sc, b, caddr(x), tail);
+    vm_patch(sc, b, end, b->len);
+    return 1;
+
+  case OP_DEF0:
+    if (!is_pair(x) || is_immutable(car(x))) {
+      return 0;
+    }
+    if (is_pair(car(x))) {
+      y = caar(x);
+      if (!is_symbol(y)) {
+        return 0;
       }
-      s_return(sc, p);
+      vm_emit2(sc, b, VM_LAMBDA, vm_const(sc, b,
+              cons(sc, cons(sc, cdar(x), cdr(x)), b->scope)));
+    } else {
+      y = car(x);
+      if (!is_symbol(y)) {
+        return 0;
+      }
+      vm_compile_expr(sc, b, cadr(x), 0);
     }
-  case OP_GET_OUTSTRING:       /* get-output-string */  {
-      port *p;
+    i = vm_lookup(sc, b, y, &d);
+    if (i >= 0 && d == 0) {
+      vm_emit(sc, b, VM_LDEF);
+      vm_emit2(sc, b, i, vm_const(sc, b, y));
+    } else {
+      vm_emit2(sc, b, VM_DEF, vm_const(sc, b, y));
+    }
+    vm_leaf(sc, b, tail);
+    return 1;
 
-      if ((p = car(sc->args)->_object._port)->kind & port_string) {
-        int size;
-        char *str;
+  case OP_SET0:
+    if (!is_pair(x) || !is_symbol(car(x)) || is_immutable(car(x))
+        || !is_pair(cdr(x))) {
+      return 0;
+    }
+    vm_compile_expr(sc, b, cadr(x), 0);
+    vm_compile_var(sc, b, VM_SET, car(x));
+    vm_leaf(sc, b, tail);
+    return 1;
 
-        size = p->rep.string.curr - p->rep.string.start + 1;
-        str = sc->malloc(size);
-        if (str != NULL) {
-          pointer s;
+  case OP_BEGIN:
+    vm_compile_body(sc, b, x, tail);
+    return 1;
 
-          memcpy(str, p->rep.string.start, size - 1);
-          str[size - 1] = '\0';
-          s = mk_counted_string(sc, str, size - 1);
-          sc->free(str);
-          s_return(sc, s);
-        }
-      }
-      s_return(sc, sc->F);
+  case OP_LAMBDA:
+    vm_emit2(sc, b, VM_LAMBDA, vm_const(sc, b, cons(sc, x, b->scope)));
+    vm_leaf(sc, b, tail);
+    return 1;
+
+  case OP_LET0:
+    return is_pair(x) && vm_compile_let(sc, b, x, tail);
+
+  case OP_LET0AST:
+    return vm_compile_letstar(sc, b, x, tail);
+
+  case OP_LET0REC:
+    return vm_compile_letrec(sc, b, x, tail);
+
+  case OP_COND0:
+    return vm_compile_cond(sc, b, x, tail);
+
+  case OP_CASE0:
+    return vm_compile_case(sc, b, x, tail);
+
+  case OP_AND0:
+  case OP_OR0:
+    if (!is_list(sc, x)) {
+      return 0;
     }
-#endif
+    if (x == sc->NIL) {
+      vm_emit2(sc, b, VM_CONST,
+          vm_const(sc, b, op == OP_AND0 ? sc->T : sc->F));
+      vm_leaf(sc, b, tail);
+      return 1;
+    }
+    for (; cdr(x) != sc->NIL; x = cdr(x)) {
+      vm_compile_expr(sc, b, car(x), 0);
+      vm_jump(sc, b, op == OP_AND0 ? VM_JMPF : VM_JMPT, &end);
+    }
+    vm_compile_expr(sc, b, car(x), tail);
+    if (end >= 0) {
+      vm_patch(sc, b, end, b->len);
+      vm_leaf(sc, b, tail);
+    }
+    return 1;
 
-  case OP_CLOSE_INPORT:        /* close-input-port */
-    port_close(sc, car(sc->args), port_input);
-    s_return(sc, sc->T);
+  case OP_DELAY:
+    y = vm_compile_lambda(sc, cons(sc, sc->NIL, x), b->scope);
+    vm_emit2(sc, b, VM_PROMISE, vm_const(sc, b, y));
+    vm_leaf(sc, b, tail);
+    return 1;
 
-  case OP_CLOSE_OUTPORT:       /* close-output-port */
-    port_close(sc, car(sc->args), port_output);
-    s_return(sc, sc->T);
+  default:                     /* macro, cons-stream */
+    return 0;
+  }
+}
 
-  case OP_INT_ENV:             /* interaction-environment */
-    s_return(sc, sc->global_env);
+static void vm_compile_expr(scheme * sc, struct vm_buf *b, pointer x,
+    int tail) {
+  pointer y, rp = sc->NIL;
+  int n, r = 0;
 
-  case OP_CURR_ENV:            /* current-environment */
-    s_return(sc, sc->envir);
+  if (sc->no_memory) {
+    return;
+  }
+  if (is_symbol(x)) {
+    vm_compile_var(sc, b, VM_REF, x);
+    vm_leaf(sc, b, tail);
+    return;
+  }
+  if (!is_pair(x)) {
+    vm_emit2(sc, b, VM_CONST, vm_const(sc, b, x));
+    vm_leaf(sc, b, tail);
+    return;
+  }
+  if (is_syntax(car(x))) {
+    if (!vm_compile_syntax(sc, b, x, tail)) {
+      vm_compile_tree(sc, b, x, tail);
+    }
+    return;
+  }
 
-  default:
-    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
-    Error_0(sc, sc->strbuff);
+  /* application */
+  if (!tail) {
+    r = vm_retpoint(sc, b, &rp);
+  }
+  vm_compile_expr(sc, b, car(x), 0);
+  vm_emit(sc, b, VM_MACCHK);
+  vm_emit2(sc, b, vm_const(sc, b, cons(sc, x, b->scope)),
+      vm_const(sc, b, sc->NIL));
+  vm_emit(sc, b, r);
+  vm_emit(sc, b, VM_PUSH);
+  for (n = 0, y = cdr(x); is_pair(y); y = cdr(y), n++) {
+    vm_compile_expr(sc, b, car(y), 0);
+    vm_emit(sc, b, VM_PUSH);
+  }
+  if (tail) {
+    vm_emit2(sc, b, VM_TCALL, n);
+  } else {
+    vm_emit2(sc, b, VM_CALL, n);
+    vm_emit(sc, b, r);
+    cdr(rp) = mk_integer(sc, b->len);
   }
-  return sc->T;
 }
 
-static pointer opexe_5(scheme * sc, enum scheme_opcodes op) {
-  pointer x;
+/* Room for n more values on the operand stack. */
+static int vm_reserve(scheme * sc, int n) {
+  pointer *p;
+  int size = sc->vm_stack_size == 0 ? 256 : sc->vm_stack_size;
 
-  if (sc->nesting != 0) {
-    int n = sc->nesting;
-    sc->nesting = 0;
-    sc->retcode = -1;
-    Error_1(sc, "unmatched parentheses:", mk_integer(sc, n));
+  if (sc->vm_sp + n <= sc->vm_stack_size) {
+    return 1;
+  }
+  while (size < sc->vm_sp + n) {
+    size *= 2;
+  }
+  p = realloc(sc->vm_stack, size * sizeof(pointer));
+  if (p == 0) {
+    sc->no_memory = 1;
+    return 0;
   }
+  sc->vm_stack = p;
+  sc->vm_stack_size = size;
+  return 1;
+}
 
-  switch (op) {
-    /* ========== reading part ========== */
-  case OP_READ:
-    if (!is_pair(sc->args)) {
-      s_goto(sc, OP_READ_INTERNAL);
-    }
-    if (!is_inport(car(sc->args))) {
-      Error_1(sc, "read: not an input port:", car(sc->args));
-    }
-    if (car(sc->args) == sc->inport) {
-      s_goto(sc, OP_READ_INTERNAL);
-    }
-    x = sc->inport;
-    sc->inport = car(sc->args);
-    x = cons(sc, x, sc->NIL);
-    s_save(sc, OP_SET_INPORT, x, sc->NIL);
-    s_goto(sc, OP_READ_INTERNAL);
+static INLINE int vm_push(scheme * sc, pointer x) {
+  if (sc->vm_sp == sc->vm_stack_size && !vm_reserve(sc, 1)) {
+    return 0;
+  }
+  sc->vm_stack[sc->vm_sp++] = x;
+  return 1;
+}
 
-  case OP_READ_CHAR:           /* read-char */
-  case OP_PEEK_CHAR:           /* peek-char */  {
-      int c;
-      if (is_pair(sc->args)) {
-        if (car(sc->args) != sc->inport) {
-          x = sc->inport;
-          x = cons(sc, x, sc->NIL);
-          s_save(sc, OP_SET_INPORT, x, sc->NIL);
-          sc->inport = car(sc->args);
-        }
-      }
-      c = inchar(sc);
-      if (c == EOF) {
-        s_return(sc, sc->EOF_OBJ);
-      }
-      if (sc->op == OP_PEEK_CHAR) {
-        backchar(sc, c);
-      }
-      s_return(sc, mk_character(sc, c));
-    }
+/* Push the elements of list a, the first first; returns how many. */
+static int vm_push_list(scheme * sc, pointer a) {
+  int n = 0;
 
-  case OP_READ_U8:           /* read-u8 */
-  case OP_PEEK_U8:           /* peek-u8 */  {
-      int c;
-      if (is_pair(sc->args)) {
-        if (car(sc->args) != sc->inport) {
-          x = sc->inport;
-          x = cons(sc, x, sc->NIL);
-          s_save(sc, OP_SET_INPORT, x, sc->NIL);
-          sc->inport = car(sc->args);
-        }
-      }
-      c = inchar8(sc);
-      if (c == EOF) {
-        s_return(sc, sc->EOF_OBJ);
-      }
-      if (sc->op == OP_PEEK_U8) {
-        backchar(sc, c);
-      }
-      s_return(sc, mk_integer(sc, c));
-    }
+  for (; is_pair(a) && vm_push(sc, car(a)); a = cdr(a)) {
+    n++;
+  }
+  return n;
+}
 
-  case OP_CHAR_READY:          /* char-ready? */  {
-      pointer p = sc->inport;
-      int res;
-      if (is_pair(sc->args)) {
-        p = car(sc->args);
-      }
-      res = p->_object._port->kind & port_string;
-      s_retbool(res);
-    }
+/* Take the top n values off the operand stack as a list, in push
+   order. */
+static pointer vm_list(scheme * sc, int n) {
+  pointer x = sc->NIL;
+  int i;
 
-  case OP_SET_INPORT:          /* set-input-port */
-    sc->inport = car(sc->args);
-    s_return(sc, sc->value);
+  for (i = sc->vm_sp - 1; i >= sc->vm_sp - n; i--) {
+    x = cons(sc, sc->vm_stack[i], x);
+  }
+  sc->vm_sp -= n;
+  return x;
+}
 
-  case OP_SET_OUTPORT:         /* set-output-port */
-    sc->outport = car(sc->args);
-    s_return(sc, sc->value);
+/* The top n values of the operand stack, n at most ARG_CELLS, in the
+   arg cells: a list for a built-in that only reads its arguments.  The
+   cells are not in the heap, so they need no barrier, and the values
+   stay on the stack meanwhile. */
+static pointer vm_arg_cells(scheme * sc, int n) {
+  pointer *v = sc->vm_stack + sc->vm_sp - n;
+  pointer x = sc->NIL;
 
-  case OP_RDSEXPR:
-    switch (sc->tok) {
-    case TOK_EOF:
-      s_return(sc, sc->EOF_OBJ);
-    case TOK_VEC:
-      s_save(sc, OP_RDVEC, sc->NIL, sc->NIL);
-      /* fall through */
-    case TOK_LPAREN:
-      sc->tok = token(sc);
-      if (sc->tok == TOK_RPAREN) {
-        s_return(sc, sc->NIL);
-      } else if (sc->tok == TOK_DOT) {
-        Error_0(sc, "syntax error: illegal dot expression");
-      } else {
-        sc->nesting_stack[sc->file_i]++;
-        s_save(sc, OP_RDLIST, sc->NIL, sc->NIL);
-        s_goto(sc, OP_RDSEXPR);
-      }
-    case TOK_QUOTE:
-      s_save(sc, OP_RDQUOTE, sc->NIL, sc->NIL);
-      sc->tok = token(sc);
-      s_goto(sc, OP_RDSEXPR);
-    case TOK_BQUOTE:
-      sc->tok = token(sc);
-      if (sc->tok == TOK_VEC) {
-        s_save(sc, OP_RDQQUOTEVEC, sc->NIL, sc->NIL);
-        sc->tok = TOK_LPAREN;
-        s_goto(sc, OP_RDSEXPR);
-      } else {
-        s_save(sc, OP_RDQQUOTE, sc->NIL, sc->NIL);
-      }
-      s_goto(sc, OP_RDSEXPR);
-    case TOK_COMMA:
-      s_save(sc, OP_RDUNQUOTE, sc->NIL, sc->NIL);
-      sc->tok = token(sc);
-      s_goto(sc, OP_RDSEXPR);
-    case TOK_ATMARK:
-      s_save(sc, OP_RDUQTSP, sc->NIL, sc->NIL);
-      sc->tok = token(sc);
-      s_goto(sc, OP_RDSEXPR);
-    case TOK_ATOM:
-      s_return(sc, mk_atom(sc, readstr_upto(sc, DELIMITERS)));
-    case TOK_DQUOTE:
-      x = readstrexp(sc);
-      if (x == sc->F) {
-        Error_0(sc, "Error reading string");
-      }
-      setimmutable(x);
-      s_return(sc, x);
-    case TOK_SHARP:{
-        pointer f = find_slot_in_env(sc, sc->envir, sc->SHARP_HOOK, 1);
-        if (f == sc->NIL) {
-          Error_0(sc, "undefined sharp expression");
-        } else {
-          sc->code = cons(sc, slot_value_in_env(f), sc->NIL);
-          s_goto(sc, OP_EVAL);
-        }
-      }
-    case TOK_SHARP_CONST:
-      if ((x = mk_sharp_const(sc, readstr_upto(sc, DELIMITERS))) == sc->NIL) {
-        Error_0(sc, "undefined sharp expression");
-      } else {
-        s_return(sc, x);
-      }
-    default:
-      Error_0(sc, "syntax error: illegal token");
-    }
-    break;
+  while (n-- > 0) {
+    car(sc->arg_cells + n) = v[n];
+    cdr(sc->arg_cells + n) = x;
+    x = sc->arg_cells + n;
+  }
+  return x;
+}
 
-  case OP_RDLIST:{
-      sc->args = cons(sc, sc->value, sc->args);
-      sc->tok = token(sc);
-      if (sc->tok == TOK_EOF) {
-        s_return(sc, sc->EOF_OBJ);
-      } else if (sc->tok == TOK_RPAREN) {
-        int c = inchar(sc);
-        if (c != '\n')
-          backchar(sc, c);
-#if SHOW_ERROR_LINE
-        else if (sc->load_stack[sc->file_i].kind & port_file)
-          sc->load_stack[sc->file_i].rep.stdio.curr_line++;
-#endif
-        sc->nesting_stack[sc->file_i]--;
-        s_return(sc, reverse_in_place(sc, sc->NIL, sc->args));
-      } else if (sc->tok == TOK_DOT) {
-        s_save(sc, OP_RDDOT, sc->args, sc->NIL);
-        sc->tok = token(sc);
-        s_goto(sc, OP_RDSEXPR);
-      } else {
-        s_save(sc, OP_RDLIST, sc->args, sc->NIL);;
-        s_goto(sc, OP_RDSEXPR);
-      }
-    }
+/* Move the bottom n values of the operand stack to sc->args, the top
+   first, the way the interpreter keeps them across a suspension. */
+static void vm_spill(scheme * sc, int n) {
+  pointer x = sc->NIL;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    x = cons(sc, sc->vm_stack[i], x);
+  }
+  sc->vm_sp -= n;
+  memmove(sc->vm_stack, sc->vm_stack + n, sc->vm_sp * sizeof(pointer));
+  sc->args = x;
+}
 
-  case OP_RDDOT:
-    if (token(sc) != TOK_RPAREN) {
-      Error_0(sc, "syntax error: illegal dot expression");
-    } else {
-      sc->nesting_stack[sc->file_i]--;
-      s_return(sc, reverse_in_place(sc, sc->value, sc->args));
-    }
+/* Put back what vm_spill took, from sc->args. */
+static void vm_unspill(scheme * sc) {
+  pointer x;
+  int i = 0;
 
-  case OP_RDQUOTE:
-    s_return(sc, cons(sc, sc->QUOTE, cons(sc, sc->value, sc->NIL)));
+  for (x = sc->args; x != sc->NIL; x = cdr(x)) {
+    i++;
+  }
+  if (!vm_reserve(sc, i)) {
+    return;
+  }
+  i = sc->vm_sp += i;
+  for (x = sc->args; x != sc->NIL; x = cdr(x)) {
+    sc->vm_stack[--i] = car(x);
+  }
+  sc->args = sc->NIL;
+}
 
-  case OP_RDQQUOTE:
-    s_return(sc, cons(sc, sc->QQUOTE, cons(sc, sc->value, sc->NIL)));
+/* Leave a return point to pc on the dump. */
+static void vm_suspend(scheme * sc, enum scheme_opcodes op, int pc) {
+  vm_spill(sc, sc->vm_sp);
+  s_save(sc, op, sc->args, cons(sc, sc->code, mk_integer(sc, pc)));
+}
 
-  case OP_RDQQUOTEVEC:
-    s_return(sc, cons(sc, mk_symbol(sc, "apply"),
-            cons(sc, mk_symbol(sc, "vector"),
-                cons(sc, cons(sc, sc->QQUOTE,
-                        cons(sc, sc->value, sc->NIL)), sc->NIL))));
+static pointer vm_error(scheme * sc, int pc, const char *s, pointer a) {
+  vm_suspend(sc, OP_VM_RET, pc);
+  return _Error_1(sc, s, a);
+}
 
-  case OP_RDUNQUOTE:
-    s_return(sc, cons(sc, sc->UNQUOTE, cons(sc, sc->value, sc->NIL)));
+/* Pop values into the first n slots of frame f. */
+static void vm_bind(scheme * sc, pointer f, int n) {
+  pointer *v = sc->vm_stack + sc->vm_sp - n;
 
-  case OP_RDUQTSP:
-    s_return(sc, cons(sc, sc->UNQUOTESP, cons(sc, sc->value, sc->NIL)));
+  sc->vm_sp -= n;
+  while (n-- > 0) {
+    gc_barrier(frame_slot(f, n), v[n]);
+    cdr(frame_slot(f, n)) = v[n];
+  }
+}
 
-  case OP_RDVEC:
-    /*sc->code=cons(sc,mk_proc(sc,OP_VECTOR),sc->value);
-       s_goto(sc,OP_EVAL); Cannot be quoted */
-    /*x=cons(sc,mk_proc(sc,OP_VECTOR),sc->value);
-       s_return(sc,x); Cannot be part of pairs */
-    /*sc->code=mk_proc(sc,OP_VECTOR);
-       sc->args=sc->value;
-       s_goto(sc,OP_APPLY); */
-    sc->args = sc->value;
-    s_goto(sc, OP_VECTOR);
+/* Make the frame for a call of compiled closure f on the top argc
+   values of the operand stack, pop them and enter it.  Only a rest
+   parameter gets a list.  Returns 0, doing nothing, on too few args
+   or no memory. */
+static int vm_enter_closure(scheme * sc, pointer f, int argc) {
+  pointer proto = car(f), frame, x;
+  int i;
 
-    /* ========== printing part ========== */
-  case OP_P0LIST:
-    if (is_vector(sc->args)) {
-      putstr(sc, "#(");
-      sc->args = cons(sc, sc->args, mk_integer(sc, 0));
-      s_goto(sc, OP_PVECFROM);
-    } else if (is_environment(sc->args)) {
-      putstr(sc, "#<ENVIRONMENT>");
-      s_return(sc, sc->T);
-    } else if (!is_pair(sc->args)) {
-      printatom(sc, sc->args, sc->print_flag);
-      s_return(sc, sc->T);
-    } else if (car(sc->args) == sc->QUOTE && ok_abbrev(cdr(sc->args))) {
-      putstr(sc, "'");
-      sc->args = cadr(sc->args);
-      s_goto(sc, OP_P0LIST);
-    } else if (car(sc->args) == sc->QQUOTE && ok_abbrev(cdr(sc->args))) {
-      putstr(sc, "`");
-      sc->args = cadr(sc->args);
-      s_goto(sc, OP_P0LIST);
-    } else if (car(sc->args) == sc->UNQUOTE && ok_abbrev(cdr(sc->args))) {
-      putstr(sc, ",");
-      sc->args = cadr(sc->args);
-      s_goto(sc, OP_P0LIST);
-    } else if (car(sc->args) == sc->UNQUOTESP && ok_abbrev(cdr(sc->args))) {
-      putstr(sc, ",@");
-      sc->args = cadr(sc->args);
-      s_goto(sc, OP_P0LIST);
-    } else {
-      putstr(sc, "(");
-      s_save(sc, OP_P1LIST, cdr(sc->args), sc->NIL);
-      sc->args = car(sc->args);
-      s_goto(sc, OP_P0LIST);
-    }
+  for (i = 0, x = car(proto_source(proto)); is_pair(x); x = cdr(x)) {
+    i++;
+  }
+  if (i > argc) {
+    return 0;
+  }
+  frame = mk_frame(sc, proto_names(proto));
+  if (sc->no_memory) {
+    return 0;
+  }
+  if (x != sc->NIL) {
+    x = vm_list(sc, argc - i);
+    gc_barrier(frame_slot(frame, i), x);
+    cdr(frame_slot(frame, i)) = x;
+  } else {
+    sc->vm_sp -= argc - i;      /* extra args are dropped */
+  }
+  vm_bind(sc, frame, i);
+  sc->envir = immutable_cons(sc, frame, closure_env(f));
+  setenvironment(sc->envir);
+  sc->code = proto;
+  return 1;
+}
 
-  case OP_P1LIST:
-    if (is_pair(sc->args)) {
-      s_save(sc, OP_P1LIST, cdr(sc->args), sc->NIL);
-      putstr(sc, " ");
-      sc->args = car(sc->args);
-      s_goto(sc, OP_P0LIST);
-    } else if (is_vector(sc->args)) {
-      s_save(sc, OP_P1LIST, sc->NIL, sc->NIL);
-      putstr(sc, " . ");
-      s_goto(sc, OP_P0LIST);
-    } else {
-      if (sc->args != sc->NIL) {
-        putstr(sc, " . ");
-        printatom(sc, sc->args, sc->print_flag);
-      }
-      putstr(sc, ")");
-      s_return(sc, sc->T);
-    }
-  case OP_PVECFROM:{
-      int i = ivalue_unchecked(cdr(sc->args));
-      pointer vec = car(sc->args);
-      int len = ivalue_unchecked(vec);
-      if (i == len) {
-        putstr(sc, ")");
-        s_return(sc, sc->T);
-      } else {
-        pointer elem = vector_elem(vec, i);
-        ivalue_unchecked(cdr(sc->args)) = i + 1;
-        s_save(sc, OP_PVECFROM, sc->args, sc->NIL);
-        sc->args = elem;
-        if (i > 0)
-          putstr(sc, " ");
-        s_goto(sc, OP_P0LIST);
+/* The slot for variable k at (d, i) in env, or () if unbound.  A slot
+   not bound yet hides nothing, so the search goes on outwards.  The
+   frames passed over may have had k defined since, by a macro
+   expansion or an eval the compiler could not see. */
+static pointer vm_slot(scheme * sc, pointer env, int d, int i, pointer k) {
+  pointer x;
+
+  for (; d > 0; d--, env = cdr(env)) {
+    for (x = frame_extra(car(env)); x != sc->NIL; x = cdr(x)) {
+      if (caar(x) == k) {
+        return car(x);
       }
     }
+  }
+  x = frame_slot(car(env), i);
+  if (cdr(x) == sc->UNBOUND) {
+    x = find_slot_in_env(sc, env, k, 1);
+  }
+  return x;
+}
 
-  default:
-    sprintf(sc->strbuff, "%d: illegal operator", sc->op);
-    Error_0(sc, sc->strbuff);
+/* The slot for variable k outside the scope.  While k has never been
+   bound outside the global frame the slot found is global, so it is
+   cached in the car of c; define and set! update that same slot. */
+static INLINE pointer vm_global(scheme * sc, pointer k, pointer c) {
+  if (is_local(k)) {
+    return find_slot_in_env(sc, sc->envir, k, 1);
+  }
+  if (car(c) == sc->NIL) {
+    pointer slot = find_slot_in_env(sc, sc->envir, k, 1);
+    gc_barrier(c, slot);
+    car(c) = slot;
+  }
+  return car(c);
+}
+
+/* Built-ins that only return or signal an error, so can be run without
+   a trip through Eval_Cycle: 2 for those that only read their
+   arguments too, so can have them in the arg cells. */
+static INLINE int vm_simple_proc(int op) {
+  dispatch_func f = dispatch_table[op].func;
 
+  if (f == opexe_2 || f == opexe_3 || f == opexe_6) {
+    return 2;
   }
-  return sc->T;
+  return op == OP_REVERSE || op == OP_LIST_STAR || op == OP_APPEND;
 }
 
-static pointer opexe_6(scheme * sc, enum scheme_opcodes op) {
+#define vm_k(i)  vector_elem(sc->code, code[pc + (i)])
+
+static pointer opexe_7(scheme * sc, enum scheme_opcodes op) {
   pointer x, y;
-  long v;
+  int *code;
+  int pc, n, m;
+#if USE_THREADING
+#define OPEXE_N 7
+#include "scm_optab.h"
+#endif
 
   switch (op) {
-  case OP_LIST_LENGTH:         /* length *//* a.k */
-    v = list_length(sc, car(sc->args));
-    if (v < 0) {
-      Error_1(sc, "length: not a list:", car(sc->args));
-    }
-    s_return(sc, mk_integer(sc, v));
+  OP_CASE(OP_VM_RUN):              /* enter the prototype in sc->code */
+    pc = 0;
+    break;
 
-  case OP_ASSQ:                /* assq *//* a.k */
-    x = car(sc->args);
-    for (y = cadr(sc->args); is_pair(y); y = cdr(y)) {
-      if (!is_pair(car(y))) {
-        Error_0(sc, "unable to handle non pair element");
-      }
-      if (x == caar(y))
-        break;
-    }
-    if (is_pair(y)) {
-      s_return(sc, car(y));
-    } else {
-      s_return(sc, sc->F);
-    }
+  OP_CASE(OP_VM_RET):              /* resume at a return point */
+    pc = ivalue(cdr(sc->code));
+    sc->code = car(sc->code);
+    break;
 
+  OP_CASE(OP_VM_EXPAND):           /* remember a macro expansion */
+    pc = ivalue(cdr(sc->code));
+    sc->code = car(sc->code);
+    code = proto_code(sc->code);
+    x = vm_compile_block(sc, sc->value,
+        cdr(vector_elem(sc->code, code[pc + 1])));
+    set_vector_elem(sc->code, code[pc + 2], cons(sc, car(sc->args), x));
+    sc->value = car(sc->args);
+    sc->args = cdr(sc->args);
+    break;
+
+  OP_CASE(OP_VM_HOOK):             /* compile what *compile-hook* returned */
+    pc = ivalue(cdr(sc->code));
+    sc->code = car(sc->code);
+    code = proto_code(sc->code);
+    set_vector_elem(sc->code, code[pc + 1], vm_compile_lambda(sc, sc->value,
+            cdr(vector_elem(sc->code, code[pc + 1]))));
+    code[pc] = VM_CLOSURE;
+    break;
 
-  case OP_GET_CLOSURE:         /* get-closure-code *//* a.k */
-    sc->args = car(sc->args);
-    if (sc->args == sc->NIL) {
-      s_return(sc, sc->F);
-    } else if (is_closure(sc->args)) {
-      s_return(sc, cons(sc, sc->LAMBDA, closure_code(sc->value)));
-    } else if (is_macro(sc->args)) {
-      s_return(sc, cons(sc, sc->LAMBDA, closure_code(sc->value)));
-    } else {
-      s_return(sc, sc->F);
-    }
-  case OP_CLOSUREP:            /* closure? */
-    /*
-     * Note, macro object is also a closure.
-     * Therefore, (closure? <#MACRO>) ==> #t
-     */
-    s_retbool(is_closure(car(sc->args)));
-  case OP_MACROP:              /* macro? */
-    s_retbool(is_macro(car(sc->args)));
   default:
     sprintf(sc->strbuff, "%d: illegal operator", sc->op);
     Error_0(sc, sc->strbuff);
   }
-  return sc->T;                 /* NOTREACHED */
-}
 
-typedef pointer(*dispatch_func) (scheme *, enum scheme_opcodes);
+  vm_unspill(sc);
+  code = proto_code(sc->code);
+  for (;;) {
+    ok_to_freely_gc(sc);
+    if (sc->no_memory) {
+      sc->vm_sp = 0;
+      return sc->T;
+    }
+    evalcnt += 1;
+#ifdef EVAL_LIMIT
+    if (evalcnt >= eval_limit) {
+        fprintf(stderr, "Eval steps limit reached: %ld\n", evalcnt);
+        exit(7);
+    }
+#endif
+    switch (code[pc]) {
+    case VM_CONST:
+      sc->value = vm_k(1);
+      pc += 2;
+      break;
 
-typedef int (*test_predicate) (pointer);
-static int is_any(pointer p) {
-  return 1;
-}
+    case VM_REF:
+      x = vm_global(sc, vm_k(1), vm_k(2));
+      if (x == sc->NIL) {
+        return vm_error(sc, pc + 3, "eval: unbound variable:", vm_k(1));
+      }
+      sc->value = slot_value_in_env(x);
+      pc += 3;
+      break;
 
-static int is_nonneg(pointer p) {
-  return ivalue(p) >= 0 && is_integer(p);
-}
+    case VM_SET:
+      x = vm_global(sc, vm_k(1), vm_k(2));
+      if (x == sc->NIL) {
+        return vm_error(sc, pc + 3, "set!: unbound variable:", vm_k(1));
+      }
+      set_slot_in_env(x, sc->value);
+      pc += 3;
+      break;
 
-/* Correspond carefully with following defines! */
-static struct {
-  test_predicate fct;
-  const char *kind;
-} tests[] = {
-  {0, 0},                        /* unused */
-  {is_any, 0},
-  {is_string, "string"},
-  {is_symbol, "symbol"},
-  {is_port, "port"},
-  {is_inport, "input port"},
-  {is_outport, "output port"},
-  {is_environment, "environment"},
-  {is_pair, "pair"},
-  {0, "pair or '()"},
-  {is_character, "character"},
-  {is_vector, "vector"},
-  {is_number, "number"},
-  {is_integer, "integer"},
-  {is_nonneg, "non-negative integer"},
-  {is_bvector, "bytevector"},
-};
+    case VM_DEF:
+      x = find_slot_in_env(sc, sc->envir, vm_k(1), 0);
+      if (x != sc->NIL) {
+        set_slot_in_env(x, sc->value);
+      } else {
+        new_slot_in_env(sc, vm_k(1), sc->value);
+      }
+      sc->value = vm_k(1);
+      pc += 2;
+      break;
+
+    case VM_LREF:
+      x = vm_slot(sc, sc->envir, code[pc + 1], code[pc + 2], vm_k(3));
+      if (x == sc->NIL) {
+        return vm_error(sc, pc + 4, "eval: unbound variable:", vm_k(3));
+      }
+      sc->value = slot_value_in_env(x);
+      pc += 4;
+      break;
+
+    case VM_LSET:
+      x = vm_slot(sc, sc->envir, code[pc + 1], code[pc + 2], vm_k(3));
+      if (x == sc->NIL) {
+        return vm_error(sc, pc + 4, "set!: unbound variable:", vm_k(3));
+      }
+      set_slot_in_env(x, sc->value);
+      pc += 4;
+      break;
+
+    case VM_LDEF:
+      set_slot_in_env(frame_slot(car(sc->envir), code[pc + 1]), sc->value);
+      sc->value = vm_k(2);
+      pc += 3;
+      break;
+
+    case VM_PUSH:
+      vm_push(sc, sc->value);
+      pc++;
+      break;
+
+    case VM_INSERT:
+      if (vm_reserve(sc, 1)) {
+        pointer *v = sc->vm_stack + sc->vm_sp - code[pc + 1];
+
+        memmove(v + 1, v, code[pc + 1] * sizeof(pointer));
+        *v = sc->value;
+        sc->vm_sp++;
+      }
+      pc += 2;
+      break;
+
+    case VM_JMP:
+      pc = code[pc + 1];
+      break;
+
+    case VM_JMPF:
+      pc = is_false(sc->value) ? code[pc + 1] : pc + 2;
+      break;
+
+    case VM_JMPT:
+      pc = is_false(sc->value) ? pc + 2 : code[pc + 1];
+      break;
+
+    case VM_MEMV:
+      for (x = vm_k(1); x != sc->NIL; x = cdr(x)) {
+        if (eqv(car(x), sc->value)) {
+          break;
+        }
+      }
+      pc = x == sc->NIL ? code[pc + 2] : pc + 3;
+      break;
+
+    case VM_FRAME:
+      x = mk_frame(sc, vm_k(2));
+      if (sc->no_memory) {
+        sc->vm_sp = 0;
+        return sc->T;
+      }
+      vm_bind(sc, x, code[pc + 1]);
+      sc->envir = immutable_cons(sc, x, sc->envir);
+      setenvironment(sc->envir);
+      pc += 3;
+      break;
 
-/* correspond with preceding struct "tests" */
-#define TST_NONE 0
-#define TST_ANY "\001"
-#define TST_STRING "\002"
-#define TST_SYMBOL "\003"
-#define TST_PORT "\004"
-#define TST_INPORT "\005"
-#define TST_OUTPORT "\006"
-#define TST_ENVIRONMENT "\007"
-#define TST_PAIR "\010"
-#define TST_LIST "\011"
-#define TST_CHAR "\012"
-#define TST_VECTOR "\013"
-#define TST_NUMBER "\014"
-#define TST_INTEGER "\015"
-#define TST_NATURAL "\016"
-#define TST_BVECTOR "\017"
+    case VM_BIND:
+      vm_bind(sc, car(sc->envir), code[pc + 1]);
+      pc += 2;
+      break;
 
-typedef struct {
-  dispatch_func func;
-  char *name;
-  int min_arity;
-  int max_arity;
-  char *arg_tests_encoding;
-} op_code_info;
+    case VM_POPENV:
+      sc->envir = cdr(sc->envir);
+      pc++;
+      break;
 
-#define INF_ARG 0xffff
+    case VM_CLOSURE:
+      sc->value = mk_closure(sc, vm_k(1), sc->envir);
+      pc += 2;
+      break;
 
-static op_code_info dispatch_table[] = {
-#define _OP_DEF(A,B,C,D,E,OP) {A,B,C,D,E},
-#include "scm_opdf.h"
-  {0}
-};
+    case VM_PROMISE:
+      sc->value = mk_closure(sc, vm_k(1), sc->envir);
+      typeflag(sc->value) = T_PROMISE;
+      pc += 2;
+      break;
 
-static const char *procname(pointer x) {
-  int n = procnum(x);
-  const char *name = dispatch_table[n].name;
-  if (name == 0) {
-    name = "ILLEGAL!";
-  }
-  return name;
-}
+    case VM_LAMBDA:
+      x = find_slot_in_env(sc, sc->envir, sc->COMPILE_HOOK, 1);
+      if (x == sc->NIL) {
+        set_vector_elem(sc->code, code[pc + 1],
+            vm_compile_lambda(sc, car(vm_k(1)), cdr(vm_k(1))));
+        code[pc] = VM_CLOSURE;
+        break;
+      }
+      vm_suspend(sc, OP_VM_HOOK, pc);
+      sc->args = cons(sc, car(vm_k(1)), sc->NIL);
+      sc->code = slot_value_in_env(x);
+      s_goto(sc, OP_APPLY);
 
-/* kernel of this interpreter */
-static void Eval_Cycle(scheme * sc, enum scheme_opcodes op) {
-  sc->op = op;
-  for (;;) {
-    op_code_info *pcd = dispatch_table + sc->op;
-    if (pcd->name != 0) {       /* if built-in function, check arguments */
-      char msg[AUXBUFF_SIZE];
-      int ok = 1;
-      int n = list_length(sc, sc->args);
-
-      /* Check number of arguments */
-      if (n < pcd->min_arity) {
-        ok = 0;
-        snprintf(msg, AUXBUFF_SIZE, "%s: needs%s %d argument(s)",
-            pcd->name,
-            pcd->min_arity == pcd->max_arity ? "" : " at least",
-            pcd->min_arity);
-      }
-      if (ok && n > pcd->max_arity) {
-        ok = 0;
-        snprintf(msg, AUXBUFF_SIZE, "%s: needs%s %d argument(s)",
-            pcd->name,
-            pcd->min_arity == pcd->max_arity ? "" : " at most",
-            pcd->max_arity);
-      }
-      if (ok) {
-        if (pcd->arg_tests_encoding != 0) {
-          int i = 0;
-          int j;
-          const char *t = pcd->arg_tests_encoding;
-          pointer arglist = sc->args;
-          do {
-            pointer arg = car(arglist);
-            j = (int) t[0];
-            if (j == TST_LIST[0]) {
-              if (arg != sc->NIL && !is_pair(arg))
-                break;
-            } else {
-              if (!tests[j].fct(arg))
-                break;
-            }
-
-            if (t[1] != 0) {    /* last test is replicated as necessary */
-              t++;
-            }
-            arglist = cdr(arglist);
-            i++;
-          } while (i < n);
-          if (i < n) {
-            ok = 0;
-            snprintf(msg, AUXBUFF_SIZE, "%s: argument %d must be: %s",
-                pcd->name, i + 1, tests[j].kind);
-          }
+    case VM_MACCHK:
+      if (!is_macro(sc->value)) {
+        pc += 4;
+        break;
+      }
+      if (!is_memo(sc->value)) {
+        /* expanded afresh each time, as OP_EVAL does */
+        if (code[pc + 3] != 0) {
+          vm_spill(sc, sc->vm_sp);
+          s_save(sc, OP_VM_RET, sc->args, vm_k(3));
         }
+        sc->code = car(vm_k(1));
+        sc->args = sc->NIL;
+        sc->vm_sp = 0;
+        s_goto(sc, OP_EVAL);
       }
-      if (!ok) {
-        if (_Error_1(sc, msg, 0) == sc->NIL) {
-          return;
+      y = vm_k(2);
+      if (!is_pair(y) || car(y) != sc->value) {
+        vm_push(sc, sc->value);
+        vm_suspend(sc, OP_VM_EXPAND, pc);
+        sc->args = cons(sc, car(vm_k(1)), sc->NIL);
+        sc->code = sc->value;
+        s_goto(sc, OP_APPLY);
+      }
+      if (code[pc + 3] != 0) {
+        vm_spill(sc, sc->vm_sp);
+        s_save(sc, OP_VM_RET, sc->args, vm_k(3));
+      }
+      sc->code = cdr(y);
+      sc->args = sc->NIL;
+      sc->vm_sp = 0;
+      code = proto_code(sc->code);
+      pc = 0;
+      break;
+
+    case VM_TREE:
+      if (code[pc + 2] != 0) {
+        vm_spill(sc, sc->vm_sp);
+        s_save(sc, OP_VM_RET, sc->args, vm_k(2));
+      }
+      sc->code = vm_k(1);
+      sc->args = sc->NIL;
+      sc->vm_sp = 0;
+      s_goto(sc, OP_EVAL);
+
+    case VM_CALL:
+    case VM_TCALL:
+      n = code[pc] == VM_CALL ? code[pc + 2] : 0;       /* return point */
+      m = code[pc + 1];                                 /* # of args */
+      y = sc->vm_stack[sc->vm_sp - m - 1];
+#if USE_TRACING
+      if (sc->tracing) {
+        y = sc->NIL;            /* let OP_APPLY trace it */
+      }
+#endif
+      if (is_proc(y) && vm_simple_proc(procnum(y)) && vm_reserve(sc, 1)) {
+        op_code_info *pcd = dispatch_table + procnum(y);
+        char msg[AUXBUFF_SIZE];
+        pointer proto = sc->code;
+        int ok = 0;
+        int held;
+
+        if (m <= ARG_CELLS && vm_simple_proc(procnum(y)) == 2) {
+          sc->args = vm_arg_cells(sc, m);
+        } else {
+          sc->args = vm_list(sc, m);
+          sc->vm_sp += m;       /* still theirs till the call is done */
         }
-        pcd = dispatch_table + sc->op;
+        /* the stack keeps the frozen frames alive meanwhile */
+        sc->vm_stack[sc->vm_sp++] = sc->dump;
+        held = dump_stack_hide(sc);
+        if (!proc_args_ok(sc, pcd, msg)) {
+          _Error_1(sc, msg, 0);
+        } else {
+          ok = pcd->func(sc, (enum scheme_opcodes) (pcd - dispatch_table))
+              == sc->NIL;
+        }
+        dump_stack_unhide(sc, held, sc->vm_stack[--sc->vm_sp]);
+        sc->vm_sp -= m + 1;
+        if (ok) {
+          sc->args = sc->NIL;
+          if (n == 0) {
+            goto ret;
+          }
+          pc += 3;
+          break;
+        }
+        /* _Error_1 has set up the next op, and its args */
+        vm_push(sc, sc->args);
+        if (n != 0) {
+          vm_spill(sc, sc->vm_sp - 1);
+          s_save(sc, OP_VM_RET, sc->args, vector_elem(proto, n));
+        }
+        sc->args = sc->vm_stack[sc->vm_sp - 1];
+        sc->vm_sp = 0;
+        return sc->T;
       }
-    }
-    ok_to_freely_gc(sc);
-    if (pcd->func(sc, (enum scheme_opcodes) sc->op) == sc->NIL) {
-      return;
-    }
-    if (sc->no_memory) {
-      fprintf(stderr, "No memory!\n");
-      sc->retcode = 9;
-      return;
+      if (n != 0) {
+        vm_spill(sc, sc->vm_sp - m - 1);
+        s_save(sc, OP_VM_RET, sc->args, vm_k(2));
+      }
+      if (is_closure(y) && is_compiled(y) && vm_enter_closure(sc, y, m)) {
+        sc->args = sc->NIL;
+        sc->vm_sp = 0;
+        code = proto_code(sc->code);
+        pc = 0;
+        break;
+      }
+      sc->args = vm_list(sc, m);
+      sc->code = sc->vm_stack[sc->vm_sp - 1];
+      sc->vm_sp = 0;
+      s_goto(sc, OP_APPLY);
+
+    case VM_RET:
+    ret:
+      sc->vm_sp = 0;
+      if (_s_return(sc, sc->value) == sc->NIL) {
+        return sc->NIL;
+      }
+      if (sc->op != OP_VM_RET) {
+        return sc->T;
+      }
+      pc = ivalue(cdr(sc->code));
+      sc->code = car(sc->code);
+      code = proto_code(sc->code);
+      vm_unspill(sc);
+      break;
+
+    default:
+      sc->vm_sp = 0;
+      sprintf(sc->strbuff, "%d: illegal instruction", code[pc]);
+      Error_0(sc, sc->strbuff);
     }
   }
 }
 
+#undef vm_k
+
 /* ========== Initialization of internal keywords ========== */
 
 static void assign_syntax(scheme * sc, char *name) {
@@ -5019,17 +8571,34 @@ int scheme_init_custom_alloc(scheme * sc, func_alloc malloc,
   sc->malloc = malloc;
   sc->free = free;
   sc->last_cell_seg = -1;
-  sc->backchar = -1;
-  sc->sink = &sc->_sink;
-  sc->NIL = &sc->_NIL;
-  sc->T = &sc->_HASHT;
-  sc->F = &sc->_HASHF;
-  sc->EOF_OBJ = &sc->_EOF_OBJ;
-  sc->free_cell = &sc->_NIL;
+  size_cell_segs();
+  if (!alloc_static_cells(sc)) {
+    sc->no_memory = 1;
+    return 0;
+  }
+  sc->free_cell = sc->NIL;
   sc->fcells = 0;
   sc->no_memory = 0;
-  sc->alloc_seg = sc->malloc(sizeof(*(sc->alloc_seg)) * cell_nsegment);
-  sc->cell_seg = sc->malloc(sizeof(*(sc->cell_seg)) * cell_nsegment);
+  for (i = 0; i < SLOT_POOL_SIZE; i++) {
+    sc->slot_pool[i] = 0;
+  }
+  sc->young = 0;
+  sc->young_top = sc->young_size = 0;
+  sc->old_live = 0;
+  sc->vec_words = sc->old_vec_words = 0;
+  sc->sweep_seg = 0;
+#if USE_PARALLEL_MARK
+  sc->root_deque = 0;
+#endif
+  sc->gc_lazy = 1;
+  sc->gc_compact = 0;
+  sc->compact_due = 0;
+  sc->recent = sc->malloc(RECENT_INITIAL_SIZE * sizeof(pointer));
+  sc->recent_size = RECENT_INITIAL_SIZE;
+  sc->recent_top = sc->recent_base = 0;
+  sc->seg_room = FIRST_CELLSEGS;
+  sc->alloc_seg = sc->malloc(sizeof(*(sc->alloc_seg)) * sc->seg_room);
+  sc->cell_seg = sc->malloc(sizeof(*(sc->cell_seg)) * sc->seg_room);
   sc->strbuff = sc->malloc(STRBUFF_INITIAL_SIZE);
   sc->strbuff_size = STRBUFF_INITIAL_SIZE;
   sc->inport = sc->NIL;
@@ -5038,6 +8607,9 @@ int scheme_init_custom_alloc(scheme * sc, func_alloc malloc,
   sc->loadport = sc->NIL;
   sc->nesting = 0;
   sc->interactive_repl = 0;
+#if USE_FASL
+  memset(sc->fasl_stack, 0, sizeof(sc->fasl_stack));
+#endif
 
   if (alloc_cellseg(sc, FIRST_CELLSEGS) != FIRST_CELLSEGS) {
     sc->no_memory = 1;
@@ -5045,21 +8617,34 @@ int scheme_init_custom_alloc(scheme * sc, func_alloc malloc,
   }
   sc->gc_verbose = 0;
   dump_stack_initialize(sc);
+  sc->vm_stack = 0;
+  sc->vm_sp = sc->vm_stack_size = 0;
   sc->code = sc->NIL;
   sc->tracing = 0;
 
   /* init sc->NIL */
-  typeflag(sc->NIL) = (T_ATOM | MARK);
+  typeflag(sc->NIL) = (T_ATOM | T_STATIC);
   car(sc->NIL) = cdr(sc->NIL) = sc->NIL;
   /* init T */
-  typeflag(sc->T) = (T_ATOM | MARK);
+  typeflag(sc->T) = (T_ATOM | T_STATIC);
   car(sc->T) = cdr(sc->T) = sc->T;
   /* init F */
-  typeflag(sc->F) = (T_ATOM | MARK);
+  typeflag(sc->F) = (T_ATOM | T_STATIC);
   car(sc->F) = cdr(sc->F) = sc->F;
+  /* init EOF_OBJ */
+  typeflag(sc->EOF_OBJ) = (T_ATOM | T_STATIC);
+  car(sc->EOF_OBJ) = cdr(sc->EOF_OBJ) = sc->EOF_OBJ;
+  /* init UNBOUND */
+  typeflag(sc->UNBOUND) = (T_ATOM | T_STATIC);
+  car(sc->UNBOUND) = cdr(sc->UNBOUND) = sc->UNBOUND;
   /* init sink */
-  typeflag(sc->sink) = (T_PAIR | MARK);
+  typeflag(sc->sink) = (T_PAIR | T_STATIC);
   car(sc->sink) = sc->NIL;
+  /* init the arg cells */
+  for (i = 0; i < ARG_CELLS; i++) {
+    typeflag(sc->arg_cells + i) = (T_PAIR | T_STATIC);
+    car(sc->arg_cells + i) = cdr(sc->arg_cells + i) = sc->NIL;
+  }
   /* init c_nest */
   sc->c_nest = sc->NIL;
 
@@ -5091,6 +8676,7 @@ int scheme_init_custom_alloc(scheme * sc, func_alloc malloc,
   for (i = 0; i < n; i++) {
     if (dispatch_table[i].name != 0) {
       assign_proc(sc, (enum scheme_opcodes) i, dispatch_table[i].name);
+      decode_arg_tests(dispatch_table + i);
     }
   }
 
@@ -5141,6 +8727,9 @@ void scheme_deinit(scheme * sc) {
   sc->oblist = sc->NIL;
   sc->global_env = sc->NIL;
   dump_stack_free(sc);
+  free(sc->vm_stack);
+  sc->vm_stack = 0;
+  sc->vm_sp = sc->vm_stack_size = 0;
   sc->envir = sc->NIL;
   sc->code = sc->NIL;
   sc->args = sc->NIL;
@@ -5160,13 +8749,30 @@ void scheme_deinit(scheme * sc) {
   sc->loadport = sc->NIL;
   sc->free(sc->strbuff);
   sc->gc_verbose = 0;
+  /* every cell has to be finalized now */
+  sc->gc_lazy = 0;
   gc(sc, sc->NIL, sc->NIL);
 
   for (i = 0; i <= sc->last_cell_seg; i++) {
     sc->free(sc->alloc_seg[i]);
   }
+  for (i = 0; i < SLOT_POOL_SIZE; i++) {
+    while (sc->slot_pool[i] != 0) {
+      pointer *v = sc->slot_pool[i];
+      sc->slot_pool[i] = (pointer *) v[0];
+      sc->free(v);
+    }
+  }
+  sc->free(sc->recent);
+  sc->free(sc->young);
   sc->free(sc->cell_seg);
   sc->free(sc->alloc_seg);
+  sc->free(sc->static_seg);
+#if USE_FASL
+  for (i = 0; i < MAXFIL; i++) {
+    fasl_drop(sc, sc->fasl_stack + i);
+  }
+#endif
 
 #if SHOW_ERROR_LINE
   for (i = 0; i <= sc->file_i; i++) {
@@ -5179,6 +8785,435 @@ void scheme_deinit(scheme * sc) {
 #endif
 }
 
+#if USE_IMAGE
+/* ========== Heap images ========== */
+
+/*
+ * An image holds the cells reachable from the oblist, the global
+ * environment and the special symbols, so that scm can start from one
+ * instead of reading init.scm again.  Each cell is written as its flags
+ * and its data, followed by its buffer if it has one.  A pointer to
+ * another cell is written as the rank of that cell among those written,
+ * so the image can be read back into any segments.  The special cells
+ * come before the ranks, and immediates stand for themselves.
+ *
+ * Foreign functions are written as offsets from scheme_init, so an
+ * image is only good for the build of scm that wrote it: the stamp at
+ * its head says which build that was.  The head also has the size,
+ * mtime and hash of the file the heap was loaded from, as a FASL cache
+ * does, and a hash of the cells, so that a stale or damaged image is
+ * never read.
+ */
+#define IMAGE_ROOTS      12
+#define IMAGE_FIRST_RANK 8
+
+struct image_head {
+  char stamp[48];
+  long src_size;                /* of the source */
+  long src_mtime;
+  unsigned int src_hash;
+  unsigned int check;           /* hash of the cells, then of the head */
+  long cells;
+  long oblist_used;
+  long gensym_cnt;
+  uintptr_t roots[IMAGE_ROOTS];
+};
+
+/* Fill in the source fields of head for file src.  0 if unreadable. */
+static int image_source(scheme * sc, const char *src,
+    struct image_head *head) {
+  struct stat st;
+  char *buf;
+  FILE *f;
+  int ok;
+
+  f = fopen(src, "rb");
+  if (f == 0) {
+    return 0;
+  }
+  ok = fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)
+      && (buf = sc->malloc(st.st_size + 1)) != 0;
+  if (ok) {
+    ok = fread(buf, 1, st.st_size, f) == (size_t) st.st_size;
+    head->src_size = st.st_size;
+    head->src_mtime = st.st_mtime;
+    head->src_hash = build_hash(2166136261u, buf, st.st_size);
+    sc->free(buf);
+  }
+  fclose(f);
+  return ok;
+}
+
+/* Hash of the cells of the image in f, from just past its head: that
+   of the head, check being 0, goes on from it. */
+static int image_check(FILE * f, unsigned int *check) {
+  char buf[4096];
+  unsigned int h = 2166136261u;
+  size_t n;
+
+  if (fseek(f, sizeof(struct image_head), SEEK_SET) != 0) {
+    return 0;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    h = build_hash(h, buf, n);
+  }
+  *check = h;
+  return !ferror(f);
+}
+
+static void image_roots(scheme * sc, pointer ** r) {
+  r[0] = &sc->oblist;
+  r[1] = &sc->global_env;
+  r[2] = &sc->LAMBDA;
+  r[3] = &sc->QUOTE;
+  r[4] = &sc->QQUOTE;
+  r[5] = &sc->UNQUOTE;
+  r[6] = &sc->UNQUOTESP;
+  r[7] = &sc->FEED_TO;
+  r[8] = &sc->COLON_HOOK;
+  r[9] = &sc->ERROR_HOOK;
+  r[10] = &sc->SHARP_HOOK;
+  r[11] = &sc->COMPILE_HOOK;
+}
+
+/* needs slide_base set up for the cells written */
+static uintptr_t image_ref(scheme * sc, pointer p) {
+  if (p == 0 || is_immediate(p)) {
+    return (uintptr_t) p;
+  }
+  if (typeflag(p) & T_STATIC) {
+    return (uintptr_t) (p - sc->sink + 1) << 2;
+  }
+  return (uintptr_t) (cell_rank(sc, p) + IMAGE_FIRST_RANK) << 2;
+}
+
+static void image_put_ref(scheme * sc, FILE * f, pointer p) {
+  uintptr_t r = image_ref(sc, p);
+
+  fwrite(&r, sizeof(r), 1, f);
+}
+
+/* Write cell p, or return 0 if it cannot be kept in an image. */
+static int image_put_cell(scheme * sc, FILE * f, pointer p) {
+  unsigned short flag = typeflag(p);
+  int type = flag & T_MASKTYPE;
+  uintptr_t r;
+  int i;
+
+  fwrite(&flag, sizeof(flag), 1, f);
+  if (!(flag & T_ATOM)) {
+    image_put_ref(sc, f, car(p));
+    image_put_ref(sc, f, cdr(p));
+  } else if (type == T_STRING && !(flag & T_SHORT)) {
+    /* the hash of a symbol name, or the chars of a UTF-8 string */
+    fwrite(&buflength(p), sizeof(int), 1, f);
+    fwrite(&strhash(p), sizeof(strhash(p)), 1, f);
+    fwrite(bufvalue(p), 1, buflength(p), f);
+  } else if (type == T_VECTOR || type == T_FRAME) {
+    fwrite(&buflength(p), sizeof(int), 1, f);
+    for (i = 0; i < buflength(p) + (type == T_FRAME); i++) {
+      image_put_ref(sc, f, ((pointer *) bufvalue(p))[i]);
+    }
+  } else if (type == T_BYTECODE) {
+    fwrite(&buflength(p), sizeof(int), 1, f);
+    fwrite(bufvalue(p), sizeof(int), buflength(p), f);
+  } else if (type == T_BYTEVECTOR) {
+    fwrite(&buflength(p), sizeof(int), 1, f);
+    fwrite(bufvalue(p), 1, buflength(p), f);
+  } else if (type == T_FOREIGN) {
+    r = (uintptr_t) p->_object._ff - (uintptr_t) scheme_init;
+    fwrite(&r, sizeof(r), 1, f);
+  } else if (type == T_PORT) {
+    return 0;
+  } else {
+    fwrite(p, sizeof(struct cell), 1, f);
+  }
+  return 1;
+}
+
+/* Write an image of sc to fname, the heap being what loading file src
+   made.  Call it between two top-level loads, when no C code holds
+   cells of its own. */
+int scheme_save_image(scheme * sc, const char *fname, const char *src) {
+  pointer *roots[IMAGE_ROOTS];
+  struct image_head head;
+  unsigned int check;
+  char *tmp;
+  FILE *f = 0;
+  pointer p;
+  int ok;
+  int i;
+
+  image_roots(sc, roots);
+  tmp = sc->malloc(strlen(fname) + 5);
+  if (tmp == 0 || !alloc_ranks(sc)) {
+    sc->free(tmp);
+    return 0;
+  }
+  /* mark what goes in the image, and nothing else */
+  for (i = 0; i <= sc->last_cell_seg; i++) {
+    memset(mark_words(sc->cell_seg[i]), 0, mark_bytes);
+  }
+  for (i = 0; i < IMAGE_ROOTS; i++) {
+    mark(*roots[i]);
+  }
+  memset(&head, 0, sizeof(head));
+  strcpy(head.stamp, build_stamp());
+  ok = image_source(sc, src, &head);
+  head.cells = count_ranks(sc);
+  head.oblist_used = sc->oblist_used;
+  head.gensym_cnt = sc->gensym_cnt;
+  for (i = 0; i < IMAGE_ROOTS; i++) {
+    head.roots[i] = image_ref(sc, *roots[i]);
+  }
+
+  /* write it aside, so that no one reads half an image */
+  sprintf(tmp, "%s.tmp", fname);
+  f = ok ? fopen(tmp, "w+b") : 0;
+  ok = f != 0 && fwrite(&head, sizeof(head), 1, f) == 1;
+  for (i = 0; ok && i <= sc->last_cell_seg; i++) {
+    for (p = sc->cell_seg[i]; ok && p < sc->cell_seg[i] + cell_segsize;
+        p++) {
+      if (cell_marked(p)) {
+        ok = image_put_cell(sc, f, p);
+      }
+    }
+  }
+  /* then the hash of the cells, read back */
+  ok = ok && fflush(f) == 0 && image_check(f, &check)
+      && fseek(f, 0, SEEK_SET) == 0;
+  head.check = build_hash(check, &head, sizeof(head));
+  ok = ok
+      && fwrite(&head, sizeof(head), 1, f) == 1;
+  if (f != 0) {
+    ok = !ferror(f) && ok;
+    ok = fclose(f) == 0 && ok;
+  }
+  sc->free(slide_base);
+  slide_base = 0;
+  /* the marks are those of the image now */
+  gc(sc, sc->NIL, sc->NIL);
+
+#ifdef _WIN32
+  if (ok) {
+    remove(fname);
+  }
+#endif
+  ok = ok && rename(tmp, fname) == 0;
+  if (!ok) {
+    remove(tmp);
+  }
+  sc->free(tmp);
+  return ok;
+}
+
+struct image_in {
+  const char *at;
+  const char *end;
+  pointer *cells;               /* where each cell goes, by rank */
+  long ncells;
+};
+
+static int image_get(struct image_in *in, void *to, size_t size) {
+  if ((size_t) (in->end - in->at) < size) {
+    return 0;
+  }
+  memcpy(to, in->at, size);
+  in->at += size;
+  return 1;
+}
+
+static int image_deref(scheme * sc, struct image_in *in, uintptr_t r,
+    pointer * to) {
+  if (r == 0 || (r & 3) != 0) {
+    *to = (pointer) r;
+  } else if ((r >> 2) < IMAGE_FIRST_RANK) {
+    if ((r >> 2) > 6) {
+      return 0;
+    }
+    *to = sc->sink + (r >> 2) - 1;
+  } else if ((long) ((r >> 2) - IMAGE_FIRST_RANK) < in->ncells) {
+    *to = in->cells[(r >> 2) - IMAGE_FIRST_RANK];
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static int image_get_ref(scheme * sc, struct image_in *in, pointer * to) {
+  uintptr_t r;
+
+  return image_get(in, &r, sizeof(r)) && image_deref(sc, in, r, to);
+}
+
+/* The length of a buffer of elements of the given size, or -1. */
+static int image_get_length(struct image_in *in, size_t size) {
+  int len;
+
+  if (!image_get(in, &len, sizeof(len)) || len < 0
+      || (size_t) len > (size_t) (in->end - in->at) / size) {
+    return -1;
+  }
+  return len;
+}
+
+/* Read the next cell into x.  Its flags are set last, so that a cell
+   left half read is free to the collector. */
+static int image_get_cell(scheme * sc, struct image_in *in, pointer x) {
+  unsigned short flag;
+  unsigned int u;
+  int type;
+  int len;
+  int size;
+  int i;
+  char *s;
+  pointer *v;
+  uintptr_t r;
+
+  if (!image_get(in, &flag, sizeof(flag))) {
+    return 0;
+  }
+  type = flag & T_MASKTYPE;
+  if (!(flag & T_ATOM)) {
+    if (!image_get_ref(sc, in, &car(x)) || !image_get_ref(sc, in, &cdr(x))) {
+      return 0;
+    }
+  } else if (type == T_STRING && !(flag & T_SHORT)) {
+    if ((len = image_get_length(in, 1)) < 0 || !image_get(in, &u, sizeof(u))
+        || len > in->end - in->at) {
+      return 0;
+    }
+    s = store_string(sc, len, in->at, (flag & T_UTF8) ? (int) u : len);
+    if (s == 0) {
+      return 0;
+    }
+    set_string_buffer(x, s, len, (flag & T_UTF8) ? (int) u : len);
+    strhash(x) = u;
+    in->at += len;
+  } else if (type == T_VECTOR || type == T_FRAME) {
+    if ((len = image_get_length(in, sizeof(uintptr_t))) < 0) {
+      return 0;
+    }
+    v = alloc_slots(sc, len + (type == T_FRAME));
+    if (v == 0) {
+      return 0;
+    }
+    bufvalue(x) = (char *) v;
+    buflength(x) = len;
+    for (i = 0; i < len + (type == T_FRAME); i++) {
+      if (!image_get_ref(sc, in, &v[i])) {
+        return 0;
+      }
+    }
+  } else if (type == T_BYTECODE || type == T_BYTEVECTOR) {
+    size = type == T_BYTECODE ? sizeof(int) : 1;
+    if ((len = image_get_length(in, size)) < 0
+        || (s = sc->malloc(len > 0 ? len * size : 1)) == 0) {
+      return 0;
+    }
+    image_get(in, s, len * size);
+    bufvalue(x) = s;
+    buflength(x) = len;
+  } else if (type == T_FOREIGN) {
+    if (!image_get(in, &r, sizeof(r))) {
+      return 0;
+    }
+    x->_object._ff = (foreign_func) ((uintptr_t) scheme_init + r);
+  } else if (type == T_PORT) {
+    return 0;
+  } else if (!image_get(in, x, sizeof(struct cell))) {
+    return 0;
+  }
+  typeflag(x) = flag;
+  return 1;
+}
+
+/* Replace the oblist, the global environment and the special symbols
+   of sc with those of the image in fname, written by this build of
+   scm from file src as it is now.  Returns 0, leaving sc as it was, if
+   the image is missing, stale or bad.  Call it between two top-level
+   loads. */
+int scheme_load_image(scheme * sc, const char *fname, const char *src) {
+  pointer *roots[IMAGE_ROOTS];
+  pointer root[IMAGE_ROOTS];
+  struct image_head head;
+  struct image_head now;
+  unsigned int check;
+  struct image_in in;
+  char *buf = 0;
+  FILE *f;
+  long size = 0;
+  pointer seg = 0;
+  long k;
+  int ok = 0;
+  int i;
+
+  f = fopen(fname, "rb");
+  if (f == 0) {
+    return 0;
+  }
+  /* all of it at once */
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > (long) sizeof(head)
+      && fseek(f, 0, SEEK_SET) == 0 && (buf = sc->malloc(size)) != 0) {
+    ok = fread(buf, 1, size, f) == (size_t) size;
+  }
+  fclose(f);
+  if (ok) {
+    memcpy(&head, buf, sizeof(head));
+    check = head.check;
+    head.check = 0;
+    ok = strncmp(head.stamp, build_stamp(), sizeof(head.stamp)) == 0
+        && image_source(sc, src, &now) && head.src_size == now.src_size
+        && head.src_mtime == now.src_mtime && head.src_hash == now.src_hash
+        && check == build_hash(build_hash(2166136261u, buf + sizeof(head),
+            size - sizeof(head)), &head, sizeof(head))
+        && head.cells > 0 && head.cells <= (size - (long) sizeof(head)) / 2;
+  }
+  in.at = buf + sizeof(head);
+  in.end = buf + size;
+  in.ncells = ok ? head.cells : 0;
+  in.cells = ok ? sc->malloc(in.ncells * sizeof(pointer)) : 0;
+  ok = ok && in.cells != 0;
+
+  if (ok) {
+    /* the cells go in segments of their own; a new segment would
+       shift the ones not swept yet */
+    while (sweep_next(sc)) {
+    }
+    for (k = 0; ok && k < in.ncells; k++) {
+      if (k % cell_segsize == 0) {
+        seg = add_cellseg(sc);
+        ok = seg != 0;
+      }
+      in.cells[k] = seg + k % cell_segsize;
+    }
+  }
+  for (k = 0; ok && k < in.ncells; k++) {
+    ok = image_get_cell(sc, &in, in.cells[k]);
+  }
+  for (i = 0; ok && i < IMAGE_ROOTS; i++) {
+    ok = image_deref(sc, &in, head.roots[i], &root[i]);
+  }
+  ok = ok && in.at == in.end;
+  if (ok) {
+    image_roots(sc, roots);
+    for (i = 0; i < IMAGE_ROOTS; i++) {
+      *roots[i] = root[i];
+    }
+    sc->oblist_used = head.oblist_used;
+    sc->gensym_cnt = head.gensym_cnt;
+    sc->envir = sc->global_env;
+  }
+  sc->free(in.cells);
+  sc->free(buf);
+  /* nothing is in the registers between loads, maybe not even NIL */
+  sc->args = sc->value = sc->code = sc->NIL;
+  /* keep the new cells, or the old ones if the image was bad */
+  gc(sc, sc->NIL, sc->NIL);
+  return ok;
+}
+#endif /* USE_IMAGE */
+
 void scheme_load_file(scheme * sc, FILE * fin) {
   scheme_load_named_file(sc, fin, 0);
 }
@@ -5191,18 +9226,21 @@ void scheme_load_named_file(scheme * sc, FILE * fin, const char *filename) {
   dump_stack_reset(sc);
   sc->envir = sc->global_env;
   sc->file_i = 0;
-  sc->load_stack[0].kind = port_input | port_file;
-  sc->load_stack[0].rep.stdio.file = fin;
+  port_set_file(sc->load_stack, fin, port_input | port_file);
   sc->loadport = mk_port(sc, sc->load_stack);
   sc->retcode = 0;
   if (fin == stdin && !str_eq(filename, "--")) {
     sc->interactive_repl = 1;
   }
+#if USE_FASL
+  fasl_start(sc, filename, fin);
+#endif
 #if SHOW_ERROR_LINE
   sc->load_stack[0].rep.stdio.curr_line = 0;
   if (fin != stdin && filename)
     sc->load_stack[0].rep.stdio.filename =
-        store_string(sc, strlen(filename), filename);
+        store_string(sc, strlen(filename), filename,
+            strlen(filename));
   else
     sc->load_stack[0].rep.stdio.filename = NULL;
 #endif
@@ -5210,6 +9248,9 @@ void scheme_load_named_file(scheme * sc, FILE * fin, const char *filename) {
   sc->args = mk_integer(sc, sc->file_i);
   Eval_Cycle(sc, OP_T0LVL);
   typeflag(sc->loadport) = T_ATOM;
+  /* fin is the caller's to close, but the buffer is ours */
+  sc->free(sc->load_stack[0].rep.stdio.buf);
+  sc->load_stack[0].rep.stdio.buf = 0;
   if (sc->retcode == 0) {
     sc->retcode = sc->nesting != 0;
   }
@@ -5219,13 +9260,15 @@ void scheme_load_string(scheme * sc, const char *cmd) {
   dump_stack_reset(sc);
   sc->envir = sc->global_env;
   sc->file_i = 0;
-  sc->load_stack[0].kind = port_input | port_string;
-  sc->load_stack[0].rep.string.start = (char *) cmd;    /* This func respects const */
-  sc->load_stack[0].rep.string.past_the_end = (char *) cmd + strlen(cmd);
-  sc->load_stack[0].rep.string.curr = (char *) cmd;
+  /* This func respects const */
+  port_set_string(sc->load_stack, (char *) cmd, (char *) cmd + strlen(cmd),
+      port_input | port_string);
   sc->loadport = mk_port(sc, sc->load_stack);
   sc->retcode = 0;
   sc->interactive_repl = 0;
+#if USE_FASL
+  fasl_drop(sc, sc->fasl_stack);
+#endif
   sc->args = mk_integer(sc, sc->file_i);
   Eval_Cycle(sc, OP_T0LVL);
   typeflag(sc->loadport) = T_ATOM;
@@ -5265,20 +9308,24 @@ pointer scheme_apply0(scheme * sc, const char *procname) {
 
 void save_from_C_call(scheme * sc) {
   pointer saved_data = cons(sc,
-      car(sc->sink),
+      mk_integer(sc, sc->recent_base),
       cons(sc,
           sc->envir,
-          sc->dump));
+          dump_stack_capture(sc)));
   /* Push */
   sc->c_nest = cons(sc, saved_data, sc->c_nest);
+  /* Keep the recent allocations of the caller while the nested
+     evaluation frees its own. */
+  sc->recent_base = sc->recent_top;
   /* Truncate the dump stack so TS will return here when done, not
      directly resume pre-C-call operations. */
   dump_stack_reset(sc);
 }
 void restore_from_C_call(scheme * sc) {
-  car(sc->sink) = caar(sc->c_nest);
+  sc->recent_top = sc->recent_base;
+  sc->recent_base = ivalue(caar(sc->c_nest));
   sc->envir = cadar(sc->c_nest);
-  sc->dump = cdr(cdar(sc->c_nest));
+  dump_stack_restore(sc, cdr(cdar(sc->c_nest)));
   /* Pop */
   sc->c_nest = cdr(sc->c_nest);
 }
@@ -5332,6 +9379,10 @@ void initFromEnv() {
     cell_segsize = val != NULL ? atoi(val) : CELL_SEGSIZE;
     val = getenv("CELL_NSEGMENT");
     cell_nsegment = val != NULL ? atoi(val) : CELL_NSEGMENT;
+#if USE_PARALLEL_MARK
+    val = getenv("GC_THREADS");
+    gc_threads = val != NULL ? atoi(val) : GC_THREADS;
+#endif
 #ifdef EVAL_LIMIT
     val = getenv("EVAL_LIMIT");
     eval_limit = val != NULL ? atol(val) : EVAL_LIMIT;
@@ -5445,6 +9496,7 @@ int run_subprocess(const char *name, const char **args, int arg_count)
 
 	return exit_status;
 #else
+	(void) arg_count;	// args is null-terminated here
 	pid_t cpid = fork();
 	if (cpid < 0)
 	{
@@ -5522,19 +9574,37 @@ int main(int argc, char **argv) {
   char *executable_name = argv[0];
   int retcode;
   int isfile = 1;
+#if USE_IMAGE
+  char *image_name = 0;
+  char image_buf[1024];
+  char *init_name = 0;
+  int save_image = 0;
+  size_t n;
+#endif
 
   initFromEnv();
+#if USE_IMAGE
+  if (argc > 2 && str_eq(argv[1], "-i")) {
+    image_name = argv[2];
+    argv += 2;
+    argc -= 2;
+  }
+#endif
   if (argc == 1) {
     printf("%s", get_version());
   }
   if (argc == 2 && str_eq(argv[1], "-?")) {
     printf("Usage: tinyscheme -?\n");
-    printf("or:    tinyscheme [<file1> <file2> ...]\n");
+    printf("or:    tinyscheme [-i <image>] [<file1> <file2> ...]\n");
     printf("followed by\n");
     printf("          -1 <file> [<arg1> <arg2> ...]\n");
     printf("          -c <Scheme commands> [<arg1> <arg2> ...]\n");
     printf("assuming that the executable is named tinyscheme.\n");
     printf("Use - as filename for stdin.\n");
+#if USE_IMAGE
+    printf("The image keeps the heap after the init file, and is\n");
+    printf("written again when the init file changes.\n");
+#endif
     return 1;
   }
   if (!scheme_init(&sc)) {
@@ -5564,8 +9634,31 @@ int main(int argc, char **argv) {
       }
     }
   }
+#if USE_IMAGE
+  /* by default, init.img next to init.scm */
+  if (image_name == 0) {
+    n = strlen(file_name);
+    if (n > 4 && str_eq(file_name + n - 4, ".scm")) {
+      n -= 4;
+    }
+    if (n + 5 <= sizeof(image_buf)) {
+      memcpy(image_buf, file_name, n);
+      strcpy(image_buf + n, ".img");
+      image_name = image_buf;
+    }
+  }
+  if (image_name != 0 && access(file_name, 0) == 0) {
+    if (scheme_load_image(&sc, image_name, file_name)) {
+      file_name = *argv++;
+    } else {
+      init_name = file_name;
+      save_image = 1;
+    }
+  }
+#endif
   evalcnt = 0;
-  do {
+  fast_checks = 0;
+  while (file_name != 0) {
     if (str_eq(file_name, "-1") || str_eq(file_name, "-c")) {
       pointer args = sc.NIL;
       isfile = file_name[1] == '1';
@@ -5591,6 +9684,11 @@ int main(int argc, char **argv) {
       } else {
         scheme_load_string(&sc, file_name);
       }
+#if USE_IMAGE
+      if (save_image && sc.retcode == 0) {
+        scheme_save_image(&sc, image_name, init_name);
+      }
+#endif
       if (!isfile || fin != stdin) {
         if (sc.retcode != 0) {
           fprintf(stderr, "Errors encountered reading %s\n", file_name);
@@ -5600,8 +9698,11 @@ int main(int argc, char **argv) {
         }
       }
     }
+#if USE_IMAGE
+    save_image = 0;
+#endif
     file_name = *argv++;
-  } while (file_name != 0);
+  }
   if (argc == 1) {
     scheme_load_named_file(&sc, stdin, "-");
   }
@@ -39,12 +39,6 @@ extern "C" {
 #define USE_PLIST 0
 #endif
 
-/*
- * Leave it defined if you want continuations, and also for the Sharp Zaurus.
- * Undefine it if you only care about faster speed and not strict Scheme compatibility.
- */
-#define USE_SCHEME_STACK
-
 #if USE_DL
 #define USE_INTERFACE 1
 #endif
@@ -91,6 +85,26 @@ extern "C" {
 #define USE_INTERFACE 0
 #endif
 
+#ifndef USE_PARALLEL_MARK       /* Mark with threads: needs pthreads */
+#define USE_PARALLEL_MARK 0
+#endif
+
+#ifndef USE_IMAGE               /* Save and load heap images */
+#define USE_IMAGE 1
+#endif
+
+#ifndef USE_FASL                /* Cache the forms of loaded files */
+#define USE_FASL 1
+#endif
+
+#ifndef USE_THREADING           /* Threaded dispatch: needs computed goto */
+#ifdef __GNUC__
+#define USE_THREADING 1
+#else
+#define USE_THREADING 0
+#endif
+#endif
+
 #ifndef SHOW_ERROR_LINE         /* Show error line in file */
 #define SHOW_ERROR_LINE 1
 #endif
@@ -127,6 +141,12 @@ extern "C" {
   SCHEME_EXPORT void scheme_load_named_file(scheme * sc, FILE * fin,
       const char *filename);
   SCHEME_EXPORT void scheme_load_string(scheme * sc, const char *cmd);
+#if USE_IMAGE
+  SCHEME_EXPORT int scheme_save_image(scheme * sc, const char *fname,
+      const char *src);
+  SCHEME_EXPORT int scheme_load_image(scheme * sc, const char *fname,
+      const char *src);
+#endif
   SCHEME_EXPORT pointer scheme_apply0(scheme * sc, const char *procname);
   SCHEME_EXPORT pointer scheme_call(scheme * sc, pointer func, pointer args);
   SCHEME_EXPORT pointer scheme_eval(scheme * sc, pointer obj);
@@ -55,6 +55,12 @@ _OP_DEF(opexe_0, "load", 1, 1, TST_STRING, OP_LOAD)
     _OP_DEF(opexe_1, "apply", 1, INF_ARG, TST_NONE, OP_PAPPLY)
     _OP_DEF(opexe_1, "call-with-current-continuation", 1, 1, TST_NONE,
     OP_CONTINUATION)
+    _OP_DEF(opexe_1, "call-with-escape-continuation", 1, 1, TST_NONE,
+    OP_ESCAPE)
+    _OP_DEF(opexe_1, 0, 0, 0, 0, OP_ESCAPE1)
+    _OP_DEF(opexe_1, "call-with-handler", 2, 2, TST_NONE, OP_CATCH)
+    _OP_DEF(opexe_1, 0, 0, 0, 0, OP_CATCH1)
+    _OP_DEF(opexe_1, "throw", 0, INF_ARG, TST_NONE, OP_THROW)
 #if USE_MATH
     _OP_DEF(opexe_2, "exact", 1, 1, TST_NUMBER, OP_INEX2EX)
     _OP_DEF(opexe_2, "exp", 1, 1, TST_NUMBER, OP_EXP)
@@ -143,6 +149,7 @@ _OP_DEF(opexe_0, "load", 1, 1, TST_STRING, OP_LOAD)
     _OP_DEF(opexe_3, "eqv?", 2, 2, TST_ANY, OP_EQV)
     _OP_DEF(opexe_3, "current-second", 0, 0, 0, OP_CURR_SEC)
     _OP_DEF(opexe_3, "eval-count", 0, 0, 0, OP_EVAL_CNT)
+    _OP_DEF(opexe_3, "fast-check-count", 0, 0, 0, OP_FAST_CHECKS)
     _OP_DEF(opexe_4, "force", 1, 1, TST_ANY, OP_FORCE)
     _OP_DEF(opexe_4, 0, 0, 0, 0, OP_SAVE_FORCED)
     _OP_DEF(opexe_4, "write", 1, 2, TST_ANY TST_OUTPORT, OP_WRITE)
@@ -162,6 +169,8 @@ _OP_DEF(opexe_0, "load", 1, 1, TST_STRING, OP_LOAD)
     _OP_DEF(opexe_4, "quit", 0, 1, TST_NUMBER, OP_QUIT)
     _OP_DEF(opexe_4, "gc", 0, 0, 0, OP_GC)
     _OP_DEF(opexe_4, "gc-verbose", 0, 1, TST_NONE, OP_GCVERB)
+    _OP_DEF(opexe_4, "gc-mode", 0, 1, TST_SYMBOL, OP_GCMODE)
+    _OP_DEF(opexe_4, "gc-compact", 0, 1, TST_NONE, OP_GCCOMPACT)
     _OP_DEF(opexe_4, "new-segment", 0, 1, TST_NUMBER, OP_NEWSEGMENT)
     _OP_DEF(opexe_4, "oblist", 0, 0, 0, OP_OBLIST)
     _OP_DEF(opexe_4, "current-input-port", 0, 0, 0, OP_CURR_INPORT)
@@ -206,4 +215,9 @@ _OP_DEF(opexe_0, "load", 1, 1, TST_STRING, OP_LOAD)
     _OP_DEF(opexe_6, "get-closure-code", 1, 1, TST_NONE, OP_GET_CLOSURE)
     _OP_DEF(opexe_6, "closure?", 1, 1, TST_NONE, OP_CLOSUREP)
     _OP_DEF(opexe_6, "macro?", 1, 1, TST_NONE, OP_MACROP)
+    _OP_DEF(opexe_6, "memoize-macro!", 1, 1, TST_NONE, OP_MEMOMACRO)
+    _OP_DEF(opexe_7, 0, 0, 0, 0, OP_VM_RUN)
+    _OP_DEF(opexe_7, 0, 0, 0, 0, OP_VM_RET)
+    _OP_DEF(opexe_7, 0, 0, 0, 0, OP_VM_EXPAND)
+    _OP_DEF(opexe_7, 0, 0, 0, 0, OP_VM_HOOK)
 #undef _OP_DEF
@@ -0,0 +1,64 @@
+/* The labels of the ops that opexe_<OPEXE_N> runs, by opcode, for
+   threaded dispatch; 0 for the ops of the other opexe_N.  Included
+   at the head of each opexe_N. */
+
+#define _OP_LABEL(OP) [OP] = &&L_##OP,
+#define _OP_NONE(OP)
+
+#if OPEXE_N == 0
+#define _OP_opexe_0 _OP_LABEL
+#else
+#define _OP_opexe_0 _OP_NONE
+#endif
+#if OPEXE_N == 1
+#define _OP_opexe_1 _OP_LABEL
+#else
+#define _OP_opexe_1 _OP_NONE
+#endif
+#if OPEXE_N == 2
+#define _OP_opexe_2 _OP_LABEL
+#else
+#define _OP_opexe_2 _OP_NONE
+#endif
+#if OPEXE_N == 3
+#define _OP_opexe_3 _OP_LABEL
+#else
+#define _OP_opexe_3 _OP_NONE
+#endif
+#if OPEXE_N == 4
+#define _OP_opexe_4 _OP_LABEL
+#else
+#define _OP_opexe_4 _OP_NONE
+#endif
+#if OPEXE_N == 5
+#define _OP_opexe_5 _OP_LABEL
+#else
+#define _OP_opexe_5 _OP_NONE
+#endif
+#if OPEXE_N == 6
+#define _OP_opexe_6 _OP_LABEL
+#else
+#define _OP_opexe_6 _OP_NONE
+#endif
+#if OPEXE_N == 7
+#define _OP_opexe_7 _OP_LABEL
+#else
+#define _OP_opexe_7 _OP_NONE
+#endif
+
+static void *const op_labels[OP_MAXDEFINED] = {
+#define _OP_DEF(A,B,C,D,E,OP) _OP_##A(OP)
+#include "scm_opdf.h"
+};
+
+#undef _OP_opexe_0
+#undef _OP_opexe_1
+#undef _OP_opexe_2
+#undef _OP_opexe_3
+#undef _OP_opexe_4
+#undef _OP_opexe_5
+#undef _OP_opexe_6
+#undef _OP_opexe_7
+#undef _OP_LABEL
+#undef _OP_NONE
+#undef OPEXE_N
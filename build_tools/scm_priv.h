@@ -5,9 +5,9 @@
 
 #include "scheme.h"
 
-// Memory limits, by default enough
-// for list of over 100k elements
-// also controlled by env vars of the same name
+// Cells per heap segment, and a soft limit on the number of
+// segments: past it the heap keeps growing, but only as far as
+// the live cells need.  Also controlled by env vars of the same name
 
 #ifndef CELL_SEGSIZE
 #define CELL_SEGSIZE    20000
@@ -16,6 +16,12 @@
 #define CELL_NSEGMENT   12
 #endif
 
+// Threads marking the heap in a full collection, if built with
+// USE_PARALLEL_MARK.  Also controlled by the GC_THREADS env var
+#ifndef GC_THREADS
+#define GC_THREADS      1
+#endif
+
 #ifndef MAXFIL
 #define MAXFIL 64
 #endif
@@ -33,6 +39,18 @@
 #ifndef AUXBUFF_SIZE
 #define AUXBUFF_SIZE 256
 #endif
+#ifndef SLOT_POOL_SIZE
+#define SLOT_POOL_SIZE 32
+#endif
+#ifndef RECENT_INITIAL_SIZE
+#define RECENT_INITIAL_SIZE 256
+#endif
+#ifndef PORT_BUFSIZE
+#define PORT_BUFSIZE 65536      /* read ahead on input files */
+#endif
+#ifndef PORT_BACK
+#define PORT_BACK 4             /* chars a port can take back */
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,6 +61,7 @@ extern "C" {
     port_file = 1,
     port_string = 2,
     port_srfi6 = 4,
+    port_unbuffered = 8,        /* file read a char at a time */
     port_input = 16,
     port_output = 32,
     port_saw_EOF = 64
@@ -50,6 +69,8 @@ extern "C" {
 
   typedef struct port {
     unsigned char kind;
+    unsigned char nback;        /* chars taken back, in back */
+    int back[PORT_BACK];
     union {
       struct {
         FILE *file;
@@ -58,23 +79,52 @@ extern "C" {
         int curr_line;
         char *filename;
 #endif
+        char *buf;              /* read ahead, from curr to end */
+        char *curr;
+        char *end;
       } stdio;
       struct {
         char *start;
         char *past_the_end;
         char *curr;
+        pointer owner;          /* string whose buffer this is, if any */
       } string;
     } rep;
   } port;
 
-/* cell structure */
+#if USE_FASL
+/* the forms of a file being loaded, as kept in its FASL cache */
+  typedef struct fasl {
+    char *name;                 /* cache to write at the end, or 0 */
+    char *buf;                  /* the forms read, or those to replay */
+    size_t len;                 /* bytes in buf */
+    size_t room;                /* bytes allocated for buf */
+    size_t at;                  /* next form to replay */
+    int replay;                 /* take the forms from buf */
+    long size;                  /* size, time and hash of the source */
+    long mtime;
+    unsigned int hash;
+  } fasl;
+#endif
+
+/* ASCII strings up to this long are kept in the cell itself */
+#define SHORT_STR_MAX   (2 * sizeof(char *) - 2)
+
+/* cell structure: its flags are kept at the head of its segment */
   struct cell {
-    unsigned int _flag;
     union {
       struct {
         char *_svalue;
-        int _length;
+        int _length;            /* in bytes */
+        union {
+          unsigned int _hash;   /* symbol names only */
+          int _chars;           /* strings with non-ASCII chars only */
+        } _u;
       } _string;
+      struct {
+        char _chars[SHORT_STR_MAX + 1];
+        unsigned char _length;
+      } _short;
       num _number;
       port *_port;
       foreign_func _ff;
@@ -97,7 +147,7 @@ extern "C" {
     char **alloc_seg;
     pointer *cell_seg;
     int last_cell_seg;
-    int backchar;
+    int seg_room;               /* # of entries allocated in the two above */
 
 /* We use 4 registers. */
     pointer args;               /* register for arguments of function */
@@ -107,17 +157,16 @@ extern "C" {
 
     int interactive_repl;       /* are we in an interactive REPL? */
 
-    struct cell _sink;
+    char *static_seg;           /* block holding the special cells below */
     pointer sink;               /* when mem. alloc. fails */
-    struct cell _NIL;
     pointer NIL;                /* special cell representing empty cell */
-    struct cell _HASHT;
     pointer T;                  /* special cell representing #t */
-    struct cell _HASHF;
     pointer F;                  /* special cell representing #f */
-    struct cell _EOF_OBJ;
     pointer EOF_OBJ;            /* special cell representing end-of-file object */
+    pointer UNBOUND;            /* special cell for unbound frame slots */
+    pointer arg_cells;          /* ARG_CELLS special pairs after them */
     pointer oblist;             /* pointer to symbol table */
+    int oblist_used;            /* symbols in it */
     pointer global_env;         /* pointer to global environment */
     pointer c_nest;             /* stack for nested calls from C */
 
@@ -136,6 +185,21 @@ extern "C" {
 
     pointer free_cell;          /* pointer to top of free cells */
     long fcells;                /* # of free cells */
+    pointer *slot_pool[SLOT_POOL_SIZE]; /* free element arrays by size */
+    pointer *young;             /* cells allocated since the last gc */
+    long young_top;             /* # of entries in use */
+    long young_size;            /* # of entries allocated */
+    long old_live;              /* # of cells live after the last full gc */
+    long vec_words;             /* vector elements made since the last gc */
+    long old_vec_words;         /* ... promoted since the last full gc */
+    int sweep_seg;              /* segments below this are not swept yet */
+#if USE_PARALLEL_MARK
+    struct mark_deque *root_deque; /* roots go here in a parallel mark */
+#endif
+    pointer *recent;            /* root stack of recent allocations */
+    int recent_top;             /* # of entries in use */
+    int recent_base;            /* entries below belong to outer C calls */
+    int recent_size;            /* # of entries allocated */
 
     pointer inport;
     pointer outport;
@@ -144,10 +208,16 @@ extern "C" {
 
     port load_stack[MAXFIL];    /* Stack of open files for port -1 (LOADing) */
     int nesting_stack[MAXFIL];
+#if USE_FASL
+    fasl fasl_stack[MAXFIL];    /* the FASL cache of each */
+#endif
     int file_i;
     int nesting;
 
     char gc_verbose;            /* if gc_verbose is not zero, print gc status */
+    char gc_lazy;               /* sweep segments only as cells are needed */
+    char gc_compact;            /* compact the heap when it fragments */
+    char compact_due;           /* ... at the next safe point */
     char no_memory;             /* Whether mem. alloc. has failed */
 
     char linebuff[LINESIZE];
@@ -166,6 +236,11 @@ extern "C" {
     struct scheme_interface *vptr;
     void *dump_base;            /* pointer to base of allocated dump stack */
     int dump_size;              /* number of frames allocated for dump stack */
+    int dump_top;               /* number of frames in use */
+    int dump_floor;             /* frames below it are hidden */
+    pointer *vm_stack;          /* operand stack of compiled code */
+    int vm_sp;                  /* # of entries in use */
+    int vm_stack_size;          /* # of entries allocated */
   };
 
 /* operator code */
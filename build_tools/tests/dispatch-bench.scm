@@ -0,0 +1,18 @@
+; Opcode dispatch microbenchmark: evaluates a quoted form 300k times
+; with eval, so every step goes through Eval_Cycle rather than the
+; bytecode VM that compiled closures run in (see dispatch-bench.sh).
+
+(define x 0)
+
+(define form
+    '(if (< x 10)
+         (set! x (+ x (car (cdr (list 0 1 2)))))
+         (begin (set! x (- x 9)) (and (pair? '(a)) (not (null? '(b)))))))
+
+(define (run n)
+    (if (> n 0)
+        (begin (eval form) (run (- n 1)))))
+
+(run 300000)
+(display x)
+(newline)
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Threaded against switch dispatch of Eval_Cycle: builds scm with and
+# without USE_THREADING in a scratch directory and times
+# dispatch-bench.scm on both, best of 5.  From the top of the repo:
+#
+#     sh build_tools/tests/dispatch-bench.sh
+#
+# CC and CFLAGS are honoured.  Where perf is installed it also counts
+# the branch misses of each, which is what threading is about; by hand
+# that is
+#
+#     cc -O2 -o scm-threaded build_tools/scheme.c -lm
+#     cc -O2 -DUSE_THREADING=0 -o scm-switch build_tools/scheme.c -lm
+#     perf stat -e instructions,branches,branch-misses \
+#         ./scm-threaded build_tools/tests/dispatch-bench.scm
+#     perf stat -e instructions,branches,branch-misses \
+#         ./scm-switch build_tools/tests/dispatch-bench.scm
+#
+# run from the top of the repo too, so that init.scm is found.
+
+set -e
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+$CC $CFLAGS -DUSE_THREADING=1 -DUSE_FASL=0 -o "$tmp/scm-threaded" \
+    build_tools/scheme.c -lm
+$CC $CFLAGS -DUSE_THREADING=0 -DUSE_FASL=0 -o "$tmp/scm-switch" \
+    build_tools/scheme.c -lm
+
+# ms taken by the best of 5 runs of $1
+best() {
+    b=
+    for r in 1 2 3 4 5; do
+        start=$(date +%s%N)
+        "$1" -i "$1.img" build_tools/tests/dispatch-bench.scm > /dev/null
+        end=$(date +%s%N)
+        t=$(( (end - start) / 1000000 ))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+    done
+    echo $b
+}
+
+for how in threaded switch; do
+    echo "$how: $(best "$tmp/scm-$how") ms"
+done
+if command -v perf > /dev/null; then
+    for how in threaded switch; do
+        echo "$how:"
+        perf stat -e instructions,branches,branch-misses \
+            "$tmp/scm-$how" -i "$tmp/scm-$how.img" \
+            build_tools/tests/dispatch-bench.scm 2>&1 > /dev/null \
+            | grep -E 'instructions|branch'
+    done
+fi
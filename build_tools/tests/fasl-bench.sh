@@ -0,0 +1,63 @@
+#!/bin/sh
+# Startup time with and without the FASL caches: init.scm alone, and
+# init.scm then build.scm.  "cold" removes the caches before every run,
+# so the files are tokenized; "fasl" runs on the caches the first run
+# wrote.  From the top of the repo:
+#
+#     sh build_tools/tests/fasl-bench.sh [runs]
+#
+# This builds a binary without the heap image in a scratch directory,
+# since the image would skip init.scm altogether, and runs it on copies
+# of the files there; CC and CFLAGS are honoured.
+
+set -e
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+runs=${1:-200}
+top=$(pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+$CC $CFLAGS -DUSE_IMAGE=0 -o "$tmp/scm" build_tools/scheme.c -lm
+mkdir "$tmp/build_tools"
+cp build_tools/init.scm "$tmp/build_tools"
+cp build.scm "$tmp"
+echo "" > "$tmp/empty.scm"
+# build.scm quits when given no command: have it read on to its end
+echo "(define *args* '()) (define (quit . args) #f)" > "$tmp/noquit.scm"
+cd "$tmp"
+
+# time runs of ./scm with the arguments given, in ms per run
+bench() {
+    cold=$1
+    shift
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $runs ]; do
+        if [ $cold = 1 ]; then
+            rm -f build_tools/init.fasl build.fasl noquit.fasl empty.fasl
+        fi
+        ./scm "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    awk "BEGIN { printf \"%.3f\", ($end - $start) / 1000000 / $runs }"
+}
+
+for what in init build; do
+    if [ $what = init ]; then
+        set -- empty.scm
+    else
+        set -- noquit.scm build.scm
+    fi
+    cold=$(bench 1 "$@")
+    ./scm "$@" > /dev/null
+    if [ ! -f build_tools/init.fasl ] || [ $what = build -a ! -f build.fasl ]; then
+        echo "no FASL cache was written"
+        exit 1
+    fi
+    fasl=$(bench 0 "$@")
+    echo "$what: cold $cold ms, fasl $fasl ms"
+done
+cd "$top"
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Cost of reading an outer local against the size of its frame: a
+# 300k-iteration loop reads the first and the last of n locals of the
+# enclosing let 4 times each, for n = 2, 10, 30 and 100.  With locals
+# addressed by (depth, index) the time should not grow with n.  From
+# the top of the repo, after building ./scm (or with SCM set to the
+# binary; give several, separated by spaces, to compare them):
+#
+#     sh build_tools/tests/frame-bench.sh
+
+set -e
+
+SCM=${SCM:-./scm}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# the benchmark for n locals
+gen() {
+    echo "(define (run)"
+    printf "    (let ("
+    i=0
+    while [ $i -lt $1 ]; do
+        printf "(a%d %d) " $i $i
+        i=$((i + 1))
+    done
+    echo ")"
+    last=a$(($1 - 1))
+    echo "        (let loop ((i 0) (s 0))"
+    echo "            (if (< i 300000)"
+    echo "                (loop (+ i 1) (+ s a0 $last a0 $last a0 $last a0 $last))"
+    echo "                s))))"
+    echo "(display (run))"
+    echo "(newline)"
+}
+
+# ms taken by the best of 5 runs of $1 on $2
+best() {
+    b=
+    for r in 1 2 3 4 5; do
+        start=$(date +%s%N)
+        "$1" "$2" > /dev/null
+        end=$(date +%s%N)
+        t=$(( (end - start) / 1000000 ))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+    done
+    echo $b
+}
+
+for n in 2 10 30 100; do
+    gen $n > "$tmp/frame$n.scm"
+    for scm in $SCM; do
+        echo "$n locals, $scm: $(best "$scm" "$tmp/frame$n.scm") ms"
+    done
+done
@@ -0,0 +1,24 @@
+; Full collections of a large live heap, for timing them (see
+; gc-threads.sh):
+;
+;     scm -1 build_tools/tests/gc-bench.scm <collections>
+;
+; builds about a million live cells of trees, vectors and strings,
+; then runs (gc) as many times as asked.  Timing it with 0 collections
+; too leaves the time of the collections alone.
+
+(define (tree depth)
+    (if (= depth 0)
+        (number->string depth)
+        (cons (tree (- depth 1)) (tree (- depth 1)))))
+
+(define (build n acc)
+    (if (= n 0)
+        acc
+        (build (- n 1) (cons (vector (tree 10) (make-string 40 #\x) n) acc))))
+
+(define live (build 200 '()))
+
+(let loop ((k (string->number (car *args*))))
+    (if (> k 0)
+        (begin (gc) (loop (- k 1)))))
@@ -0,0 +1,89 @@
+; Stress test for gc-compact: fragment the heap, slide it together and
+; check that what was live is still there.  From the top of the repo:
+;
+;     CELL_SEGSIZE=2000 ./scm build_tools/tests/gc-compact.scm
+;
+; A small CELL_SEGSIZE spreads the heap over many segments.  Prints ok,
+; or what went wrong and quits with 1.
+
+(define failed #f)
+
+(define (fail what . args)
+    (set! failed #t)
+    (display "FAIL: ") (display what)
+    (for-each (lambda (x) (display " ") (write x)) args)
+    (newline))
+
+; Item i: short and long strings, a vector, a closure over i.
+(define (make-item i)
+    (list i
+          (number->string i)
+          (make-string (+ 20 (modulo i 50)) (integer->char (+ 97 (modulo i 26))))
+          (make-vector (+ 1 (modulo i 7)) (list i))
+          (lambda () (* i 3))))
+
+(define (item-ok? x)
+    (let ((i (car x)))
+        (and (equal? (cadr x) (number->string i))
+             (= (string-length (caddr x)) (+ 20 (modulo i 50)))
+             (char=? (string-ref (caddr x) 19) (integer->char (+ 97 (modulo i 26))))
+             (= (vector-length (cadddr x)) (+ 1 (modulo i 7)))
+             (= (car (vector-ref (cadddr x) (modulo i 7))) i)
+             (= ((car (cddddr x))) (* i 3)))))
+
+(define (checksum items)
+    (let loop ((l items) (sum 0))
+        (if (null? l)
+            sum
+            (let ((x (car l)))
+                (loop (cdr l)
+                      (modulo (+ (* sum 31) (car x)
+                                 (string-length (caddr x))
+                                 (vector-length (cadddr x))
+                                 ((car (cddddr x))))
+                              1000000007))))))
+
+; Live items interleaved with garbage of every kind, then every other
+; item dropped: the survivors end up spread thin over the heap.
+(define (fragment n)
+    (let loop ((i 0) (keep '()) (junk '()))
+        (if (= i n)
+            (let drop ((l keep) (acc '()) (odd #f))
+                (cond ((null? l) acc)
+                      (odd (drop (cdr l) acc #f))
+                      (else (drop (cdr l) (cons (car l) acc) #t))))
+            (loop (+ i 1)
+                  (cons (make-item i) keep)
+                  (if (= (modulo i 100) 0)
+                      '()
+                      (cons (list (make-vector 5 i) (number->string (* i i)))
+                            junk))))))
+
+(gc-compact #t)
+
+(define items (fragment 20000))
+(define expected (checksum items))
+(define count (length items))
+
+(let round ((k 0))
+    (if (< k 5)
+        (begin
+            ; more garbage, then a collection that slides the heap
+            (fragment 5000)
+            (gc)
+            (if (not (= (length items) count))
+                (fail "length after round" k (length items)))
+            (if (not (= (checksum items) expected))
+                (fail "checksum after round" k (checksum items) expected))
+            (round (+ k 1)))))
+
+(let check ((l items))
+    (if (pair? l)
+        (begin
+            (if (not (item-ok? (car l)))
+                (fail "item" (caar l)))
+            (check (cdr l)))))
+
+(if failed
+    (quit 1)
+    (begin (display "ok") (newline)))
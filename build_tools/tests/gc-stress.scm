@@ -0,0 +1,62 @@
+; GC stress workload: builds trees, vectors, strings and closures,
+; drops some of them and forces full collections, printing a checksum
+; of what is live after each round.  The output does not depend on
+; how the heap was collected, so runs of builds or settings that
+; should not change the result can be compared (see gc-threads.sh).
+
+(define (tree depth i)
+    (if (= depth 0)
+        (if (even? i) (number->string i) (list i))
+        (cons (tree (- depth 1) (* 2 i))
+              (tree (- depth 1) (+ (* 2 i) 1)))))
+
+(define (tree-sum t)
+    (cond ((pair? t)
+           (if (null? (cdr t))
+               (car t)
+               (+ (tree-sum (car t)) (tree-sum (cdr t)))))
+          ((string? t) (string->number t))
+          (else 0)))
+
+(define (make-thing i)
+    (vector i
+            (make-string (+ 10 (modulo i 40)) #\x)
+            (tree (modulo i 6) i)
+            (let ((k (* i 7))) (lambda () k))))
+
+(define (thing-sum v)
+    (+ (vector-ref v 0)
+       (string-length (vector-ref v 1))
+       (tree-sum (vector-ref v 2))
+       ((vector-ref v 3))))
+
+(define (checksum things)
+    (let loop ((l things) (sum 0))
+        (if (null? l)
+            sum
+            (loop (cdr l) (modulo (+ (* sum 31) (thing-sum (car l)))
+                                  1000000007)))))
+
+; keep the things i with (modulo i m) not 0
+(define (thin things m)
+    (let loop ((l things) (acc '()))
+        (cond ((null? l) (reverse acc))
+              ((= (modulo (vector-ref (car l) 0) m) 0) (loop (cdr l) acc))
+              (else (loop (cdr l) (cons (car l) acc))))))
+
+(define live '())
+
+(let round ((k 0))
+    (if (< k 8)
+        (let loop ((i 0))
+            (if (< i 4000)
+                (begin
+                    (set! live (cons (make-thing (+ (* k 4000) i)) live))
+                    (loop (+ i 1)))
+                (begin
+                    (set! live (thin live (+ k 2)))
+                    (gc)
+                    (display k) (display " ")
+                    (display (length live)) (display " ")
+                    (display (checksum live)) (newline)
+                    (round (+ k 1)))))))
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Run the GC stress workload with the parallel marker on 1, 2 and 4
+# threads and check that all runs print the same, then time the full
+# collections of a large live heap on as many threads.  From the top
+# of the repo:
+#
+#     sh build_tools/tests/gc-threads.sh
+#
+# The marker is off by default (USE_PARALLEL_MARK), so this builds a
+# binary with it in a scratch directory; CC and CFLAGS are honoured.
+# The heap image goes there too, so build_tools/init.img is left alone.
+
+set -e
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+$CC $CFLAGS -DUSE_PARALLEL_MARK=1 -DUSE_FASL=0 -pthread \
+    -o "$tmp/scm" build_tools/scheme.c -lm
+
+status=0
+for n in 1 2 4; do
+    # a small segment size makes for many segments to share out
+    GC_THREADS=$n CELL_SEGSIZE=${CELL_SEGSIZE:-5000} \
+        "$tmp/scm" -i "$tmp/init.img" build_tools/tests/gc-stress.scm \
+        > "$tmp/out.$n"
+    if [ $n != 1 ] && ! cmp -s "$tmp/out.1" "$tmp/out.$n"; then
+        echo "GC_THREADS=$n differs from GC_THREADS=1:"
+        diff "$tmp/out.1" "$tmp/out.$n" || true
+        status=1
+    fi
+done
+if [ $status = 0 ]; then
+    echo "ok"
+fi
+
+# Microseconds taken by the best of 3 runs of gc-bench.scm with $2
+# collections on $1 threads
+best() {
+    b=
+    for r in 1 2 3; do
+        start=$(date +%s%N)
+        GC_THREADS=$1 "$tmp/scm" -i "$tmp/init.img" \
+            -1 build_tools/tests/gc-bench.scm $2 > /dev/null
+        end=$(date +%s%N)
+        t=$(( (end - start) / 1000 ))
+        if [ -z "$b" ] || [ $t -lt $b ]; then
+            b=$t
+        fi
+    done
+    echo $b
+}
+
+gcs=${GCS:-40}
+echo "full collection pause, $gcs collections, $(nproc 2>/dev/null || echo ?) cpus:"
+for n in 1 2 4; do
+    base=$(best $n 0)
+    with=$(best $n $gcs)
+    awk "BEGIN { printf \"GC_THREADS=%d: %.2f ms\\n\", $n, ($with - $base) / 1000 / $gcs }"
+done
+exit $status
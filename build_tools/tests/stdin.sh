@@ -0,0 +1,31 @@
+#!/bin/sh
+# Code read from stdin that goes on to (read) its data from stdin too,
+# with stdin redirected from a file and from a pipe: the loading port
+# must not take the data.  From the top of the repo, after building
+# ./scm (or with SCM set to the binary):
+#
+#     sh build_tools/tests/stdin.sh
+
+SCM=${SCM:-./scm}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf "(write (list 'got (read)))\n(data here)\n" > "$tmp/in.scm"
+echo "(got (data here))" > "$tmp/want"
+
+status=0
+"$SCM" -- < "$tmp/in.scm" > "$tmp/file" 2>&1
+cat "$tmp/in.scm" | "$SCM" -- > "$tmp/pipe" 2>&1
+for how in file pipe; do
+    # there is no newline after what the script writes
+    echo >> "$tmp/$how"
+    if ! cmp -s "$tmp/want" "$tmp/$how"; then
+        echo "stdin from a $how:"
+        cat "$tmp/$how"
+        status=1
+    fi
+done
+if [ $status = 0 ]; then
+    echo "ok"
+fi
+exit $status
@@ -0,0 +1,75 @@
+; Fragmentation stress for vector storage: makes 200k vectors of 1 to
+; 1000 elements, so every pooled size class and the malloc'd arrays
+; above SLOT_POOL_SIZE are churned, keeps every 7th in a 64-entry ring
+; and a few hundred for good, and checks the contents of all the
+; survivors as it goes.  From the top of the repo:
+;
+;     ./scm build_tools/tests/vector-churn.scm
+;
+; Prints ok, or what went wrong and quits with 1.
+
+(define failed #f)
+
+(define (fail what . args)
+    (set! failed #t)
+    (display "FAIL: ") (display what)
+    (for-each (lambda (x) (display " ") (write x)) args)
+    (newline))
+
+(define seed 12345)
+
+(define (next-size)
+    (set! seed (modulo (+ (* seed 1103515245) 12345) 2147483648))
+    (+ 1 (modulo (quotient seed 65536) 1000)))
+
+; Vector i of n elements: i everywhere, a pair at both ends.
+(define (make-thing i n)
+    (let ((v (make-vector n i)))
+        (vector-set! v 0 (list i n))
+        (if (> n 1)
+            (vector-set! v (- n 1) (cons n i)))
+        v))
+
+(define (thing-ok? v)
+    (let* ((head (vector-ref v 0))
+           (i (car head))
+           (n (cadr head)))
+        (and (= (vector-length v) n)
+             (or (= n 1)
+                 (equal? (vector-ref v (- n 1)) (cons n i)))
+             (or (< n 3)
+                 (= (vector-ref v (quotient n 2)) i)))))
+
+(define ring (make-vector 64 #f))
+(define kept '())
+
+(define (check-ring)
+    (let loop ((k 0))
+        (if (< k 64)
+            (begin
+                (if (and (vector-ref ring k) (not (thing-ok? (vector-ref ring k))))
+                    (fail "ring" k (vector-ref (vector-ref ring k) 0)))
+                (loop (+ k 1))))))
+
+(let loop ((i 0))
+    (if (< i 200000)
+        (let ((v (make-thing i (next-size))))
+            (if (= (modulo i 7) 0)
+                (vector-set! ring (modulo (quotient i 7) 64) v))
+            (if (= (modulo i 701) 0)
+                (set! kept (cons v kept)))
+            (if (= (modulo i 10000) 0)
+                (check-ring))
+            (loop (+ i 1)))))
+
+(check-ring)
+(for-each (lambda (v)
+              (if (not (thing-ok? v))
+                  (fail "kept" (vector-ref v 0))))
+          kept)
+(if (not (= (length kept) 286))
+    (fail "kept count" (length kept)))
+
+(if failed
+    (quit 1)
+    (begin (display "ok") (newline)))